@@ -1,14 +1,10 @@
 #include "constants.glsl"
 
-uniform mat4 view_matrix;
-uniform mat3 lightmap_matrix;
-
 #ifdef USE_2D_TEXTURES_FOR_ANIMATIONS
 uniform isampler2D animations_vertices_buffer;
 #else
 uniform isamplerBuffer animations_vertices_buffer;
 #endif
-uniform int first_animation_vertex_number;
 
 
 in int vertex_id;
@@ -16,12 +12,21 @@ in vec2 tex_coord;
 in int tex_id;
 in float alpha_test_mask;
 
+// Per-instance data.
+in mat4 instance_view_matrix;
+in mat3 instance_rotation_matrix;
+in vec3 instance_lightmap_matrix_x;
+in vec3 instance_lightmap_matrix_y;
+in ivec2 instance_params; // x - first animation vertex number, y - enabled groups mask
+
 out vec3 f_tex_coord;
 out vec2 f_lightmap_coord;
 out float f_alpha_test_mask;
 
 void main()
 {
+	int first_animation_vertex_number= instance_params.x;
+
 #ifdef USE_2D_TEXTURES_FOR_ANIMATIONS
 	int final_vertex_id= first_animation_vertex_number + vertex_id;
 	ivec2 animation_vertex_coord= ivec2( final_vertex_id & (ANIMATION_TEXTURE_WIDTH-1), final_vertex_id / ANIMATION_TEXTURE_WIDTH );
@@ -37,7 +42,10 @@ void main()
 #endif
 
 	f_tex_coord= vec3( tex_coord, float(tex_id) + 0.01 );
-	f_lightmap_coord= ( lightmap_matrix * vec3( pos.xy, 1.0 ) ).xy;
+	f_lightmap_coord=
+		vec2(
+			dot( instance_lightmap_matrix_x, vec3( pos.xy, 1.0 ) ),
+			dot( instance_lightmap_matrix_y, vec3( pos.xy, 1.0 ) ) );
 	f_alpha_test_mask= alpha_test_mask;
-	gl_Position= view_matrix * vec4( pos, 1.0 );
+	gl_Position= instance_view_matrix * vec4( pos, 1.0 );
 }
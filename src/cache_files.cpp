@@ -0,0 +1,44 @@
+#include <cstdio>
+
+// Include OS-dependend stuff for "mkdir".
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+#include "cache_files.hpp"
+
+#define CACHE_DIR "cache"
+
+namespace PanzerChasm
+{
+
+void GetMapCacheFileName(
+	const unsigned int map_number,
+	const char* const extension,
+	char* const out_file_name,
+	const unsigned int out_file_name_max_length )
+{
+	std::snprintf( out_file_name, out_file_name_max_length, CACHE_DIR"/map_%02u.%s", map_number, extension );
+}
+
+void GetShaderProgramCacheFileName(
+	const uint64_t key,
+	char* const out_file_name,
+	const unsigned int out_file_name_max_length )
+{
+	std::snprintf( out_file_name, out_file_name_max_length, CACHE_DIR"/program_%016llx.pcprog", static_cast<unsigned long long>(key) );
+}
+
+void CreateCacheDir()
+{
+#ifdef _WIN32
+	_mkdir( CACHE_DIR );
+#else
+	mkdir( CACHE_DIR, 0777 );
+#endif
+}
+
+} // namespace PanzerChasm
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstdint>
+
+namespace PanzerChasm
+{
+
+// Cache files contain data, calculated from game data, like BSP trees and PVS of maps, and linked shader programs.
+// All such files are placed in one directory.
+
+// "extension" - extension of file without dot, like "pcbsp".
+void GetMapCacheFileName(
+	unsigned int map_number,
+	const char* extension,
+	char* out_file_name,
+	unsigned int out_file_name_max_length );
+
+// "key" - hash of program sources and driver strings.
+void GetShaderProgramCacheFileName(
+	uint64_t key,
+	char* out_file_name,
+	unsigned int out_file_name_max_length );
+
+void CreateCacheDir();
+
+} // namespace PanzerChasm
@@ -65,6 +65,8 @@ Client::Client(
 	CommandsMapPtr commands= std::make_shared<CommandsMap>();
 	commands->emplace( "fullmap", std::bind( &Client::FullMap, this ) );
 	commands->emplace( "pos", std::bind( &Client::PrintPlayerPos, this ) );
+	commands->emplace( "renderer_stats", std::bind( &Client::PrintRendererStats, this ) );
+	commands->emplace( "record_camera_path", std::bind( &Client::RecordCameraPath, this, std::placeholders::_1 ) );
 	commands_= std::move( commands );
 	commands_processor.RegisterCommands(commands_);
 
@@ -76,7 +78,10 @@ Client::Client(
 }
 
 Client::~Client()
-{}
+{
+	if( camera_path_file_ != nullptr )
+		std::fclose( camera_path_file_ );
+}
 
 void Client::VidClear()
 {
@@ -204,6 +209,13 @@ bool Client::PlayingCutscene() const
 	return !cutscene_player_->IsFinished();
 }
 
+const char* Client::GetMapDrawerStatus() const
+{
+	if( map_drawer_ == nullptr )
+		return nullptr;
+	return map_drawer_->GetStatus();
+}
+
 void Client::ProcessEvents( const SystemEvents& events )
 {
 	if( cutscene_player_ != nullptr )
@@ -410,6 +422,9 @@ void Client::Draw()
 			view_clip_planes,
 			player_state_.health > 0u ? player_monster_id_ : 0u /* draw body, if death */ );
 
+		if( camera_path_file_ != nullptr )
+			WriteCameraPathFrame( pos );
+
 		// Draw weapon, if alive.
 		if( player_state_.health > 0u )
 		{
@@ -764,4 +779,55 @@ void Client::PrintPlayerPos()
 	Log::Info( "Pos: ", player_position_.x, ", ", player_position_.y, ", ", player_position_.z );
 }
 
+void Client::PrintRendererStats()
+{
+	if( map_drawer_ != nullptr )
+		map_drawer_->PrintStats();
+}
+
+void Client::RecordCameraPath( const CommandsArguments& args )
+{
+	if( camera_path_file_ != nullptr )
+	{
+		std::fclose( camera_path_file_ );
+		camera_path_file_= nullptr;
+		Log::Info( "Camera path recording stopped" );
+		return;
+	}
+
+	if( args.empty() )
+	{
+		Log::Info( "Expected file name" );
+		return;
+	}
+
+	camera_path_file_= std::fopen( args.front().c_str(), "wb" );
+	if( camera_path_file_ == nullptr )
+	{
+		Log::Warning( "Can not open file \"", args.front(), "\"" );
+		return;
+	}
+
+	camera_path_map_number_= ~0u;
+	Log::Info( "Camera path recording started. Type \"record_camera_path\" again to stop" );
+}
+
+void Client::WriteCameraPathFrame( const m_Vec3& camera_pos )
+{
+	PC_ASSERT( camera_path_file_ != nullptr );
+	PC_ASSERT( current_map_data_ != nullptr );
+
+	if( current_map_data_->number != camera_path_map_number_ )
+	{
+		camera_path_map_number_= current_map_data_->number;
+		std::fprintf( camera_path_file_, "map %u\n", camera_path_map_number_ );
+	}
+
+	std::fprintf(
+		camera_path_file_, "cam %f %f %f %f %f\n",
+		camera_pos.x, camera_pos.y, camera_pos.z,
+		camera_controller_.GetViewAngleZ() * Constants::to_deg,
+		camera_controller_.GetViewAngleX() * Constants::to_deg );
+}
+
 } // namespace PanzerChasm
@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdio>
 
 #include "../commands_processor.hpp"
 #include "../connection_info.hpp"
@@ -40,6 +41,9 @@ public:
 	bool Disconnected() const;
 	bool PlayingCutscene() const;
 
+	// Returns null, if there is no status.
+	const char* GetMapDrawerStatus() const;
+
 	void ProcessEvents( const SystemEvents& events );
 
 	void Loop( const InputState& input_state, bool paused );
@@ -87,6 +91,9 @@ private:
 	void CorrectPlayerName();
 	void FullMap();
 	void PrintPlayerPos();
+	void PrintRendererStats();
+	void RecordCameraPath( const CommandsArguments& args );
+	void WriteCameraPathFrame( const m_Vec3& camera_pos );
 private:
 	Settings& settings_;
 	const GameResourcesConstPtr game_resources_;
@@ -131,6 +138,10 @@ private:
 	IHudDrawerPtr hud_drawer_;
 
 	std::unique_ptr<CutscenePlayer> cutscene_player_;
+
+	// Camera path for software renderer benchmark.
+	std::FILE* camera_path_file_= nullptr;
+	unsigned int camera_path_map_number_= ~0u;
 };
 
 } // PanzerChasm
@@ -1,10 +1,10 @@
 #pragma once
 
-#include <glsl_program.hpp>
 #include <polygon_buffer.hpp>
 #include <texture.hpp>
 
 #include "../rendering_context.hpp"
+#include "../shader_program.hpp"
 #include "hud_drawer_base.hpp"
 
 namespace PanzerChasm
@@ -40,7 +40,7 @@ private:
 	const Size2 viewport_size_;
 	const bool filter_textures_;
 
-	r_GLSLProgram hud_shader_;
+	ShaderProgram hud_shader_;
 	r_PolygonBuffer quad_buffer_;
 
 	r_Texture crosshair_texture_;
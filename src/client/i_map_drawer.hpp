@@ -53,6 +53,12 @@ public:
 		unsigned char model_id;
 	};
 
+	// Short renderer state for fps overlay. May be null.
+	virtual const char* GetStatus() const= 0;
+
+	// Print detailed renderer statistics into log.
+	virtual void PrintStats() const= 0;
+
 	// Draw specified models with depth clear.
 	virtual void DrawMapRelatedModels(
 		const MapRelatedModel* models, unsigned int model_count,
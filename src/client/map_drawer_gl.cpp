@@ -1,5 +1,8 @@
 
+#include <algorithm>
+#include <cstddef>
 #include <cstring>
+#include <functional>
 
 #include <ogl_state_manager.hpp>
 
@@ -8,6 +11,7 @@
 #include "../images.hpp"
 #include "../log.hpp"
 #include "../map_loader.hpp"
+#include "../map_pvs.hpp"
 #include "../math_utils.hpp"
 #include "../settings.hpp"
 #include "../shared_settings_keys.hpp"
@@ -27,6 +31,16 @@ constexpr float g_walls_coords_scale= 256.0f;
 
 const GLenum g_gl_state_blend_func[2]= { GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA };
 
+// Per-instance attributes of models and monsters shaders. Attributes 0-4 used for models vertices.
+const GLuint c_instance_view_matrix_attrib= 5u; // mat4, 5-8
+const GLuint c_instance_rotation_matrix_attrib= 9u; // mat3, 9-11
+const GLuint c_instance_lightmap_matrix_x_attrib= 12u;
+const GLuint c_instance_lightmap_matrix_y_attrib= 13u;
+const GLuint c_instance_params_attrib= 14u;
+const GLuint c_instance_attribs_end= 15u;
+
+const unsigned int c_min_models_instances_buffer_size= 1024u * 128u;
+
 // Draw static walls with back-faces culling.
 // Draw dynamic walls without back-faces culling.
 const r_OGLState g_static_walls_gl_state(
@@ -106,6 +120,24 @@ struct WallVertex
 //SIZE_ASSERT( WallVertex, 16u );
 SIZE_ASSERT( WallVertex, 24u );
 
+struct MapDrawerGL::ModelInstance
+{
+	float view_matrix[16];
+	float rotation_matrix[9];
+	// Rows of lightmap matrix. We need only xy lightmap coordinates.
+	float lightmap_matrix_x[3];
+	float lightmap_matrix_y[3];
+	int params[2]; // First animation vertex number, enabled groups mask.
+};
+
+struct MapDrawerGL::ModelsBatchInstance
+{
+	const ModelGeometry* geometry;
+	const r_Texture* texture;
+	const r_Texture* lightmap;
+	ModelInstance instance;
+};
+
 struct ModelsTexturesPlacement
 {
 	struct ModelTexturePlacement
@@ -211,6 +243,15 @@ static void CreateModelMatrices(
 	out_lightmap_matrix= rotate_z * shift_xy * scale;
 }
 
+static void SetModelsInstanceAttribsLocations( ShaderProgram& shader )
+{
+	shader.SetAttribLocation( "instance_view_matrix", c_instance_view_matrix_attrib );
+	shader.SetAttribLocation( "instance_rotation_matrix", c_instance_rotation_matrix_attrib );
+	shader.SetAttribLocation( "instance_lightmap_matrix_x", c_instance_lightmap_matrix_x_attrib );
+	shader.SetAttribLocation( "instance_lightmap_matrix_y", c_instance_lightmap_matrix_y_attrib );
+	shader.SetAttribLocation( "instance_params", c_instance_params_attrib );
+}
+
 MapDrawerGL::MapDrawerGL(
 	Settings& settings,
 	const GameResourcesConstPtr& game_resources,
@@ -220,11 +261,21 @@ MapDrawerGL::MapDrawerGL(
 	, rendering_context_(rendering_context)
 	, filter_textures_( settings.GetOrSetBool( SettingsKeys::opengl_textures_filtering, false ) )
 	, use_hd_dynamic_lightmap_( settings.GetOrSetBool( SettingsKeys::opengl_dynamic_lighting, false ) )
-	, map_light_( game_resources, rendering_context, use_hd_dynamic_lightmap_ )
+	, map_light_(
+		game_resources, rendering_context, use_hd_dynamic_lightmap_,
+		settings.GetOrSetBool( SettingsKeys::opengl_incremental_lightmaps, true ) )
+	, models_instancing_( settings.GetOrSetBool( SettingsKeys::opengl_models_instancing, true ) )
 {
 	PC_ASSERT( game_resources_ != nullptr );
 
 	current_sky_texture_file_name_[0]= '\0';
+	status_[0]= '\0';
+
+	models_instances_buffer_=
+		StreamingBuffer(
+			settings.GetOrSetBool( SettingsKeys::opengl_persistent_buffers, true ) && StreamingBuffer::PersistentMappingSupported(),
+			c_min_models_instances_buffer_size );
+	Log::Info( "Models instances streaming buffer: ", models_instances_buffer_.IsPersistentMapped() ? "persistent mapped" : "orphaning" );
 
 	// Textures
 	glGenTextures( 1, &floor_textures_array_id_ );
@@ -361,6 +412,7 @@ MapDrawerGL::MapDrawerGL(
 	models_shader_.SetAttribLocation( "tex_coord", 1u );
 	models_shader_.SetAttribLocation( "tex_id", 2u );
 	models_shader_.SetAttribLocation( "alpha_test_mask", 3u );
+	SetModelsInstanceAttribsLocations( models_shader_ );
 	models_shader_.Create();
 
 	models_shadow_shader_.ShaderSource(
@@ -395,6 +447,7 @@ MapDrawerGL::MapDrawerGL(
 	monsters_shader_.SetAttribLocation( "tex_id", 2u );
 	monsters_shader_.SetAttribLocation( "alpha_test_mask", 3u );
 	monsters_shader_.SetAttribLocation( "groups_mask", 4u );
+	SetModelsInstanceAttribsLocations( monsters_shader_ );
 	monsters_shader_.Create();
 
 	sky_shader_.ShaderSource(
@@ -421,6 +474,9 @@ MapDrawerGL::~MapDrawerGL()
 
 	glDeleteTextures( sprites_textures_arrays_.size(), sprites_textures_arrays_.data() );
 	glDeleteTextures( bmp_objects_sprites_textures_arrays_.size(), bmp_objects_sprites_textures_arrays_.data() );
+
+	if( passes_stats_csv_file_ != nullptr )
+		std::fclose( passes_stats_csv_file_ );
 }
 
 void MapDrawerGL::SetMap( const MapDataConstPtr& map_data )
@@ -433,6 +489,7 @@ void MapDrawerGL::SetMap( const MapDataConstPtr& map_data )
 	map_light_.SetMap( map_data );
 
 	current_map_data_= map_data;
+	visible_geometry_.valid= false;
 
 	LoadFloorsTextures( *map_data );
 	LoadWallsTextures( *map_data );
@@ -491,8 +548,49 @@ void MapDrawerGL::Draw(
 	if( current_map_data_ == nullptr )
 		return;
 
-	UpdateDynamicWalls( map_state.GetDynamicWalls() );
+	last_frame_models_draw_stats_= models_draw_stats_;
+	models_draw_stats_= ModelsDrawStats();
+	models_instances_buffer_.BeginFrame();
+	passes_profiler_.BeginFrame();
+	WritePassesStatsCSV();
+
+	UpdateVisibleGeometry( camera_position.xy() );
+
+	passes_profiler_.BeginPass( PassesProfiler::Pass::LightmapUpdate );
 	map_light_.Update( map_state );
+	passes_profiler_.AddDrawCalls( map_light_.GetLastUpdateDrawCalls() );
+	passes_profiler_.AddUploadedBytes( map_light_.GetLastUpdateUploadedBytes() );
+	passes_profiler_.EndPass();
+
+	if( settings_.GetOrSetBool( SettingsKeys::opengl_draw_stats, false ) )
+	{
+		int pos=
+			std::snprintf(
+				status_, sizeof(status_),
+				"models: %u instances, %u draw calls",
+				last_frame_models_draw_stats_.instances, last_frame_models_draw_stats_.draw_calls );
+
+		if( use_hd_dynamic_lightmap_ && pos > 0 && pos < int(sizeof(status_)) )
+		{
+			unsigned int floor_updated, floor_total, walls_updated, walls_total;
+			map_light_.GetLastUpdateStats( floor_updated, floor_total, walls_updated, walls_total );
+			std::snprintf(
+				status_ + pos, sizeof(status_) - pos,
+				"; lightmap tiles: floor %u/%u, walls %u/%u",
+				floor_updated, floor_total, walls_updated, walls_total );
+		}
+
+		PrintPassesStatsToStatus();
+	}
+	else
+		status_[0]= '\0';
+
+	const auto update_state=
+	[&]( const r_OGLState& state )
+	{
+		r_OGLStateManager::UpdateState( state );
+		passes_profiler_.AddStateChanges();
+	};
 
 	m_Mat4 translate;
 	translate.Translate( -camera_position );
@@ -501,26 +599,36 @@ void MapDrawerGL::Draw(
 
 	glClear( GL_DEPTH_BUFFER_BIT );
 
+	passes_profiler_.BeginPass( PassesProfiler::Pass::Walls );
+	UpdateDynamicWalls( map_state.GetDynamicWalls() );
 	DrawWalls( view_matrix );
 
-	r_OGLStateManager::UpdateState( g_floors_gl_state );
+	passes_profiler_.BeginPass( PassesProfiler::Pass::Floors );
+	update_state( g_floors_gl_state );
 	DrawFloors( view_matrix );
 
-	r_OGLStateManager::UpdateState( g_models_gl_state );
+	passes_profiler_.BeginPass( PassesProfiler::Pass::Models );
+	update_state( g_models_gl_state );
 	DrawModels( map_state, view_matrix, view_clip_planes, false );
 	DrawItems( map_state, view_matrix, view_clip_planes, false );
 	DrawDynamicItems( map_state, view_matrix, view_clip_planes, false );
+
+	passes_profiler_.BeginPass( PassesProfiler::Pass::Monsters );
 	DrawMonsters( map_state, view_matrix, view_clip_planes, player_monster_id, false, true );
 	DrawMonstersBodyParts( map_state, view_matrix, view_clip_planes, false );
+
+	passes_profiler_.BeginPass( PassesProfiler::Pass::Models );
 	DrawRockets( map_state, view_matrix, view_clip_planes, false );
 	DrawGibs( map_state, view_matrix, view_clip_planes, false );
 
-	r_OGLStateManager::UpdateState( g_sky_gl_state );
+	passes_profiler_.BeginPass( PassesProfiler::Pass::Sky );
+	update_state( g_sky_gl_state );
 	DrawSky( view_rotation_and_projection_matrix );
 
 	if( settings_.GetOrSetBool( SettingsKeys::shadows, true ) )
 	{
-		r_OGLStateManager::UpdateState( g_shadows_gl_state );
+		passes_profiler_.BeginPass( PassesProfiler::Pass::Shadows );
+		update_state( g_shadows_gl_state );
 		DrawMapModelsShadows( map_state, view_matrix, view_clip_planes );
 		DrawItemsShadows( map_state, view_matrix, view_clip_planes );
 		DrawMonstersShadows( map_state, view_matrix, view_clip_planes, player_monster_id );
@@ -529,19 +637,27 @@ void MapDrawerGL::Draw(
 	/*
 	TRANSPARENT SECTION
 	*/
-	r_OGLStateManager::UpdateState( g_transparent_models_gl_state );
+	passes_profiler_.BeginPass( PassesProfiler::Pass::Models );
+	update_state( g_transparent_models_gl_state );
 	DrawModels( map_state, view_matrix, view_clip_planes, true );
 	DrawItems( map_state, view_matrix, view_clip_planes, true );
 	DrawDynamicItems( map_state, view_matrix, view_clip_planes, true );
+
+	passes_profiler_.BeginPass( PassesProfiler::Pass::Monsters );
 	DrawMonsters( map_state, view_matrix, view_clip_planes, player_monster_id, true, false );
 	DrawMonsters( map_state, view_matrix, view_clip_planes, player_monster_id, false, false );
 	DrawMonstersBodyParts( map_state, view_matrix, view_clip_planes, true );
+
+	passes_profiler_.BeginPass( PassesProfiler::Pass::Models );
 	DrawRockets( map_state, view_matrix, view_clip_planes, true );
 	DrawGibs( map_state, view_matrix, view_clip_planes, true );
 
-	r_OGLStateManager::UpdateState( g_sprites_gl_state );
+	passes_profiler_.BeginPass( PassesProfiler::Pass::Sprites );
+	update_state( g_sprites_gl_state );
 	DrawBMPObjectsSprites( map_state, view_matrix, camera_position );
 	DrawEffectsSprites( map_state, view_matrix, camera_position );
+
+	passes_profiler_.EndPass();
 }
 
 void MapDrawerGL::DrawWeapon(
@@ -556,7 +672,6 @@ void MapDrawerGL::DrawWeapon(
 
 	glActiveTexture( GL_TEXTURE0 + 0 );
 	glBindTexture( GL_TEXTURE_2D_ARRAY, weapons_textures_array_id_ );
-	active_lightmap_->Bind(1);
 	models_shader_.Uniform( "tex", int(0) );
 	models_shader_.Uniform( "lightmap", int(1) );
 
@@ -579,9 +694,8 @@ void MapDrawerGL::DrawWeapon(
 	rotation_mat_x.RotateX( x_angle );
 	rotation_mat_z.RotateZ( z_angle );
 
-	models_shader_.Uniform( "view_matrix", shift_mat * projection_matrix );
-	models_shader_.Uniform( "lightmap_matrix", lightmap_mat );
-	models_shader_.Uniform( "rotation_matrix", rotation_mat_x * rotation_mat_z );
+	const m_Mat4 view_matrix= shift_mat * projection_matrix;
+	const m_Mat4 rotation_mat= rotation_mat_x * rotation_mat_z;
 
 	const Model& model= game_resources_->weapons_models[ weapon_state.CurrentWeaponIndex() ];
 	const unsigned int frame= model.animations[ weapon_state.CurrentAnimation() ].first_frame + weapon_state.CurrentAnimationFrame();
@@ -594,18 +708,11 @@ void MapDrawerGL::DrawWeapon(
 		if( index_count == 0u )
 			return;
 
-		const unsigned int first_index= transparent ? model_geometry.first_transparent_index : model_geometry.first_index;
-
-		models_shader_.Uniform(
-			"first_animation_vertex_number",
-			int( model_geometry.first_animations_vertex + model_geometry.animations_vertex_count * frame ) );
-
-		glDrawElementsBaseVertex(
-			GL_TRIANGLES,
-			index_count,
-			GL_UNSIGNED_SHORT,
-			reinterpret_cast<void*>( first_index * sizeof(unsigned short) ),
-			model_geometry.first_vertex_index );
+		AddModelInstance(
+			model_geometry, nullptr, *active_lightmap_,
+			view_matrix, rotation_mat, lightmap_mat,
+			model_geometry.first_animations_vertex + model_geometry.animations_vertex_count * frame );
+		FlushModelsInstances( transparent );
 	};
 
 	glDepthRange( 0.0f, 1.0f / 8.0f );
@@ -649,7 +756,6 @@ void MapDrawerGL::DrawActiveItemIcon(
 
 	glActiveTexture( GL_TEXTURE0 + 0 );
 	glBindTexture( GL_TEXTURE_2D_ARRAY, items_textures_array_id_ );
-	map_light_.GetFullbrightLightmapDummy().Bind(1);
 	items_animations_.Bind( 2 );
 	models_shader_.Uniform( "tex", int(0) );
 	models_shader_.Uniform( "lightmap", int(1) );
@@ -669,11 +775,6 @@ void MapDrawerGL::DrawActiveItemIcon(
 		model_geometry.first_animations_vertex +
 		model_geometry.animations_vertex_count * frame_number;
 
-	models_shader_.Uniform( "view_matrix", model_matrix * view_matrix );
-	models_shader_.Uniform( "lightmap_matrix", lightmap_matrix );
-	models_shader_.Uniform( "rotation_matrix", rotation_matrix );
-	models_shader_.Uniform( "first_animation_vertex_number", int(first_animation_vertex) );
-
 	for( unsigned int t= 0u; t < 2u; ++t )
 	{
 		const bool transparent= t == 1u;
@@ -683,14 +784,11 @@ void MapDrawerGL::DrawActiveItemIcon(
 		if( index_count == 0u )
 			continue;
 
-		const unsigned int first_index= transparent ? model_geometry.first_transparent_index : model_geometry.first_index;
-
-		glDrawElementsBaseVertex(
-			GL_TRIANGLES,
-			index_count,
-			GL_UNSIGNED_SHORT,
-			reinterpret_cast<void*>( first_index * sizeof(unsigned short) ),
-			model_geometry.first_vertex_index );
+		AddModelInstance(
+			model_geometry, nullptr, map_light_.GetFullbrightLightmapDummy(),
+			model_matrix * view_matrix, rotation_matrix, lightmap_matrix,
+			first_animation_vertex );
+		FlushModelsInstances( transparent );
 	}
 }
 
@@ -709,6 +807,124 @@ void MapDrawerGL::DoFullscreenPostprocess( const MapState& map_state )
 
 }
 
+const char* MapDrawerGL::GetStatus() const
+{
+	return status_[0] == '\0' ? nullptr : status_;
+}
+
+void MapDrawerGL::PrintStats() const
+{
+	Log::Info(
+		"Last frame models: ", last_frame_models_draw_stats_.instances, " instances, ",
+		last_frame_models_draw_stats_.draw_calls, " draw calls",
+		models_instancing_ ? "" : " (instancing disabled)" );
+
+	if( use_hd_dynamic_lightmap_ )
+	{
+		unsigned int floor_updated, floor_total, walls_updated, walls_total;
+		map_light_.GetLastUpdateStats( floor_updated, floor_total, walls_updated, walls_total );
+		Log::Info(
+			"Last frame lightmap tiles updated: floor ", floor_updated, "/", floor_total,
+			", walls ", walls_updated, "/", walls_total );
+	}
+
+	const PassesProfiler::FrameStats& passes_stats= passes_profiler_.GetLastFrameStats();
+	for( unsigned int p= 0u; p < PassesProfiler::c_pass_count; p++ )
+	{
+		const PassesProfiler::PassStats& pass_stats= passes_stats.passes[p];
+		Log::Info(
+			"Last frame ", PassesProfiler::GetPassName( static_cast<PassesProfiler::Pass>(p) ), ": ",
+			"cpu ", pass_stats.cpu_time_ms, " ms, ",
+			"gpu ", passes_stats.gpu_time_valid ? std::to_string( pass_stats.gpu_time_ms ) : "n/a", " ms, ",
+			pass_stats.draw_calls, " draw calls, ",
+			pass_stats.state_changes, " state changes, ",
+			pass_stats.uploaded_bytes, " bytes uploaded" );
+	}
+}
+
+void MapDrawerGL::PrintPassesStatsToStatus()
+{
+	const PassesProfiler::FrameStats& passes_stats= passes_profiler_.GetLastFrameStats();
+
+	unsigned int pos= std::strlen( status_ );
+	for( unsigned int p= 0u; p < PassesProfiler::c_pass_count && pos < sizeof(status_); p++ )
+	{
+		const PassesProfiler::PassStats& pass_stats= passes_stats.passes[p];
+
+		char gpu_time_str[16];
+		if( passes_stats.gpu_time_valid )
+			std::snprintf( gpu_time_str, sizeof(gpu_time_str), "%.2f", pass_stats.gpu_time_ms );
+		else
+			std::snprintf( gpu_time_str, sizeof(gpu_time_str), "n/a" );
+
+		const int written=
+			std::snprintf(
+				status_ + pos, sizeof(status_) - pos,
+				"\n%s: cpu %.2f ms, gpu %s ms, %u draws, %u states, %u kb",
+				PassesProfiler::GetPassName( static_cast<PassesProfiler::Pass>(p) ),
+				pass_stats.cpu_time_ms, gpu_time_str,
+				pass_stats.draw_calls, pass_stats.state_changes,
+				( pass_stats.uploaded_bytes + 1023u ) / 1024u );
+		if( written < 0 )
+			break;
+		pos+= static_cast<unsigned int>(written);
+	}
+}
+
+void MapDrawerGL::WritePassesStatsCSV()
+{
+	// Reopen file after file name change. Empty name - no output.
+	const char* const file_name= settings_.GetOrSetString( SettingsKeys::opengl_passes_stats_csv, "" );
+	if( passes_stats_csv_file_name_ != file_name )
+	{
+		if( passes_stats_csv_file_ != nullptr )
+		{
+			std::fclose( passes_stats_csv_file_ );
+			passes_stats_csv_file_= nullptr;
+			Log::Info( "Passes stats recording to \"", passes_stats_csv_file_name_, "\" stopped" );
+		}
+
+		passes_stats_csv_file_name_= file_name;
+		passes_stats_frame_= 0u;
+
+		if( file_name[0] != '\0' )
+		{
+			passes_stats_csv_file_= std::fopen( file_name, "wb" );
+			if( passes_stats_csv_file_ == nullptr )
+				Log::Warning( "Can not open file \"", file_name, "\"" );
+			else
+			{
+				std::fprintf( passes_stats_csv_file_, "frame,pass,cpu_ms,gpu_ms,draw_calls,state_changes,uploaded_bytes\n" );
+				Log::Info( "Passes stats recording to \"", file_name, "\" started" );
+			}
+		}
+	}
+
+	if( passes_stats_csv_file_ == nullptr )
+		return;
+
+	const PassesProfiler::FrameStats& passes_stats= passes_profiler_.GetLastFrameStats();
+	for( unsigned int p= 0u; p < PassesProfiler::c_pass_count; p++ )
+	{
+		const PassesProfiler::PassStats& pass_stats= passes_stats.passes[p];
+
+		// Leave GPU time empty, if it is not measured.
+		char gpu_time_str[16];
+		if( passes_stats.gpu_time_valid )
+			std::snprintf( gpu_time_str, sizeof(gpu_time_str), "%.3f", pass_stats.gpu_time_ms );
+		else
+			gpu_time_str[0]= '\0';
+
+		std::fprintf(
+			passes_stats_csv_file_, "%u,%s,%.3f,%s,%u,%u,%u\n",
+			passes_stats_frame_,
+			PassesProfiler::GetPassName( static_cast<PassesProfiler::Pass>(p) ),
+			pass_stats.cpu_time_ms, gpu_time_str,
+			pass_stats.draw_calls, pass_stats.state_changes, pass_stats.uploaded_bytes );
+	}
+	passes_stats_frame_++;
+}
+
 void MapDrawerGL::DrawMapRelatedModels(
 	const MapRelatedModel* const models, const unsigned int model_count,
 	const m_Mat4& view_rotation_and_projection_matrix,
@@ -730,7 +946,6 @@ void MapDrawerGL::DrawMapRelatedModels(
 
 	glActiveTexture( GL_TEXTURE0 + 0 );
 	glBindTexture( GL_TEXTURE_2D_ARRAY, models_textures_array_id_ );
-	active_lightmap_->Bind(1);
 	models_shader_.Uniform( "tex", int(0) );
 	models_shader_.Uniform( "lightmap", int(1) );
 
@@ -757,7 +972,6 @@ void MapDrawerGL::DrawMapRelatedModels(
 			if( index_count == 0u )
 				continue;
 
-			const unsigned int first_index= transparent ? model_geometry.first_transparent_index : model_geometry.first_index;
 			const unsigned int first_animation_vertex=
 				model_geometry.first_animations_vertex +
 				model_geometry.animations_vertex_count * map_model.frame;
@@ -773,18 +987,13 @@ void MapDrawerGL::DrawMapRelatedModels(
 			if( BBoxIsOutsideView( view_clip_planes, bbox, model_matrix ) )
 				continue;
 
-			models_shader_.Uniform( "view_matrix", model_matrix * view_matrix );
-			models_shader_.Uniform( "lightmap_matrix", lightmap_matrix );
-			models_shader_.Uniform( "rotation_matrix", rotation_matrix );
-			models_shader_.Uniform( "first_animation_vertex_number", int(first_animation_vertex) );
-
-			glDrawElementsBaseVertex(
-				GL_TRIANGLES,
-				index_count,
-				GL_UNSIGNED_SHORT,
-				reinterpret_cast<void*>( first_index * sizeof(unsigned short) ),
-				model_geometry.first_vertex_index );
+			AddModelInstance(
+				model_geometry, nullptr, *active_lightmap_,
+				model_matrix * view_matrix, rotation_matrix, lightmap_matrix,
+				first_animation_vertex );
 		}
+
+		FlushModelsInstances( transparent );
 	} // for transparent/untransparent
 }
 
@@ -1072,6 +1281,7 @@ void MapDrawerGL::LoadFloors( const MapData& map_data )
 	for( unsigned int floor_or_ceiling= 0u; floor_or_ceiling < 2u; floor_or_ceiling++ )
 	{
 		floors_geometry_info[ floor_or_ceiling ].first_vertex_number= floors_vertices.size();
+		floors_geometry_info[ floor_or_ceiling ].cells.clear();
 
 		const unsigned char* const in_data= floor_or_ceiling == 0u ? map_data.floor_textures : map_data.ceiling_textures;
 
@@ -1095,6 +1305,8 @@ void MapDrawerGL::LoadFloors( const MapData& map_data )
 			v[0].texture_id= v[1].texture_id= v[2].texture_id= v[3].texture_id= texture_number;
 			v[4]= v[0];
 			v[5]= v[2];
+
+			floors_geometry_info[ floor_or_ceiling ].cells.push_back( static_cast<unsigned short>( x + y * MapData::c_map_size ) );
 		} // for xy
 
 		floors_geometry_info[ floor_or_ceiling ].vertex_count=
@@ -1125,8 +1337,14 @@ void MapDrawerGL::LoadWalls( const MapData& map_data )
 	walls_vertices.reserve( map_data.static_walls.size() * 4u );
 	walls_indeces.reserve( map_data.static_walls.size() * 6u );
 
+	static_walls_indices_.resize( map_data.static_walls.size() );
+
 	for( const MapData::Wall& wall : map_data.static_walls )
 	{
+		StaticWallIndices& wall_indices= static_walls_indices_[ &wall - map_data.static_walls.data() ];
+		wall_indices.first_index= walls_indeces.size();
+		wall_indices.index_count= 0u;
+
 		if( map_data.walls_textures[ wall.texture_id ].file_path[0] == '\0' )
 			continue; // Wall has no texture - do not draw it.
 
@@ -1197,6 +1415,8 @@ void MapDrawerGL::LoadWalls( const MapData& map_data )
 			ind[4]= first_vertex_index + 3u;
 			ind[5]= first_vertex_index + 2u;
 		}
+
+		wall_indices.index_count= walls_indeces.size() - wall_indices.first_index;
 	} // for walls
 
 	const auto setup_attribs=
@@ -1240,6 +1460,7 @@ void MapDrawerGL::LoadWalls( const MapData& map_data )
 
 	// Reserve place for dynamic walls geometry
 	dynamc_walls_vertices_.resize( map_data.dynamic_walls.size() * 4u );
+	prev_dynamic_walls_.clear(); // Force update of all dynamic walls.
 
 	// Prepare indeces for dynamic walls.
 	walls_indeces.clear();
@@ -1553,12 +1774,29 @@ void MapDrawerGL::UpdateDynamicWalls( const MapState::DynamicWalls& dynamic_wall
 {
 	PC_ASSERT( current_map_data_->dynamic_walls.size() == dynamic_walls.size() );
 
+	// Rewrite and upload only walls, changed since previous frame.
+	const bool force_update= prev_dynamic_walls_.size() != dynamic_walls.size();
+	prev_dynamic_walls_.resize( dynamic_walls.size() );
+
+	unsigned int first_updated_wall= ~0u;
+	unsigned int last_updated_wall= 0u;
+
 	for( unsigned int w= 0u; w < dynamic_walls.size(); w++ )
 	{
 		const MapData::Wall& map_wall= current_map_data_->dynamic_walls[w];
 		const MapState::DynamicWall wall= dynamic_walls[w];
 		// TODO - discard walls without textures.
 
+		MapState::DynamicWall& prev_wall= prev_dynamic_walls_[w];
+		if( !force_update &&
+			prev_wall.vert_pos[0] == wall.vert_pos[0] && prev_wall.vert_pos[1] == wall.vert_pos[1] &&
+			prev_wall.z == wall.z && prev_wall.texture_id == wall.texture_id )
+			continue;
+
+		prev_wall= wall;
+		first_updated_wall= std::min( first_updated_wall, w );
+		last_updated_wall= w;
+
 		WallVertex* const v= dynamc_walls_vertices_.data() + w * 4u;
 
 		v[0].xyz[0]= v[2].xyz[0]= short( wall.vert_pos[0].x * 256.0f );
@@ -1599,10 +1837,15 @@ void MapDrawerGL::UpdateDynamicWalls( const MapState::DynamicWalls& dynamic_wall
 		}
 	}
 
+	if( first_updated_wall > last_updated_wall )
+		return;
+
+	const unsigned int upload_size= ( last_updated_wall - first_updated_wall + 1u ) * 4u * sizeof(WallVertex);
 	dynamic_walls_geometry_.VertexSubData(
-		dynamc_walls_vertices_.data(),
-		dynamc_walls_vertices_.size() * sizeof(WallVertex),
-		0u );
+		dynamc_walls_vertices_.data() + first_updated_wall * 4u,
+		upload_size,
+		first_updated_wall * 4u * sizeof(WallVertex) );
+	passes_profiler_.AddUploadedBytes( upload_size );
 }
 
 void MapDrawerGL::PrepareModelsPolygonBuffer(
@@ -1643,6 +1886,221 @@ void MapDrawerGL::PrepareModelsPolygonBuffer(
 		((char*)&v.groups_mask) - ((char*)&v) );
 }
 
+void MapDrawerGL::AddModelInstance(
+	const ModelGeometry& geometry,
+	const r_Texture* const texture,
+	const r_Texture& lightmap,
+	const m_Mat4& view_matrix,
+	const m_Mat4& rotation_matrix,
+	const m_Mat3& lightmap_matrix,
+	const unsigned int first_animation_vertex,
+	const unsigned int enabled_groups_mask )
+{
+	models_batch_instances_.emplace_back();
+	ModelsBatchInstance& batch_instance= models_batch_instances_.back();
+	batch_instance.geometry= &geometry;
+	batch_instance.texture= texture;
+	batch_instance.lightmap= &lightmap;
+
+	ModelInstance& instance= batch_instance.instance;
+	std::memcpy( instance.view_matrix, view_matrix.value, sizeof(instance.view_matrix) );
+	for( unsigned int i= 0u; i < 3u; i++ )
+	{
+		for( unsigned int j= 0u; j < 3u; j++ )
+			instance.rotation_matrix[ i * 3u + j ]= rotation_matrix.value[ i * 4u + j ];
+		instance.lightmap_matrix_x[i]= lightmap_matrix.value[ i * 3u + 0u ];
+		instance.lightmap_matrix_y[i]= lightmap_matrix.value[ i * 3u + 1u ];
+	}
+	instance.params[0]= int(first_animation_vertex);
+	instance.params[1]= int(enabled_groups_mask);
+}
+
+void MapDrawerGL::FlushModelsInstances( const bool transparent )
+{
+	if( models_batch_instances_.empty() )
+		return;
+
+	const auto same_batch=
+	[]( const ModelsBatchInstance& a, const ModelsBatchInstance& b ) -> bool
+	{
+		return a.geometry == b.geometry && a.texture == b.texture && a.lightmap == b.lightmap;
+	};
+
+	// Group instances of same model with same textures. Stable sort keeps draw order inside groups.
+	if( models_instancing_ )
+		std::stable_sort(
+			models_batch_instances_.begin(), models_batch_instances_.end(),
+			[]( const ModelsBatchInstance& a, const ModelsBatchInstance& b ) -> bool
+			{
+				const std::less<const void*> less;
+				if( a.geometry != b.geometry )
+					return less( a.geometry, b.geometry );
+				if( a.texture != b.texture )
+					return less( a.texture, b.texture );
+				return less( a.lightmap, b.lightmap );
+			} );
+
+	const unsigned int instance_count= models_batch_instances_.size();
+	models_instances_upload_.resize( instance_count );
+	for( unsigned int i= 0u; i < instance_count; i++ )
+		models_instances_upload_[i]= models_batch_instances_[i].instance;
+
+	const unsigned int data_size= instance_count * sizeof(ModelInstance);
+
+	const unsigned int buffer_offset= models_instances_buffer_.Upload( models_instances_upload_.data(), data_size );
+	passes_profiler_.AddUploadedBytes( data_size );
+
+	for( GLuint attrib= c_instance_view_matrix_attrib; attrib < c_instance_attribs_end; attrib++ )
+	{
+		glEnableVertexAttribArray( attrib );
+		glVertexAttribDivisor( attrib, 1u );
+	}
+
+	const r_Texture* current_texture= nullptr;
+	const r_Texture* current_lightmap= nullptr;
+
+	unsigned int i= 0u;
+	while( i < instance_count )
+	{
+		const ModelsBatchInstance& batch_instance= models_batch_instances_[i];
+
+		unsigned int batch_size= 1u;
+		if( models_instancing_ )
+			while( i + batch_size < instance_count && same_batch( batch_instance, models_batch_instances_[ i + batch_size ] ) )
+				batch_size++;
+
+		if( batch_instance.texture != nullptr && batch_instance.texture != current_texture )
+		{
+			current_texture= batch_instance.texture;
+			current_texture->Bind(0);
+			passes_profiler_.AddStateChanges();
+		}
+		if( batch_instance.lightmap != current_lightmap )
+		{
+			current_lightmap= batch_instance.lightmap;
+			current_lightmap->Bind(1);
+			passes_profiler_.AddStateChanges();
+		}
+
+		const ModelGeometry& geometry= *batch_instance.geometry;
+		const unsigned int index_count= transparent ? geometry.transparent_index_count : geometry.index_count;
+		const unsigned int first_index= transparent ? geometry.first_transparent_index : geometry.first_index;
+
+		SetupModelsInstancesAttribs( buffer_offset + i * sizeof(ModelInstance) );
+
+		glDrawElementsInstancedBaseVertex(
+			GL_TRIANGLES,
+			index_count,
+			GL_UNSIGNED_SHORT,
+			reinterpret_cast<void*>( first_index * sizeof(unsigned short) ),
+			batch_size,
+			geometry.first_vertex_index );
+
+		models_draw_stats_.draw_calls++;
+		passes_profiler_.AddDrawCalls();
+		i+= batch_size;
+	}
+
+	for( GLuint attrib= c_instance_view_matrix_attrib; attrib < c_instance_attribs_end; attrib++ )
+		glDisableVertexAttribArray( attrib );
+
+	models_draw_stats_.instances+= instance_count;
+	models_batch_instances_.clear();
+}
+
+void MapDrawerGL::SetupModelsInstancesAttribs( const unsigned int buffer_offset )
+{
+	SIZE_ASSERT( ModelInstance, 132u );
+
+	const GLsizei stride= sizeof(ModelInstance);
+	const auto offset=
+	[&]( const size_t field_offset ) -> const GLvoid*
+	{
+		return reinterpret_cast<const GLvoid*>( buffer_offset + field_offset );
+	};
+
+	for( unsigned int i= 0u; i < 4u; i++ )
+		glVertexAttribPointer(
+			c_instance_view_matrix_attrib + i, 4, GL_FLOAT, GL_FALSE, stride,
+			offset( offsetof( ModelInstance, view_matrix ) + i * 4u * sizeof(float) ) );
+
+	for( unsigned int i= 0u; i < 3u; i++ )
+		glVertexAttribPointer(
+			c_instance_rotation_matrix_attrib + i, 3, GL_FLOAT, GL_FALSE, stride,
+			offset( offsetof( ModelInstance, rotation_matrix ) + i * 3u * sizeof(float) ) );
+
+	glVertexAttribPointer(
+		c_instance_lightmap_matrix_x_attrib, 3, GL_FLOAT, GL_FALSE, stride,
+		offset( offsetof( ModelInstance, lightmap_matrix_x ) ) );
+	glVertexAttribPointer(
+		c_instance_lightmap_matrix_y_attrib, 3, GL_FLOAT, GL_FALSE, stride,
+		offset( offsetof( ModelInstance, lightmap_matrix_y ) ) );
+
+	glVertexAttribIPointer(
+		c_instance_params_attrib, 2, GL_INT, stride,
+		offset( offsetof( ModelInstance, params ) ) );
+}
+
+void MapDrawerGL::UpdateVisibleGeometry( const m_Vec2& camera_position_xy )
+{
+	const MapPVS& pvs= *current_map_data_->pvs;
+	const unsigned int pvs_cell=
+		settings_.GetOrSetBool( SettingsKeys::pvs, true )
+			? MapPVS::GetCellIndex( camera_position_xy )
+			: MapPVS::c_invalid_cell;
+
+	if( visible_geometry_.valid && visible_geometry_.pvs_cell == pvs_cell )
+		return;
+
+	visible_geometry_.valid= true;
+	visible_geometry_.pvs_cell= pvs_cell;
+
+	visible_geometry_.walls_counts.clear();
+	visible_geometry_.walls_offsets.clear();
+	unsigned int range_end= ~0u;
+	for( unsigned int w= 0u; w < static_walls_indices_.size(); w++ )
+	{
+		const StaticWallIndices& wall_indices= static_walls_indices_[w];
+		if( wall_indices.index_count == 0u || !pvs.IsStaticWallVisible( pvs_cell, w ) )
+			continue;
+
+		if( wall_indices.first_index == range_end )
+			visible_geometry_.walls_counts.back()+= wall_indices.index_count;
+		else
+		{
+			visible_geometry_.walls_counts.push_back( wall_indices.index_count );
+			visible_geometry_.walls_offsets.push_back(
+				reinterpret_cast<const GLvoid*>( wall_indices.first_index * sizeof(unsigned short) ) );
+		}
+		range_end= wall_indices.first_index + wall_indices.index_count;
+	}
+
+	for( unsigned int z= 0u; z < 2u; z++ )
+	{
+		const FloorGeometryInfo& info= floors_geometry_info[z];
+		std::vector<GLint>& floors_first= visible_geometry_.floors_first[z];
+		std::vector<GLsizei>& floors_counts= visible_geometry_.floors_counts[z];
+		floors_first.clear();
+		floors_counts.clear();
+
+		for( unsigned int i= 0u; i < info.cells.size(); i++ )
+		{
+			const unsigned int cell= info.cells[i];
+			if( !pvs.IsCellVisible( pvs_cell, cell % MapData::c_map_size, cell / MapData::c_map_size ) )
+				continue;
+
+			const GLint first_vertex= info.first_vertex_number + i * 6u;
+			if( !floors_counts.empty() && floors_first.back() + floors_counts.back() == first_vertex )
+				floors_counts.back()+= 6;
+			else
+			{
+				floors_first.push_back( first_vertex );
+				floors_counts.push_back( 6 );
+			}
+		}
+	}
+}
+
 void MapDrawerGL::DrawWalls( const m_Mat4& view_matrix )
 {
 	walls_shader_.Bind();
@@ -1661,11 +2119,19 @@ void MapDrawerGL::DrawWalls( const m_Mat4& view_matrix )
 
 	r_OGLStateManager::UpdateState( g_static_walls_gl_state );
 	walls_geometry_.Bind();
-	walls_geometry_.Draw();
+	glMultiDrawElements(
+		GL_TRIANGLES,
+		visible_geometry_.walls_counts.data(),
+		GL_UNSIGNED_SHORT,
+		visible_geometry_.walls_offsets.data(),
+		visible_geometry_.walls_counts.size() );
 
 	r_OGLStateManager::UpdateState( g_dynamic_walls_gl_state );
 	dynamic_walls_geometry_.Bind();
 	dynamic_walls_geometry_.Draw();
+
+	passes_profiler_.AddDrawCalls( 2u );
+	passes_profiler_.AddStateChanges( 2u );
 }
 
 void MapDrawerGL::DrawFloors( const m_Mat4& view_matrix )
@@ -1686,10 +2152,12 @@ void MapDrawerGL::DrawFloors( const m_Mat4& view_matrix )
 	{
 		floors_shader_.Uniform( "pos_z", float(z) * 2.0f );
 
-		glDrawArrays(
+		glMultiDrawArrays(
 			GL_TRIANGLES,
-			floors_geometry_info[z].first_vertex_number,
-			floors_geometry_info[z].vertex_count );
+			visible_geometry_.floors_first[z].data(),
+			visible_geometry_.floors_counts[z].data(),
+			visible_geometry_.floors_counts[z].size() );
+		passes_profiler_.AddDrawCalls();
 	}
 }
 
@@ -1704,7 +2172,6 @@ void MapDrawerGL::DrawModels(
 
 	glActiveTexture( GL_TEXTURE0 + 0 );
 	glBindTexture( GL_TEXTURE_2D_ARRAY, models_textures_array_id_ );
-	active_lightmap_->Bind(1);
 	models_shader_.Uniform( "tex", int(0) );
 	models_shader_.Uniform( "lightmap", int(1) );
 
@@ -1724,7 +2191,6 @@ void MapDrawerGL::DrawModels(
 		if( index_count == 0u )
 			continue;
 
-		const unsigned int first_index= transparent ? model_geometry.first_transparent_index : model_geometry.first_index;
 		const unsigned int first_animation_vertex=
 			model_geometry.first_animations_vertex +
 			model_geometry.animations_vertex_count * static_model.animation_frame;
@@ -1740,18 +2206,13 @@ void MapDrawerGL::DrawModels(
 		if( BBoxIsOutsideView( view_clip_planes, bbox, model_matrix ) )
 			continue;
 
-		models_shader_.Uniform( "view_matrix", model_matrix * view_matrix );
-		models_shader_.Uniform( "lightmap_matrix", lightmap_matrix );
-		models_shader_.Uniform( "rotation_matrix", rotation_matrix );
-		models_shader_.Uniform( "first_animation_vertex_number", int(first_animation_vertex) );
-
-		glDrawElementsBaseVertex(
-			GL_TRIANGLES,
-			index_count,
-			GL_UNSIGNED_SHORT,
-			reinterpret_cast<void*>( first_index * sizeof(unsigned short) ),
-			model_geometry.first_vertex_index );
+		AddModelInstance(
+			model_geometry, nullptr, *active_lightmap_,
+			model_matrix * view_matrix, rotation_matrix, lightmap_matrix,
+			first_animation_vertex );
 	}
+
+	FlushModelsInstances( transparent );
 }
 
 void MapDrawerGL::DrawItems(
@@ -1765,7 +2226,6 @@ void MapDrawerGL::DrawItems(
 
 	glActiveTexture( GL_TEXTURE0 + 0 );
 	glBindTexture( GL_TEXTURE_2D_ARRAY, items_textures_array_id_ );
-	active_lightmap_->Bind(1);
 	models_shader_.Uniform( "tex", int(0) );
 	models_shader_.Uniform( "lightmap", int(1) );
 
@@ -1784,7 +2244,6 @@ void MapDrawerGL::DrawItems(
 		if( index_count == 0u )
 			continue;
 
-		const unsigned int first_index= transparent ? model_geometry.first_transparent_index : model_geometry.first_index;
 		const unsigned int first_animation_vertex=
 			model_geometry.first_animations_vertex +
 			model_geometry.animations_vertex_count * item.animation_frame;
@@ -1800,18 +2259,13 @@ void MapDrawerGL::DrawItems(
 		if( BBoxIsOutsideView( view_clip_planes, bbox, model_matrix ) )
 			continue;
 
-		models_shader_.Uniform( "view_matrix", model_matrix * view_matrix );
-		models_shader_.Uniform( "lightmap_matrix", lightmap_matrix );
-		models_shader_.Uniform( "rotation_matrix", rotation_matrix );
-		models_shader_.Uniform( "first_animation_vertex_number", int(first_animation_vertex) );
-
-		glDrawElementsBaseVertex(
-			GL_TRIANGLES,
-			index_count,
-			GL_UNSIGNED_SHORT,
-			reinterpret_cast<void*>( first_index * sizeof(unsigned short) ),
-			model_geometry.first_vertex_index );
+		AddModelInstance(
+			model_geometry, nullptr, *active_lightmap_,
+			model_matrix * view_matrix, rotation_matrix, lightmap_matrix,
+			first_animation_vertex );
 	}
+
+	FlushModelsInstances( transparent );
 }
 
 void MapDrawerGL::DrawDynamicItems(
@@ -1842,7 +2296,6 @@ void MapDrawerGL::DrawDynamicItems(
 		if( index_count == 0u )
 			continue;
 
-		const unsigned int first_index= transparent ? model_geometry.first_transparent_index : model_geometry.first_index;
 		const unsigned int first_animation_vertex=
 			model_geometry.first_animations_vertex +
 			model_geometry.animations_vertex_count * item.frame;
@@ -1858,20 +2311,14 @@ void MapDrawerGL::DrawDynamicItems(
 		if( BBoxIsOutsideView( view_clip_planes, bbox, model_matrix ) )
 			continue;
 
-		models_shader_.Uniform( "view_matrix", model_matrix * view_matrix );
-		models_shader_.Uniform( "lightmap_matrix", lightmap_matrix );
-		models_shader_.Uniform( "rotation_matrix", rotation_matrix );
-		models_shader_.Uniform( "first_animation_vertex_number", int(first_animation_vertex) );
-
-		( item.fullbright ? map_light_.GetFullbrightLightmapDummy() : *active_lightmap_ ).Bind(1);
-
-		glDrawElementsBaseVertex(
-			GL_TRIANGLES,
-			index_count,
-			GL_UNSIGNED_SHORT,
-			reinterpret_cast<void*>( first_index * sizeof(unsigned short) ),
-			model_geometry.first_vertex_index );
+		AddModelInstance(
+			model_geometry, nullptr,
+			item.fullbright ? map_light_.GetFullbrightLightmapDummy() : *active_lightmap_,
+			model_matrix * view_matrix, rotation_matrix, lightmap_matrix,
+			first_animation_vertex );
 	}
+
+	FlushModelsInstances( transparent );
 }
 
 void MapDrawerGL::DrawMonsters(
@@ -1885,7 +2332,7 @@ void MapDrawerGL::DrawMonsters(
 	monsters_shader_.Bind();
 	monsters_geometry_data_.Bind();
 
-	active_lightmap_->Bind(1);
+	monsters_shader_.Uniform( "tex", int(0) );
 	monsters_shader_.Uniform( "lightmap", int(1) );
 
 	monsters_animations_.Bind(2);
@@ -1917,7 +2364,6 @@ void MapDrawerGL::DrawMonsters(
 		if( index_count == 0u )
 			continue;
 
-		const unsigned int first_index= transparent ? model_geometry.first_transparent_index : model_geometry.first_index;
 		const unsigned int first_animations_vertex=
 			model_geometry.first_animations_vertex +
 			frame * model_geometry.animations_vertex_count;
@@ -1931,25 +2377,16 @@ void MapDrawerGL::DrawMonsters(
 		if( BBoxIsOutsideView( view_clip_planes, bbox, model_matrix ) )
 			continue;
 
-		monsters_shader_.Uniform( "view_matrix", model_matrix * view_matrix );
-		monsters_shader_.Uniform( "lightmap_matrix", lightmap_matrix );
-		monsters_shader_.Uniform( "enabled_groups_mask", int(monster.body_parts_mask) );
-		monsters_shader_.Uniform( "rotation_matrix", rotation_matrix );
-		monsters_shader_.Uniform( "first_animation_vertex_number", int(first_animations_vertex) );
-
-		if( monster.monster_id == 0u )
-			GetPlayerTexture( monster.color ).Bind(0);
-		else
-			monster_model.texture.Bind(0);
-		monsters_shader_.Uniform( "tex", int(0) );
-
-		glDrawElementsBaseVertex(
-			GL_TRIANGLES,
-			index_count,
-			GL_UNSIGNED_SHORT,
-			reinterpret_cast<void*>( first_index * sizeof(unsigned short) ),
-			model_geometry.first_vertex_index );
+		AddModelInstance(
+			model_geometry,
+			monster.monster_id == 0u ? &GetPlayerTexture( monster.color ) : &monster_model.texture,
+			*active_lightmap_,
+			model_matrix * view_matrix, rotation_matrix, lightmap_matrix,
+			first_animations_vertex,
+			monster.body_parts_mask );
 	}
+
+	FlushModelsInstances( transparent );
 }
 
 void MapDrawerGL::DrawMonstersBodyParts(
@@ -1961,7 +2398,7 @@ void MapDrawerGL::DrawMonstersBodyParts(
 	monsters_shader_.Bind();
 	monsters_geometry_data_.Bind();
 
-	active_lightmap_->Bind(1);
+	monsters_shader_.Uniform( "tex", int(0) );
 	monsters_shader_.Uniform( "lightmap", int(1) );
 
 	monsters_animations_.Bind(2);
@@ -1984,7 +2421,6 @@ void MapDrawerGL::DrawMonstersBodyParts(
 		if( index_count == 0u )
 			continue;
 
-		const unsigned int first_index= transparent ? model_geometry.first_transparent_index : model_geometry.first_index;
 		const unsigned int first_animations_vertex=
 			model_geometry.first_animations_vertex +
 			frame * model_geometry.animations_vertex_count;
@@ -1998,22 +2434,13 @@ void MapDrawerGL::DrawMonstersBodyParts(
 		if( BBoxIsOutsideView( view_clip_planes, bbox, model_matrix ) )
 			continue;
 
-		monsters_shader_.Uniform( "view_matrix", model_matrix * view_matrix );
-		monsters_shader_.Uniform( "lightmap_matrix", lightmap_matrix );
-		monsters_shader_.Uniform( "enabled_groups_mask", int(255) );
-		monsters_shader_.Uniform( "rotation_matrix", rotation_matrix );
-		monsters_shader_.Uniform( "first_animation_vertex_number", int(first_animations_vertex) );
-
-		monster_model.texture.Bind(0);
-		monsters_shader_.Uniform( "tex", int(0) );
-
-		glDrawElementsBaseVertex(
-			GL_TRIANGLES,
-			index_count,
-			GL_UNSIGNED_SHORT,
-			reinterpret_cast<void*>( first_index * sizeof(unsigned short) ),
-			model_geometry.first_vertex_index );
+		AddModelInstance(
+			model_geometry, &monster_model.texture, *active_lightmap_,
+			model_matrix * view_matrix, rotation_matrix, lightmap_matrix,
+			first_animations_vertex );
 	}
+
+	FlushModelsInstances( transparent );
 }
 
 void MapDrawerGL::DrawRockets(
@@ -2027,7 +2454,6 @@ void MapDrawerGL::DrawRockets(
 
 	glActiveTexture( GL_TEXTURE0 + 0 );
 	glBindTexture( GL_TEXTURE_2D_ARRAY, rockets_textures_array_id_ );
-	active_lightmap_->Bind(1);
 	models_shader_.Uniform( "tex", int(0) );
 	models_shader_.Uniform( "lightmap", int(1) );
 
@@ -2046,7 +2472,6 @@ void MapDrawerGL::DrawRockets(
 		if( index_count == 0u )
 			continue;
 
-		const unsigned int first_index= transparent ? model_geometry.first_transparent_index : model_geometry.first_index;
 		const unsigned int first_animation_vertex=
 			model_geometry.first_animations_vertex +
 			rocket.frame * model_geometry.animations_vertex_count;
@@ -2072,23 +2497,16 @@ void MapDrawerGL::DrawRockets(
 		if( BBoxIsOutsideView( view_clip_planes, bbox, model_mat ) )
 			continue;
 
-		models_shader_.Uniform( "view_matrix", model_mat * view_matrix );
-		models_shader_.Uniform( "lightmap_matrix", lightmap_mat );
-		models_shader_.Uniform( "rotation_matrix", rotate_mat );
-		models_shader_.Uniform( "first_animation_vertex_number", int(first_animation_vertex) );
-
-		if( game_resources_->rockets_description[ rocket.rocket_id ].fullbright )
-			map_light_.GetFullbrightLightmapDummy().Bind(1);
-		else
-			active_lightmap_->Bind(1);
-
-		glDrawElementsBaseVertex(
-			GL_TRIANGLES,
-			index_count,
-			GL_UNSIGNED_SHORT,
-			reinterpret_cast<void*>( first_index * sizeof(unsigned short) ),
-			model_geometry.first_vertex_index );
+		AddModelInstance(
+			model_geometry, nullptr,
+			game_resources_->rockets_description[ rocket.rocket_id ].fullbright
+				? map_light_.GetFullbrightLightmapDummy()
+				: *active_lightmap_,
+			model_mat * view_matrix, rotate_mat, lightmap_mat,
+			first_animation_vertex );
 	}
+
+	FlushModelsInstances( transparent );
 }
 
 void MapDrawerGL::DrawGibs(
@@ -2102,10 +2520,8 @@ void MapDrawerGL::DrawGibs(
 
 	glActiveTexture( GL_TEXTURE0 + 0 );
 	glBindTexture( GL_TEXTURE_2D_ARRAY, gibs_textures_array_id_ );
-	active_lightmap_->Bind(1);
 	models_shader_.Uniform( "tex", int(0) );
 
-	active_lightmap_->Bind(1);
 	models_shader_.Uniform( "lightmap", int(1) );
 
 	gibs_animations_.Bind( 2 );
@@ -2125,7 +2541,6 @@ void MapDrawerGL::DrawGibs(
 
 		const unsigned int frame= 0u;
 
-		const unsigned int first_index= transparent ? model_geometry.first_transparent_index : model_geometry.first_index;
 		const unsigned int first_animation_vertex=
 			model_geometry.first_animations_vertex +
 			frame * model_geometry.animations_vertex_count;
@@ -2151,18 +2566,13 @@ void MapDrawerGL::DrawGibs(
 		if( BBoxIsOutsideView( view_clip_planes, bbox, model_mat ) )
 			continue;
 
-		models_shader_.Uniform( "view_matrix", model_mat * view_matrix );
-		models_shader_.Uniform( "lightmap_matrix", lightmap_mat );
-		models_shader_.Uniform( "rotation_matrix", rotate_mat );
-		models_shader_.Uniform( "first_animation_vertex_number", int(first_animation_vertex) );
-
-		glDrawElementsBaseVertex(
-			GL_TRIANGLES,
-			index_count,
-			GL_UNSIGNED_SHORT,
-			reinterpret_cast<void*>( first_index * sizeof(unsigned short) ),
-			model_geometry.first_vertex_index );
+		AddModelInstance(
+			model_geometry, nullptr, *active_lightmap_,
+			model_mat * view_matrix, rotate_mat, lightmap_mat,
+			first_animation_vertex );
 	}
+
+	FlushModelsInstances( transparent );
 }
 
 void MapDrawerGL::DrawBMPObjectsSprites(
@@ -2221,6 +2631,8 @@ void MapDrawerGL::DrawBMPObjectsSprites(
 		sprites_shader_.Uniform( "lightmap_coord", pos.xy() / float(MapData::c_map_size) );
 
 		glDrawArrays( GL_TRIANGLES, 0, 6 );
+		passes_profiler_.AddDrawCalls();
+		passes_profiler_.AddStateChanges( 2u ); // Textures.
 	}
 }
 
@@ -2271,6 +2683,8 @@ void MapDrawerGL::DrawEffectsSprites(
 		sprites_shader_.Uniform( "lightmap_coord", sprite.pos.xy() / float(MapData::c_map_size) );
 
 		glDrawArrays( GL_TRIANGLES, 0, 6 );
+		passes_profiler_.AddDrawCalls();
+		passes_profiler_.AddStateChanges( 2u ); // Textures.
 	}
 }
 
@@ -2284,6 +2698,7 @@ void MapDrawerGL::DrawSky( const m_Mat4& view_rotation_matrix )
 	sky_shader_.Uniform( "view_matrix", view_rotation_matrix );
 
 	sky_geometry_data_.Draw();
+	passes_profiler_.AddDrawCalls();
 }
 
 
@@ -2344,6 +2759,7 @@ void MapDrawerGL::DrawMapModelsShadows(
 			GL_UNSIGNED_SHORT,
 			reinterpret_cast<void*>( first_index * sizeof(unsigned short) ),
 			model_geometry.first_vertex_index );
+		passes_profiler_.AddDrawCalls();
 	}
 }
 
@@ -2403,6 +2819,7 @@ void MapDrawerGL::DrawItemsShadows(
 			GL_UNSIGNED_SHORT,
 			reinterpret_cast<void*>( first_index * sizeof(unsigned short) ),
 			model_geometry.first_vertex_index );
+		passes_profiler_.AddDrawCalls();
 	}
 }
 
@@ -2472,6 +2889,7 @@ void MapDrawerGL::DrawMonstersShadows(
 			GL_UNSIGNED_SHORT,
 			reinterpret_cast<void*>( first_index * sizeof(unsigned short) ),
 			model_geometry.first_vertex_index );
+		passes_profiler_.AddDrawCalls();
 	}
 }
 
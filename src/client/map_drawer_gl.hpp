@@ -1,17 +1,21 @@
 #pragma once
+#include <cstdio>
+#include <string>
 
 #include <framebuffer.hpp>
-#include <glsl_program.hpp>
 #include <polygon_buffer.hpp>
 #include <texture.hpp>
 
 #include "../fwd.hpp"
 #include "../rendering_context.hpp"
+#include "../shader_program.hpp"
 #include "i_map_drawer.hpp"
 #include "fwd.hpp"
 #include "map_state.hpp"
 #include "opengl_renderer/animations_buffer.hpp"
 #include "opengl_renderer/map_light.hpp"
+#include "opengl_renderer/passes_profiler.hpp"
+#include "opengl_renderer/streaming_buffer.hpp"
 
 namespace PanzerChasm
 {
@@ -50,6 +54,9 @@ public:
 
 	virtual void DoFullscreenPostprocess( const MapState& map_state ) override;
 
+	virtual const char* GetStatus() const override;
+	virtual void PrintStats() const override;
+
 	virtual void DrawMapRelatedModels(
 		const MapRelatedModel* models, unsigned int model_count,
 		const m_Mat4& view_rotation_and_projection_matrix,
@@ -61,6 +68,26 @@ private:
 	{
 		unsigned int first_vertex_number;
 		unsigned int vertex_count;
+		std::vector<unsigned short> cells; // x + y * map_size for each cell quad.
+	};
+
+	struct StaticWallIndices
+	{
+		unsigned int first_index;
+		unsigned int index_count; // Zero for walls without geometry.
+	};
+
+	// Ranges of geometry, visible from PVS cell. Adjacent ranges are merged.
+	struct VisibleGeometry
+	{
+		unsigned int pvs_cell;
+		bool valid= false;
+
+		std::vector<GLsizei> walls_counts;
+		std::vector<const GLvoid*> walls_offsets;
+
+		std::vector<GLint> floors_first[2];
+		std::vector<GLsizei> floors_counts[2];
 	};
 
 	struct ModelGeometry
@@ -87,6 +114,15 @@ private:
 		r_Texture texture;
 	};
 
+	struct ModelInstance;
+	struct ModelsBatchInstance;
+
+	struct ModelsDrawStats
+	{
+		unsigned int instances= 0u; // Draw calls count without instancing.
+		unsigned int draw_calls= 0u;
+	};
+
 private:
 	void LoadSprites( const std::vector<ObjSprite>& sprites, std::vector<GLuint>& out_textures );
 	void PrepareSkyGeometry();
@@ -108,12 +144,33 @@ private:
 	void LoadMonstersModels();
 
 	void UpdateDynamicWalls( const MapState::DynamicWalls& dynamic_walls );
+	void UpdateVisibleGeometry( const m_Vec2& camera_position_xy );
 
 	static void PrepareModelsPolygonBuffer(
 		std::vector<Model::Vertex>& vertices,
 		std::vector<unsigned short>& indeces,
 		r_PolygonBuffer& buffer );
 
+	// Collect model instance for drawing. Instances are drawn in "FlushModelsInstances".
+	// Texture is null for models with textures array, bound by caller.
+	void AddModelInstance(
+		const ModelGeometry& geometry,
+		const r_Texture* texture,
+		const r_Texture& lightmap,
+		const m_Mat4& view_matrix,
+		const m_Mat4& rotation_matrix,
+		const m_Mat3& lightmap_matrix,
+		unsigned int first_animation_vertex,
+		unsigned int enabled_groups_mask= 255u );
+
+	// Draw collected instances, using one instanced draw call for each group of same model instances.
+	// Polygon buffer of models and shader must be bound.
+	void FlushModelsInstances( bool transparent );
+	void SetupModelsInstancesAttribs( unsigned int buffer_offset );
+
+	void PrintPassesStatsToStatus();
+	void WritePassesStatsCSV();
+
 	void DrawWalls( const m_Mat4& view_matrix );
 	void DrawFloors( const m_Mat4& view_matrix );
 
@@ -212,19 +269,23 @@ private:
 	std::vector<GLuint> sprites_textures_arrays_;
 	std::vector<GLuint> bmp_objects_sprites_textures_arrays_;
 
-	r_GLSLProgram floors_shader_;
+	ShaderProgram floors_shader_;
 	r_PolygonBuffer floors_geometry_;
 	// 0 - floor, 1 - ceiling
 	FloorGeometryInfo floors_geometry_info[2];
 
-	r_GLSLProgram walls_shader_;
+	ShaderProgram walls_shader_;
 	r_PolygonBuffer walls_geometry_;
+	std::vector<StaticWallIndices> static_walls_indices_;
+
+	VisibleGeometry visible_geometry_;
 
 	r_PolygonBuffer dynamic_walls_geometry_;
 	std::vector<WallVertex> dynamc_walls_vertices_;
+	MapState::DynamicWalls prev_dynamic_walls_;
 
-	r_GLSLProgram models_shader_;
-	r_GLSLProgram models_shadow_shader_;
+	ShaderProgram models_shader_;
+	ShaderProgram models_shadow_shader_;
 
 	std::vector<ModelGeometry> models_geometry_;
 	r_PolygonBuffer models_geometry_data_;
@@ -246,9 +307,9 @@ private:
 	r_PolygonBuffer weapons_geometry_data_;
 	AnimationsBuffer weapons_animations_;
 
-	r_GLSLProgram sprites_shader_;
+	ShaderProgram sprites_shader_;
 
-	r_GLSLProgram monsters_shader_;
+	ShaderProgram monsters_shader_;
 	std::vector<MonsterModel> monsters_models_;
 	r_PolygonBuffer monsters_geometry_data_;
 	AnimationsBuffer monsters_animations_;
@@ -256,14 +317,29 @@ private:
 	std::vector<r_Texture> player_textures_;
 
 	char current_sky_texture_file_name_[32];
-	r_GLSLProgram sky_shader_;
+	ShaderProgram sky_shader_;
 	r_Texture sky_texture_;
 	r_PolygonBuffer sky_geometry_data_;
 
-	r_GLSLProgram fullscreen_blend_shader_;
+	ShaderProgram fullscreen_blend_shader_;
 
 	MapLight map_light_;
 
+	// Per-frame buffer with models instances data.
+	const bool models_instancing_;
+	StreamingBuffer models_instances_buffer_;
+	std::vector<ModelsBatchInstance> models_batch_instances_;
+	std::vector<ModelInstance> models_instances_upload_;
+
+	ModelsDrawStats models_draw_stats_;
+	ModelsDrawStats last_frame_models_draw_stats_;
+	PassesProfiler passes_profiler_;
+	std::FILE* passes_stats_csv_file_= nullptr;
+	std::string passes_stats_csv_file_name_;
+	unsigned int passes_stats_frame_= 0u;
+
+	char status_[1024];
+
 	// Reuse vector (do not create new vector each frame).
 	std::vector<const MapState::SpriteEffect*> sorted_sprites_;
 };
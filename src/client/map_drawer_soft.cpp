@@ -1,9 +1,14 @@
+#include <algorithm>
+#include <cmath>
 #include <cstring>
+#include <limits>
+#include <thread>
 
 #include "../assert.hpp"
 #include "../game_constants.hpp"
 #include "../log.hpp"
 #include "../map_loader.hpp"
+#include "../map_pvs.hpp"
 #include "../math_utils.hpp"
 #include "../settings.hpp"
 #include "../shared_settings_keys.hpp"
@@ -11,6 +16,7 @@
 #include "software_renderer/map_bsp_tree.hpp"
 #include "software_renderer/map_bsp_tree.inl"
 #include "software_renderer/rasterizer.inl"
+#include "software_renderer/vertices_transform.hpp"
 
 #include "map_drawer_soft.hpp"
 
@@ -104,6 +110,157 @@ static void MakeBinaryAlpha( uint32_t* const pixels, const unsigned int pixel_co
 	}
 }
 
+// Builds mips for texture (or for set of same-sized textures), placed in "data" at "texture_offset".
+// Mips are appended to end of "data". Returns mip count, including mip 0.
+static unsigned int BuildTextureMips(
+	std::vector<uint32_t>& data,
+	const unsigned int texture_offset,
+	const unsigned int size_x, const unsigned int size_y, const unsigned int layer_count,
+	const bool alpha,
+	const unsigned int max_mips,
+	unsigned int* const out_mips_offsets )
+{
+	unsigned int mip_count= 1u;
+	while( mip_count < max_mips && ( size_x >> mip_count ) > 0u && ( size_y >> mip_count ) > 0u )
+		mip_count++;
+
+	out_mips_offsets[0]= texture_offset;
+	unsigned int data_size= texture_offset + size_x * size_y * layer_count;
+	for( unsigned int mip= 1u; mip < mip_count; mip++ )
+	{
+		out_mips_offsets[mip]= data_size;
+		data_size+= ( size_x >> mip ) * ( size_y >> mip ) * layer_count;
+	}
+	data.resize( data_size );
+
+	for( unsigned int mip= 1u; mip < mip_count; mip++ )
+	{
+		const unsigned int src_size_x= size_x >> ( mip - 1u ), src_size_y= size_y >> ( mip - 1u );
+		const unsigned int dst_size_x= size_x >> mip, dst_size_y= size_y >> mip;
+		for( unsigned int layer= 0u; layer < layer_count; layer++ )
+		{
+			const uint32_t* const src= data.data() + out_mips_offsets[ mip - 1u ] + src_size_x * src_size_y * layer;
+			uint32_t* const dst= data.data() + out_mips_offsets[ mip ] + dst_size_x * dst_size_y * layer;
+			if( alpha )
+			{
+				BuildMipAlphaCorrected( src, src_size_x, src_size_y, dst );
+				MakeBinaryAlpha( dst, dst_size_x * dst_size_y );
+			}
+			else
+				BuildMip( src, src_size_x, src_size_y, dst );
+		}
+	}
+
+	return mip_count;
+}
+
+static unsigned int TexelsPerPixelToMip( const float texels_per_pixel )
+{
+	if( texels_per_pixel < 1.0f )
+		return 0u;
+	if( texels_per_pixel < 2.0f )
+		return 1u;
+	if( texels_per_pixel < 4.0f )
+		return 2u;
+	return 3u;
+}
+
+// Select mip for projected polygon, using d_tc / d_length of longest polygon edge.
+// Texture coordinates are scaled for result mip.
+static unsigned int SelectPolygonMip( RasterizerVertex* const vertices, const unsigned int vertex_count, const unsigned int mip_count )
+{
+	// Search longest edge for mip calculation.
+	unsigned int longest_edge_index= 0u;
+	fixed8_t longest_edge_squre_length= 1; // fixed8_t range should be enought for vector ( 2048, 2048 ) square length.
+	for( unsigned int i= 0u; i < vertex_count; i++ )
+	{
+		unsigned int prev_i= i == 0u ? (vertex_count - 1u) : (i - 1u);
+		const fixed16_t dx= vertices[i].x - vertices[prev_i].x;
+		const fixed16_t dy= vertices[i].y - vertices[prev_i].y;
+		const fixed8_t square_length= FixedMul<16+8>( dx, dx ) + FixedMul<16+8>( dy, dy );
+		if( square_length > longest_edge_squre_length )
+		{
+			longest_edge_squre_length= square_length;
+			longest_edge_index= i;
+		}
+	}
+
+	const unsigned int prev_v= longest_edge_index == 0u ? (vertex_count - 1u) : (longest_edge_index - 1u);
+	const fixed16_t du= vertices[longest_edge_index].u - vertices[prev_v].u;
+	const fixed16_t dv= vertices[longest_edge_index].v - vertices[prev_v].v;
+	const fixed8_t square_tc_delta= FixedMul<16+8>( du, du ) + FixedMul<16+8>( dv, dv );
+	const int d_tc_d_len_square = square_tc_delta / longest_edge_squre_length;
+
+	unsigned int mip;
+	if( d_tc_d_len_square < 1 * 1 )
+		mip= 0u;
+	else if( d_tc_d_len_square < 2 * 2 )
+		mip= 1u;
+	else if( d_tc_d_len_square < 4 * 4 )
+		mip= 2u;
+	else
+		mip= 3u;
+
+	mip= std::min( mip, mip_count - 1u );
+	if( mip > 0u )
+	{
+		for( unsigned int i= 0u; i < vertex_count; i++ )
+		{
+			vertices[i].u >>= mip;
+			vertices[i].v >>= mip;
+		}
+	}
+
+	return mip;
+}
+
+// Inverse 3x3 matrix, which maps some coordinates to clip space ( x, y, w ), and combine it with screen to clip space transformation.
+// Result maps screen point ( x, y, 1 ) to source coordinates. Returns false, if matrix is degenerated.
+static bool BuildScreenInverseTransform(
+	const float* const to_clip,
+	const float screen_transform_x, const float screen_transform_y,
+	float* const out_screen_to )
+{
+	const float cofactors[9]=
+	{
+		to_clip[4] * to_clip[8] - to_clip[5] * to_clip[7],
+		to_clip[2] * to_clip[7] - to_clip[1] * to_clip[8],
+		to_clip[1] * to_clip[5] - to_clip[2] * to_clip[4],
+		to_clip[5] * to_clip[6] - to_clip[3] * to_clip[8],
+		to_clip[0] * to_clip[8] - to_clip[2] * to_clip[6],
+		to_clip[2] * to_clip[3] - to_clip[0] * to_clip[5],
+		to_clip[3] * to_clip[7] - to_clip[4] * to_clip[6],
+		to_clip[1] * to_clip[6] - to_clip[0] * to_clip[7],
+		to_clip[0] * to_clip[4] - to_clip[1] * to_clip[3],
+	};
+	const float det= to_clip[0] * cofactors[0] + to_clip[1] * cofactors[3] + to_clip[2] * cofactors[6];
+	if( std::abs( det ) < 1.0e-12f )
+		return false;
+
+	// Screen to clip space: x_clip= x / screen_transform_x - 1.
+	for( unsigned int row= 0u; row < 3u; row++ )
+	{
+		const float* const src= cofactors + row * 3u;
+		float* const dst= out_screen_to + row * 3u;
+		dst[0]= src[0] / ( det * screen_transform_x );
+		dst[1]= src[1] / ( det * screen_transform_y );
+		dst[2]= ( src[2] - src[0] - src[1] ) / det;
+	}
+	return true;
+}
+
+const char* const MapDrawerSoft::StagesTimes::c_stage_names[ StageCount ]=
+{
+	"surfaces",
+	"walls",
+	"floors",
+	"sky",
+	"hierarchy",
+	"models",
+	"shadows",
+	"sprites",
+};
+
 static fixed16_t ScaleLightmapLight( const unsigned char lightmap_value )
 {
 	// Overbright constant must be equal to same constant in shader. See shaders/constants.glsl.
@@ -113,6 +270,53 @@ static fixed16_t ScaleLightmapLight( const unsigned char lightmap_value )
 	return lightmap_value * scale;
 }
 
+// Returns nearest opaque palette color.
+static unsigned char FindNearestPaletteColor( const Palette& palette, const int r, const int g, const int b )
+{
+	unsigned char result= 0u;
+	int min_square_distance= std::numeric_limits<int>::max();
+
+	// Last color is transparent.
+	for( unsigned int i= 0u; i < 255u; i++ )
+	{
+		const int dr= int(palette[ i * 3u + 0u ]) - r;
+		const int dg= int(palette[ i * 3u + 1u ]) - g;
+		const int db= int(palette[ i * 3u + 2u ]) - b;
+		const int square_distance= dr * dr + dg * dg + db * db;
+		if( square_distance < min_square_distance )
+		{
+			min_square_distance= square_distance;
+			result= static_cast<unsigned char>(i);
+		}
+	}
+
+	return result;
+}
+
+// Zero or negative value means "use all hardware threads".
+static unsigned int GetThreadCount( Settings& settings, const char* const key, const int default_value )
+{
+	const int thread_count= settings.GetOrSetInt( key, default_value );
+	if( thread_count <= 0 )
+		return std::max( 1u, std::thread::hardware_concurrency() );
+
+	return static_cast<unsigned int>( thread_count );
+}
+
+static unsigned int GetRasterizerThreadCount( Settings& settings )
+{
+	return GetThreadCount( settings, SettingsKeys::software_threads, 1 );
+}
+
+static unsigned int GetTasksPoolThreadCount( Settings& settings )
+{
+	// Pool is shared, so, it needs threads for both rasterizer and surfaces generation.
+	return
+		std::max(
+			GetRasterizerThreadCount( settings ),
+			GetThreadCount( settings, SettingsKeys::software_surfaces_threads, 0 ) );
+}
+
 MapDrawerSoft::MapDrawerSoft(
 	Settings& settings,
 	const GameResourcesConstPtr& game_resources,
@@ -122,13 +326,36 @@ MapDrawerSoft::MapDrawerSoft(
 	, rendering_context_( rendering_context )
 	, screen_transform_x_( 0.5f * float( rendering_context_.viewport_size.Width () ) )
 	, screen_transform_y_( 0.5f * float( rendering_context_.viewport_size.Height() ) )
+	, indexed_surfaces_( settings.GetOrSetBool( SettingsKeys::software_indexed_surfaces, false ) )
+	, tasks_pool_( GetTasksPoolThreadCount( settings ) )
 	, rasterizer_(
 		rendering_context.viewport_size.Width(), rendering_context.viewport_size.Height(),
-		rendering_context.row_pixels, rendering_context.window_surface_data )
-	, surfaces_cache_( rendering_context_.viewport_size )
+		rendering_context.row_pixels, rendering_context.window_surface_data,
+		tasks_pool_, GetRasterizerThreadCount( settings ) )
+	, surfaces_cache_( rendering_context_.viewport_size, indexed_surfaces_ ? 1u : 4u )
 {
 	PC_ASSERT( game_resources_ != nullptr );
 
+	scaled_viewport_size_[0]= rendering_context_.viewport_size.Width ();
+	scaled_viewport_size_[1]= rendering_context_.viewport_size.Height();
+	status_[0]= '\0';
+
+	// Surfaces may be used by recorded rasterizer commands. Execute these commands before surfaces recycling.
+	if( rasterizer_.IsMultithreaded() )
+		surfaces_cache_.SetBeforeRecycleFunction( [this]{ rasterizer_.Flush(); } );
+
+	{ // SIMD level for span drawing: 0 - none, 1 - SSE2, 2 - AVX2. Actual level is limited by CPU.
+		const int simd_level= std::max( 0, settings_.GetOrSetInt( SettingsKeys::software_simd, 2 ) );
+		rasterizer_.SetSIMDLevel( static_cast<Rasterizer::SIMDLevel>( std::min( simd_level, 2 ) ) );
+		Log::Info( "Software rasterizer SIMD: ", Rasterizer::GetSIMDLevelName( rasterizer_.GetSIMDLevel() ) );
+	}
+
+	if( indexed_surfaces_ )
+	{
+		BuildIndexedSurfacesTables();
+		Log::Info( "Using indexed surfaces" );
+	}
+
 	sky_texture_.file_name[0]= '\0';
 
 	LoadModelsGroup( game_resources_->items_models, items_models_ );
@@ -155,6 +382,12 @@ MapDrawerSoft::MapDrawerSoft(
 		out_sprite_texture.data.resize( pixel_count );
 		for( unsigned int j= 0u; j < pixel_count; j++ )
 			out_sprite_texture.data[j]= palette[in_sprite.data[j]];
+
+		out_sprite_texture.mip_count=
+			BuildTextureMips(
+				out_sprite_texture.data, 0u,
+				in_sprite.size[0], in_sprite.size[1], in_sprite.frame_count,
+				true, c_textures_max_mips, out_sprite_texture.mips_offsets );
 	}
 
 	bmp_objects_sprites_.resize( game_resources_->bmp_objects_sprites.size() );
@@ -171,6 +404,12 @@ MapDrawerSoft::MapDrawerSoft(
 		out_sprite_texture.data.resize( pixel_count );
 		for( unsigned int j= 0u; j < pixel_count; j++ )
 			out_sprite_texture.data[j]= palette[in_sprite.data[j]];
+
+		out_sprite_texture.mip_count=
+			BuildTextureMips(
+				out_sprite_texture.data, 0u,
+				in_sprite.size[0], in_sprite.size[1], in_sprite.frame_count,
+				true, c_textures_max_mips, out_sprite_texture.mips_offsets );
 	}
 }
 
@@ -186,13 +425,29 @@ void MapDrawerSoft::SetMap( const MapDataConstPtr& map_data )
 	if( map_data == nullptr )
 		return; // TODO - if map is null - clear resources, etc.
 
-	surfaces_cache_.Clear();
+	// Map models are changed, so, pointers to them are not valid now.
+	models_vertices_cache_.clear();
+
+	if( settings_.GetOrSetBool( SettingsKeys::software_surfaces_cache_adaptive, false ) )
+		surfaces_cache_.AdaptStorageSize();
+	else
+		surfaces_cache_.Clear();
+	prev_view_yaw_valid_= false;
+
+	{
+		MapBSPTree::BuildOptions options;
+		options.use_cache= settings_.GetOrSetBool( SettingsKeys::software_bsp_cache, true );
+		options.max_splitter_candidates=
+			static_cast<unsigned int>( std::max( 0, settings_.GetOrSetInt( SettingsKeys::software_bsp_max_splitter_candidates, 0 ) ) );
 
-	map_bsp_tree_.reset( new MapBSPTree( map_data ) );
+		map_bsp_tree_.reset( new MapBSPTree( map_data, options ) );
+	}
 
 	LoadModelsGroup( map_data->models, map_models_ );
 	LoadWallsTextures( *map_data );
 	LoadFloorsTextures( *map_data );
+	textures_conversion_buffer_.clear();
+	textures_conversion_buffer_.shrink_to_fit();
 	LoadWalls( *map_data );
 	LoadFloorsAndCeilings( *map_data );
 
@@ -218,6 +473,11 @@ void MapDrawerSoft::SetMap( const MapDataConstPtr& map_data )
 
 		sky_texture_.size[0]= cel_header.size[0];
 		sky_texture_.size[1]= cel_header.size[1];
+		sky_texture_.mip_count=
+			BuildTextureMips(
+				sky_texture_.data, 0u,
+				sky_texture_.size[0], sky_texture_.size[1], 1u,
+				false, c_textures_max_mips, sky_texture_.mips_offsets );
 	}
 }
 
@@ -233,176 +493,46 @@ void MapDrawerSoft::Draw(
 	if( current_map_data_ == nullptr )
 		return;
 
+	UpdateDynamicResolution();
+	UpdateSurfacesCacheStats();
+
 	rasterizer_.ClearDepthBuffer();
 	rasterizer_.ClearOcclusionBuffer();
 
+	pvs_cell_=
+		settings_.GetOrSetBool( SettingsKeys::pvs, true )
+			? MapPVS::GetCellIndex( camera_position.xy() )
+			: MapPVS::c_invalid_cell;
+
 	m_Mat4 cam_shift_mat, cam_mat, screen_flip_mat;
 	cam_shift_mat.Translate( -camera_position );
 	screen_flip_mat.Scale( m_Vec3( 1.0f, -1.0f, 1.0f ) );
 	cam_mat= cam_shift_mat * view_rotation_and_projection_matrix * screen_flip_mat;
 
+	if( profiling_enabled_ )
+		profiling_stage_start_time_= std::chrono::steady_clock::now();
+
+	PrepareSurfaces( view_rotation_and_projection_matrix, camera_position, view_clip_planes );
+	EndProfilingStage( StagesTimes::Surfaces );
+
 	// Draw objects front to back with occlusion test.
 	// Occlusion test uses walls, floors/ceilings, sky.
 	DrawWalls( map_state, cam_mat, camera_position.xy(), view_clip_planes );
-	DrawFloorsAndCeilings( cam_mat, view_clip_planes );
+	EndProfilingStage( StagesTimes::Walls );
+	DrawFloorsAndCeilings( cam_mat, camera_position.xy(), view_clip_planes );
+	EndProfilingStage( StagesTimes::Floors );
 	DrawSky( cam_mat, camera_position, view_clip_planes );
+	EndProfilingStage( StagesTimes::Sky );
 
 	rasterizer_.BuildDepthBufferHierarchy();
+	EndProfilingStage( StagesTimes::Hierarchy );
 
-	// Draw regular polygons of models, than transparent
-	for( unsigned int t= 0u; t < 2u; t++ )
-	{
-		const bool transparent= t == 1u;
-
-		for( const MapState::StaticModel& static_model : map_state.GetStaticModels() )
-		{
-			if( static_model.model_id >= current_map_data_->models_description.size() ||
-				!static_model.visible )
-				continue;
-
-			m_Mat4 rotate_mat;
-			rotate_mat.RotateZ( static_model.angle );
-
-			DrawModel(
-				map_models_, current_map_data_->models, static_model.model_id,
-				static_model.animation_frame,
-				view_clip_planes,
-				static_model.pos, rotate_mat,
-				cam_mat, camera_position,
-				255u,
-				transparent, false );
-		}
-
-		for( const MapState::Item& item : map_state.GetItems() )
-		{
-			if( item.item_id >= game_resources_->items_models.size() ||
-				item.picked_up )
-				continue;
-
-			m_Mat4 rotate_mat;
-			rotate_mat.RotateZ( item.angle );
-
-			DrawModel(
-				items_models_, game_resources_->items_models, item.item_id,
-				item.animation_frame,
-				view_clip_planes,
-				item.pos, rotate_mat,
-				cam_mat, camera_position,
-				255u,
-				transparent, false );
-		}
-
-		for( const MapState::DynamicItemsContainer::value_type& dynamic_item_value : map_state.GetDynamicItems() )
-		{
-			const MapState::DynamicItem& item= dynamic_item_value.second;
-			if( item.item_type_id >= game_resources_->items_models.size() )
-				continue;
-
-			m_Mat4 rotate_mat;
-			rotate_mat.RotateZ( item.angle );
-
-			DrawModel(
-				items_models_, game_resources_->items_models, item.item_type_id,
-				item.frame,
-				view_clip_planes,
-				item.pos, rotate_mat,
-				cam_mat, camera_position,
-				255u,
-				transparent, false,
-				item.fullbright );
-		}
-
-		for( const MapState::RocketsContainer::value_type& rocket_value : map_state.GetRockets() )
-		{
-			const MapState::Rocket& rocket= rocket_value.second;
-			if( rocket.rocket_id >= game_resources_->rockets_models.size() )
-				continue;
-
-			m_Mat4 rotate_max_x, rotate_mat_z;
-			rotate_max_x.RotateX( rocket.angle[1] );
-			rotate_mat_z.RotateZ( rocket.angle[0] - Constants::half_pi );
-
-			DrawModel(
-				rockets_models_, game_resources_->rockets_models, rocket.rocket_id,
-				rocket.frame,
-				view_clip_planes,
-				rocket.pos, rotate_max_x * rotate_mat_z,
-				cam_mat, camera_position,
-				255u,
-				transparent, false,
-				game_resources_->rockets_description[ rocket.rocket_id ].fullbright );
-		}
-
-		for( const MapState::Gib& gib : map_state.GetGibs() )
-		{
-			if( gib.gib_id >= gibs_models_.models.size() )
-				continue;
-
-			m_Mat4 rotate_max_x, rotate_mat_z;
-			rotate_max_x.RotateX( gib.angle_x );
-			rotate_mat_z.RotateZ( gib.angle_z );
-
-			DrawModel(
-				gibs_models_, game_resources_->gibs_models, gib.gib_id,
-				0u,
-				view_clip_planes,
-				gib.pos, rotate_max_x * rotate_mat_z,
-				cam_mat, camera_position,
-				255u, transparent );
-		}
-
-		for( const MapState::MonstersContainer::value_type& monster_value : map_state.GetMonsters() )
-		{
-			const MapState::Monster& monster= monster_value.second;
-			if( monster.monster_id >= game_resources_->monsters_models.size() )
-				continue;
-
-			if( monster_value.first == player_monster_id )
-				continue;
-
-			const unsigned int frame=
-				game_resources_->monsters_models[ monster.monster_id ].animations[ monster.animation ].first_frame +
-				monster.animation_frame;
-
-			m_Mat4 rotate_mat;
-			rotate_mat.RotateZ( monster.angle + Constants::half_pi );
-
-			DrawModel(
-				monsters_models_, game_resources_->monsters_models, monster.monster_id,
-				frame,
-				view_clip_planes,
-				monster.pos, rotate_mat,
-				cam_mat, camera_position,
-				monster.body_parts_mask,
-				transparent, monster.is_invisible,
-				false, ~0u, monster.color );
-		}
-
-		for( const MapState::MonsterBodyPart& part : map_state.GetMonstersBodyParts() )
-		{
-			if( part.monster_type >= game_resources_->monsters_models.size() )
-				continue;
-
-			PC_ASSERT( part.body_part_id <= game_resources_->monsters_models[ part.monster_type ].submodels.size() );
-
-			const Submodel& submodel= game_resources_->monsters_models[ part.monster_type ].submodels[ part.body_part_id ];
-			const unsigned int frame= submodel.animations[ part.animation ].first_frame + part.animation_frame;
+	// Draw regular polygons of models, than transparent.
+	CollectModelsDrawList( map_state, cam_mat, player_monster_id );
+	DrawModelsList( view_clip_planes, cam_mat, camera_position, false );
+	DrawModelsList( view_clip_planes, cam_mat, camera_position, true );
 
-			m_Mat4 rotate_mat;
-			rotate_mat.RotateZ( part.angle + Constants::half_pi );
-
-			DrawModel(
-				monsters_models_, game_resources_->monsters_models, part.monster_type,
-				frame,
-				view_clip_planes,
-				part.pos, rotate_mat,
-				cam_mat, camera_position,
-				255u,
-				transparent, false,
-				false,
-				part.body_part_id );
-		}
-	}
+	EndProfilingStage( StagesTimes::Models );
 
 	// Shadows.
 	if( settings_.GetOrSetBool( SettingsKeys::shadows, true ) )
@@ -488,7 +618,11 @@ void MapDrawerSoft::Draw(
 				cam_mat, camera_position, light_pos,
 				monster.body_parts_mask );
 		}
+
+		// Darken all shadowed pixels at once.
+		rasterizer_.ApplyShadowMask();
 	} // if shadows
+	EndProfilingStage( StagesTimes::Shadows );
 
 	// Transparent objects.
 
@@ -499,6 +633,9 @@ void MapDrawerSoft::Draw(
 		rasterizer_.DebugDrawDepthHierarchy( static_cast<unsigned int>(map_state.GetSpritesFrame()) / 16u );
 	if( settings_.GetOrSetBool( "r_debug_draw_occlusion_buffer", false ) )
 		rasterizer_.DebugDrawOcclusionBuffer( static_cast<unsigned int>(map_state.GetSpritesFrame()) / 32u );
+
+	rasterizer_.Flush();
+	EndProfilingStage( StagesTimes::Sprites );
 }
 
 void MapDrawerSoft::DrawWeapon(
@@ -637,9 +774,11 @@ void MapDrawerSoft::DrawWeapon(
 		{
 			traingle_vertices[1]= verties_projected[ i + 1u ];
 			traingle_vertices[2]= verties_projected[ i + 2u ];
-			(rasterizer_.*triangle_func)( traingle_vertices );
+			rasterizer_.DrawTriangle( triangle_func, traingle_vertices );
 		}
 	} // for model triangles
+
+	rasterizer_.Flush();
 }
 
 void MapDrawerSoft::DrawActiveItemIcon(
@@ -742,11 +881,13 @@ void MapDrawerSoft::DrawActiveItemIcon(
 
 			const bool triangle_needs_alpha_test= model.vertices[ indeces[t] ].alpha_test_mask != 0u;
 			if( triangle_needs_alpha_test )
-				(rasterizer_.*alpha_draw_func)( verties_projected );
+				rasterizer_.DrawTriangle( alpha_draw_func, verties_projected );
 			else
-				(rasterizer_.*draw_func)( verties_projected );
+				rasterizer_.DrawTriangle( draw_func, verties_projected );
 		} // for model triangles
 	} // for transparent and nontransparent
+
+	rasterizer_.Flush();
 }
 
 void MapDrawerSoft::DoFullscreenPostprocess( const MapState& map_state )
@@ -755,10 +896,11 @@ void MapDrawerSoft::DoFullscreenPostprocess( const MapState& map_state )
 	m_Vec3 blend_color;
 	float blend_alpha;
 	map_state.GetFullscreenBlend( blend_color, blend_alpha );
+
+	unsigned char blend_color_i[3]= { 0u, 0u, 0u };
+	unsigned char blend_alpha_i= 0u;
 	if( blend_alpha > 0.001f )
 	{
-		unsigned char blend_color_i[3];
-		unsigned char blend_alpha_i;
 		for( unsigned int j= 0u; j < 3u; j++ )
 		{
 			int c= static_cast<int>( std::round( 255.0f * blend_color.ToArr()[j] ) );
@@ -768,8 +910,55 @@ void MapDrawerSoft::DoFullscreenPostprocess( const MapState& map_state )
 		}
 
 		blend_alpha_i= std::max( 0, std::min( 255, static_cast<int>( std::round( blend_alpha * 255.0f ) ) ) );
+	}
+
+	if( rendering_context_.frame_postprocess != nullptr )
+	{
+		// Blend is done by window, together with final copy of frame.
+		std::memcpy( rendering_context_.frame_postprocess->blend_color, blend_color_i, 3u );
+		rendering_context_.frame_postprocess->blend_alpha= blend_alpha_i;
+		blend_alpha_i= 0u;
+	}
+	else if( blend_alpha_i > 0u && !scaled_viewport_active_ )
+	{
+		// With reduced resolution blend is done together with upscale.
+		BindFullViewport();
 		rasterizer_.DrawFullscreenBlend( blend_color_i, blend_alpha_i );
 	}
+
+	rasterizer_.Flush();
+
+	if( frame_started_ )
+	{
+		frame_started_= false;
+		const float frame_time_ms=
+			std::chrono::duration<float, std::milli>( std::chrono::steady_clock::now() - frame_start_time_ ).count();
+		average_frame_time_ms_=
+			average_frame_time_ms_ > 0.0f
+				? ( average_frame_time_ms_ * 0.75f + frame_time_ms * 0.25f )
+				: frame_time_ms;
+	}
+
+	EndScaledViewport( blend_color_i, blend_alpha_i );
+}
+
+const char* MapDrawerSoft::GetStatus() const
+{
+	return status_[0] == '\0' ? nullptr : status_;
+}
+
+void MapDrawerSoft::PrintStats() const
+{
+	const SurfacesCache::Stats& stats= surfaces_cache_.GetLastFrameStats();
+	const unsigned int requests= stats.hits + stats.misses;
+
+	Log::Info( "Surfaces cache size: ", ( surfaces_cache_.GetStorageSize() + 1023u ) / 1024u, "kb" );
+	Log::Info( "Last frame: hits ", stats.hits, ", misses ", stats.misses,
+		" (", requests == 0u ? 100u : stats.hits * 100u / requests, "% hits)" );
+	Log::Info( "Last frame: evictions ", stats.evictions, ", evictions of surfaces used in frame ", stats.evictions_in_frame );
+	Log::Info( "Last frame: generated ", ( stats.bytes_generated + 1023u ) / 1024u, "kb" );
+	Log::Info( "Working set: ", ( stats.working_set_bytes + 1023u ) / 1024u, "kb, peak for this map: ",
+		( surfaces_cache_.GetPeakWorkingSet() + 1023u ) / 1024u, "kb" );
 }
 
 void MapDrawerSoft::DrawMapRelatedModels(
@@ -781,6 +970,8 @@ void MapDrawerSoft::DrawMapRelatedModels(
 	if( current_map_data_ == nullptr )
 		return;
 
+	EndScaledViewport();
+	BindFullViewport();
 	rasterizer_.ClearDepthBuffer();
 
 	m_Mat4 cam_shift_mat, cam_mat, screen_flip_mat;
@@ -810,62 +1001,280 @@ void MapDrawerSoft::DrawMapRelatedModels(
 				255u, transparent );
 		} // for models
 	}
+
+	rasterizer_.Flush();
 }
 
-void MapDrawerSoft::LoadModelsGroup( const std::vector<Model>& models, ModelsGroup& out_group )
+void MapDrawerSoft::UpdateSurfacesCacheStats()
 {
-	const PaletteTransformed& palette= *rendering_context_.palette_transformed;
+	surfaces_cache_.BeginFrame();
 
-	unsigned int texel_count= 0u;
-	for( const Model& model : models )
-		texel_count+= model.texture_data.size();
+	if( !settings_.GetOrSetBool( SettingsKeys::software_surfaces_cache_stats, false ) )
+		return;
 
-	out_group.textures_data.resize( texel_count );
-	out_group.models.resize( models.size() );
+	const SurfacesCache::Stats& stats= surfaces_cache_.GetLastFrameStats();
 
-	unsigned int texture_data_offset= 0u;
-	for( unsigned int m= 0u; m < out_group.models.size(); m++ )
-	{
-		const Model& in_model= models[m];
-		ModelsGroup::ModelEntry& model_entry= out_group.models[m];
+	const size_t len= std::strlen( status_ );
+	std::snprintf(
+		status_ + len, sizeof(status_) - len,
+		"%scache: %u/%u/%u %ukb/%ukb",
+		len == 0u ? "" : "\n",
+		stats.hits, stats.misses, stats.evictions_in_frame,
+		( stats.working_set_bytes + 1023u ) / 1024u,
+		( surfaces_cache_.GetStorageSize() + 1023u ) / 1024u );
+}
 
-		model_entry.texture_size[0]= in_model.texture_size[0];
-		model_entry.texture_size[1]= in_model.texture_size[1];
-		model_entry.texture_data_offset= texture_data_offset;
+void MapDrawerSoft::UpdateDynamicResolution()
+{
+	const float c_min_resolution_scale= 0.5f;
 
-		for( unsigned int t= 0u; t < in_model.texture_data.size(); t++ )
+	const unsigned int full_width = rendering_context_.viewport_size.Width ();
+	const unsigned int full_height= rendering_context_.viewport_size.Height();
+
+	const int target_frame_time_ms= settings_.GetOrSetInt( SettingsKeys::software_target_frame_time, 0 );
+	if( target_frame_time_ms <= 0 )
+	{
+		resolution_scale_= 1.0f;
+		status_[0]= '\0';
+	}
+	else
+	{
+		if( average_frame_time_ms_ > 0.0f )
 		{
-			const unsigned char color_index= in_model.texture_data[t];
-			uint32_t color= palette[ color_index ];
-			if( color_index == 0u ) color&= ~Rasterizer::c_alpha_mask; // For models color #0 is transparent.
-			out_group.textures_data[ texture_data_offset + t ]= color;
+			// Frame time is almost proportional to pixel count, so, use square root.
+			// Change scale slowly and do not change it near target, for prevention of oscillations.
+			const float ratio= float(target_frame_time_ms) / average_frame_time_ms_;
+			if( ratio < 0.95f || ratio > 1.1f )
+				resolution_scale_*= std::max( 0.9f, std::min( std::sqrt( ratio ), 1.05f ) );
+			resolution_scale_= std::max( c_min_resolution_scale, std::min( resolution_scale_, 1.0f ) );
 		}
 
-		texture_data_offset+= in_model.texture_data.size();
+		std::snprintf(
+			status_, sizeof(status_),
+			"soft scale: %3d%% (%02.1f/%d ms)",
+			static_cast<int>( std::round( resolution_scale_ * 100.0f ) ),
+			average_frame_time_ms_, target_frame_time_ms );
 	}
-}
 
-void MapDrawerSoft::LoadWallsTextures( const MapData& map_data )
-{
-	const PaletteTransformed& palette= *rendering_context_.palette_transformed;
+	unsigned int width = std::min( full_width , std::max( 16u, static_cast<unsigned int>( float(full_width ) * resolution_scale_ ) & ~1u ) );
+	unsigned int height= std::min( full_height, std::max( 16u, static_cast<unsigned int>( float(full_height) * resolution_scale_ ) ) );
+	if( resolution_scale_ >= 1.0f )
+	{
+		width = full_width ;
+		height= full_height;
+	}
 
-	std::vector<unsigned char> file_content;
+	if( width != full_width || height != full_height )
+	{
+		if( scaled_color_buffer_.empty() )
+			scaled_color_buffer_.resize( full_width * full_height );
 
-	for( unsigned int i= 0u; i < MapData::c_max_walls_textures; i++ )
+		// Scaled viewport stays bound between frames, switch it only if resolution is changed.
+		if( !scaled_viewport_bound_ || width != scaled_viewport_size_[0] || height != scaled_viewport_size_[1] )
+			rasterizer_.SetViewport( width, height, full_width, scaled_color_buffer_.data() );
+
+		scaled_viewport_bound_= true;
+		scaled_viewport_active_= true;
+	}
+	else
 	{
-		WallTexture& out_texture= wall_textures_[i];
-		out_texture.size[0]= out_texture.size[1]= 0u;
+		EndScaledViewport();
+		BindFullViewport();
+	}
 
-		const char* const texture_file_path= map_data.walls_textures[i].file_path;
-		if( texture_file_path[0] == '\n' )
-			continue;
+	scaled_viewport_size_[0]= width ;
+	scaled_viewport_size_[1]= height;
+	screen_transform_x_= 0.5f * float(width );
+	screen_transform_y_= 0.5f * float(height);
 
-		game_resources_->vfs->ReadFile( texture_file_path, file_content );
-		if( file_content.empty() )
-			continue;
+	frame_started_= true;
+	frame_start_time_= std::chrono::steady_clock::now();
+}
 
-		const CelTextureHeader& header= *reinterpret_cast<const CelTextureHeader*>( file_content.data() );
-		if( header.size[0] % ( g_max_wall_texture_width / 16u ) != 0u ||
+void MapDrawerSoft::EndScaledViewport( const unsigned char* const blend_color, const unsigned char blend_alpha )
+{
+	if( !scaled_viewport_active_ )
+		return;
+	scaled_viewport_active_= false;
+
+	// Nearest neighbor upscale, fused with fullscreen blend. Each rasterizer band upscales own rows.
+	const unsigned int full_width = rendering_context_.viewport_size.Width ();
+	const unsigned int full_height= rendering_context_.viewport_size.Height();
+	const unsigned char no_blend_color[3]= { 0u, 0u, 0u };
+	rasterizer_.CopyScaledViewport(
+		rendering_context_.window_surface_data, full_width, full_height, rendering_context_.row_pixels,
+		blend_color == nullptr ? no_blend_color : blend_color, blend_alpha );
+	rasterizer_.Flush();
+}
+
+void MapDrawerSoft::BindFullViewport()
+{
+	if( !scaled_viewport_bound_ )
+		return;
+	scaled_viewport_bound_= false;
+
+	const unsigned int full_width = rendering_context_.viewport_size.Width ();
+	const unsigned int full_height= rendering_context_.viewport_size.Height();
+	rasterizer_.SetViewport( full_width, full_height, rendering_context_.row_pixels, rendering_context_.window_surface_data );
+	scaled_viewport_size_[0]= full_width ;
+	scaled_viewport_size_[1]= full_height;
+	screen_transform_x_= 0.5f * float(full_width );
+	screen_transform_y_= 0.5f * float(full_height);
+}
+
+void MapDrawerSoft::SetProfilingEnabled( const bool enabled )
+{
+	profiling_enabled_= enabled;
+}
+
+const MapDrawerSoft::StagesTimes& MapDrawerSoft::GetLastFrameStagesTimes() const
+{
+	return stages_times_;
+}
+
+void MapDrawerSoft::EndProfilingStage( const StagesTimes::Stage stage )
+{
+	if( !profiling_enabled_ )
+		return;
+
+	rasterizer_.Flush();
+
+	const std::chrono::steady_clock::time_point current_time= std::chrono::steady_clock::now();
+	stages_times_.time_ms[ stage ]= std::chrono::duration<double, std::milli>( current_time - profiling_stage_start_time_ ).count();
+	profiling_stage_start_time_= current_time;
+}
+
+void MapDrawerSoft::LoadModelsGroup( const std::vector<Model>& models, ModelsGroup& out_group )
+{
+	const PaletteTransformed& palette= *rendering_context_.palette_transformed;
+
+	unsigned int texel_count= 0u;
+	for( const Model& model : models )
+		texel_count+= model.texture_data.size();
+
+	out_group.textures_data.clear();
+	out_group.textures_data.reserve( texel_count * 4u / 3u + 1u ); // Reserve space for mips.
+	out_group.models.resize( models.size() );
+
+	for( unsigned int m= 0u; m < out_group.models.size(); m++ )
+	{
+		const Model& in_model= models[m];
+		ModelsGroup::ModelEntry& model_entry= out_group.models[m];
+
+		const unsigned int texture_data_offset= out_group.textures_data.size();
+		model_entry.texture_size[0]= in_model.texture_size[0];
+		model_entry.texture_size[1]= in_model.texture_size[1];
+		model_entry.texture_data_offset= texture_data_offset;
+
+		out_group.textures_data.resize( texture_data_offset + in_model.texture_data.size() );
+		for( unsigned int t= 0u; t < in_model.texture_data.size(); t++ )
+		{
+			const unsigned char color_index= in_model.texture_data[t];
+			uint32_t color= palette[ color_index ];
+			if( color_index == 0u ) color&= ~Rasterizer::c_alpha_mask; // For models color #0 is transparent.
+			out_group.textures_data[ texture_data_offset + t ]= color;
+		}
+
+		model_entry.mip_count=
+			BuildTextureMips(
+				out_group.textures_data, texture_data_offset,
+				in_model.texture_size[0], in_model.texture_size[1], 1u,
+				true, c_textures_max_mips, model_entry.mips_offsets );
+
+		// Calculate texture density, using first animation frame.
+		// Ratio of texture space area to model space area is sqare of texels per unit.
+		double model_space_area= 0.0, texture_space_area= 0.0;
+		if( in_model.frame_count > 0u )
+		{
+			for( const std::vector<unsigned short>* const indeces : { &in_model.regular_triangles_indeces, &in_model.transparent_triangles_indeces } )
+			for( unsigned int t= 0u; t + 2u < indeces->size(); t+= 3u )
+			{
+				m_Vec3 pos[3];
+				m_Vec2 tc[3];
+				for( unsigned int tv= 0u; tv < 3u; tv++ )
+				{
+					const Model::Vertex& vertex= in_model.vertices[ (*indeces)[t + tv] ];
+					const Model::AnimationVertex& animation_vertex= in_model.animations_vertices[ vertex.vertex_id ];
+					pos[tv]= m_Vec3( float(animation_vertex.pos[0]), float(animation_vertex.pos[1]), float(animation_vertex.pos[2]) ) / 2048.0f;
+					tc[tv]= m_Vec2( vertex.tex_coord[0] * float(in_model.texture_size[0]), vertex.tex_coord[1] * float(in_model.texture_size[1]) );
+				}
+
+				model_space_area+= mVec3Cross( pos[1] - pos[0], pos[2] - pos[0] ).Length();
+				const m_Vec2 tc_v0= tc[1] - tc[0];
+				const m_Vec2 tc_v1= tc[2] - tc[0];
+				texture_space_area+= std::abs( tc_v0.x * tc_v1.y - tc_v0.y * tc_v1.x );
+			}
+		}
+
+		model_entry.texels_per_unit=
+			model_space_area > 0.0
+				? float( std::sqrt( texture_space_area / model_space_area ) )
+				: 0.0f;
+	}
+}
+
+void MapDrawerSoft::BuildIndexedSurfacesTables()
+{
+	const Palette& palette= game_resources_->palette;
+
+	// Light is applied to each component in same way, as in RGBA surfaces generation.
+	for( unsigned int l= 0u; l < 256u; l++ )
+	{
+		const unsigned int light= static_cast<unsigned int>( ScaleLightmapLight( static_cast<unsigned char>(l) ) );
+		for( unsigned int i= 0u; i < 255u; i++ )
+		{
+			int components[3];
+			for( unsigned int j= 0u; j < 3u; j++ )
+				components[j]= int( std::min( palette[ i * 3u + j ] * light >> 16u, 255u ) );
+
+			light_colormap_[l][i]= FindNearestPaletteColor( palette, components[0], components[1], components[2] );
+		}
+		light_colormap_[l][255u]= 255u;
+	}
+
+	inverse_palette_.resize( 32u * 32u * 32u );
+	for( unsigned int b= 0u; b < 32u; b++ )
+	for( unsigned int g= 0u; g < 32u; g++ )
+	for( unsigned int r= 0u; r < 32u; r++ )
+		inverse_palette_[ r | ( g << 5u ) | ( b << 10u ) ]=
+			FindNearestPaletteColor( palette, int( (r << 3u) | 4u ), int( (g << 3u) | 4u ), int( (b << 3u) | 4u ) );
+}
+
+unsigned char MapDrawerSoft::ColorToPaletteIndex( const uint32_t color ) const
+{
+	if( ( color & Rasterizer::c_alpha_mask ) == 0u )
+		return 255u;
+
+	unsigned char components[4];
+	std::memcpy( components, &color, sizeof(uint32_t) );
+
+	const unsigned int r= components[ rendering_context_.color_indeces_rgba[0] ] >> 3u;
+	const unsigned int g= components[ rendering_context_.color_indeces_rgba[1] ] >> 3u;
+	const unsigned int b= components[ rendering_context_.color_indeces_rgba[2] ] >> 3u;
+	return inverse_palette_[ r | ( g << 5u ) | ( b << 10u ) ];
+}
+
+void MapDrawerSoft::LoadWallsTextures( const MapData& map_data )
+{
+	const PaletteTransformed& palette= *rendering_context_.palette_transformed;
+
+	std::vector<unsigned char> file_content;
+
+	for( unsigned int i= 0u; i < MapData::c_max_walls_textures; i++ )
+	{
+		WallTexture& out_texture= wall_textures_[i];
+		out_texture.size[0]= out_texture.size[1]= 0u;
+
+		const char* const texture_file_path= map_data.walls_textures[i].file_path;
+		if( texture_file_path[0] == '\n' )
+			continue;
+
+		game_resources_->vfs->ReadFile( texture_file_path, file_content );
+		if( file_content.empty() )
+			continue;
+
+		const CelTextureHeader& header= *reinterpret_cast<const CelTextureHeader*>( file_content.data() );
+		if( header.size[0] % ( g_max_wall_texture_width / 16u ) != 0u ||
 			header.size[1] < g_wall_texture_height )
 		{
 			Log::Warning( "Invalid wall texture size: ", header.size[0], "x", header.size[1] );
@@ -879,20 +1288,42 @@ void MapDrawerSoft::LoadWallsTextures( const MapData& map_data )
 		const unsigned int storage_size= pixel_count + pixel_count / 4u + pixel_count / 16u + pixel_count / 64u;
 		const unsigned char* const src= file_content.data() + sizeof(CelTextureHeader);
 
-		out_texture.data.resize( storage_size );
-		out_texture.mip0= out_texture.data.data();
-		out_texture.mips[0]= out_texture.mip0 + pixel_count;
-		out_texture.mips[1]= out_texture.mips[0] + pixel_count /  4u;
-		out_texture.mips[2]= out_texture.mips[1] + pixel_count / 16u;
+		// For indexed surfaces 32bit mips are needed only for calculation of indexed mips.
+		std::vector<uint32_t>& data= indexed_surfaces_ ? textures_conversion_buffer_ : out_texture.data;
+		data.resize( storage_size );
+		uint32_t* mips[4];
+		mips[0]= data.data();
+		mips[1]= mips[0] + pixel_count;
+		mips[2]= mips[1] + pixel_count /  4u;
+		mips[3]= mips[2] + pixel_count / 16u;
 
 		for( unsigned int j= 0u; j < pixel_count; j++ )
-			out_texture.mip0[j]= palette[ src[j] ];
-		BuildMipAlphaCorrected( out_texture.mip0   , out_texture.size[0]     , out_texture.size[1]     , out_texture.mips[0] );
-		BuildMipAlphaCorrected( out_texture.mips[0], out_texture.size[0] / 2u, out_texture.size[1] / 2u, out_texture.mips[1] );
-		BuildMipAlphaCorrected( out_texture.mips[1], out_texture.size[0] / 4u, out_texture.size[1] / 4u, out_texture.mips[2] );
-		MakeBinaryAlpha( out_texture.mips[0], pixel_count /  4u );
-		MakeBinaryAlpha( out_texture.mips[1], pixel_count / 16u );
-		MakeBinaryAlpha( out_texture.mips[2], pixel_count / 64u );
+			mips[0][j]= palette[ src[j] ];
+		BuildMipAlphaCorrected( mips[0], out_texture.size[0]     , out_texture.size[1]     , mips[1] );
+		BuildMipAlphaCorrected( mips[1], out_texture.size[0] / 2u, out_texture.size[1] / 2u, mips[2] );
+		BuildMipAlphaCorrected( mips[2], out_texture.size[0] / 4u, out_texture.size[1] / 4u, mips[3] );
+		MakeBinaryAlpha( mips[1], pixel_count /  4u );
+		MakeBinaryAlpha( mips[2], pixel_count / 16u );
+		MakeBinaryAlpha( mips[3], pixel_count / 64u );
+
+		if( indexed_surfaces_ )
+		{
+			out_texture.data_indexed.resize( storage_size );
+			out_texture.indexed_mips[0]= out_texture.data_indexed.data();
+			out_texture.indexed_mips[1]= out_texture.indexed_mips[0] + pixel_count;
+			out_texture.indexed_mips[2]= out_texture.indexed_mips[1] + pixel_count /  4u;
+			out_texture.indexed_mips[3]= out_texture.indexed_mips[2] + pixel_count / 16u;
+
+			std::memcpy( out_texture.indexed_mips[0], src, pixel_count );
+			for( unsigned int mip= 1u; mip < 4u; mip++ )
+			for( unsigned int j= 0u; j < ( pixel_count >> ( 2u * mip ) ); j++ )
+				out_texture.indexed_mips[mip][j]= ColorToPaletteIndex( mips[mip][j] );
+		}
+		else
+		{
+			for( unsigned int mip= 0u; mip < 4u; mip++ )
+				out_texture.mips[mip]= mips[mip];
+		}
 
 		// Calculate top and bottom alpha-rejected texture rows.
 		out_texture.full_alpha_row[0]= 0u;
@@ -967,14 +1398,45 @@ void MapDrawerSoft::LoadFloorsTextures( const MapData& map_data )
 
 	for( unsigned int i= 0u; i < MapData::c_floors_textures_count; i++ )
 	{
+		FloorTexture& texture= floor_textures_[i];
 		const unsigned char* const src= map_data.floor_textures_data[i];
-		uint32_t* const dst= floor_textures_[i].data;
-		for( unsigned int j= 0u; j < MapData::c_floor_texture_size * MapData::c_floor_texture_size; j++ )
-			dst[j]= palette[ src[j] ];
+		const unsigned int pixel_count= MapData::c_floor_texture_size * MapData::c_floor_texture_size;
+		const unsigned int storage_size= pixel_count + pixel_count / 4u + pixel_count / 16u + pixel_count / 64u;
+
+		// For indexed surfaces 32bit mips are needed only for calculation of indexed mips.
+		std::vector<uint32_t>& data= indexed_surfaces_ ? textures_conversion_buffer_ : texture.data;
+		data.resize( storage_size );
+		uint32_t* mips[4];
+		mips[0]= data.data();
+		mips[1]= mips[0] + pixel_count;
+		mips[2]= mips[1] + pixel_count /  4u;
+		mips[3]= mips[2] + pixel_count / 16u;
+
+		for( unsigned int j= 0u; j < pixel_count; j++ )
+			mips[0][j]= palette[ src[j] ];
+
+		BuildMip( mips[0], MapData::c_floor_texture_size     , MapData::c_floor_texture_size     , mips[1] );
+		BuildMip( mips[1], MapData::c_floor_texture_size / 2u, MapData::c_floor_texture_size / 2u, mips[2] );
+		BuildMip( mips[2], MapData::c_floor_texture_size / 4u, MapData::c_floor_texture_size / 4u, mips[3] );
 
-		BuildMip( floor_textures_[i].data, MapData::c_floor_texture_size     , MapData::c_floor_texture_size     , floor_textures_[i].mip1 );
-		BuildMip( floor_textures_[i].mip1, MapData::c_floor_texture_size / 2u, MapData::c_floor_texture_size / 2u, floor_textures_[i].mip2 );
-		BuildMip( floor_textures_[i].mip2, MapData::c_floor_texture_size / 4u, MapData::c_floor_texture_size / 4u, floor_textures_[i].mip3 );
+		if( indexed_surfaces_ )
+		{
+			texture.data_indexed.resize( storage_size );
+			texture.indexed_mips[0]= texture.data_indexed.data();
+			texture.indexed_mips[1]= texture.indexed_mips[0] + pixel_count;
+			texture.indexed_mips[2]= texture.indexed_mips[1] + pixel_count /  4u;
+			texture.indexed_mips[3]= texture.indexed_mips[2] + pixel_count / 16u;
+
+			std::memcpy( texture.indexed_mips[0], src, pixel_count );
+			for( unsigned int mip= 1u; mip < 4u; mip++ )
+			for( unsigned int j= 0u; j < ( pixel_count >> ( 2u * mip ) ); j++ )
+				texture.indexed_mips[mip][j]= ColorToPaletteIndex( mips[mip][j] );
+		}
+		else
+		{
+			for( unsigned int mip= 0u; mip < 4u; mip++ )
+				texture.mips[mip]= mips[mip];
+		}
 	}
 }
 
@@ -1060,6 +1522,7 @@ MapDrawerSoft::TextureView MapDrawerSoft::GetPlayerTexture( const unsigned char
 void MapDrawerSoft::LoadFloorsAndCeilings( const MapData& map_data )
 {
 	map_floors_and_ceilings_.clear();
+	std::fill_n( &floors_and_ceilings_grid_[0][0], 2u * MapData::c_map_size * MapData::c_map_size, static_cast<unsigned short>(c_no_floor_ceiling_cell) );
 
 	for( unsigned int i= 0u; i < 2u; i++ )
 	{
@@ -1077,6 +1540,8 @@ void MapDrawerSoft::LoadFloorsAndCeilings( const MapData& map_data )
 				texture_number >= MapData::c_floors_textures_count )
 				continue;
 
+			floors_and_ceilings_grid_[i][ x + y * MapData::c_map_size ]= static_cast<unsigned short>( map_floors_and_ceilings_.size() );
+
 			map_floors_and_ceilings_.emplace_back();
 			FloorCeilingCell& cell= map_floors_and_ceilings_.back();
 			cell.xy[0]= x;
@@ -1089,23 +1554,204 @@ void MapDrawerSoft::LoadFloorsAndCeilings( const MapData& map_data )
 	}
 }
 
+void MapDrawerSoft::PrepareSurfaces(
+	const m_Mat4& view_rotation_and_projection_matrix,
+	const m_Vec3& camera_position,
+	const ViewClipPlanes& view_clip_planes )
+{
+	// Predict camera rotation for this count of frames ahead.
+	const float c_prediction_frames= 4.0f;
+	const float c_min_prediction_angle= 1.0f * Constants::to_rad;
+	const float c_max_prediction_angle= 45.0f * Constants::to_rad;
+
+	// Calculate camera yaw, using "w" row of matrix. It is view direction.
+	float yaw_delta= 0.0f;
+	const m_Vec2 view_direction( view_rotation_and_projection_matrix.value[3], view_rotation_and_projection_matrix.value[7] );
+	if( view_direction.SquareLength() > 0.0001f )
+	{
+		const float yaw= std::atan2( view_direction.y, view_direction.x );
+		if( prev_view_yaw_valid_ )
+		{
+			yaw_delta= yaw - prev_view_yaw_;
+			if( yaw_delta > +Constants::pi ) yaw_delta-= Constants::two_pi;
+			if( yaw_delta < -Constants::pi ) yaw_delta+= Constants::two_pi;
+		}
+		prev_view_yaw_= yaw;
+		prev_view_yaw_valid_= true;
+	}
+	else
+		prev_view_yaw_valid_= false;
+
+	if( !settings_.GetOrSetBool( SettingsKeys::software_surfaces_prefetch, true ) )
+		return;
+
+	// Prefetch is useful only for parallel generation. With one thread it just generates surfaces of hidden
+	// and predicted walls and floors, which may be not needed at all. Visible surfaces are generated while drawing.
+	if( tasks_pool_.GetThreadCount() <= 1u )
+		return;
+
+	m_Mat4 cam_shift_mat, screen_flip_mat;
+	cam_shift_mat.Translate( -camera_position );
+	screen_flip_mat.Scale( m_Vec3( 1.0f, -1.0f, 1.0f ) );
+
+	surfaces_generation_tasks_.clear();
+
+	// Limit count of pixels of new surfaces, because surfaces of hidden walls and floors are generated too.
+	// Without limit we can recycle surfaces, needed for this frame.
+	unsigned int pixels_budget= surfaces_cache_.GetStorageSize() / ( 4u * surfaces_cache_.GetBytesPerTexel() );
+
+	CollectViewSurfaces(
+		cam_shift_mat * view_rotation_and_projection_matrix * screen_flip_mat,
+		camera_position.xy(), view_clip_planes,
+		pixels_budget );
+
+	const float prediction_angle=
+		std::max( -c_max_prediction_angle, std::min( yaw_delta * c_prediction_frames, c_max_prediction_angle ) );
+	if( std::abs( prediction_angle ) >= c_min_prediction_angle )
+	{
+		// Rotate view around camera.
+		const float s= std::sin( prediction_angle );
+		const float c= std::cos( prediction_angle );
+
+		m_Mat4 rotation;
+		rotation.Identity();
+		rotation.value[0]= c;
+		rotation.value[1]= -s;
+		rotation.value[4]= s;
+		rotation.value[5]= c;
+
+		ViewClipPlanes predicted_clip_planes= view_clip_planes;
+		for( m_Plane3& plane : predicted_clip_planes )
+		{
+			const m_Vec3 normal= plane.normal;
+			plane.normal.x= c * normal.x - s * normal.y;
+			plane.normal.y= s * normal.x + c * normal.y;
+			plane.dist+= camera_position * normal - camera_position * plane.normal;
+		}
+
+		CollectViewSurfaces(
+			cam_shift_mat * rotation * view_rotation_and_projection_matrix * screen_flip_mat,
+			camera_position.xy(), predicted_clip_planes,
+			pixels_budget );
+	}
+
+	// Surfaces of first tasks may be recycled by later allocations. Generate only alive surfaces.
+	surfaces_generation_tasks_.erase(
+		std::remove_if(
+			surfaces_generation_tasks_.begin(), surfaces_generation_tasks_.end(),
+			[]( const SurfaceGenerationTask& task )
+			{
+				const SurfacesCache::Surface* const current_surface=
+					task.wall != nullptr
+						? task.wall->mips_surfaces[ task.mip ]
+						: task.cell->mips_surfaces[ task.mip ];
+				return current_surface != task.surface;
+			} ),
+		surfaces_generation_tasks_.end() );
+
+	const WallSurfaceGenerationFunc* const wall_funcs=
+		indexed_surfaces_ ? c_wall_surface_indexed_generation_funcs : c_wall_surface_generation_funcs;
+	const FloorCeilingSurfaceGenerationFunc* const floor_ceiling_funcs=
+		indexed_surfaces_ ? c_floor_ceiling_surface_indexed_generation_funcs : c_floor_ceiling_surface_generation_funcs;
+
+	tasks_pool_.Run(
+		static_cast<unsigned int>( surfaces_generation_tasks_.size() ),
+		[this, wall_funcs, floor_ceiling_funcs]( const unsigned int task_index )
+		{
+			const SurfaceGenerationTask& task= surfaces_generation_tasks_[ task_index ];
+			if( task.wall != nullptr )
+				(this->*wall_funcs[ task.mip ])( *task.wall, *task.surface );
+			else
+				(this->*floor_ceiling_funcs[ task.mip ])( *task.cell, *task.surface );
+		} );
+}
+
+void MapDrawerSoft::CollectViewSurfaces(
+	const m_Mat4& matrix,
+	const m_Vec2& camera_position_xy,
+	const ViewClipPlanes& view_clip_planes,
+	unsigned int& pixels_budget )
+{
+	RasterizerVertex verties_projected[ c_max_clip_vertices_ ];
+	unsigned int mip;
+	bool is_back;
+
+	// Enumerate walls front to back, because nearest walls are more important.
+	map_bsp_tree_->EnumerateSegmentsFrontToBack(
+		camera_position_xy,
+		[&]( const MapBSPTree::Node& node )
+		{
+			return pixels_budget > 0u && IsBSPNodeVisible( node, matrix, view_clip_planes, false );
+		},
+		[&]( const MapBSPTree::WallSegment& segment )
+		{
+			if( pixels_budget == 0u ||
+				!current_map_data_->pvs->IsStaticWallVisible( pvs_cell_, segment.wall_index ) )
+				return;
+
+			DrawWall& wall= static_walls_[ segment.wall_index ];
+			const unsigned int polygon_vertex_count=
+				ProjectWallSegment<false>(
+					wall,
+					segment.vert_pos[0], segment.vert_pos[1], 0.0f,
+					segment.start, segment.end,
+					matrix, camera_position_xy, view_clip_planes,
+					verties_projected, mip, is_back );
+			if( polygon_vertex_count == 0u || wall.mips_surfaces[mip] != nullptr )
+				return;
+
+			SurfaceGenerationTask task;
+			task.surface= AllocateWallSurface( wall, mip );
+			task.wall= &wall;
+			task.cell= nullptr;
+			task.mip= mip;
+			surfaces_generation_tasks_.push_back( task );
+
+			pixels_budget-= std::min( pixels_budget, task.surface->size[0] * task.surface->size[1] );
+		} );
+
+	CollectFloorsAndCeilingsCandidates( camera_position_xy, view_clip_planes );
+	for( unsigned int i= 0u; i < floors_and_ceilings_candidates_.size() && pixels_budget > 0u; i++ )
+	{
+		FloorCeilingCell& cell= map_floors_and_ceilings_[ floors_and_ceilings_candidates_[i] ];
+		const bool is_ceiling= floors_and_ceilings_candidates_[i] >= first_ceiling_;
+
+		const unsigned int polygon_vertex_count=
+			ProjectFloorCeilingCell( cell, is_ceiling, matrix, view_clip_planes, verties_projected, mip );
+		if( polygon_vertex_count == 0u || cell.mips_surfaces[mip] != nullptr )
+			continue;
+
+		SurfaceGenerationTask task;
+		task.surface= AllocateFloorCeilingSurface( cell, mip );
+		task.wall= nullptr;
+		task.cell= &cell;
+		task.mip= mip;
+		surfaces_generation_tasks_.push_back( task );
+
+		pixels_budget-= std::min( pixels_budget, task.surface->size[0] * task.surface->size[1] );
+	}
+}
+
 template< bool is_dynamic_wall >
-void MapDrawerSoft::DrawWallSegment(
-	DrawWall& wall,
+unsigned int MapDrawerSoft::ProjectWallSegment(
+	const DrawWall& wall,
 	const m_Vec2& vert_pos0, const m_Vec2& vert_pos1, const float z,
 	const float tc_0, const float tc_1,
 	const m_Mat4& matrix,
 	const m_Vec2& camera_position_xy,
-	const ViewClipPlanes& view_clip_planes )
+	const ViewClipPlanes& view_clip_planes,
+	RasterizerVertex* const out_vertices,
+	unsigned int& out_mip,
+	bool& out_is_back )
 {
 	PC_ASSERT( z >= 0.0f );
 
 	PC_ASSERT( wall.texture_id < MapData::c_max_walls_textures );
 	const WallTexture& texture= wall_textures_[ wall.texture_id ];
 	if( texture.size[0] == 0u || texture.size[1] == 0u )
-		return;
+		return 0u;
 	if( texture.full_alpha_row[0] == texture.full_alpha_row[1] )
-		return;
+		return 0u;
 
 	// Discard back faces.
 	// TODO - know, what discard criteria was in original game.
@@ -1113,7 +1759,8 @@ void MapDrawerSoft::DrawWallSegment(
 	if( !is_dynamic_wall &&
 		wall.texture_id < MapData::c_first_transparent_texture_id &&
 		is_back )
-		return;
+		return 0u;
+	out_is_back= is_back;
 
 	const float z_bottom_top[]=
 	{
@@ -1148,12 +1795,11 @@ void MapDrawerSoft::DrawWallSegment(
 			break;
 	}
 	if( polygon_vertex_count == 0u )
-		return;
+		return 0u;
 
 	float min_world_z= Constants::max_float, max_world_z= Constants::min_float;
 	unsigned int min_worlz_z_vertex= 0u, max_world_z_vertex= 0u;
 
-	RasterizerVertex verties_projected[ c_max_clip_vertices_ ];
 	ClippedVertex* v= fisrt_clipped_vertex_;
 	for( unsigned int i= 0u; i < polygon_vertex_count; i++, v= v->next )
 	{
@@ -1177,7 +1823,7 @@ void MapDrawerSoft::DrawWallSegment(
 		vertex_projected.x= ( vertex_projected.x + 1.0f ) * screen_transform_x_;
 		vertex_projected.y= ( vertex_projected.y + 1.0f ) * screen_transform_y_;
 
-		RasterizerVertex& out_v= verties_projected[ i ];
+		RasterizerVertex& out_v= out_vertices[ i ];
 		out_v.x= fixed16_t( vertex_projected.x * 65536.0f );
 		out_v.y= fixed16_t( vertex_projected.y * 65536.0f );
 		out_v.u= fixed16_t( v->tc.x );
@@ -1185,81 +1831,93 @@ void MapDrawerSoft::DrawWallSegment(
 		out_v.z= fixed16_t( w * 65536.0f );
 	}
 
-	if( !is_dynamic_wall && rasterizer_.IsOccluded( verties_projected, polygon_vertex_count ) )
-		return;
-
-	int mip= 0;
-	const SurfacesCache::Surface* surface;
 	if( min_worlz_z_vertex != max_world_z_vertex )
 	{
 		// Calculate only vertical texture scale.
 		// TODO - maybe calculate also horizontal texture scale?
-		const fixed16_t dv= verties_projected[ max_world_z_vertex ].v - verties_projected[ min_worlz_z_vertex ].v;
-		const fixed16_t dx= verties_projected[ max_world_z_vertex ].x - verties_projected[ min_worlz_z_vertex ].x;
-		const fixed16_t dy= verties_projected[ max_world_z_vertex ].y - verties_projected[ min_worlz_z_vertex ].y;
+		const fixed16_t dv= out_vertices[ max_world_z_vertex ].v - out_vertices[ min_worlz_z_vertex ].v;
+		const fixed16_t dx= out_vertices[ max_world_z_vertex ].x - out_vertices[ min_worlz_z_vertex ].x;
+		const fixed16_t dy= out_vertices[ max_world_z_vertex ].y - out_vertices[ min_worlz_z_vertex ].y;
 		const fixed8_t d_len_square= FixedMul<16+8>( dx, dx ) + FixedMul<16+8>( dy, dy );
 		const int d_tc_d_len_square= FixedMul<16+8>( dv, dv ) / std::max( d_len_square, 1 );
 
 		if( d_tc_d_len_square < 2 * 2 )
-		{
-			mip= 0;
-			surface= GetWallSurface<0>( wall );
-		}
+			out_mip= 0u;
 		else
 		{
 			if( d_tc_d_len_square < 4 * 4 )
-			{
-				mip= 1;
-				surface= GetWallSurface<1>( wall );
-			}
+				out_mip= 1u;
 			else if( d_tc_d_len_square < 8 * 8 )
-			{
-				surface= GetWallSurface<2>( wall );
-				mip= 2;
-			}
+				out_mip= 2u;
 			else
-			{
-				surface= GetWallSurface<3>( wall );
-				mip= 3;
-			}
+				out_mip= 3u;
 
 			for( unsigned int i= 0u; i < polygon_vertex_count; i++ )
 			{
-				verties_projected[i].u >>= mip;
-				verties_projected[i].v >>= mip;
+				out_vertices[i].u >>= out_mip;
+				out_vertices[i].v >>= out_mip;
 			}
 		}
 	}
 	else
-		surface= GetWallSurface<3>( wall );
+		out_mip= 3u;
+
+	return polygon_vertex_count;
+}
+
+template< bool is_dynamic_wall >
+void MapDrawerSoft::DrawWallSegment(
+	DrawWall& wall,
+	const m_Vec2& vert_pos0, const m_Vec2& vert_pos1, const float z,
+	const float tc_0, const float tc_1,
+	const m_Mat4& matrix,
+	const m_Vec2& camera_position_xy,
+	const ViewClipPlanes& view_clip_planes )
+{
+	RasterizerVertex verties_projected[ c_max_clip_vertices_ ];
+	unsigned int mip;
+	bool is_back;
+	const unsigned int polygon_vertex_count=
+		ProjectWallSegment<is_dynamic_wall>(
+			wall,
+			vert_pos0, vert_pos1, z,
+			tc_0, tc_1,
+			matrix, camera_position_xy, view_clip_planes,
+			verties_projected, mip, is_back );
+	if( polygon_vertex_count == 0u )
+		return;
 
-	rasterizer_.SetTexture( surface->size[0], surface->size[1], surface->GetData() );
+	if( !is_dynamic_wall && rasterizer_.IsOccluded( verties_projected, polygon_vertex_count ) )
+		return;
+
+	const WallTexture& texture= wall_textures_[ wall.texture_id ];
+	const SurfacesCache::Surface* const surface= GetWallSurface( wall, mip );
 
 	if( is_dynamic_wall )
 	{
 		if( texture.has_alpha )
-			rasterizer_.DrawTexturedConvexPolygonSpanCorrected<
+			DrawSurfacePolygonSpanCorrected<
 				Rasterizer::DepthTest::Yes, Rasterizer::DepthWrite::Yes,
 				Rasterizer::AlphaTest::Yes,
-				Rasterizer::OcclusionTest::No, Rasterizer::OcclusionWrite::Yes>( verties_projected, polygon_vertex_count, !is_back );
+				Rasterizer::OcclusionTest::No, Rasterizer::OcclusionWrite::Yes>( *surface, verties_projected, polygon_vertex_count, !is_back );
 		else
-			rasterizer_.DrawTexturedConvexPolygonSpanCorrected<
+			DrawSurfacePolygonSpanCorrected<
 				Rasterizer::DepthTest::Yes, Rasterizer::DepthWrite::Yes,
 				Rasterizer::AlphaTest::No,
-				Rasterizer::OcclusionTest::No, Rasterizer::OcclusionWrite::Yes>( verties_projected, polygon_vertex_count, !is_back );
+				Rasterizer::OcclusionTest::No, Rasterizer::OcclusionWrite::Yes>( *surface, verties_projected, polygon_vertex_count, !is_back );
 	}
 	else
 	{
 		if( texture.has_alpha )
-			rasterizer_.DrawTexturedConvexPolygonSpanCorrected<
+			DrawSurfacePolygonSpanCorrected<
 				Rasterizer::DepthTest::No, Rasterizer::DepthWrite::Yes,
 				Rasterizer::AlphaTest::Yes,
-				Rasterizer::OcclusionTest::Yes, Rasterizer::OcclusionWrite::Yes>( verties_projected, polygon_vertex_count, !is_back );
+				Rasterizer::OcclusionTest::Yes, Rasterizer::OcclusionWrite::Yes>( *surface, verties_projected, polygon_vertex_count, !is_back );
 		else
-			rasterizer_.DrawTexturedConvexPolygonSpanCorrected<
+			DrawSurfacePolygonSpanCorrected<
 				Rasterizer::DepthTest::No, Rasterizer::DepthWrite::Yes,
 				Rasterizer::AlphaTest::No,
-				Rasterizer::OcclusionTest::Yes, Rasterizer::OcclusionWrite::Yes>( verties_projected, polygon_vertex_count, !is_back );
+				Rasterizer::OcclusionTest::Yes, Rasterizer::OcclusionWrite::Yes>( *surface, verties_projected, polygon_vertex_count, !is_back );
 	}
 
 	rasterizer_.UpdateOcclusionHierarchy( verties_projected, polygon_vertex_count, texture.has_alpha );
@@ -1272,10 +1930,18 @@ void MapDrawerSoft::DrawWalls(
 	const ViewClipPlanes& view_clip_planes )
 {
 	// Draw static walls fron to back, using bsp tree.
+	// Skip whole subtrees, if they are outside frustum or behind already drawn walls.
 	map_bsp_tree_->EnumerateSegmentsFrontToBack(
 		camera_position_xy,
+		[&]( const MapBSPTree::Node& node )
+		{
+			return IsBSPNodeVisible( node, matrix, view_clip_planes, true );
+		},
 		[&]( const MapBSPTree::WallSegment& segment )
 		{
+			if( !current_map_data_->pvs->IsStaticWallVisible( pvs_cell_, segment.wall_index ) )
+				return;
+
 			DrawWallSegment<false>(
 				static_walls_[ segment.wall_index ],
 				segment.vert_pos[0], segment.vert_pos[1], 0.0f,
@@ -1313,28 +1979,289 @@ void MapDrawerSoft::DrawWalls(
 	}
 }
 
-void MapDrawerSoft::DrawFloorsAndCeilings( const m_Mat4& matrix, const ViewClipPlanes& view_clip_planes  )
+bool MapDrawerSoft::IsBSPNodeVisible(
+	const MapBSPTree::Node& node,
+	const m_Mat4& matrix,
+	const ViewClipPlanes& view_clip_planes,
+	const bool occlusion_test )
 {
-	for( unsigned int i= 0u; i < map_floors_and_ceilings_.size(); i++ )
+	m_Vec3 corners[8];
+	for( unsigned int i= 0u; i < 8u; i++ )
+		corners[i]=
+			m_Vec3(
+				( i & 1u ) == 0u ? node.bb_min.x : node.bb_max.x,
+				( i & 2u ) == 0u ? node.bb_min.y : node.bb_max.y,
+				( i & 4u ) == 0u ? 0.0f : GameConstants::walls_height );
+
+	for( const m_Plane3& plane : view_clip_planes )
 	{
-		FloorCeilingCell& cell= map_floors_and_ceilings_[i];
-		const bool is_ceiling= i >= first_ceiling_;
-		const float z= is_ceiling ? GameConstants::walls_height : 0.0f;
+		bool is_ahead= false;
+		for( const m_Vec3& corner : corners )
+			is_ahead|= plane.IsPointAheadPlane( corner );
+		if( !is_ahead )
+			return false;
+	}
 
-		PC_ASSERT( cell.texture_id < MapData::c_floors_textures_count );
+	if( !occlusion_test )
+		return true;
 
-		clipped_vertices_[0].pos= m_Vec3( float(cell.xy[0]   ), float(cell.xy[1]   ), z );
-		clipped_vertices_[1].pos= m_Vec3( float(cell.xy[0]+1u), float(cell.xy[1]   ), z );
-		clipped_vertices_[2].pos= m_Vec3( float(cell.xy[0]+1u), float(cell.xy[1]+1u), z );
-		clipped_vertices_[3].pos= m_Vec3( float(cell.xy[0]   ), float(cell.xy[1]+1u), z );
-		clipped_vertices_[0].tc= m_Vec2( 0.0f, 0.0f );
-		clipped_vertices_[1].tc= m_Vec2( float( MapData::c_floor_texture_size << 16u ), 0.0f );
-		clipped_vertices_[2].tc= m_Vec2( float( MapData::c_floor_texture_size << 16u ), float( MapData::c_floor_texture_size << 16u ) );
-		clipped_vertices_[3].tc= m_Vec2( 0.0f, float( MapData::c_floor_texture_size << 16u ) );
-		clipped_vertices_[0].next= &clipped_vertices_[1];
-		clipped_vertices_[1].next= &clipped_vertices_[2];
-		clipped_vertices_[2].next= &clipped_vertices_[3];
-		clipped_vertices_[3].next= &clipped_vertices_[0];
+	// Project box and test it`s screen rectangle.
+	const float c_min_w= 1.0f / 16.0f;
+	const float screen_size_x= 2.0f * screen_transform_x_, screen_size_y= 2.0f * screen_transform_y_;
+	float x_min= screen_size_x, x_max= 0.0f, y_min= screen_size_y, y_max= 0.0f;
+	for( const m_Vec3& corner : corners )
+	{
+		const float w= corner.x * matrix.value[3] + corner.y * matrix.value[7] + corner.z * matrix.value[11] + matrix.value[15];
+		if( w < c_min_w )
+			return true; // Box is too close to camera. Consider it visible.
+
+		const m_Vec3 corner_projected= corner * matrix;
+		const float x= ( corner_projected.x / w + 1.0f ) * screen_transform_x_;
+		const float y= ( corner_projected.y / w + 1.0f ) * screen_transform_y_;
+		x_min= std::min( x_min, x );
+		x_max= std::max( x_max, x );
+		y_min= std::min( y_min, y );
+		y_max= std::max( y_max, y );
+	}
+
+	x_min= std::max( x_min, 0.0f ); x_max= std::min( x_max, screen_size_x );
+	y_min= std::max( y_min, 0.0f ); y_max= std::min( y_max, screen_size_y );
+	if( x_min >= x_max || y_min >= y_max )
+		return true;
+
+	RasterizerVertex rect[4];
+	rect[0].x= fixed16_t( x_min * 65536.0f ); rect[0].y= fixed16_t( y_min * 65536.0f );
+	rect[1].x= fixed16_t( x_max * 65536.0f ); rect[1].y= fixed16_t( y_min * 65536.0f );
+	rect[2].x= fixed16_t( x_max * 65536.0f ); rect[2].y= fixed16_t( y_max * 65536.0f );
+	rect[3].x= fixed16_t( x_min * 65536.0f ); rect[3].y= fixed16_t( y_max * 65536.0f );
+	for( RasterizerVertex& v : rect )
+		v.u= v.v= v.z= 0;
+
+	return !rasterizer_.IsOccluded( rect, 4u );
+}
+
+unsigned int MapDrawerSoft::ProjectFloorCeilingCell(
+	const FloorCeilingCell& cell,
+	const bool is_ceiling,
+	const m_Mat4& matrix,
+	const ViewClipPlanes& view_clip_planes,
+	RasterizerVertex* const out_vertices,
+	unsigned int& out_mip )
+{
+	const float z= is_ceiling ? GameConstants::walls_height : 0.0f;
+
+	PC_ASSERT( cell.texture_id < MapData::c_floors_textures_count );
+
+	clipped_vertices_[0].pos= m_Vec3( float(cell.xy[0]   ), float(cell.xy[1]   ), z );
+	clipped_vertices_[1].pos= m_Vec3( float(cell.xy[0]+1u), float(cell.xy[1]   ), z );
+	clipped_vertices_[2].pos= m_Vec3( float(cell.xy[0]+1u), float(cell.xy[1]+1u), z );
+	clipped_vertices_[3].pos= m_Vec3( float(cell.xy[0]   ), float(cell.xy[1]+1u), z );
+	clipped_vertices_[0].tc= m_Vec2( 0.0f, 0.0f );
+	clipped_vertices_[1].tc= m_Vec2( float( MapData::c_floor_texture_size << 16u ), 0.0f );
+	clipped_vertices_[2].tc= m_Vec2( float( MapData::c_floor_texture_size << 16u ), float( MapData::c_floor_texture_size << 16u ) );
+	clipped_vertices_[3].tc= m_Vec2( 0.0f, float( MapData::c_floor_texture_size << 16u ) );
+	clipped_vertices_[0].next= &clipped_vertices_[1];
+	clipped_vertices_[1].next= &clipped_vertices_[2];
+	clipped_vertices_[2].next= &clipped_vertices_[3];
+	clipped_vertices_[3].next= &clipped_vertices_[0];
+	fisrt_clipped_vertex_= &clipped_vertices_[0];
+	next_new_clipped_vertex_= 4u;
+
+	unsigned int polygon_vertex_count= 4u;
+	for( const m_Plane3& plane : view_clip_planes )
+	{
+		polygon_vertex_count= ClipPolygon( plane, polygon_vertex_count );
+		PC_ASSERT( polygon_vertex_count == 0u || polygon_vertex_count >= 3u );
+		if( polygon_vertex_count == 0u )
+			break;
+	}
+	if( polygon_vertex_count == 0u )
+		return 0u;
+
+	ClippedVertex* v= fisrt_clipped_vertex_;
+	for( unsigned int i= 0u; i < polygon_vertex_count; i++, v= v->next )
+	{
+		m_Vec3 vertex_projected= v->pos * matrix;
+		const float w= v->pos.x * matrix.value[3] + v->pos.y * matrix.value[7] + v->pos.z * matrix.value[11] + matrix.value[15];
+
+		vertex_projected/= w;
+		vertex_projected.z= w;
+
+		vertex_projected.x= ( vertex_projected.x + 1.0f ) * screen_transform_x_;
+		vertex_projected.y= ( vertex_projected.y + 1.0f ) * screen_transform_y_;
+
+		RasterizerVertex& out_v= out_vertices[ i ];
+		out_v.x= fixed16_t( vertex_projected.x * 65536.0f );
+		out_v.y= fixed16_t( vertex_projected.y * 65536.0f );
+		out_v.u= fixed16_t( v->tc.x );
+		out_v.v= fixed16_t( v->tc.y );
+		out_v.z= fixed16_t( w * 65536.0f );
+	}
+
+	// Calculate d_tc / d_length for longest edge, select mip.
+	out_mip= SelectPolygonMip( out_vertices, polygon_vertex_count, 4u );
+
+	return polygon_vertex_count;
+}
+
+void MapDrawerSoft::DrawFloorsAndCeilings( const m_Mat4& matrix, const m_Vec2& camera_position_xy, const ViewClipPlanes& view_clip_planes )
+{
+	CollectFloorsAndCeilingsCandidates( camera_position_xy, view_clip_planes );
+
+	if( settings_.GetOrSetBool( SettingsKeys::software_floor_spans, true ) )
+	{
+		DrawFloorsAndCeilingsSpans( matrix, view_clip_planes );
+		return;
+	}
+
+	for( const unsigned int cell_index : floors_and_ceilings_candidates_ )
+		DrawFloorCeilingCellPolygon( map_floors_and_ceilings_[ cell_index ], cell_index >= first_ceiling_, matrix, view_clip_planes );
+}
+
+void MapDrawerSoft::DrawFloorsAndCeilingsSpans( const m_Mat4& matrix, const ViewClipPlanes& view_clip_planes )
+{
+	const unsigned int c_grid_cells= MapData::c_map_size * MapData::c_map_size;
+	Rasterizer::GridPlanes& grid_planes= floors_and_ceilings_grid_planes_;
+
+	floors_and_ceilings_grid_cells_.resize( 2u * c_grid_cells );
+	for( Rasterizer::GridPlanes::Cell& grid_cell : floors_and_ceilings_grid_cells_ )
+	{
+		grid_cell.texture_data= nullptr;
+		grid_cell.texture_size_log2= 0u;
+	}
+
+	// Prepare surfaces of visible cells.
+	for( const unsigned int cell_index : floors_and_ceilings_candidates_ )
+	{
+		FloorCeilingCell& cell= map_floors_and_ceilings_[ cell_index ];
+		const bool is_ceiling= cell_index >= first_ceiling_;
+
+		RasterizerVertex verties_projected[ c_max_clip_vertices_ ];
+		unsigned int mip;
+		const unsigned int polygon_vertex_count=
+			ProjectFloorCeilingCell( cell, is_ceiling, matrix, view_clip_planes, verties_projected, mip );
+		if( polygon_vertex_count == 0u ||
+			rasterizer_.IsOccluded( verties_projected, polygon_vertex_count ) )
+			continue;
+
+		const SurfacesCache::Surface* const surface= GetFloorCeilingSurface( cell, mip );
+
+		Rasterizer::GridPlanes::Cell& grid_cell=
+			floors_and_ceilings_grid_cells_[ ( is_ceiling ? c_grid_cells : 0u ) + cell.xy[0] + cell.xy[1] * MapData::c_map_size ];
+		grid_cell.texture_data= surface->GetData();
+		grid_cell.texture_size_log2= MapData::c_floor_texture_size_log2 - mip;
+	}
+
+	// Surfaces of first cells may be recycled, while surfaces of last cells are generated.
+	// Draw such cells later, using polygons.
+	floors_and_ceilings_candidates_sorted_.clear();
+	for( const unsigned int cell_index : floors_and_ceilings_candidates_ )
+	{
+		FloorCeilingCell& cell= map_floors_and_ceilings_[ cell_index ];
+		const bool is_ceiling= cell_index >= first_ceiling_;
+		Rasterizer::GridPlanes::Cell& grid_cell=
+			floors_and_ceilings_grid_cells_[ ( is_ceiling ? c_grid_cells : 0u ) + cell.xy[0] + cell.xy[1] * MapData::c_map_size ];
+		if( grid_cell.texture_data == nullptr )
+			continue;
+
+		const SurfacesCache::Surface* const surface= cell.mips_surfaces[ MapData::c_floor_texture_size_log2 - grid_cell.texture_size_log2 ];
+		if( surface == nullptr || surface->GetData() != grid_cell.texture_data )
+		{
+			grid_cell.texture_data= nullptr;
+			floors_and_ceilings_candidates_sorted_.push_back( cell_index );
+		}
+	}
+
+	// Calculate screen to plane transformation for floors and ceilings.
+	// Inverse "plane to screen" transformation, which is matrix rows for x, y, w with z= plane height.
+	for( unsigned int i= 0u; i < 2u; i++ )
+	{
+		const float z= i == 0u ? 0.0f : GameConstants::walls_height;
+		const float* const m= matrix.value;
+		const float plane_to_clip[9]=
+		{
+			m[0], m[4], z * m[ 8] + m[12],
+			m[1], m[5], z * m[ 9] + m[13],
+			m[3], m[7], z * m[11] + m[15],
+		};
+
+		Rasterizer::GridPlanes::Plane& plane= grid_planes.planes[i];
+		plane.cells= floors_and_ceilings_grid_cells_.data() + i * c_grid_cells;
+		if( !BuildScreenInverseTransform( plane_to_clip, screen_transform_x_, screen_transform_y_, plane.screen_to_plane ) )
+		{
+			// Camera is on plane - plane is invisible.
+			std::fill_n( plane.screen_to_plane, 9u, 0.0f );
+			continue;
+		}
+	}
+	grid_planes.grid_size= MapData::c_map_size;
+	grid_planes.palette= indexed_surfaces_ ? rendering_context_.palette_transformed->data() : nullptr;
+
+	rasterizer_.DrawGridPlanes( grid_planes );
+
+	for( const unsigned int cell_index : floors_and_ceilings_candidates_sorted_ )
+		DrawFloorCeilingCellPolygon( map_floors_and_ceilings_[ cell_index ], cell_index >= first_ceiling_, matrix, view_clip_planes );
+
+	// Update occlusion hierarchy for whole screen.
+	const fixed16_t width = fixed16_t( 2.0f * screen_transform_x_ * 65536.0f );
+	const fixed16_t height= fixed16_t( 2.0f * screen_transform_y_ * 65536.0f );
+	RasterizerVertex screen_vertices[4];
+	screen_vertices[0].x= 0    ; screen_vertices[0].y= 0     ;
+	screen_vertices[1].x= width; screen_vertices[1].y= 0     ;
+	screen_vertices[2].x= width; screen_vertices[2].y= height;
+	screen_vertices[3].x= 0    ; screen_vertices[3].y= height;
+	for( RasterizerVertex& v : screen_vertices )
+		v.u= v.v= v.z= 0;
+	rasterizer_.UpdateOcclusionHierarchy( screen_vertices, 4u, true );
+}
+
+void MapDrawerSoft::DrawFloorCeilingCellPolygon(
+	FloorCeilingCell& cell, const bool is_ceiling,
+	const m_Mat4& matrix, const ViewClipPlanes& view_clip_planes )
+{
+	RasterizerVertex verties_projected[ c_max_clip_vertices_ ];
+	unsigned int mip;
+	const unsigned int polygon_vertex_count=
+		ProjectFloorCeilingCell( cell, is_ceiling, matrix, view_clip_planes, verties_projected, mip );
+	if( polygon_vertex_count == 0u )
+		return;
+
+	if( rasterizer_.IsOccluded( verties_projected, polygon_vertex_count ) )
+		return;
+
+	const SurfacesCache::Surface* const surface= GetFloorCeilingSurface( cell, mip );
+
+	DrawSurfacePolygonPerLineCorrected<
+		Rasterizer::DepthTest::No, Rasterizer::DepthWrite::Yes,
+		Rasterizer::AlphaTest::No,
+		Rasterizer::OcclusionTest::Yes, Rasterizer::OcclusionWrite::Yes>( *surface, verties_projected, polygon_vertex_count, is_ceiling );
+
+	// TODO - does this needs?
+	// Maybe update whole screen hierarchy after floors and ceilings?
+	rasterizer_.UpdateOcclusionHierarchy( verties_projected, polygon_vertex_count, false );
+}
+
+void MapDrawerSoft::CollectFloorsAndCeilingsCandidates( const m_Vec2& camera_position_xy, const ViewClipPlanes& view_clip_planes )
+{
+	const int c_map_size= int(MapData::c_map_size);
+	const float c_eps= 1.0f / 64.0f;
+
+	floors_and_ceilings_candidates_.clear();
+
+	for( unsigned int layer= 0u; layer < 2u; layer++ )
+	{
+		const float z= layer == 0u ? 0.0f : GameConstants::walls_height;
+
+		// Clip whole map square by view planes. Result is convex polygon - frustum section.
+		clipped_vertices_[0].pos= m_Vec3( 0.0f, 0.0f, z );
+		clipped_vertices_[1].pos= m_Vec3( float(c_map_size), 0.0f, z );
+		clipped_vertices_[2].pos= m_Vec3( float(c_map_size), float(c_map_size), z );
+		clipped_vertices_[3].pos= m_Vec3( 0.0f, float(c_map_size), z );
+		for( unsigned int i= 0u; i < 4u; i++ )
+		{
+			clipped_vertices_[i].tc= m_Vec2( 0.0f, 0.0f );
+			clipped_vertices_[i].next= &clipped_vertices_[ (i + 1u) & 3u ];
+		}
 		fisrt_clipped_vertex_= &clipped_vertices_[0];
 		next_new_clipped_vertex_= 4u;
 
@@ -1342,103 +2269,306 @@ void MapDrawerSoft::DrawFloorsAndCeilings( const m_Mat4& matrix, const ViewClipP
 		for( const m_Plane3& plane : view_clip_planes )
 		{
 			polygon_vertex_count= ClipPolygon( plane, polygon_vertex_count );
-			PC_ASSERT( polygon_vertex_count == 0u || polygon_vertex_count >= 3u );
 			if( polygon_vertex_count == 0u )
 				break;
 		}
 		if( polygon_vertex_count == 0u )
 			continue;
 
-		RasterizerVertex verties_projected[ c_max_clip_vertices_ ];
-		ClippedVertex* v= fisrt_clipped_vertex_;
+		m_Vec2 polygon[ c_max_clip_vertices_ ];
+		float y_min= float(c_map_size), y_max= 0.0f;
+		const ClippedVertex* v= fisrt_clipped_vertex_;
 		for( unsigned int i= 0u; i < polygon_vertex_count; i++, v= v->next )
 		{
-			m_Vec3 vertex_projected= v->pos * matrix;
-			const float w= v->pos.x * matrix.value[3] + v->pos.y * matrix.value[7] + v->pos.z * matrix.value[11] + matrix.value[15];
+			polygon[i]= v->pos.xy();
+			y_min= std::min( y_min, polygon[i].y );
+			y_max= std::max( y_max, polygon[i].y );
+		}
 
-			vertex_projected/= w;
-			vertex_projected.z= w;
+		// Rasterize polygon conservative - take all cells, touched by polygon.
+		const int row_start= std::max( 0, static_cast<int>( std::floor( y_min - c_eps ) ) );
+		const int row_end= std::min( c_map_size, static_cast<int>( std::ceil( y_max + c_eps ) ) );
+		for( int y= row_start; y < row_end; y++ )
+		{
+			const float row_y0= float(y) - c_eps, row_y1= float(y + 1) + c_eps;
 
-			vertex_projected.x= ( vertex_projected.x + 1.0f ) * screen_transform_x_;
-			vertex_projected.y= ( vertex_projected.y + 1.0f ) * screen_transform_y_;
+			// Search x range of polygon part inside row.
+			float x_min= float(c_map_size), x_max= 0.0f;
+			for( unsigned int i= 0u; i < polygon_vertex_count; i++ )
+			{
+				const m_Vec2& a= polygon[i];
+				const m_Vec2& b= polygon[ i + 1u == polygon_vertex_count ? 0u : i + 1u ];
+				if( ( a.y < row_y0 && b.y < row_y0 ) || ( a.y > row_y1 && b.y > row_y1 ) )
+					continue;
+
+				float t0= 0.0f, t1= 1.0f;
+				const float dy= b.y - a.y;
+				if( std::abs( dy ) > 0.0001f )
+				{
+					const float ta= ( row_y0 - a.y ) / dy;
+					const float tb= ( row_y1 - a.y ) / dy;
+					t0= std::max( t0, std::min( ta, tb ) );
+					t1= std::min( t1, std::max( ta, tb ) );
+				}
+				const float x0= a.x + ( b.x - a.x ) * t0;
+				const float x1= a.x + ( b.x - a.x ) * t1;
+				x_min= std::min( x_min, std::min( x0, x1 ) );
+				x_max= std::max( x_max, std::max( x0, x1 ) );
+			}
 
-			RasterizerVertex& out_v= verties_projected[ i ];
-			out_v.x= fixed16_t( vertex_projected.x * 65536.0f );
-			out_v.y= fixed16_t( vertex_projected.y * 65536.0f );
-			out_v.u= fixed16_t( v->tc.x );
-			out_v.v= fixed16_t( v->tc.y );
-			out_v.z= fixed16_t( w * 65536.0f );
+			const int x_start= std::max( 0, static_cast<int>( std::floor( x_min - c_eps ) ) );
+			const int x_end= std::min( c_map_size, static_cast<int>( std::ceil( x_max + c_eps ) ) );
+			const unsigned short* const grid_row= floors_and_ceilings_grid_[layer] + y * c_map_size;
+			for( int x= x_start; x < x_end; x++ )
+			{
+				if( grid_row[x] == c_no_floor_ceiling_cell ||
+					!current_map_data_->pvs->IsCellVisible( pvs_cell_, x, y ) )
+					continue;
+				floors_and_ceilings_candidates_.push_back( grid_row[x] );
+			}
 		}
+	}
 
-		if( rasterizer_.IsOccluded( verties_projected, polygon_vertex_count ) )
+	// Sort nearest first, using counting sort by distance ( in cells ) to camera cell.
+	const int cam_x= static_cast<int>( std::floor( camera_position_xy.x ) );
+	const int cam_y= static_cast<int>( std::floor( camera_position_xy.y ) );
+	const auto get_distance=
+	[&]( const unsigned int cell_index ) -> unsigned int
+	{
+		const FloorCeilingCell& cell= map_floors_and_ceilings_[ cell_index ];
+		const int d= std::max( std::abs( int(cell.xy[0]) - cam_x ), std::abs( int(cell.xy[1]) - cam_y ) );
+		return static_cast<unsigned int>( std::min( d, c_map_size - 1 ) );
+	};
+
+	unsigned int bucket_offsets[ MapData::c_map_size + 1u ];
+	std::fill_n( bucket_offsets, MapData::c_map_size + 1u, 0u );
+	for( const unsigned int cell_index : floors_and_ceilings_candidates_ )
+		bucket_offsets[ get_distance( cell_index ) + 1u ]++;
+	for( unsigned int i= 1u; i <= MapData::c_map_size; i++ )
+		bucket_offsets[i]+= bucket_offsets[i - 1u];
+
+	floors_and_ceilings_candidates_sorted_.resize( floors_and_ceilings_candidates_.size() );
+	for( const unsigned int cell_index : floors_and_ceilings_candidates_ )
+		floors_and_ceilings_candidates_sorted_[ bucket_offsets[ get_distance( cell_index ) ]++ ]= cell_index;
+
+	floors_and_ceilings_candidates_.swap( floors_and_ceilings_candidates_sorted_ );
+}
+
+void MapDrawerSoft::CollectModelsDrawList(
+	const MapState& map_state,
+	const m_Mat4& view_matrix,
+	const EntityId player_monster_id )
+{
+	models_draw_list_.clear();
+
+	const auto add_model=
+	[&](
+		const ModelsGroup& models_group, const std::vector<Model>& models, const unsigned int model_id,
+		const unsigned int animation_frame,
+		const m_Vec3& position, const m_Mat4& rotation_matrix ) -> ModelsDrawListItem&
+	{
+		models_draw_list_.emplace_back();
+		ModelsDrawListItem& item= models_draw_list_.back();
+		item.models_group= &models_group;
+		item.models= &models;
+		item.model_id= model_id;
+		item.animation_frame= animation_frame;
+		item.submodel_id= ~0u;
+		item.position= position;
+		item.rotation_matrix= rotation_matrix;
+		// W of projected position is distance along view direction.
+		item.depth=
+			position.x * view_matrix.value[3] + position.y * view_matrix.value[7] + position.z * view_matrix.value[11] +
+			view_matrix.value[15];
+		item.visible_groups_mask= 255u;
+		item.color= 0u;
+		item.force_transparent_nontransparent_polygons= false;
+		item.fullbright= false;
+		return item;
+	};
+
+	for( const MapState::StaticModel& static_model : map_state.GetStaticModels() )
+	{
+		if( static_model.model_id >= current_map_data_->models_description.size() ||
+			!static_model.visible )
 			continue;
 
-		// Search longest edge for mip calculation.
-		unsigned int longest_edge_index= 0u;
-		fixed8_t longest_edge_squre_length= 1; // fixed8_t range should be enought for vector ( 2048, 2048 ) square length.
-		for( unsigned int i= 0u; i < polygon_vertex_count; i++ )
-		{
-			unsigned int prev_i= i == 0u ? (polygon_vertex_count - 1u) : (i - 1u);
-			const fixed16_t dx= verties_projected[i].x - verties_projected[prev_i].x;
-			const fixed16_t dy= verties_projected[i].y - verties_projected[prev_i].y;
-			const fixed8_t square_length= FixedMul<16+8>( dx, dx ) + FixedMul<16+8>( dy, dy );
-			if( square_length > longest_edge_squre_length )
-			{
-				longest_edge_squre_length= square_length;
-				longest_edge_index= i;
-			}
-		}
-		int mip= 0;
-		const SurfacesCache::Surface* surface;
-		// Calculate d_tc / d_length for longest edge, select mip.
-		unsigned int prev_v= longest_edge_index == 0u ? (polygon_vertex_count - 1u) : (longest_edge_index - 1u);
-		const fixed16_t du= verties_projected[longest_edge_index].u - verties_projected[prev_v].u;
-		const fixed16_t dv= verties_projected[longest_edge_index].v - verties_projected[prev_v].v;
-		const fixed8_t square_tc_delta= FixedMul<16+8>( du, du ) + FixedMul<16+8>( dv, dv );
-		const int d_tc_d_len_square = square_tc_delta / longest_edge_squre_length;
+		m_Mat4 rotate_mat;
+		rotate_mat.RotateZ( static_model.angle );
+
+		add_model(
+			map_models_, current_map_data_->models, static_model.model_id,
+			static_model.animation_frame,
+			static_model.pos, rotate_mat );
+	}
+
+	for( const MapState::Item& item : map_state.GetItems() )
+	{
+		if( item.item_id >= game_resources_->items_models.size() ||
+			item.picked_up )
+			continue;
+
+		m_Mat4 rotate_mat;
+		rotate_mat.RotateZ( item.angle );
+
+		add_model(
+			items_models_, game_resources_->items_models, item.item_id,
+			item.animation_frame,
+			item.pos, rotate_mat );
+	}
+
+	for( const MapState::DynamicItemsContainer::value_type& dynamic_item_value : map_state.GetDynamicItems() )
+	{
+		const MapState::DynamicItem& item= dynamic_item_value.second;
+		if( item.item_type_id >= game_resources_->items_models.size() )
+			continue;
+
+		m_Mat4 rotate_mat;
+		rotate_mat.RotateZ( item.angle );
+
+		add_model(
+			items_models_, game_resources_->items_models, item.item_type_id,
+			item.frame,
+			item.pos, rotate_mat ).fullbright= item.fullbright;
+	}
+
+	for( const MapState::RocketsContainer::value_type& rocket_value : map_state.GetRockets() )
+	{
+		const MapState::Rocket& rocket= rocket_value.second;
+		if( rocket.rocket_id >= game_resources_->rockets_models.size() )
+			continue;
+
+		m_Mat4 rotate_max_x, rotate_mat_z;
+		rotate_max_x.RotateX( rocket.angle[1] );
+		rotate_mat_z.RotateZ( rocket.angle[0] - Constants::half_pi );
+
+		add_model(
+			rockets_models_, game_resources_->rockets_models, rocket.rocket_id,
+			rocket.frame,
+			rocket.pos, rotate_max_x * rotate_mat_z ).fullbright= game_resources_->rockets_description[ rocket.rocket_id ].fullbright;
+	}
+
+	for( const MapState::Gib& gib : map_state.GetGibs() )
+	{
+		if( gib.gib_id >= gibs_models_.models.size() )
+			continue;
+
+		m_Mat4 rotate_max_x, rotate_mat_z;
+		rotate_max_x.RotateX( gib.angle_x );
+		rotate_mat_z.RotateZ( gib.angle_z );
+
+		add_model(
+			gibs_models_, game_resources_->gibs_models, gib.gib_id,
+			0u,
+			gib.pos, rotate_max_x * rotate_mat_z );
+	}
+
+	for( const MapState::MonstersContainer::value_type& monster_value : map_state.GetMonsters() )
+	{
+		const MapState::Monster& monster= monster_value.second;
+		if( monster.monster_id >= game_resources_->monsters_models.size() )
+			continue;
+
+		if( monster_value.first == player_monster_id )
+			continue;
+
+		const unsigned int frame=
+			game_resources_->monsters_models[ monster.monster_id ].animations[ monster.animation ].first_frame +
+			monster.animation_frame;
+
+		m_Mat4 rotate_mat;
+		rotate_mat.RotateZ( monster.angle + Constants::half_pi );
+
+		ModelsDrawListItem& item=
+			add_model(
+				monsters_models_, game_resources_->monsters_models, monster.monster_id,
+				frame,
+				monster.pos, rotate_mat );
+		item.visible_groups_mask= monster.body_parts_mask;
+		item.force_transparent_nontransparent_polygons= monster.is_invisible;
+		item.color= monster.color;
+	}
+
+	for( const MapState::MonsterBodyPart& part : map_state.GetMonstersBodyParts() )
+	{
+		if( part.monster_type >= game_resources_->monsters_models.size() )
+			continue;
+
+		PC_ASSERT( part.body_part_id <= game_resources_->monsters_models[ part.monster_type ].submodels.size() );
+
+		const Submodel& submodel= game_resources_->monsters_models[ part.monster_type ].submodels[ part.body_part_id ];
+		const unsigned int frame= submodel.animations[ part.animation ].first_frame + part.animation_frame;
+
+		m_Mat4 rotate_mat;
+		rotate_mat.RotateZ( part.angle + Constants::half_pi );
+
+		add_model(
+			monsters_models_, game_resources_->monsters_models, part.monster_type,
+			frame,
+			part.pos, rotate_mat ).submodel_id= part.body_part_id;
+	}
 
-		if( d_tc_d_len_square < 1 * 1 )
-		{
-			mip= 0;
-			surface= GetFloorCeilingSurface<0>( cell );
-		}
-		else
-		{
-			if( d_tc_d_len_square < 2 * 2 )
-			{
-				mip= 1;
-				surface= GetFloorCeilingSurface<1>( cell );
-			}
-			else if( d_tc_d_len_square < 4 * 4 )
-			{
-				mip= 2;
-				surface= GetFloorCeilingSurface<2>( cell );
-			}
-			else
-			{
-				mip= 3;
-				surface= GetFloorCeilingSurface<3>( cell );
-			}
+	// Bucket sort by depth. Order inside bucket is not important.
+	const unsigned int c_buckets= 256u;
+	const float c_buckets_per_unit= 2.0f; // Enough for any distance inside map.
 
-			for( unsigned int i= 0u; i < polygon_vertex_count; i++ )
-			{
-				verties_projected[i].u >>= mip;
-				verties_projected[i].v >>= mip;
-			}
-		}
+	unsigned int bucket_offsets[ c_buckets + 1u ];
+	std::memset( bucket_offsets, 0, sizeof(bucket_offsets) );
 
-		rasterizer_.SetTexture(
-			surface->size[0], surface->size[1],
-			surface->GetData() );
+	const auto get_bucket=
+	[&]( const ModelsDrawListItem& item ) -> unsigned int
+	{
+		return static_cast<unsigned int>( std::max( 0.0f, std::min( item.depth * c_buckets_per_unit, float(c_buckets - 1u) ) ) );
+	};
 
-		rasterizer_.DrawTexturedConvexPolygonPerLineCorrected<
-			Rasterizer::DepthTest::No, Rasterizer::DepthWrite::Yes,
-			Rasterizer::AlphaTest::No,
-			Rasterizer::OcclusionTest::Yes, Rasterizer::OcclusionWrite::Yes>( verties_projected, polygon_vertex_count, is_ceiling );
+	for( const ModelsDrawListItem& item : models_draw_list_ )
+		bucket_offsets[ get_bucket( item ) + 1u ]++;
+	for( unsigned int i= 1u; i <= c_buckets; i++ )
+		bucket_offsets[i]+= bucket_offsets[ i - 1u ];
+
+	models_draw_list_sorted_.resize( models_draw_list_.size() );
+	for( const ModelsDrawListItem& item : models_draw_list_ )
+		models_draw_list_sorted_[ bucket_offsets[ get_bucket( item ) ]++ ]= item;
+}
+
+void MapDrawerSoft::DrawModelsList(
+	const ViewClipPlanes& view_clip_planes,
+	const m_Mat4& view_matrix,
+	const m_Vec3& camera_position,
+	const bool transparent )
+{
+	const auto draw_item=
+	[&]( const ModelsDrawListItem& item )
+	{
+		DrawModel(
+			*item.models_group, *item.models, item.model_id,
+			item.animation_frame,
+			view_clip_planes,
+			item.position, item.rotation_matrix,
+			view_matrix, camera_position,
+			item.visible_groups_mask,
+			transparent, item.force_transparent_nontransparent_polygons,
+			item.fullbright, item.submodel_id, item.color );
+	};
+
+	if( transparent )
+	{
+		for( unsigned int i= static_cast<unsigned int>( models_draw_list_sorted_.size() ); i > 0u; i-- )
+			draw_item( models_draw_list_sorted_[ i - 1u ] );
+		return;
+	}
 
-		// TODO - does this needs?
-		// Maybe update whole screen hierarchy after floors and ceilings?
-		rasterizer_.UpdateOcclusionHierarchy( verties_projected, polygon_vertex_count, false );
+	// Nearest models may occlude farther models. Rebuild depth hierarchy sometimes, with growing interval,
+	// because rebuilding is not free.
+	unsigned int next_hierarchy_rebuild= 4u;
+	for( unsigned int i= 0u; i < models_draw_list_sorted_.size(); i++ )
+	{
+		if( i == next_hierarchy_rebuild )
+		{
+			rasterizer_.BuildDepthBufferHierarchy();
+			next_hierarchy_rebuild*= 4u;
+		}
+		draw_item( models_draw_list_sorted_[i] );
 	}
 }
 
@@ -1643,8 +2773,7 @@ void MapDrawerSoft::DrawModel(
 
 	const m_Vec3 cam_pos_model_space= ( camera_position - position ) * inv_rotation_mat;
 
-	const unsigned int first_animation_vertex= model.animations_vertices.size() / model.frame_count * animation_frame;
-
+	unsigned int mip= 0u;
 	if( &models_group == &monsters_models_ && model_id == 0u )
 	{
 		// Detect player - set colored texture.
@@ -1654,13 +2783,57 @@ void MapDrawerSoft::DrawModel(
 	else
 	{
 		const ModelsGroup::ModelEntry& model_entry= models_group.models[ model_id ];
+
+		// Select one mip for whole model, using nearest bounding box point and average texture density of model.
+		if( w_min > 0.0f && model_entry.mip_count > 1u )
+		{
+			const float view_scale_x=
+				std::sqrt(
+					view_matrix.value[0] * view_matrix.value[0] +
+					view_matrix.value[4] * view_matrix.value[4] +
+					view_matrix.value[8] * view_matrix.value[8] );
+			const float pixels_per_unit= screen_transform_x_ * view_scale_x / w_min;
+			mip= std::min( TexelsPerPixelToMip( model_entry.texels_per_unit / pixels_per_unit ), model_entry.mip_count - 1u );
+		}
+
 		rasterizer_.SetTexture(
-			model_entry.texture_size[0], model_entry.texture_size[1],
-			models_group.textures_data.data() + model_entry.texture_data_offset );
+			model_entry.texture_size[0] >> mip, model_entry.texture_size[1] >> mip,
+			models_group.textures_data.data() + model_entry.mips_offsets[mip] );
 	}
+	const float tc_scale= 65536.0f / float( 1u << mip );
 
-	// TODO - make other branch, if clip_planes_transformed_count == 0
-	// Transform animation vertices, then rasterize trianglez directly, without clipping.
+	// Animation vertices of frame, decoded once.
+	const ModelVerticesCache& vertices_cache= GetModelVerticesCache( model );
+	const unsigned int vertex_count_padded= vertices_cache.vertex_count_padded;
+	if( vertex_count_padded == 0u )
+		return;
+	const float* const frame_x= vertices_cache.positions.data() + animation_frame * 3u * vertex_count_padded;
+	const float* const frame_y= frame_x + vertex_count_padded;
+	const float* const frame_z= frame_y + vertex_count_padded;
+
+	// If model is fully inside view, transform and project all vertices of frame in one pass, than draw triangles without clipping.
+	const bool use_transformed_vertices= clip_planes_transformed_count == 0u;
+	const fixed16_t* transformed_x= nullptr;
+	const fixed16_t* transformed_y= nullptr;
+	const fixed16_t* transformed_w= nullptr;
+	if( use_transformed_vertices )
+	{
+		if( model_vertices_transformed_.size() < 3u * vertex_count_padded )
+			model_vertices_transformed_.resize( 3u * vertex_count_padded );
+
+		fixed16_t* const out_x= model_vertices_transformed_.data();
+		fixed16_t* const out_y= out_x + vertex_count_padded;
+		fixed16_t* const out_w= out_y + vertex_count_padded;
+		TransformAndProjectVertices(
+			rasterizer_.GetSIMDLevel(),
+			frame_x, frame_y, frame_z, vertex_count_padded,
+			final_mat.value, screen_transform_x_, screen_transform_y_,
+			out_x, out_y, out_w );
+
+		transformed_x= out_x;
+		transformed_y= out_y;
+		transformed_w= out_w;
+	}
 
 	// TODO - use original QUADS from .3o/.car models.
 
@@ -1675,11 +2848,11 @@ void MapDrawerSoft::DrawModel(
 		for( unsigned int tv= 0u; tv < 3u; tv++ )
 		{
 			const Model::Vertex& vertex= model.vertices[ indeces[t + tv] ];
-			const Model::AnimationVertex& animation_vertex= model.animations_vertices[ first_animation_vertex + vertex.vertex_id ];
+			const unsigned int vertex_id= vertex.vertex_id;
 
-			clipped_vertices_[tv].pos= m_Vec3( float(animation_vertex.pos[0]), float(animation_vertex.pos[1]), float(animation_vertex.pos[2]) ) / 2048.0f;
-			clipped_vertices_[tv].tc.x= vertex.tex_coord[0] * float(base_model.texture_size[0]) * 65536.0f;
-			clipped_vertices_[tv].tc.y= vertex.tex_coord[1] * float(base_model.texture_size[1]) * 65536.0f;
+			clipped_vertices_[tv].pos= m_Vec3( frame_x[vertex_id], frame_y[vertex_id], frame_z[vertex_id] );
+			clipped_vertices_[tv].tc.x= vertex.tex_coord[0] * float(base_model.texture_size[0]) * tc_scale;
+			clipped_vertices_[tv].tc.y= vertex.tex_coord[1] * float(base_model.texture_size[1]) * tc_scale;
 
 			triangle_center+= clipped_vertices_[tv].pos;
 		}
@@ -1690,6 +2863,41 @@ void MapDrawerSoft::DrawModel(
 			if( mVec3Cross( v0, v1 ) * vec_to_cam < 0.0f )
 				continue;
 		}
+
+		fixed16_t light= g_fixed16_one;
+		if( !fullbright )
+		{
+			triangle_center*= 1.0f / 3.0f;
+			const m_Vec2 triangle_center_world_space= ( triangle_center * to_world_mat ).xy();
+			const unsigned int lightmap_x= static_cast<unsigned int>( triangle_center_world_space.x * float(MapData::c_lightmap_scale) );
+			const unsigned int lightmap_y= static_cast<unsigned int>( triangle_center_world_space.y * float(MapData::c_lightmap_scale) );
+
+			if( lightmap_x < MapData::c_lightmap_size && lightmap_y < MapData::c_lightmap_size )
+				light= ScaleLightmapLight( current_map_data_->lightmap[ lightmap_x + lightmap_y * MapData::c_lightmap_size ] );
+		}
+
+		const bool triangle_needs_alpha_test= first_vertex.alpha_test_mask != 0u;
+		const Rasterizer::TriangleDrawFunc triangle_func= triangle_needs_alpha_test ? alpha_draw_func : draw_func;
+
+		if( use_transformed_vertices )
+		{
+			RasterizerVertex traingle_vertices[3];
+			for( unsigned int tv= 0u; tv < 3u; tv++ )
+			{
+				const unsigned int vertex_id= model.vertices[ indeces[t + tv] ].vertex_id;
+				RasterizerVertex& out_v= traingle_vertices[tv];
+				out_v.x= transformed_x[vertex_id];
+				out_v.y= transformed_y[vertex_id];
+				out_v.z= transformed_w[vertex_id];
+				out_v.u= fixed16_t( clipped_vertices_[tv].tc.x );
+				out_v.v= fixed16_t( clipped_vertices_[tv].tc.y );
+			}
+
+			rasterizer_.SetLight( light );
+			rasterizer_.DrawTriangle( triangle_func, traingle_vertices );
+			continue;
+		}
+
 		clipped_vertices_[0].next= &clipped_vertices_[1];
 		clipped_vertices_[1].next= &clipped_vertices_[2];
 		clipped_vertices_[2].next= &clipped_vertices_[0];
@@ -1728,33 +2936,48 @@ void MapDrawerSoft::DrawModel(
 			out_v.z= fixed16_t( w * 65536.0f );
 		}
 
-		fixed16_t light= g_fixed16_one;
-		if( !fullbright )
-		{
-			triangle_center*= 1.0f / 3.0f;
-			const m_Vec2 triangle_center_world_space= ( triangle_center * to_world_mat ).xy();
-			const unsigned int lightmap_x= static_cast<unsigned int>( triangle_center_world_space.x * float(MapData::c_lightmap_scale) );
-			const unsigned int lightmap_y= static_cast<unsigned int>( triangle_center_world_space.y * float(MapData::c_lightmap_scale) );
-
-			if( lightmap_x < MapData::c_lightmap_size && lightmap_y < MapData::c_lightmap_size )
-				light= ScaleLightmapLight( current_map_data_->lightmap[ lightmap_x + lightmap_y * MapData::c_lightmap_size ] );
-		}
 		rasterizer_.SetLight( light );
 
-		const bool triangle_needs_alpha_test= first_vertex.alpha_test_mask != 0u;
-		const Rasterizer::TriangleDrawFunc triangle_func= triangle_needs_alpha_test ? alpha_draw_func : draw_func;
-
 		RasterizerVertex traingle_vertices[3];
 		traingle_vertices[0]= verties_projected[0];
 		for( unsigned int i= 0u; i < polygon_vertex_count - 2u; i++ )
 		{
 			traingle_vertices[1]= verties_projected[ i + 1u ];
 			traingle_vertices[2]= verties_projected[ i + 2u ];
-			(rasterizer_.*triangle_func)( traingle_vertices );
+			rasterizer_.DrawTriangle( triangle_func, traingle_vertices );
 		}
 	} // for model triangles
 }
 
+const MapDrawerSoft::ModelVerticesCache& MapDrawerSoft::GetModelVerticesCache( const Submodel& model )
+{
+	ModelVerticesCache& cache= models_vertices_cache_[ &model ];
+	if( !cache.positions.empty() || model.frame_count == 0u )
+		return cache;
+
+	const unsigned int vertex_count= model.animations_vertices.size() / model.frame_count;
+	if( vertex_count == 0u )
+		return cache; // Empty cache, model can not be drawn.
+
+	cache.vertex_count_padded= PadVerticesCount( vertex_count );
+	cache.positions.resize( 3u * cache.vertex_count_padded * model.frame_count );
+
+	for( unsigned int f= 0u; f < model.frame_count; f++ )
+	{
+		float* const dst= cache.positions.data() + f * 3u * cache.vertex_count_padded;
+		const Model::AnimationVertex* const src= model.animations_vertices.data() + f * vertex_count;
+		for( unsigned int v= 0u; v < cache.vertex_count_padded; v++ )
+		{
+			// Fill padding with copies of first vertex, for prevention of division by zero in transformation.
+			const Model::AnimationVertex& animation_vertex= src[ v < vertex_count ? v : 0u ];
+			for( unsigned int j= 0u; j < 3u; j++ )
+				dst[ v + j * cache.vertex_count_padded ]= float(animation_vertex.pos[j]) / 2048.0f;
+		}
+	}
+
+	return cache;
+}
+
 void MapDrawerSoft::DrawModelShadow(
 	const Model& base_model,
 	const unsigned int animation_frame,
@@ -1993,6 +3216,51 @@ void MapDrawerSoft::DrawSky(
 
 	constexpr int c_repeat_x= 5;
 	constexpr int c_repeat_y= 3;
+
+	if( settings_.GetOrSetBool( SettingsKeys::software_sky_panorama, true ) )
+	{
+		// Sky texture is already cylindrical panorama - texture coordinates depend only on view direction.
+		// So, calculate it directly for each pixel, instead of sky polygons drawing.
+		// Rows of direction to clip space ( x, y, w ) matrix. Camera translation does not affect directions.
+		const float* const m= matrix.value;
+		const float direction_to_clip[9]=
+		{
+			m[0], m[4], m[ 8],
+			m[1], m[5], m[ 9],
+			m[3], m[7], m[11],
+		};
+
+		Rasterizer::SkyPanorama& sky= sky_panorama_;
+		if( !BuildScreenInverseTransform( direction_to_clip, screen_transform_x_, screen_transform_y_, sky.screen_to_direction ) )
+			return;
+
+		// Select mip, using angular size of pixel in screen center.
+		const float center[2]= { screen_transform_x_, screen_transform_y_ };
+		float dir[2][3];
+		for( unsigned int i= 0u; i < 2u; i++ )
+		for( unsigned int j= 0u; j < 3u; j++ )
+		{
+			const float* const row= sky.screen_to_direction + j * 3u;
+			dir[i][j]= row[0] * ( center[0] + float(i) ) + row[1] * center[1] + row[2];
+		}
+		const m_Vec3 dir0( dir[0][0], dir[0][1], dir[0][2] );
+		const m_Vec3 dir1( dir[1][0], dir[1][1], dir[1][2] );
+		const float pixel_angle= std::atan2( mVec3Cross( dir0, dir1 ).Length(), dir0 * dir1 );
+
+		const float u_scale= float( sky_texture_.size[0] * c_repeat_x ) / Constants::two_pi;
+		const float v_scale= float( sky_texture_.size[1] * c_repeat_y ) / Constants::half_pi;
+		const unsigned int mip= std::min( TexelsPerPixelToMip( pixel_angle * std::max( u_scale, v_scale ) ), sky_texture_.mip_count - 1u );
+
+		sky.u_scale= u_scale / float( 1u << mip );
+		sky.v_scale= v_scale / float( 1u << mip );
+		sky.texture_size[0]= sky_texture_.size[0] >> mip;
+		sky.texture_size[1]= sky_texture_.size[1] >> mip;
+		sky.texture_data= sky_texture_.data.data() + sky_texture_.mips_offsets[mip];
+
+		rasterizer_.DrawSkyPanorama( sky );
+		return;
+	}
+
 	constexpr int c_x_polygons= c_repeat_x * 4;
 	constexpr int c_y_polygons= c_repeat_y * 3;
 	constexpr int c_y_polygons_start= -1; // TODO - does this need ? maybe, sky abowe horizont should be enough?
@@ -2001,9 +3269,8 @@ void MapDrawerSoft::DrawSky(
 	const fixed16_t tex_size_x= fixed16_t( sky_texture_.size[0] << 16u );
 	const fixed16_t tex_size_y= fixed16_t( sky_texture_.size[1] << 16u );
 
-	rasterizer_.SetTexture(
-		sky_texture_.size[0], sky_texture_.size[1],
-		sky_texture_.data.data() );
+	// Mip is selected for each polygon, but texture is changed only if mip is changed.
+	unsigned int current_mip= ~0u;
 
 	// TODO - optimize this
 	// 180 quads is too many for sky.
@@ -2075,6 +3342,15 @@ void MapDrawerSoft::DrawSky(
 		if( rasterizer_.IsOccluded( verties_projected, polygon_vertex_count ) )
 			continue;
 
+		const unsigned int mip= SelectPolygonMip( verties_projected, polygon_vertex_count, sky_texture_.mip_count );
+		if( mip != current_mip )
+		{
+			current_mip= mip;
+			rasterizer_.SetTexture(
+				sky_texture_.size[0] >> mip, sky_texture_.size[1] >> mip,
+				sky_texture_.data.data() + sky_texture_.mips_offsets[mip] );
+		}
+
 		rasterizer_.DrawTexturedConvexPolygonSpanCorrected<
 			Rasterizer::DepthTest::No, Rasterizer::DepthWrite::No,
 			Rasterizer::AlphaTest::No,
@@ -2161,10 +3437,14 @@ void MapDrawerSoft::DrawEffectsSprites(
 			out_v.z= fixed16_t( w * 65536.0f );
 		}
 
+		const unsigned int mip= SelectPolygonMip( verties_projected, polygon_vertex_count, sprite_texture.mip_count );
+		const unsigned int mip_size_x= sprite_texture.size[0] >> mip;
+		const unsigned int mip_size_y= sprite_texture.size[1] >> mip;
+
 		const unsigned int frame= static_cast<unsigned int>( sprite.frame ) % sprite_texture.size[2];
 		rasterizer_.SetTexture(
-			sprite_texture.size[0], sprite_texture.size[1],
-			sprite_texture.data.data() + sprite_texture.size[0] * sprite_texture.size[1] * frame );
+			mip_size_x, mip_size_y,
+			sprite_texture.data.data() + sprite_texture.mips_offsets[mip] + mip_size_x * mip_size_y * frame );
 
 		Rasterizer::ConvexPolygonDrawFunc draw_func;
 
@@ -2192,7 +3472,7 @@ void MapDrawerSoft::DrawEffectsSprites(
 					Rasterizer::OcclusionTest::No, Rasterizer::OcclusionWrite::No,
 					Rasterizer::Lighting::No, Rasterizer::Blending::Yes>;
 
-		(rasterizer_.*draw_func)( verties_projected, polygon_vertex_count, false );
+		rasterizer_.DrawConvexPolygon( draw_func, verties_projected, polygon_vertex_count, false );
 	}
 }
 
@@ -2287,9 +3567,13 @@ void MapDrawerSoft::DrawBMPObjectsSprites(
 		const unsigned int phase= GetModelBMPSpritePhase( model );
 		const unsigned int frame= static_cast<unsigned int>( sprites_frame + phase ) % sprite_picture.frame_count;
 
+		const unsigned int mip= SelectPolygonMip( verties_projected, polygon_vertex_count, sprite_texture.mip_count );
+		const unsigned int mip_size_x= sprite_texture.size[0] >> mip;
+		const unsigned int mip_size_y= sprite_texture.size[1] >> mip;
+
 		rasterizer_.SetTexture(
-			sprite_texture.size[0], sprite_texture.size[1],
-			sprite_texture.data.data() + sprite_texture.size[0] * sprite_texture.size[1] * frame );
+			mip_size_x, mip_size_y,
+			sprite_texture.data.data() + sprite_texture.mips_offsets[mip] + mip_size_x * mip_size_y * frame );
 
 		rasterizer_.DrawTexturedConvexPolygonSpanCorrected<
 			Rasterizer::DepthTest::Yes, Rasterizer::DepthWrite::Yes,
@@ -2388,39 +3672,89 @@ unsigned int MapDrawerSoft::ClipPolygon(
 	return vertex_count - vertices_behind + 2u;
 }
 
-template<unsigned int mip>
-const SurfacesCache::Surface* MapDrawerSoft::GetWallSurface( DrawWall& wall )
+SurfacesCache::Surface* MapDrawerSoft::AllocateWallSurface( DrawWall& wall, const unsigned int mip )
 {
 	PC_ASSERT( mip < 4u );
 	PC_ASSERT( wall.texture_id < MapData::c_max_walls_textures );
-
-	if( wall.mips_surfaces[mip] != nullptr )
-		return wall.mips_surfaces[mip];
+	PC_ASSERT( wall.mips_surfaces[mip] == nullptr );
 
 	const WallTexture& texture= wall_textures_[wall.texture_id];
 
 	// Do not generate cache pixels for alpha-texels.
 	// TODO - maybe cut surface below full_alpha_row[0] too?
-	const unsigned int y_start= texture.full_alpha_row[0] >> mip;
 	const unsigned int y_end= ( texture.full_alpha_row[1] + ( (1u << mip) - 1u ) ) >> mip;
 
 	const unsigned int surface_height= y_end;
 	const unsigned int surface_width = wall.surface_width >> mip;
-	const unsigned int lightmap_x_shift= ( wall.surface_width == 128u ? 4u : 3u ) - mip;
 
 	surfaces_cache_.AllocateSurface( surface_width, surface_height, &wall.mips_surfaces[mip] );
-	SurfacesCache::Surface* const surface= wall.mips_surfaces[mip];
-	uint32_t* const out_data= surface->GetData();
-
-	const uint32_t* in_data;
-	if( mip == 0u )
-		in_data= texture.mip0;
-	if( mip == 1u )
-		in_data= texture.mips[0];
-	if( mip == 2u )
-		in_data= texture.mips[1];
-	if( mip == 3u )
-		in_data= texture.mips[2];
+	return wall.mips_surfaces[mip];
+}
+
+SurfacesCache::Surface* MapDrawerSoft::AllocateFloorCeilingSurface( FloorCeilingCell& cell, const unsigned int mip )
+{
+	PC_ASSERT( mip < 4u );
+	PC_ASSERT( cell.mips_surfaces[mip] == nullptr );
+
+	const unsigned int texture_size= MapData::c_floor_texture_size >> mip;
+
+	surfaces_cache_.AllocateSurface( texture_size, texture_size, &cell.mips_surfaces[mip] );
+	return cell.mips_surfaces[mip];
+}
+
+const SurfacesCache::Surface* MapDrawerSoft::GetWallSurface( DrawWall& wall, const unsigned int mip )
+{
+	PC_ASSERT( mip < 4u );
+
+	if( wall.mips_surfaces[mip] != nullptr )
+	{
+		surfaces_cache_.MarkSurfaceUsed( *wall.mips_surfaces[mip] );
+		return wall.mips_surfaces[mip];
+	}
+
+	SurfacesCache::Surface* const surface= AllocateWallSurface( wall, mip );
+	if( indexed_surfaces_ )
+		(this->*c_wall_surface_indexed_generation_funcs[mip])( wall, *surface );
+	else
+		(this->*c_wall_surface_generation_funcs[mip])( wall, *surface );
+	return surface;
+}
+
+const SurfacesCache::Surface* MapDrawerSoft::GetFloorCeilingSurface( FloorCeilingCell& cell, const unsigned int mip )
+{
+	PC_ASSERT( mip < 4u );
+
+	if( cell.mips_surfaces[mip] != nullptr )
+	{
+		surfaces_cache_.MarkSurfaceUsed( *cell.mips_surfaces[mip] );
+		return cell.mips_surfaces[mip];
+	}
+
+	SurfacesCache::Surface* const surface= AllocateFloorCeilingSurface( cell, mip );
+	if( indexed_surfaces_ )
+		(this->*c_floor_ceiling_surface_indexed_generation_funcs[mip])( cell, *surface );
+	else
+		(this->*c_floor_ceiling_surface_generation_funcs[mip])( cell, *surface );
+	return surface;
+}
+
+template<unsigned int mip>
+void MapDrawerSoft::GenerateWallSurface( const DrawWall& wall, SurfacesCache::Surface& surface ) const
+{
+	PC_ASSERT( mip < 4u );
+	PC_ASSERT( wall.texture_id < MapData::c_max_walls_textures );
+
+	const WallTexture& texture= wall_textures_[wall.texture_id];
+
+	const unsigned int y_start= texture.full_alpha_row[0] >> mip;
+	const unsigned int y_end= surface.size[1];
+
+	const unsigned int surface_width = surface.size[0];
+	const unsigned int lightmap_x_shift= ( wall.surface_width == 128u ? 4u : 3u ) - mip;
+
+	uint32_t* const out_data= surface.GetData();
+
+	const uint32_t* const in_data= texture.mips[mip];
 
 	const unsigned int texture_width= texture.size[0] >> mip;
 	const unsigned int texture_x_wrap_mask= texture_width - 1u;
@@ -2446,18 +3780,12 @@ const SurfacesCache::Surface* MapDrawerSoft::GetWallSurface( DrawWall& wall )
 
 		std::memcpy( &out_data[ x + y * surface_width ], components, sizeof(uint32_t) );
 	}
-
-	return surface;
 }
 
 template<unsigned int mip>
-const SurfacesCache::Surface* MapDrawerSoft::GetFloorCeilingSurface( FloorCeilingCell& cell )
+void MapDrawerSoft::GenerateFloorCeilingSurface( const FloorCeilingCell& cell, SurfacesCache::Surface& surface ) const
 {
 	PC_ASSERT( mip < 4u );
-
-	if( cell.mips_surfaces[mip] != nullptr )
-		return cell.mips_surfaces[mip];
-
 	PC_ASSERT( cell.xy[0] < MapData::c_map_size );
 	PC_ASSERT( cell.xy[1] < MapData::c_map_size );
 	PC_ASSERT( cell.texture_id < MapData::c_floors_textures_count );
@@ -2465,19 +3793,10 @@ const SurfacesCache::Surface* MapDrawerSoft::GetFloorCeilingSurface( FloorCeilin
 	const unsigned int texture_size= MapData::c_floor_texture_size >> mip;
 	const unsigned int monolighted_block_size= ( MapData::c_floor_texture_size / MapData::c_lightmap_scale ) >> mip;
 
-	surfaces_cache_.AllocateSurface( texture_size, texture_size, &cell.mips_surfaces[mip] );
-	SurfacesCache::Surface* const surface= cell.mips_surfaces[mip];
-	uint32_t* const out_data= surface->GetData();
-
-	const uint32_t* in_data;
-	if( mip == 0u )
-		in_data= floor_textures_[cell.texture_id].data;
-	if( mip == 1u )
-		in_data= floor_textures_[cell.texture_id].mip1;
-	if( mip == 2u )
-		in_data= floor_textures_[cell.texture_id].mip2;
-	if( mip == 3u )
-		in_data= floor_textures_[cell.texture_id].mip3;
+	PC_ASSERT( surface.size[0] == texture_size && surface.size[1] == texture_size );
+	uint32_t* const out_data= surface.GetData();
+
+	const uint32_t* const in_data= floor_textures_[cell.texture_id].mips[mip];
 
 	for( unsigned int lightmap_cell_y= 0u; lightmap_cell_y < MapData::c_lightmap_scale; lightmap_cell_y++ )
 	for( unsigned int lightmap_cell_x= 0u; lightmap_cell_x < MapData::c_lightmap_scale; lightmap_cell_x++ )
@@ -2506,8 +3825,147 @@ const SurfacesCache::Surface* MapDrawerSoft::GetFloorCeilingSurface( FloorCeilin
 			std::memcpy( &out_data[ texel_address ], components, sizeof(uint32_t) );
 		}
 	} // for lightmap cells
+}
 
-	return surface;
+template<unsigned int mip>
+void MapDrawerSoft::GenerateWallSurfaceIndexed( const DrawWall& wall, SurfacesCache::Surface& surface ) const
+{
+	PC_ASSERT( mip < 4u );
+	PC_ASSERT( wall.texture_id < MapData::c_max_walls_textures );
+
+	const WallTexture& texture= wall_textures_[wall.texture_id];
+
+	const unsigned int y_start= texture.full_alpha_row[0] >> mip;
+	const unsigned int y_end= surface.size[1];
+
+	const unsigned int surface_width = surface.size[0];
+	const unsigned int lightmap_x_shift= ( wall.surface_width == 128u ? 4u : 3u ) - mip;
+
+	uint8_t* const out_data= surface.GetDataIndexed();
+	const uint8_t* const in_data= texture.indexed_mips[mip];
+
+	const unsigned int texture_width= texture.size[0] >> mip;
+	const unsigned int texture_x_wrap_mask= texture_width - 1u;
+
+	for( unsigned int y= y_start; y < y_end; y++ )
+	for( unsigned int x= 0u; x < surface_width ; x++ )
+	{
+		const unsigned char* const colormap= light_colormap_[ wall.lightmap[ x >> lightmap_x_shift ] ];
+		out_data[ x + y * surface_width ]= colormap[ in_data[ ( x & texture_x_wrap_mask ) + y * texture_width ] ];
+	}
+}
+
+template<unsigned int mip>
+void MapDrawerSoft::GenerateFloorCeilingSurfaceIndexed( const FloorCeilingCell& cell, SurfacesCache::Surface& surface ) const
+{
+	PC_ASSERT( mip < 4u );
+	PC_ASSERT( cell.xy[0] < MapData::c_map_size );
+	PC_ASSERT( cell.xy[1] < MapData::c_map_size );
+	PC_ASSERT( cell.texture_id < MapData::c_floors_textures_count );
+
+	const unsigned int texture_size= MapData::c_floor_texture_size >> mip;
+	const unsigned int monolighted_block_size= ( MapData::c_floor_texture_size / MapData::c_lightmap_scale ) >> mip;
+
+	PC_ASSERT( surface.size[0] == texture_size && surface.size[1] == texture_size );
+	uint8_t* const out_data= surface.GetDataIndexed();
+	const uint8_t* const in_data= floor_textures_[cell.texture_id].indexed_mips[mip];
+
+	for( unsigned int lightmap_cell_y= 0u; lightmap_cell_y < MapData::c_lightmap_scale; lightmap_cell_y++ )
+	for( unsigned int lightmap_cell_x= 0u; lightmap_cell_x < MapData::c_lightmap_scale; lightmap_cell_x++ )
+	{
+		const unsigned int lightmap_global_x= lightmap_cell_x + MapData::c_lightmap_scale * cell.xy[0];
+		const unsigned int lightmap_global_y= lightmap_cell_y + MapData::c_lightmap_scale * cell.xy[1];
+
+		const unsigned char lightmap_value= current_map_data_->lightmap[ lightmap_global_x + lightmap_global_y * MapData::c_lightmap_size ];
+		const unsigned char* const colormap= light_colormap_[ lightmap_value ];
+
+		for( unsigned int texel_y= 0u; texel_y < monolighted_block_size; texel_y++ )
+		for( unsigned int texel_x= 0u; texel_x < monolighted_block_size; texel_x++ )
+		{
+			const unsigned int texture_x= texel_x + lightmap_cell_x * monolighted_block_size;
+			const unsigned int texture_y= texel_y + lightmap_cell_y * monolighted_block_size;
+			const unsigned int texel_address= texture_x + texture_y * texture_size;
+			out_data[ texel_address ]= colormap[ in_data[ texel_address ] ];
+		}
+	} // for lightmap cells
+}
+
+template<
+	Rasterizer::DepthTest depth_test, Rasterizer::DepthWrite depth_write,
+	Rasterizer::AlphaTest alpha_test,
+	Rasterizer::OcclusionTest occlusion_test, Rasterizer::OcclusionWrite occlusion_write>
+void MapDrawerSoft::DrawSurfacePolygonSpanCorrected(
+	const SurfacesCache::Surface& surface,
+	const RasterizerVertex* const vertices, const unsigned int vertex_count, const bool is_anticlockwise )
+{
+	if( indexed_surfaces_ )
+	{
+		rasterizer_.SetIndexedTexture( surface.size[0], surface.size[1], surface.GetDataIndexed(), rendering_context_.palette_transformed->data() );
+		rasterizer_.DrawTexturedConvexPolygonSpanCorrected<
+			depth_test, depth_write, alpha_test, occlusion_test, occlusion_write,
+			Rasterizer::Lighting::No, Rasterizer::Blending::No, Rasterizer::IndexedTexture::Yes>( vertices, vertex_count, is_anticlockwise );
+	}
+	else
+	{
+		rasterizer_.SetTexture( surface.size[0], surface.size[1], surface.GetData() );
+		rasterizer_.DrawTexturedConvexPolygonSpanCorrected<
+			depth_test, depth_write, alpha_test, occlusion_test, occlusion_write>( vertices, vertex_count, is_anticlockwise );
+	}
+}
+
+template<
+	Rasterizer::DepthTest depth_test, Rasterizer::DepthWrite depth_write,
+	Rasterizer::AlphaTest alpha_test,
+	Rasterizer::OcclusionTest occlusion_test, Rasterizer::OcclusionWrite occlusion_write>
+void MapDrawerSoft::DrawSurfacePolygonPerLineCorrected(
+	const SurfacesCache::Surface& surface,
+	const RasterizerVertex* const vertices, const unsigned int vertex_count, const bool is_anticlockwise )
+{
+	if( indexed_surfaces_ )
+	{
+		rasterizer_.SetIndexedTexture( surface.size[0], surface.size[1], surface.GetDataIndexed(), rendering_context_.palette_transformed->data() );
+		rasterizer_.DrawTexturedConvexPolygonPerLineCorrected<
+			depth_test, depth_write, alpha_test, occlusion_test, occlusion_write,
+			Rasterizer::Lighting::No, Rasterizer::Blending::No, Rasterizer::IndexedTexture::Yes>( vertices, vertex_count, is_anticlockwise );
+	}
+	else
+	{
+		rasterizer_.SetTexture( surface.size[0], surface.size[1], surface.GetData() );
+		rasterizer_.DrawTexturedConvexPolygonPerLineCorrected<
+			depth_test, depth_write, alpha_test, occlusion_test, occlusion_write>( vertices, vertex_count, is_anticlockwise );
+	}
 }
 
+const MapDrawerSoft::WallSurfaceGenerationFunc MapDrawerSoft::c_wall_surface_generation_funcs[4]=
+{
+	&MapDrawerSoft::GenerateWallSurface<0u>,
+	&MapDrawerSoft::GenerateWallSurface<1u>,
+	&MapDrawerSoft::GenerateWallSurface<2u>,
+	&MapDrawerSoft::GenerateWallSurface<3u>,
+};
+
+const MapDrawerSoft::FloorCeilingSurfaceGenerationFunc MapDrawerSoft::c_floor_ceiling_surface_generation_funcs[4]=
+{
+	&MapDrawerSoft::GenerateFloorCeilingSurface<0u>,
+	&MapDrawerSoft::GenerateFloorCeilingSurface<1u>,
+	&MapDrawerSoft::GenerateFloorCeilingSurface<2u>,
+	&MapDrawerSoft::GenerateFloorCeilingSurface<3u>,
+};
+
+const MapDrawerSoft::WallSurfaceGenerationFunc MapDrawerSoft::c_wall_surface_indexed_generation_funcs[4]=
+{
+	&MapDrawerSoft::GenerateWallSurfaceIndexed<0u>,
+	&MapDrawerSoft::GenerateWallSurfaceIndexed<1u>,
+	&MapDrawerSoft::GenerateWallSurfaceIndexed<2u>,
+	&MapDrawerSoft::GenerateWallSurfaceIndexed<3u>,
+};
+
+const MapDrawerSoft::FloorCeilingSurfaceGenerationFunc MapDrawerSoft::c_floor_ceiling_surface_indexed_generation_funcs[4]=
+{
+	&MapDrawerSoft::GenerateFloorCeilingSurfaceIndexed<0u>,
+	&MapDrawerSoft::GenerateFloorCeilingSurfaceIndexed<1u>,
+	&MapDrawerSoft::GenerateFloorCeilingSurfaceIndexed<2u>,
+	&MapDrawerSoft::GenerateFloorCeilingSurfaceIndexed<3u>,
+};
+
 } // PanzerChasm
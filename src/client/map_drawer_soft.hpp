@@ -1,18 +1,44 @@
 #pragma once
+#include <chrono>
+#include <unordered_map>
 
 #include "../map_loader.hpp"
 #include "../model.hpp"
 #include "../rendering_context.hpp"
 #include "fwd.hpp"
 #include "i_map_drawer.hpp"
-#include "software_renderer/rasterizer.hpp"
+#include "software_renderer/map_bsp_tree.hpp"
+#include "software_renderer/rasterizer_bands.hpp"
 #include "software_renderer/surfaces_cache.hpp"
+#include "software_renderer/tasks_pool.hpp"
 
 namespace PanzerChasm
 {
 
 class MapDrawerSoft final : public IMapDrawer
 {
+public:
+	// Times of map drawing stages, in milliseconds.
+	struct StagesTimes
+	{
+		enum Stage : unsigned int
+		{
+			Surfaces,
+			Walls,
+			Floors,
+			Sky,
+			Hierarchy,
+			Models,
+			Shadows,
+			Sprites,
+			StageCount,
+		};
+
+		static const char* const c_stage_names[ StageCount ];
+
+		double time_ms[ StageCount ];
+	};
+
 public:
 	MapDrawerSoft(
 		Settings& settings,
@@ -43,24 +69,36 @@ public:
 
 	virtual void DoFullscreenPostprocess( const MapState& map_state ) override;
 
+	virtual const char* GetStatus() const override;
+	virtual void PrintStats() const override;
+
 	virtual void DrawMapRelatedModels(
 		const MapRelatedModel* models, unsigned int model_count,
 		const m_Mat4& view_rotation_and_projection_matrix,
 		const m_Vec3& camera_position,
 		const ViewClipPlanes& view_clip_planes ) override;
 
+	// If profiling enabled, rasterizer commands are flushed after each stage, for correct stages times.
+	void SetProfilingEnabled( bool enabled );
+	const StagesTimes& GetLastFrameStagesTimes() const;
+
 private:
+	// Mips count for sprites, sky and models textures. Same, as for walls and floors.
+	static constexpr unsigned int c_textures_max_mips= 4u;
+
 	struct ModelsGroup
 	{
 		struct ModelEntry
 		{
 			unsigned int texture_size[2];
 			unsigned int texture_data_offset; // in pixels
+			unsigned int mip_count;
+			unsigned int mips_offsets[ c_textures_max_mips ]; // in pixels, mip 0 offset is equal to "texture_data_offset".
+			float texels_per_unit; // Average texture density of model surface, used for mip selection.
 		};
 
 		std::vector<ModelEntry> models;
 
-		// TODO - add mips support
 		std::vector<uint32_t> textures_data;
 	};
 
@@ -80,13 +118,15 @@ private:
 		SurfacesCache::Surface* mips_surfaces[4];
 	};
 
+	// Only one of 32bit or indexed mips is stored, depending on surfaces format.
 	struct FloorTexture
 	{
-		// TODO - do not store mip0 32bit texture.
-		uint32_t data[ MapData::c_floor_texture_size * MapData::c_floor_texture_size ];
-		uint32_t mip1[ MapData::c_floor_texture_size * MapData::c_floor_texture_size /  4u ];
-		uint32_t mip2[ MapData::c_floor_texture_size * MapData::c_floor_texture_size / 16u ];
-		uint32_t mip3[ MapData::c_floor_texture_size * MapData::c_floor_texture_size / 64u ];
+		std::vector<uint32_t> data;
+		uint32_t* mips[4];
+
+		// Palette indices of all mips. Used only with indexed surfaces.
+		std::vector<uint8_t> data_indexed;
+		uint8_t* indexed_mips[4];
 	};
 
 	struct WallTexture
@@ -96,18 +136,22 @@ private:
 		unsigned char full_alpha_row[2];
 		bool has_alpha; // Except low and bottom rejected rows.
 
-		// TODO - do not store mip0 32bit texture.
+		// Only one of 32bit or indexed mips is stored, depending on surfaces format.
 		std::vector<uint32_t> data;
-		uint32_t* mip0;
-		uint32_t* mips[3]; // 1, 2, 3
+		uint32_t* mips[4];
+
+		// Palette indices of all mips. Used only with indexed surfaces.
+		std::vector<uint8_t> data_indexed;
+		uint8_t* indexed_mips[4];
 	};
 
 	struct SkyTexture
 	{
 		char file_name[32];
 		unsigned int size[2];
+		unsigned int mip_count;
+		unsigned int mips_offsets[ c_textures_max_mips ];
 
-		// TODO - add mips support.
 		// TODO - do not store mip0 32bit texture.
 		std::vector<uint32_t> data;
 	};
@@ -115,8 +159,9 @@ private:
 	struct SpriteTexture
 	{
 		unsigned int size[3]; // Contains several frames
+		unsigned int mip_count;
+		unsigned int mips_offsets[ c_textures_max_mips ]; // Each mip contains all frames.
 
-		// TODO - add mips support.
 		// TODO - do not store mip0 32bit texture.
 		std::vector<uint32_t> data;
 	};
@@ -133,6 +178,43 @@ private:
 		std::vector<uint32_t> data;
 	};
 
+	// Surface allocated, but not yet generated. Only one of "wall", "cell" is not null.
+	struct SurfaceGenerationTask
+	{
+		SurfacesCache::Surface* surface;
+		DrawWall* wall;
+		FloorCeilingCell* cell;
+		unsigned int mip;
+	};
+
+	// Animation vertices of model, converted into floats. For each frame there are arrays of x, y, z, padded for SIMD transformation.
+	// Cache of model without vertices is empty, with zero "vertex_count_padded".
+	struct ModelVerticesCache
+	{
+		unsigned int vertex_count_padded= 0u;
+		std::vector<float> positions;
+	};
+
+	// Parameters of "DrawModel" call, collected for sorting.
+	struct ModelsDrawListItem
+	{
+		const ModelsGroup* models_group;
+		const std::vector<Model>* models;
+		unsigned int model_id;
+		unsigned int animation_frame;
+		unsigned int submodel_id;
+		m_Vec3 position;
+		m_Mat4 rotation_matrix;
+		float depth; // Distance along view direction.
+		unsigned char visible_groups_mask;
+		unsigned char color;
+		bool force_transparent_nontransparent_polygons;
+		bool fullbright;
+	};
+
+	typedef void (MapDrawerSoft::*WallSurfaceGenerationFunc)( const DrawWall&, SurfacesCache::Surface& ) const;
+	typedef void (MapDrawerSoft::*FloorCeilingSurfaceGenerationFunc)( const FloorCeilingCell&, SurfacesCache::Surface& ) const;
+
 private:
 	void LoadModelsGroup( const std::vector<Model>& models, ModelsGroup& out_group );
 	void LoadWallsTextures( const MapData& map_data );
@@ -141,6 +223,43 @@ private:
 	void LoadFloorsAndCeilings( const MapData& map_data );
 	TextureView GetPlayerTexture( unsigned char color );
 
+	// Generate in parallel surfaces for visible walls and floors before drawing.
+	// Also generate surfaces for predicted view, using camera rotation speed.
+	void PrepareSurfaces(
+		const m_Mat4& view_rotation_and_projection_matrix,
+		const m_Vec3& camera_position,
+		const ViewClipPlanes& view_clip_planes );
+
+	// Allocates surfaces and adds generation tasks for walls and floors, visible in given view.
+	void CollectViewSurfaces(
+		const m_Mat4& matrix,
+		const m_Vec2& camera_position_xy,
+		const ViewClipPlanes& view_clip_planes,
+		unsigned int& pixels_budget );
+
+	// Returns vertex count after clipping, or zero, if segment is invisible.
+	// Texture coordinates of result vertices are scaled for result mip.
+	template< bool is_dynamic_wall >
+	unsigned int ProjectWallSegment(
+		const DrawWall& wall,
+		const m_Vec2& vert_pos0, const m_Vec2& vert_pos1, float z,
+		float tc_0, float tc_1,
+		const m_Mat4& matrix,
+		const m_Vec2& camera_position_xy,
+		const ViewClipPlanes& view_clip_planes,
+		RasterizerVertex* out_vertices,
+		unsigned int& out_mip,
+		bool& out_is_back );
+
+	// Returns vertex count after clipping, or zero, if cell is invisible.
+	unsigned int ProjectFloorCeilingCell(
+		const FloorCeilingCell& cell,
+		bool is_ceiling,
+		const m_Mat4& matrix,
+		const ViewClipPlanes& view_clip_planes,
+		RasterizerVertex* out_vertices,
+		unsigned int& out_mip );
+
 	template< bool is_dynamic_wall >
 	void DrawWallSegment(
 		DrawWall& wall,
@@ -151,7 +270,35 @@ private:
 		const ViewClipPlanes& view_clip_planes );
 
 	void DrawWalls( const MapState& map_state, const m_Mat4& matrix, const m_Vec2& camera_position_xy, const ViewClipPlanes& view_clip_planes );
-	void DrawFloorsAndCeilings( const m_Mat4& matrix, const ViewClipPlanes& view_clip_planes  );
+
+	// Test bounding box of BSP tree node against view frustum and, optionally, against occlusion buffer.
+	bool IsBSPNodeVisible(
+		const MapBSPTree::Node& node,
+		const m_Mat4& matrix,
+		const ViewClipPlanes& view_clip_planes,
+		bool occlusion_test );
+	void DrawFloorsAndCeilings( const m_Mat4& matrix, const m_Vec2& camera_position_xy, const ViewClipPlanes& view_clip_planes );
+	// Alternative path - draw floors and ceilings by screen rows, using rasterizer grid planes.
+	// Must be called after walls drawing, because it fills only pixels, unfilled in occlusion buffer.
+	void DrawFloorsAndCeilingsSpans( const m_Mat4& matrix, const ViewClipPlanes& view_clip_planes );
+	void DrawFloorCeilingCellPolygon( FloorCeilingCell& cell, bool is_ceiling, const m_Mat4& matrix, const ViewClipPlanes& view_clip_planes );
+
+	// Rasterize view frustum over map grid and collect floors and ceilings cells inside it.
+	// Result is sorted nearest first.
+	void CollectFloorsAndCeilingsCandidates( const m_Vec2& camera_position_xy, const ViewClipPlanes& view_clip_planes );
+
+	// Collect all models (static models, items, rockets, gibs, monsters, body parts) into one list, sorted front to back.
+	void CollectModelsDrawList(
+		const MapState& map_state,
+		const m_Mat4& view_matrix,
+		EntityId player_monster_id );
+
+	// Draw opaque parts front to back, transparent parts - back to front.
+	void DrawModelsList(
+		const ViewClipPlanes& view_clip_planes,
+		const m_Mat4& view_matrix,
+		const m_Vec3& camera_position,
+		bool transparent );
 
 	void DrawModel(
 		const ModelsGroup& models_group,
@@ -170,6 +317,8 @@ private:
 		unsigned int submodel_id= ~0u,  /* Submodel of model to draw. ~0 means base model. */
 		unsigned char color= 0u /* For players only. */ );
 
+	const ModelVerticesCache& GetModelVerticesCache( const Submodel& model );
+
 	void DrawModelShadow(
 		const Model& base_model,
 		unsigned int animation_frame,
@@ -205,11 +354,53 @@ private:
 		const m_Plane3& clip_plane,
 		unsigned int vertex_count );
 
-	template<unsigned int mip>
-	const SurfacesCache::Surface* GetWallSurface( DrawWall& wall );
+	// Allocate surfaces without generation.
+	SurfacesCache::Surface* AllocateWallSurface( DrawWall& wall, unsigned int mip );
+	SurfacesCache::Surface* AllocateFloorCeilingSurface( FloorCeilingCell& cell, unsigned int mip );
 
+	// Generation does not modify drawer state, so, it may be called in parallel for different surfaces.
+	template<unsigned int mip>
+	void GenerateWallSurface( const DrawWall& wall, SurfacesCache::Surface& surface ) const;
+	template<unsigned int mip>
+	void GenerateFloorCeilingSurface( const FloorCeilingCell& cell, SurfacesCache::Surface& surface ) const;
+	template<unsigned int mip>
+	void GenerateWallSurfaceIndexed( const DrawWall& wall, SurfacesCache::Surface& surface ) const;
 	template<unsigned int mip>
-	const SurfacesCache::Surface* GetFloorCeilingSurface( FloorCeilingCell& cell );
+	void GenerateFloorCeilingSurfaceIndexed( const FloorCeilingCell& cell, SurfacesCache::Surface& surface ) const;
+
+	// Get surface from cache, or allocate and generate it immediately.
+	const SurfacesCache::Surface* GetWallSurface( DrawWall& wall, unsigned int mip );
+	const SurfacesCache::Surface* GetFloorCeilingSurface( FloorCeilingCell& cell, unsigned int mip );
+
+	// Surfaces cache statistics for fps overlay. Status line looks like "cache: hits/misses/evictions_in_frame working_set/size".
+	void UpdateSurfacesCacheStats();
+
+	// Set surface as texture and draw polygon. Selects texture format, suitable for surfaces cache.
+	template<
+		Rasterizer::DepthTest depth_test, Rasterizer::DepthWrite depth_write,
+		Rasterizer::AlphaTest alpha_test,
+		Rasterizer::OcclusionTest occlusion_test, Rasterizer::OcclusionWrite occlusion_write>
+	void DrawSurfacePolygonSpanCorrected( const SurfacesCache::Surface& surface, const RasterizerVertex* vertices, unsigned int vertex_count, bool is_anticlockwise );
+	template<
+		Rasterizer::DepthTest depth_test, Rasterizer::DepthWrite depth_write,
+		Rasterizer::AlphaTest alpha_test,
+		Rasterizer::OcclusionTest occlusion_test, Rasterizer::OcclusionWrite occlusion_write>
+	void DrawSurfacePolygonPerLineCorrected( const SurfacesCache::Surface& surface, const RasterizerVertex* vertices, unsigned int vertex_count, bool is_anticlockwise );
+
+	void EndProfilingStage( StagesTimes::Stage stage );
+
+	// Dynamic resolution. Map and weapon are drawn into internal buffer with reduced resolution,
+	// than buffer is upscaled into screen in postprocess.
+	void UpdateDynamicResolution();
+
+	// Upscale frame into screen. Blend color is in screen components order.
+	void EndScaledViewport( const unsigned char* blend_color= nullptr, unsigned char blend_alpha= 0u );
+	// Scaled viewport stays bound after upscale, call this before drawing into screen directly.
+	void BindFullViewport();
+
+	// Indexed surfaces.
+	void BuildIndexedSurfacesTables();
+	unsigned char ColorToPaletteIndex( uint32_t color ) const;
 
 private:
 	struct ClippedVertex
@@ -219,18 +410,58 @@ private:
 		ClippedVertex* next;
 	};
 
+	static const WallSurfaceGenerationFunc c_wall_surface_generation_funcs[4];
+	static const FloorCeilingSurfaceGenerationFunc c_floor_ceiling_surface_generation_funcs[4];
+	static const WallSurfaceGenerationFunc c_wall_surface_indexed_generation_funcs[4];
+	static const FloorCeilingSurfaceGenerationFunc c_floor_ceiling_surface_indexed_generation_funcs[4];
+
 private:
 	Settings& settings_;
 	const GameResourcesConstPtr game_resources_;
 	const RenderingContextSoft rendering_context_;
-	const float screen_transform_x_;
-	const float screen_transform_y_;
-
-	Rasterizer rasterizer_;
+	float screen_transform_x_;
+	float screen_transform_y_;
+
+	// Dynamic resolution state.
+	std::vector<uint32_t> scaled_color_buffer_;
+	unsigned int scaled_viewport_size_[2];
+	bool scaled_viewport_active_= false; // Frame is drawn into scaled buffer and it is not upscaled yet.
+	bool scaled_viewport_bound_= false; // Rasterizer viewport is scaled buffer.
+	float resolution_scale_= 1.0f;
+	float average_frame_time_ms_= 0.0f;
+	bool frame_started_= false;
+	std::chrono::steady_clock::time_point frame_start_time_;
+	char status_[128];
+
+	// Store surfaces as 8-bit palette indices, lit via colormap. Palette is applied while drawing.
+	const bool indexed_surfaces_;
+
+	// Shared by rasterizer bands and surfaces generation. Must be declared before rasterizer.
+	TasksPool tasks_pool_;
+	RasterizerBands rasterizer_;
 	SurfacesCache surfaces_cache_;
 
+	std::vector<SurfaceGenerationTask> surfaces_generation_tasks_;
+
+	std::vector<ModelsDrawListItem> models_draw_list_;
+	std::vector<ModelsDrawListItem> models_draw_list_sorted_;
+
+	// Decoded vertices of models. Key is model or submodel.
+	std::unordered_map<const Submodel*, ModelVerticesCache> models_vertices_cache_;
+	// Reuse vector for transformed vertices of model: screen x, screen y, w.
+	std::vector<fixed16_t> model_vertices_transformed_;
+
+	bool profiling_enabled_= false;
+	std::chrono::steady_clock::time_point profiling_stage_start_time_;
+	StagesTimes stages_times_{};
+
+	// Camera yaw in previous frame, for rotation speed calculation.
+	float prev_view_yaw_= 0.0f;
+	bool prev_view_yaw_valid_= false;
+
 	MapDataConstPtr current_map_data_;
 	std::unique_ptr<MapBSPTree> map_bsp_tree_;
+	unsigned int pvs_cell_= ~0u; // Cell of camera in map PVS for current frame.
 
 	ModelsGroup map_models_;
 	ModelsGroup items_models_;
@@ -246,9 +477,19 @@ private:
 	unsigned int first_floor_= 0u;
 	unsigned int first_ceiling_= 0u;
 
+	// Reuse vectors for floors and ceilings candidates.
+	std::vector<unsigned int> floors_and_ceilings_candidates_;
+	std::vector<unsigned int> floors_and_ceilings_candidates_sorted_;
+
+	// Data for floors and ceilings spans drawing. Must live until rasterizer flush.
+	Rasterizer::GridPlanes floors_and_ceilings_grid_planes_;
+	std::vector<Rasterizer::GridPlanes::Cell> floors_and_ceilings_grid_cells_;
+
 	std::vector<SpriteTexture> sprite_effects_textures_;
 	std::vector<SpriteTexture> bmp_objects_sprites_;
 	SkyTexture sky_texture_;
+	// Data for sky drawing. Must live until rasterizer flush.
+	Rasterizer::SkyPanorama sky_panorama_;
 
 	std::vector<PlayerTexture> player_textures_;
 
@@ -267,6 +508,19 @@ private:
 	WallTexture wall_textures_[ MapData::c_max_walls_textures ];
 
 	FloorTexture floor_textures_[ MapData::c_floors_textures_count ];
+
+	// Temporary 32bit mips of textures, used for calculation of indexed mips.
+	std::vector<uint32_t> textures_conversion_buffer_;
+
+	// Index of cell in "map_floors_and_ceilings_" for floors ([0]) and ceilings ([1]) for each map cell.
+	static constexpr unsigned short c_no_floor_ceiling_cell= 0xFFFFu;
+	unsigned short floors_and_ceilings_grid_[2][ MapData::c_map_size * MapData::c_map_size ];
+
+	// Tables for indexed surfaces.
+	// Colormap - palette index of lit color for each lightmap value and each palette color.
+	unsigned char light_colormap_[256u][256u];
+	// Nearest palette color for 15-bit rgb color.
+	std::vector<unsigned char> inverse_palette_;
 };
 
 } // namespace PanzerChasm
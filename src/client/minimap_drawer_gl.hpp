@@ -1,10 +1,10 @@
 #pragma once
 
-#include <glsl_program.hpp>
 #include <polygon_buffer.hpp>
 
 #include "../fwd.hpp"
 #include "../rendering_context.hpp"
+#include "../shader_program.hpp"
 #include "fwd.hpp"
 #include "i_minimap_drawer.hpp"
 
@@ -45,7 +45,7 @@ private:
 
 	MapDataConstPtr current_map_data_;
 
-	r_GLSLProgram lines_shader_;
+	ShaderProgram lines_shader_;
 
 	r_PolygonBuffer walls_buffer_;
 	std::vector<WallLineVertex> dynamic_walls_vertices_;
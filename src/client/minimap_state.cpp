@@ -6,6 +6,7 @@
 #include "../game_constants.hpp"
 #include "../log.hpp"
 #include "../map_loader.hpp"
+#include "../map_pvs.hpp"
 
 #include "map_state.hpp"
 
@@ -194,7 +195,8 @@ void MinimapState::Update(
 		}
 	};
 
-	// Draw static walls
+	// Draw static walls. Walls outside PVS can not be nearest, so, skip them.
+	const unsigned int pvs_cell= MapPVS::GetCellIndex( camera_position );
 	for( const MapData::Wall& wall : map_data_->static_walls )
 	{
 		if( wall.texture_id >= MapData::c_first_transparent_texture_id )
@@ -203,6 +205,9 @@ void MinimapState::Update(
 		MapData::IndexElement index;
 		index.type= MapData::IndexElement::StaticWall;
 		index.index= &wall - map_data_->static_walls.data();
+		if( !map_data_->pvs->IsStaticWallVisible( pvs_cell, index.index ) )
+			continue;
+
 		draw_wall( wall.vert_pos[0], wall.vert_pos[1], index );
 	}
 
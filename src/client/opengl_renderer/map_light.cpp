@@ -39,8 +39,36 @@ const r_OGLState g_light_pass_state(
 	true, false, false, false,
 	g_light_pass_blend_func );
 
+// Floor lightmap splitted into 16x16 tiles, each tile is 4x4 map cells.
+const unsigned int g_floor_tiles_per_side= 16u;
+const float g_floor_tile_size= float(MapData::c_map_size) / float(g_floor_tiles_per_side);
+
+// Walls lightmap atlas splitted into tiles, 8 walls in each.
+const unsigned int g_walls_tile_size= 8u;
+const unsigned int g_walls_tiles_per_row= MapData::c_map_size / g_walls_tile_size;
+
+// Approxiamte cone light as set of point lights.
+const unsigned int g_cone_light_circles= 3u;
+
 } // namespace
 
+static uint64_t CombineHash( uint64_t hash, const void* const data, const unsigned int size )
+{
+	// FNV-1a
+	const unsigned char* const bytes= static_cast<const unsigned char*>(data);
+	for( unsigned int i= 0u; i < size; i++ )
+	{
+		hash^= bytes[i];
+		hash*= 1099511628211ull;
+	}
+	return hash;
+}
+
+static uint64_t GetLightHash( const MapData::Light& light )
+{
+	return CombineHash( 14695981039346656037ull, &light, sizeof(MapData::Light) );
+}
+
 static void CreateFullbrightLightmapDummy( r_Texture& texture, const bool use_hd_dynamic_lightmap )
 {
 	constexpr unsigned int c_size= 4u;
@@ -59,9 +87,11 @@ static void CreateFullbrightLightmapDummy( r_Texture& texture, const bool use_hd
 MapLight::MapLight(
 	const GameResourcesConstPtr& game_resources,
 	const RenderingContextGL& rendering_context,
-	const bool use_hd_dynamic_lightmap )
+	const bool use_hd_dynamic_lightmap,
+	const bool incremental_update )
 	: game_resources_(game_resources)
 	, use_hd_dynamic_lightmap_(use_hd_dynamic_lightmap)
+	, incremental_update_(incremental_update)
 {
 	PC_ASSERT( game_resources_ != nullptr );
 
@@ -147,6 +177,7 @@ void MapLight::SetMap( const MapDataConstPtr& map_data )
 		return;
 
 	map_data_= map_data;
+	lightmaps_valid_= false;
 
 	if( !use_hd_dynamic_lightmap_ )
 	{
@@ -264,176 +295,51 @@ void MapLight::Update( const MapState& map_state )
 	if( !use_hd_dynamic_lightmap_ )
 		return;
 
-	UpdateLightOnDynamicWalls( map_state );
-
-	const auto gen_light_for_rocket=
-	[&]( const MapState::Rocket& rocket, MapData::Light& out_light ) -> bool
-	{
-		if( rocket.rocket_id >= game_resources_->rockets_description.size() )
-			return false;
-		if( !game_resources_->rockets_description[ rocket.rocket_id ].Light )
-			return false;
-
-		out_light.inner_radius= 0.5f;
-		out_light.outer_radius= 1.0f;
-		out_light.power= 64.0f;
-		out_light.max_light_level= 128.0f;
-		out_light.pos= rocket.pos.xy();
+	last_update_draw_calls_= 0u;
+	last_update_uploaded_bytes_= 0u;
 
-		return true;
-	};
-
-	const auto gen_light_for_flash=
-	[&]( const MapState::LightFlash& flash, MapData::Light& out_light )
-	{
-		// TODO - calibrate params.
-		out_light.outer_radius= 1.7f * ( flash.intensity * 0.6f + 0.4f );
-		out_light.inner_radius= 0.5f * out_light.outer_radius;
-		out_light.power= 48.0f * flash.intensity;
-		out_light.max_light_level= 128.0f;
-		out_light.pos= flash.pos;
-	};
-
-	const auto gen_light_for_source=
-	[&]( const MapState::LightSource& light_source, MapData::Light& out_light )
-	{
-		out_light.outer_radius= light_source.radius;
-		out_light.inner_radius= light_source.radius * 0.25f;
-		out_light.power= 4.0f * light_source.intensity;
-		out_light.max_light_level= 128.0f;
-		out_light.pos= light_source.pos;
-	};
-
-	// Approxiamte cone light as set of point lights.
-	const unsigned int c_cone_light_circles= 3u;
-	const auto gen_lights_for_directed_source=
-	[&]( const MapState::DirectedLightSource& light_source, MapData::Light* const out_lights )
-	{
-		const m_Vec2 dir( std::cos( light_source.direction - Constants::half_pi ), std::sin( light_source.direction - Constants::half_pi ) );
-
-		for( unsigned int i= 0; i < c_cone_light_circles; i++ )
-		{
-			const float r= float( 1u << i ) / ( 3.0f * float( (1u<<(c_cone_light_circles-1u)) ) );
+	UpdateLightOnDynamicWalls( map_state );
+	CollectDynamicLights( map_state );
 
-			out_lights[i].power= 4.0f * light_source.intensity;
-			out_lights[i].max_light_level= 128.0f;
+	CalculateFloorTilesSignatures();
+	CalculateWallsTilesSignatures( map_state );
 
-			out_lights[i].pos= light_source.pos + light_source.radius * ( 2.0f * r ) * dir;
-			out_lights[i].outer_radius= 1.25f * r * light_source.radius;
-			out_lights[i].inner_radius= out_lights[i].outer_radius * 0.5f;
-		}
-	};
+	glEnable( GL_SCISSOR_TEST );
 
 	// Clear shadowmap.
 	shadowmap_.Bind();
+	glScissor( 0, 0, shadowmap_.Width(), shadowmap_.Height() );
 	r_OGLStateManager::UpdateState( g_lightmap_clear_state );
 	glClear( GL_COLOR_BUFFER_BIT );
 
 	// Draw to floor lightmap.
-	final_floor_lightmap_.Bind();
-
-	{ // Copy base floor lightmap.
-		r_OGLStateManager::UpdateState( g_lightmap_clear_state );
-		copy_shader_.Bind();
-		base_floor_lightmap_.GetTextures().front().Bind(0);
-		copy_shader_.Uniform( "tex", 0 );
-		glDrawArrays( GL_TRIANGLES, 0, 6 );
-	}
-
-	{ // Mix with ambient light texture.
-		r_OGLStateManager::UpdateState( g_light_pass_state );
-		floor_ambient_light_pass_shader_.Bind();
-		ambient_lightmap_texture_.Bind(0);
-		floor_ambient_light_pass_shader_.Uniform( "tex", 0 );
-
-		glBlendEquation( GL_MAX );
-		glDrawArrays( GL_TRIANGLES, 0, 6 );
-		glBlendEquation( GL_FUNC_ADD );
-	}
-
-	{ // Dynamic lights.
-		r_OGLStateManager::UpdateState( g_light_pass_state );
-		floor_light_pass_shader_.Bind();
-
-		for( const MapState::RocketsContainer::value_type& rocket_value : map_state.GetRockets() )
-		{
-			MapData::Light light;
-			if( gen_light_for_rocket( rocket_value.second, light ) )
-				DrawFloorLight( light );
-		}
-		for( const MapState::LightFlash& light_flash : map_state.GetLightFlashes() )
-		{
-			MapData::Light light;
-			gen_light_for_flash( light_flash, light );
-			DrawFloorLight( light );
-		}
-		for( const MapState::LightSourcesContainer::value_type& light_source_value : map_state.GetLightSources() )
-		{
-			MapData::Light light;
-			gen_light_for_source( light_source_value.second, light );
-			DrawFloorLight( light );
-		}
-		for( const MapState::DirectedLightSourcesContainer::value_type& directed_light_source_value : map_state.GetDirectedLightSources() )
-		{
-			MapData::Light lights[ c_cone_light_circles ];
-			gen_lights_for_directed_source( directed_light_source_value.second, lights );
-			for( const MapData::Light& light : lights )
-				DrawFloorLight( light );
-		}
+	last_floor_tiles_updated_=
+		BuildDirtyRegions(
+			floor_tiles_signatures_, prev_floor_tiles_signatures_,
+			g_floor_tiles_per_side, floor_tiles_signatures_.size() );
+	if( !dirty_regions_.empty() )
+	{
+		final_floor_lightmap_.Bind();
+		for( const TilesRegion& region : dirty_regions_ )
+			UpdateFloorRegion( region );
 	}
 
 	// Draw to walls lightmap.
-	final_walls_lightmap_.Bind();
-
-	{ // Copy base walls lightmap.
-		r_OGLStateManager::UpdateState( g_lightmap_clear_state );
-		copy_shader_.Bind();
-		base_walls_lightmap_.GetTextures().front().Bind(0);
-		copy_shader_.Uniform( "tex", 0 );
-		glDrawArrays( GL_TRIANGLES, 0, 6 );
-	}
-
-	{ // Mix with ambient light texture.
-		r_OGLStateManager::UpdateState( g_light_pass_state );
-		walls_ambient_light_pass_shader_.Bind();
-		ambient_lightmap_texture_.Bind(0);
-		walls_ambient_light_pass_shader_.Uniform( "tex", 0 );
-
-		glBlendEquation( GL_MAX );
-		walls_vertex_buffer_.Draw();
-		glBlendEquation( GL_FUNC_ADD );
+	last_walls_tiles_updated_=
+		BuildDirtyRegions(
+			walls_tiles_signatures_, prev_walls_tiles_signatures_,
+			g_walls_tiles_per_row, walls_tiles_signatures_.size() );
+	if( !dirty_regions_.empty() )
+	{
+		final_walls_lightmap_.Bind();
+		walls_vertex_buffer_.Bind();
+		for( const TilesRegion& region : dirty_regions_ )
+			UpdateWallsRegion( region );
 	}
 
-	{ // Dynamic lights.
-		r_OGLStateManager::UpdateState( g_light_pass_state );
-		walls_light_pass_shader_.Bind();
+	glDisable( GL_SCISSOR_TEST );
 
-		for( const MapState::RocketsContainer::value_type& rocket_value : map_state.GetRockets() )
-		{
-			MapData::Light light;
-			if( gen_light_for_rocket( rocket_value.second, light ) )
-				DrawWallsLight( light );
-		}
-		for( const MapState::LightFlash& light_flash : map_state.GetLightFlashes() )
-		{
-			MapData::Light light;
-			gen_light_for_flash( light_flash, light );
-			DrawWallsLight( light );
-		}
-		for( const MapState::LightSourcesContainer::value_type& light_source_value : map_state.GetLightSources() )
-		{
-			MapData::Light light;
-			gen_light_for_source( light_source_value.second, light );
-			DrawWallsLight( light );
-		}
-		for( const MapState::DirectedLightSourcesContainer::value_type& directed_light_source_value : map_state.GetDirectedLightSources() )
-		{
-			MapData::Light lights[ c_cone_light_circles ];
-			gen_lights_for_directed_source( directed_light_source_value.second, lights );
-			for( const MapData::Light& light : lights )
-				DrawWallsLight( light );
-		}
-	}
+	lightmaps_valid_= true;
 
 	r_Framebuffer::BindScreenFramebuffer();
 }
@@ -489,6 +395,26 @@ const r_Texture& MapLight::GetWallsLightmap() const
 	return final_walls_lightmap_.GetTextures().front();
 }
 
+void MapLight::GetLastUpdateStats(
+	unsigned int& out_floor_tiles_updated, unsigned int& out_floor_tiles_total,
+	unsigned int& out_walls_tiles_updated, unsigned int& out_walls_tiles_total ) const
+{
+	out_floor_tiles_updated= last_floor_tiles_updated_;
+	out_floor_tiles_total= floor_tiles_signatures_.size();
+	out_walls_tiles_updated= last_walls_tiles_updated_;
+	out_walls_tiles_total= walls_tiles_signatures_.size();
+}
+
+unsigned int MapLight::GetLastUpdateDrawCalls() const
+{
+	return last_update_draw_calls_;
+}
+
+unsigned int MapLight::GetLastUpdateUploadedBytes() const
+{
+	return last_update_uploaded_bytes_;
+}
+
 void MapLight::PrepareMapWalls( const MapData& map_data )
 {
 	// Place walls in lightmap atlas.
@@ -643,10 +569,12 @@ void MapLight::UpdateLightOnDynamicWalls( const MapState& map_state )
 		return; // Nothing to update.
 
 	// Update GPU data.
+	const unsigned int upload_size= ( 1u + last_updated_wall - first_updated_wall ) * 4u * sizeof(WallVertex);
 	walls_vertex_buffer_.VertexSubData(
 		walls_vertices_.data() + dynamic_walls_first_vertex_ + first_updated_wall * 4u,
-		( 1u + last_updated_wall - first_updated_wall ) * 4u * sizeof(WallVertex),
+		upload_size,
 		( dynamic_walls_first_vertex_ + first_updated_wall * 4u ) * sizeof(WallVertex) );
+	last_update_uploaded_bytes_+= upload_size;
 
 	// Clear shadowmap.
 	shadowmap_.Bind();
@@ -676,6 +604,7 @@ void MapLight::UpdateLightOnDynamicWalls( const MapState& map_state )
 		walls_light_pass_shader_.Uniform( "max_radius", 1.0f );
 
 		glDrawArrays( GL_LINES, dynamic_walls_first_vertex_ + w * 4u, 4u );
+		last_update_draw_calls_++;
 
 		// Add light from nearest sources.
 		r_OGLStateManager::UpdateState( g_light_pass_state );
@@ -692,12 +621,353 @@ void MapLight::UpdateLightOnDynamicWalls( const MapState& map_state )
 			walls_light_pass_shader_.Uniform( "max_radius", light.outer_radius );
 
 			glDrawArrays( GL_LINES, dynamic_walls_first_vertex_ + w * 4u, 4u );
+			last_update_draw_calls_++;
 		}
 	}
 
 	r_Framebuffer::BindScreenFramebuffer();
 }
 
+void MapLight::CollectDynamicLights( const MapState& map_state )
+{
+	dynamic_lights_.clear();
+
+	for( const MapState::RocketsContainer::value_type& rocket_value : map_state.GetRockets() )
+	{
+		const MapState::Rocket& rocket= rocket_value.second;
+		if( rocket.rocket_id >= game_resources_->rockets_description.size() )
+			continue;
+		if( !game_resources_->rockets_description[ rocket.rocket_id ].Light )
+			continue;
+
+		MapData::Light light;
+		light.inner_radius= 0.5f;
+		light.outer_radius= 1.0f;
+		light.power= 64.0f;
+		light.max_light_level= 128.0f;
+		light.pos= rocket.pos.xy();
+		dynamic_lights_.push_back( light );
+	}
+
+	for( const MapState::LightFlash& flash : map_state.GetLightFlashes() )
+	{
+		// TODO - calibrate params.
+		MapData::Light light;
+		light.outer_radius= 1.7f * ( flash.intensity * 0.6f + 0.4f );
+		light.inner_radius= 0.5f * light.outer_radius;
+		light.power= 48.0f * flash.intensity;
+		light.max_light_level= 128.0f;
+		light.pos= flash.pos;
+		dynamic_lights_.push_back( light );
+	}
+
+	for( const MapState::LightSourcesContainer::value_type& light_source_value : map_state.GetLightSources() )
+	{
+		const MapState::LightSource& light_source= light_source_value.second;
+
+		MapData::Light light;
+		light.outer_radius= light_source.radius;
+		light.inner_radius= light_source.radius * 0.25f;
+		light.power= 4.0f * light_source.intensity;
+		light.max_light_level= 128.0f;
+		light.pos= light_source.pos;
+		dynamic_lights_.push_back( light );
+	}
+
+	// Approxiamte cone light as set of point lights.
+	for( const MapState::DirectedLightSourcesContainer::value_type& directed_light_source_value : map_state.GetDirectedLightSources() )
+	{
+		const MapState::DirectedLightSource& light_source= directed_light_source_value.second;
+		const m_Vec2 dir( std::cos( light_source.direction - Constants::half_pi ), std::sin( light_source.direction - Constants::half_pi ) );
+
+		for( unsigned int i= 0; i < g_cone_light_circles; i++ )
+		{
+			const float r= float( 1u << i ) / ( 3.0f * float( (1u<<(g_cone_light_circles-1u)) ) );
+
+			MapData::Light light;
+			light.power= 4.0f * light_source.intensity;
+			light.max_light_level= 128.0f;
+
+			light.pos= light_source.pos + light_source.radius * ( 2.0f * r ) * dir;
+			light.outer_radius= 1.25f * r * light_source.radius;
+			light.inner_radius= light.outer_radius * 0.5f;
+			dynamic_lights_.push_back( light );
+		}
+	}
+
+	dynamic_lights_hashes_.resize( dynamic_lights_.size() );
+	for( unsigned int i= 0u; i < dynamic_lights_.size(); i++ )
+		dynamic_lights_hashes_[i]= GetLightHash( dynamic_lights_[i] );
+}
+
+void MapLight::CalculateFloorTilesSignatures()
+{
+	floor_tiles_signatures_.clear();
+	floor_tiles_signatures_.resize( g_floor_tiles_per_side * g_floor_tiles_per_side, 0u );
+
+	// Light quad is extended by one texel, add one more texel for rasterization.
+	const float border= 2.0f * float( MapData::c_map_size ) / float( final_floor_lightmap_.Width() );
+
+	for( unsigned int i= 0u; i < dynamic_lights_.size(); i++ )
+	{
+		const MapData::Light& light= dynamic_lights_[i];
+		const float radius= light.outer_radius + border;
+
+		const int max_tile= int(g_floor_tiles_per_side) - 1;
+		const int x_min= std::max( 0, std::min( int( std::floor( ( light.pos.x - radius ) / g_floor_tile_size ) ), max_tile ) );
+		const int x_max= std::max( 0, std::min( int( std::floor( ( light.pos.x + radius ) / g_floor_tile_size ) ), max_tile ) );
+		const int y_min= std::max( 0, std::min( int( std::floor( ( light.pos.y - radius ) / g_floor_tile_size ) ), max_tile ) );
+		const int y_max= std::max( 0, std::min( int( std::floor( ( light.pos.y + radius ) / g_floor_tile_size ) ), max_tile ) );
+
+		// Use sum of hashes, because lights order does not matter for additive blending.
+		for( int y= y_min; y <= y_max; y++ )
+		for( int x= x_min; x <= x_max; x++ )
+			floor_tiles_signatures_[ x + y * int(g_floor_tiles_per_side) ]+= dynamic_lights_hashes_[i];
+	}
+}
+
+void MapLight::CalculateWallsTilesSignatures( const MapState& map_state )
+{
+	const MapState::DynamicWalls& dynamic_walls= map_state.GetDynamicWalls();
+	const unsigned int static_wall_count= map_data_->static_walls.size();
+	const unsigned int wall_count= static_wall_count + dynamic_walls.size();
+	const unsigned int tile_count= ( wall_count + g_walls_tile_size - 1u ) / g_walls_tile_size;
+
+	const auto get_wall=
+	[&]( const unsigned int w, m_Vec2& out_v0, m_Vec2& out_v1 )
+	{
+		if( w < static_wall_count )
+		{
+			out_v0= map_data_->static_walls[w].vert_pos[0];
+			out_v1= map_data_->static_walls[w].vert_pos[1];
+		}
+		else
+		{
+			out_v0= dynamic_walls[ w - static_wall_count ].vert_pos[0];
+			out_v1= dynamic_walls[ w - static_wall_count ].vert_pos[1];
+		}
+	};
+
+	walls_tiles_signatures_.clear();
+	walls_tiles_signatures_.resize( tile_count, 0u );
+	walls_tiles_bboxes_.resize( tile_count );
+
+	for( unsigned int t= 0u; t < tile_count; t++ )
+	{
+		TilesBBox& bbox= walls_tiles_bboxes_[t];
+		bbox.min= m_Vec2( +1.0e16f, +1.0e16f );
+		bbox.max= m_Vec2( -1.0e16f, -1.0e16f );
+
+		const unsigned int w_end= std::min( ( t + 1u ) * g_walls_tile_size, wall_count );
+		for( unsigned int w= t * g_walls_tile_size; w < w_end; w++ )
+		{
+			m_Vec2 v[2];
+			get_wall( w, v[0], v[1] );
+			for( const m_Vec2& vert : v )
+			{
+				bbox.min.x= std::min( bbox.min.x, vert.x );
+				bbox.min.y= std::min( bbox.min.y, vert.y );
+				bbox.max.x= std::max( bbox.max.x, vert.x );
+				bbox.max.y= std::max( bbox.max.y, vert.y );
+			}
+
+			// Dynamic walls lightmap changes after wall movement, so, add wall position into signature.
+			if( w >= static_wall_count )
+			{
+				const WallVertex* const wall_v= &walls_vertices_[ dynamic_walls_first_vertex_ + ( w - static_wall_count ) * 4u ];
+				walls_tiles_signatures_[t]= CombineHash( walls_tiles_signatures_[t], wall_v[0].pos, sizeof(wall_v[0].pos) );
+				walls_tiles_signatures_[t]= CombineHash( walls_tiles_signatures_[t], wall_v[1].pos, sizeof(wall_v[1].pos) );
+			}
+		}
+	}
+
+	for( unsigned int i= 0u; i < dynamic_lights_.size(); i++ )
+	{
+		const MapData::Light& light= dynamic_lights_[i];
+
+		for( unsigned int t= 0u; t < tile_count; t++ )
+		{
+			const TilesBBox& bbox= walls_tiles_bboxes_[t];
+			if( light.pos.x + light.outer_radius < bbox.min.x || light.pos.x - light.outer_radius > bbox.max.x ||
+				light.pos.y + light.outer_radius < bbox.min.y || light.pos.y - light.outer_radius > bbox.max.y )
+				continue;
+
+			const unsigned int w_end= std::min( ( t + 1u ) * g_walls_tile_size, wall_count );
+			for( unsigned int w= t * g_walls_tile_size; w < w_end; w++ )
+			{
+				m_Vec2 v0, v1;
+				get_wall( w, v0, v1 );
+				if( DistanceToLineSegment( light.pos, v0, v1 ) <= light.outer_radius )
+					walls_tiles_signatures_[t]+= dynamic_lights_hashes_[i];
+			}
+		}
+	}
+}
+
+void MapLight::UpdateFloorRegion( const TilesRegion& region )
+{
+	const unsigned int tile_size_pixels= final_floor_lightmap_.Width() / g_floor_tiles_per_side;
+	glScissor(
+		region.x * tile_size_pixels, region.y * tile_size_pixels,
+		region.width * tile_size_pixels, region.height * tile_size_pixels );
+
+	{ // Copy base floor lightmap.
+		r_OGLStateManager::UpdateState( g_lightmap_clear_state );
+		copy_shader_.Bind();
+		base_floor_lightmap_.GetTextures().front().Bind(0);
+		copy_shader_.Uniform( "tex", 0 );
+		glDrawArrays( GL_TRIANGLES, 0, 6 );
+		last_update_draw_calls_++;
+	}
+
+	{ // Mix with ambient light texture.
+		r_OGLStateManager::UpdateState( g_light_pass_state );
+		floor_ambient_light_pass_shader_.Bind();
+		ambient_lightmap_texture_.Bind(0);
+		floor_ambient_light_pass_shader_.Uniform( "tex", 0 );
+
+		glBlendEquation( GL_MAX );
+		glDrawArrays( GL_TRIANGLES, 0, 6 );
+		last_update_draw_calls_++;
+		glBlendEquation( GL_FUNC_ADD );
+	}
+
+	{ // Dynamic lights.
+		r_OGLStateManager::UpdateState( g_light_pass_state );
+		floor_light_pass_shader_.Bind();
+
+		const float border= 2.0f * float( MapData::c_map_size ) / float( final_floor_lightmap_.Width() );
+		const float region_min_x= float(region.x) * g_floor_tile_size - border;
+		const float region_min_y= float(region.y) * g_floor_tile_size - border;
+		const float region_max_x= float( region.x + region.width  ) * g_floor_tile_size + border;
+		const float region_max_y= float( region.y + region.height ) * g_floor_tile_size + border;
+
+		for( const MapData::Light& light : dynamic_lights_ )
+		{
+			if( light.pos.x + light.outer_radius < region_min_x || light.pos.x - light.outer_radius > region_max_x ||
+				light.pos.y + light.outer_radius < region_min_y || light.pos.y - light.outer_radius > region_max_y )
+				continue;
+
+			DrawFloorLight( light );
+		}
+	}
+}
+
+void MapLight::UpdateWallsRegion( const TilesRegion& region )
+{
+	const unsigned int tile_size_pixels= g_walls_tile_size * g_wall_lightmap_size;
+	glScissor(
+		region.x * tile_size_pixels, region.y,
+		region.width * tile_size_pixels, region.height );
+
+	{ // Copy base walls lightmap.
+		r_OGLStateManager::UpdateState( g_lightmap_clear_state );
+		copy_shader_.Bind();
+		base_walls_lightmap_.GetTextures().front().Bind(0);
+		copy_shader_.Uniform( "tex", 0 );
+		glDrawArrays( GL_TRIANGLES, 0, 6 );
+		last_update_draw_calls_++;
+	}
+
+	{ // Mix with ambient light texture.
+		r_OGLStateManager::UpdateState( g_light_pass_state );
+		walls_ambient_light_pass_shader_.Bind();
+		ambient_lightmap_texture_.Bind(0);
+		walls_ambient_light_pass_shader_.Uniform( "tex", 0 );
+
+		glBlendEquation( GL_MAX );
+		walls_vertex_buffer_.Draw();
+		last_update_draw_calls_++;
+		glBlendEquation( GL_FUNC_ADD );
+	}
+
+	{ // Dynamic lights.
+		r_OGLStateManager::UpdateState( g_light_pass_state );
+		walls_light_pass_shader_.Bind();
+
+		// Bounding box of all walls in region.
+		TilesBBox region_bbox;
+		region_bbox.min= m_Vec2( +1.0e16f, +1.0e16f );
+		region_bbox.max= m_Vec2( -1.0e16f, -1.0e16f );
+		for( unsigned int y= region.y; y < region.y + region.height; y++ )
+		for( unsigned int x= region.x; x < region.x + region.width; x++ )
+		{
+			const unsigned int t= x + y * g_walls_tiles_per_row;
+			if( t >= walls_tiles_bboxes_.size() )
+				continue;
+			const TilesBBox& bbox= walls_tiles_bboxes_[t];
+			region_bbox.min.x= std::min( region_bbox.min.x, bbox.min.x );
+			region_bbox.min.y= std::min( region_bbox.min.y, bbox.min.y );
+			region_bbox.max.x= std::max( region_bbox.max.x, bbox.max.x );
+			region_bbox.max.y= std::max( region_bbox.max.y, bbox.max.y );
+		}
+
+		for( const MapData::Light& light : dynamic_lights_ )
+		{
+			if( light.pos.x + light.outer_radius < region_bbox.min.x || light.pos.x - light.outer_radius > region_bbox.max.x ||
+				light.pos.y + light.outer_radius < region_bbox.min.y || light.pos.y - light.outer_radius > region_bbox.max.y )
+				continue;
+
+			DrawWallsLight( light );
+		}
+	}
+}
+
+unsigned int MapLight::BuildDirtyRegions(
+	const std::vector<uint64_t>& signatures,
+	std::vector<uint64_t>& prev_signatures,
+	const unsigned int width,
+	const unsigned int tile_count )
+{
+	const bool all_dirty= !incremental_update_ || !lightmaps_valid_ || prev_signatures.size() != signatures.size();
+
+	unsigned int dirty_tile_count= 0u;
+	dirty_tiles_.resize( tile_count );
+	for( unsigned int t= 0u; t < tile_count; t++ )
+	{
+		dirty_tiles_[t]= all_dirty || signatures[t] != prev_signatures[t];
+		if( dirty_tiles_[t] )
+			dirty_tile_count++;
+	}
+	prev_signatures= signatures;
+
+	// Merge dirty tiles in row into horizontal spans, merge spans with same range in adjacent rows.
+	dirty_regions_.clear();
+	const unsigned int height= ( tile_count + width - 1u ) / width;
+	for( unsigned int y= 0u; y < height; y++ )
+	{
+		unsigned int x= 0u;
+		while( x < width )
+		{
+			const unsigned int t= x + y * width;
+			if( t >= tile_count || !dirty_tiles_[t] )
+			{
+				x++;
+				continue;
+			}
+
+			const unsigned int span_start= x;
+			while( x < width && x + y * width < tile_count && dirty_tiles_[ x + y * width ] )
+				x++;
+
+			bool merged= false;
+			for( TilesRegion& region : dirty_regions_ )
+			{
+				if( region.y + region.height == y && region.x == span_start && region.width == x - span_start )
+				{
+					region.height++;
+					merged= true;
+					break;
+				}
+			}
+			if( !merged )
+				dirty_regions_.push_back( TilesRegion{ span_start, y, x - span_start, 1u } );
+		}
+	}
+
+	return dirty_tile_count;
+}
+
 void MapLight::DrawFloorLight( const MapData::Light& light )
 {
 	shadowmap_.GetTextures().front().Bind(0);
@@ -729,6 +999,7 @@ void MapLight::DrawFloorLight( const MapData::Light& light )
 	floor_light_pass_shader_.Uniform( "max_radius", light.outer_radius );
 
 	glDrawArrays( GL_TRIANGLES, 0, 6 );
+	last_update_draw_calls_++;
 }
 
 void MapLight::DrawWallsLight( const MapData::Light& light )
@@ -743,6 +1014,7 @@ void MapLight::DrawWallsLight( const MapData::Light& light )
 	walls_light_pass_shader_.Uniform( "max_radius", light.outer_radius );
 
 	walls_vertex_buffer_.Draw();
+	last_update_draw_calls_++;
 }
 
 } // namespace PanzerChasm
@@ -1,13 +1,14 @@
 #pragma once
+#include <cstdint>
 
 #include <framebuffer.hpp>
-#include <glsl_program.hpp>
 #include <polygon_buffer.hpp>
 #include <texture.hpp>
 
 #include "../../fwd.hpp"
 #include "../../map_loader.hpp"
 #include "../../rendering_context.hpp"
+#include "../../shader_program.hpp"
 #include "fwd.hpp"
 
 namespace PanzerChasm
@@ -19,7 +20,8 @@ public:
 	MapLight(
 		const GameResourcesConstPtr& game_resources,
 		const RenderingContextGL& rendering_context,
-		bool use_hd_dynamic_lightmap );
+		bool use_hd_dynamic_lightmap,
+		bool incremental_update );
 	~MapLight();
 
 	void SetMap( const MapDataConstPtr& map_data );
@@ -33,6 +35,15 @@ public:
 	const r_Texture& GetFloorLightmap() const;
 	const r_Texture& GetWallsLightmap() const;
 
+	// Count of lightmaps tiles, redrawn in last update.
+	void GetLastUpdateStats(
+		unsigned int& out_floor_tiles_updated, unsigned int& out_floor_tiles_total,
+		unsigned int& out_walls_tiles_updated, unsigned int& out_walls_tiles_total ) const;
+
+	// Draw calls and uploaded data size of last update.
+	unsigned int GetLastUpdateDrawCalls() const;
+	unsigned int GetLastUpdateUploadedBytes() const;
+
 private:
 	struct WallVertex
 	{
@@ -43,12 +54,37 @@ private:
 
 	SIZE_ASSERT( WallVertex, 8u );
 
+	// Rectangle in tiles.
+	struct TilesRegion
+	{
+		unsigned int x, y;
+		unsigned int width, height;
+	};
+
+	struct TilesBBox
+	{
+		m_Vec2 min, max;
+	};
+
 private:
 	void PrepareMapWalls( const MapData& map_data );
 	void UpdateLightOnDynamicWalls( const MapState& map_state );
 	void DrawFloorLight( const MapData::Light& light );
 	void DrawWallsLight( const MapData::Light& light );
 
+	void CollectDynamicLights( const MapState& map_state );
+	void CalculateFloorTilesSignatures();
+	void CalculateWallsTilesSignatures( const MapState& map_state );
+
+	void UpdateFloorRegion( const TilesRegion& region );
+	void UpdateWallsRegion( const TilesRegion& region );
+
+	// Find rectangles of dirty tiles. Returns number of dirty tiles.
+	unsigned int BuildDirtyRegions(
+		const std::vector<uint64_t>& signatures,
+		std::vector<uint64_t>& prev_signatures,
+		unsigned int width, unsigned int tile_count );
+
 private:
 	const GameResourcesConstPtr game_resources_;
 	const bool use_hd_dynamic_lightmap_;
@@ -74,17 +110,41 @@ private:
 	r_Framebuffer shadowmap_;
 
 	// Shaders
-	r_GLSLProgram floor_light_pass_shader_;
-	r_GLSLProgram floor_ambient_light_pass_shader_;
-	r_GLSLProgram walls_light_pass_shader_;
-	r_GLSLProgram walls_ambient_light_pass_shader_;
+	ShaderProgram floor_light_pass_shader_;
+	ShaderProgram floor_ambient_light_pass_shader_;
+	ShaderProgram walls_light_pass_shader_;
+	ShaderProgram walls_ambient_light_pass_shader_;
 
-	r_GLSLProgram copy_shader_;
-	r_GLSLProgram shadowmap_shader_;
+	ShaderProgram copy_shader_;
+	ShaderProgram shadowmap_shader_;
 
 	MapDataConstPtr map_data_;
 
 	std::vector<bool> updated_dynamic_walls_flags_;
+
+	// Incremental update.
+	// Lightmaps are splitted into tiles. For each tile we calculate signature of dynamic lights, affecting it.
+	// Only tiles with changed signature are redrawn. Other tiles keep result of previous frame.
+	const bool incremental_update_;
+	bool lightmaps_valid_= false;
+
+	std::vector<MapData::Light> dynamic_lights_;
+	std::vector<uint64_t> dynamic_lights_hashes_;
+
+	std::vector<uint64_t> floor_tiles_signatures_;
+	std::vector<uint64_t> prev_floor_tiles_signatures_;
+
+	std::vector<uint64_t> walls_tiles_signatures_;
+	std::vector<uint64_t> prev_walls_tiles_signatures_;
+	std::vector<TilesBBox> walls_tiles_bboxes_;
+
+	std::vector<bool> dirty_tiles_;
+	std::vector<TilesRegion> dirty_regions_;
+
+	unsigned int last_floor_tiles_updated_= 0u;
+	unsigned int last_walls_tiles_updated_= 0u;
+	unsigned int last_update_draw_calls_= 0u;
+	unsigned int last_update_uploaded_bytes_= 0u;
 };
 
 } // namespace PanzerChasm
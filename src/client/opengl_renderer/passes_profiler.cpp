@@ -0,0 +1,187 @@
+#include "../../assert.hpp"
+#include "../../log.hpp"
+
+#include "passes_profiler.hpp"
+
+namespace PanzerChasm
+{
+
+constexpr unsigned int PassesProfiler::c_pass_count;
+constexpr unsigned int PassesProfiler::c_query_frames;
+constexpr unsigned int PassesProfiler::c_max_segments;
+
+const char* PassesProfiler::GetPassName( const Pass pass )
+{
+	switch( pass )
+	{
+	case Pass::LightmapUpdate: return "lightmap";
+	case Pass::Walls: return "walls";
+	case Pass::Floors: return "floors";
+	case Pass::Models: return "models";
+	case Pass::Monsters: return "monsters";
+	case Pass::Sky: return "sky";
+	case Pass::Shadows: return "shadows";
+	case Pass::Sprites: return "sprites";
+	case Pass::NumPasses: break;
+	};
+
+	PC_ASSERT(false);
+	return "";
+}
+
+PassesProfiler::PassesProfiler()
+{
+	for( float& t : last_gpu_times_ms_ )
+		t= 0.0f;
+
+	// Some implementations have no timestamp counter.
+	GLint counter_bits= 0;
+	glGetQueryiv( GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &counter_bits );
+	gpu_time_supported_= counter_bits > 0;
+
+	if( gpu_time_supported_ )
+	{
+		frames_queries_.resize( c_query_frames );
+		for( FrameQueries& frame_queries : frames_queries_ )
+			glGenQueries( c_max_segments * 2u, frame_queries.queries );
+	}
+	else
+		Log::Info( "GPU timestamp queries not supported, GPU time of passes will not be measured" );
+}
+
+PassesProfiler::~PassesProfiler()
+{
+	for( FrameQueries& frame_queries : frames_queries_ )
+		glDeleteQueries( c_max_segments * 2u, frame_queries.queries );
+}
+
+bool PassesProfiler::GPUTimeSupported() const
+{
+	return gpu_time_supported_;
+}
+
+void PassesProfiler::BeginFrame()
+{
+	if( pass_active_ )
+		EndPass();
+
+	last_frame_stats_= current_frame_stats_;
+	current_frame_stats_= FrameStats();
+
+	if( !gpu_time_supported_ )
+		return;
+
+	// Read results of previous frames, starting from oldest. Do not wait for not ready results.
+	for( unsigned int i= 1u; i <= c_query_frames; i++ )
+	{
+		FrameQueries& frame_queries= frames_queries_[ ( current_query_frame_ + i ) % c_query_frames ];
+		if( frame_queries.issued && TryReadQueries( frame_queries ) )
+			frame_queries.issued= false;
+	}
+
+	// Results of frame, which queries are reused, are lost, if still not ready.
+	current_query_frame_= ( current_query_frame_ + 1u ) % c_query_frames;
+	FrameQueries& frame_queries= frames_queries_[ current_query_frame_ ];
+	frame_queries.issued= false;
+	frame_queries.segment_count= 0u;
+
+	for( unsigned int p= 0u; p < c_pass_count; p++ )
+		last_frame_stats_.passes[p].gpu_time_ms= last_gpu_times_ms_[p];
+	last_frame_stats_.gpu_time_valid= last_gpu_times_valid_;
+}
+
+void PassesProfiler::BeginPass( const Pass pass )
+{
+	PC_ASSERT( pass != Pass::NumPasses );
+
+	if( pass_active_ )
+		EndPass();
+
+	pass_active_= true;
+	current_pass_= pass;
+	pass_start_time_= std::chrono::steady_clock::now();
+
+	if( gpu_time_supported_ )
+	{
+		FrameQueries& frame_queries= frames_queries_[ current_query_frame_ ];
+		if( frame_queries.segment_count < c_max_segments )
+		{
+			frame_queries.segments_passes[ frame_queries.segment_count ]= pass;
+			glQueryCounter( frame_queries.queries[ frame_queries.segment_count * 2u ], GL_TIMESTAMP );
+		}
+	}
+}
+
+void PassesProfiler::EndPass()
+{
+	if( !pass_active_ )
+		return;
+
+	current_frame_stats_.passes[ static_cast<unsigned int>(current_pass_) ].cpu_time_ms+=
+		std::chrono::duration<float, std::milli>( std::chrono::steady_clock::now() - pass_start_time_ ).count();
+
+	if( gpu_time_supported_ )
+	{
+		FrameQueries& frame_queries= frames_queries_[ current_query_frame_ ];
+		if( frame_queries.segment_count < c_max_segments )
+		{
+			glQueryCounter( frame_queries.queries[ frame_queries.segment_count * 2u + 1u ], GL_TIMESTAMP );
+			frame_queries.segment_count++;
+			frame_queries.issued= true;
+		}
+	}
+
+	pass_active_= false;
+}
+
+void PassesProfiler::AddDrawCalls( const unsigned int count )
+{
+	if( pass_active_ )
+		current_frame_stats_.passes[ static_cast<unsigned int>(current_pass_) ].draw_calls+= count;
+}
+
+void PassesProfiler::AddStateChanges( const unsigned int count )
+{
+	if( pass_active_ )
+		current_frame_stats_.passes[ static_cast<unsigned int>(current_pass_) ].state_changes+= count;
+}
+
+void PassesProfiler::AddUploadedBytes( const unsigned int bytes )
+{
+	if( pass_active_ )
+		current_frame_stats_.passes[ static_cast<unsigned int>(current_pass_) ].uploaded_bytes+= bytes;
+}
+
+const PassesProfiler::FrameStats& PassesProfiler::GetLastFrameStats() const
+{
+	return last_frame_stats_;
+}
+
+bool PassesProfiler::TryReadQueries( FrameQueries& frame_queries )
+{
+	PC_ASSERT( frame_queries.segment_count > 0u );
+
+	// Queries are finished in order of issuing, so, check only last.
+	GLuint available= 0u;
+	glGetQueryObjectuiv( frame_queries.queries[ frame_queries.segment_count * 2u - 1u ], GL_QUERY_RESULT_AVAILABLE, &available );
+	if( available == 0u )
+		return false;
+
+	for( float& t : last_gpu_times_ms_ )
+		t= 0.0f;
+
+	for( unsigned int s= 0u; s < frame_queries.segment_count; s++ )
+	{
+		GLuint64 begin_time= 0u, end_time= 0u;
+		glGetQueryObjectui64v( frame_queries.queries[ s * 2u      ], GL_QUERY_RESULT, &begin_time );
+		glGetQueryObjectui64v( frame_queries.queries[ s * 2u + 1u ], GL_QUERY_RESULT, &end_time );
+		if( end_time > begin_time )
+			last_gpu_times_ms_[ static_cast<unsigned int>( frame_queries.segments_passes[s] ) ]+=
+				float( end_time - begin_time ) / 1000000.0f;
+	}
+
+	last_gpu_times_valid_= true;
+	return true;
+}
+
+} // namespace PanzerChasm
@@ -0,0 +1,100 @@
+#pragma once
+#include <chrono>
+#include <vector>
+
+#include <panzer_ogl_lib.hpp>
+
+namespace PanzerChasm
+{
+
+// Per-pass statistics of map drawing.
+// CPU time is time of commands submission. GPU time is measured via timestamp queries, if they are supported.
+// Queries results are read some frames later, only when they are ready, so, GPU times are late for several frames.
+class PassesProfiler final
+{
+public:
+	enum class Pass : unsigned int
+	{
+		LightmapUpdate,
+		Walls,
+		Floors,
+		Models,
+		Monsters,
+		Sky,
+		Shadows,
+		Sprites,
+		NumPasses,
+	};
+
+	static constexpr unsigned int c_pass_count= static_cast<unsigned int>(Pass::NumPasses);
+
+	struct PassStats
+	{
+		float cpu_time_ms= 0.0f;
+		float gpu_time_ms= 0.0f;
+		unsigned int draw_calls= 0u;
+		unsigned int state_changes= 0u;
+		unsigned int uploaded_bytes= 0u;
+	};
+
+	struct FrameStats
+	{
+		PassStats passes[ c_pass_count ];
+		bool gpu_time_valid= false;
+	};
+
+	static const char* GetPassName( Pass pass );
+
+	PassesProfiler();
+	PassesProfiler( const PassesProfiler& other )= delete;
+	~PassesProfiler();
+
+	PassesProfiler& operator=( const PassesProfiler& other )= delete;
+
+	bool GPUTimeSupported() const;
+
+	void BeginFrame();
+
+	// Pass may be started many times in one frame, times are summed.
+	void BeginPass( Pass pass );
+	void EndPass();
+
+	// Counters are added to current pass. Ignored, if there is no current pass.
+	void AddDrawCalls( unsigned int count= 1u );
+	void AddStateChanges( unsigned int count= 1u );
+	void AddUploadedBytes( unsigned int bytes );
+
+	// Stats of previous frame, GPU times of last frame with ready results.
+	const FrameStats& GetLastFrameStats() const;
+
+private:
+	static constexpr unsigned int c_query_frames= 4u;
+	static constexpr unsigned int c_max_segments= 32u;
+
+	struct FrameQueries
+	{
+		// Two timestamps for each segment - at begin and at end.
+		GLuint queries[ c_max_segments * 2u ];
+		Pass segments_passes[ c_max_segments ];
+		unsigned int segment_count= 0u;
+		bool issued= false;
+	};
+
+	bool TryReadQueries( FrameQueries& frame_queries );
+
+private:
+	bool gpu_time_supported_= false;
+	std::vector<FrameQueries> frames_queries_;
+	unsigned int current_query_frame_= 0u;
+
+	FrameStats current_frame_stats_;
+	FrameStats last_frame_stats_;
+	float last_gpu_times_ms_[ c_pass_count ];
+	bool last_gpu_times_valid_= false;
+
+	bool pass_active_= false;
+	Pass current_pass_= Pass::NumPasses;
+	std::chrono::steady_clock::time_point pass_start_time_;
+};
+
+} // namespace PanzerChasm
@@ -0,0 +1,225 @@
+#include <cstring>
+#include <utility>
+
+#include "../../assert.hpp"
+#include "../../log.hpp"
+
+#include "streaming_buffer.hpp"
+
+namespace PanzerChasm
+{
+
+constexpr unsigned int StreamingBuffer::c_frames;
+constexpr unsigned int StreamingBuffer::c_data_alignment;
+
+static const GLbitfield g_persistent_mapping_flags= GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+bool StreamingBuffer::PersistentMappingSupported()
+{
+	GLint major_version= 0, minor_version= 0;
+	glGetIntegerv( GL_MAJOR_VERSION, &major_version );
+	glGetIntegerv( GL_MINOR_VERSION, &minor_version );
+	if( major_version > 4 || ( major_version == 4 && minor_version >= 4 ) )
+		return true;
+
+	GLint extension_count= 0;
+	glGetIntegerv( GL_NUM_EXTENSIONS, &extension_count );
+	for( GLint i= 0; i < extension_count; i++ )
+	{
+		const char* const extension= reinterpret_cast<const char*>( glGetStringi( GL_EXTENSIONS, i ) );
+		if( extension != nullptr && std::strcmp( extension, "GL_ARB_buffer_storage" ) == 0 )
+			return true;
+	}
+
+	return false;
+}
+
+StreamingBuffer::StreamingBuffer()
+{
+	for( GLsync& fence : frames_fences_ )
+		fence= nullptr;
+}
+
+StreamingBuffer::StreamingBuffer( const bool use_persistent_mapping, const unsigned int initial_frame_size )
+	: StreamingBuffer()
+{
+	persistent_mapping_= use_persistent_mapping;
+	Allocate( initial_frame_size );
+}
+
+StreamingBuffer::StreamingBuffer( StreamingBuffer&& other )
+	: StreamingBuffer()
+{
+	*this= std::move(other);
+}
+
+StreamingBuffer::~StreamingBuffer()
+{
+	Free();
+}
+
+StreamingBuffer& StreamingBuffer::operator=( StreamingBuffer&& other )
+{
+	Free();
+
+	persistent_mapping_= other.persistent_mapping_;
+	buffer_id_= other.buffer_id_;
+	frame_size_= other.frame_size_;
+	frame_offset_= other.frame_offset_;
+	mapped_data_= other.mapped_data_;
+	current_frame_= other.current_frame_;
+	for( unsigned int i= 0u; i < c_frames; i++ )
+	{
+		frames_fences_[i]= other.frames_fences_[i];
+		other.frames_fences_[i]= nullptr;
+	}
+
+	other.buffer_id_= 0u;
+	other.frame_size_= 0u;
+	other.frame_offset_= 0u;
+	other.mapped_data_= nullptr;
+
+	return *this;
+}
+
+void StreamingBuffer::BeginFrame()
+{
+	if( buffer_id_ == 0u )
+		return;
+
+	if( persistent_mapping_ )
+	{
+		// Mark end of usage of current frame region, than wait, while GPU finish reading of next region.
+		if( frames_fences_[ current_frame_ ] != nullptr )
+			glDeleteSync( frames_fences_[ current_frame_ ] );
+		frames_fences_[ current_frame_ ]= glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+
+		current_frame_= ( current_frame_ + 1u ) % c_frames;
+		WaitFence( current_frame_ );
+
+		frame_offset_= 0u;
+	}
+	else
+	{
+		// Force orphaning of buffer at first upload in frame.
+		frame_offset_= frame_size_;
+	}
+}
+
+unsigned int StreamingBuffer::Upload( const void* const data, const unsigned int size )
+{
+	PC_ASSERT( buffer_id_ != 0u );
+
+	glBindBuffer( GL_ARRAY_BUFFER, buffer_id_ );
+
+	if( frame_offset_ + size > frame_size_ )
+	{
+		if( persistent_mapping_ || size > frame_size_ )
+		{
+			// Frame region is too small. Recreate bigger buffer. Driver keeps old storage, while it is used by previous draw calls.
+			unsigned int new_frame_size= frame_size_ * 2u;
+			while( new_frame_size < size )
+				new_frame_size*= 2u;
+
+			Free();
+			Allocate( new_frame_size );
+		}
+		else
+		{
+			// Orphan buffer storage. Driver gives us new storage, without waiting for previous draw calls.
+			glBufferData( GL_ARRAY_BUFFER, frame_size_, nullptr, GL_STREAM_DRAW );
+		}
+
+		frame_offset_= 0u;
+	}
+
+	unsigned int offset;
+	if( persistent_mapping_ )
+	{
+		offset= current_frame_ * frame_size_ + frame_offset_;
+		std::memcpy( mapped_data_ + offset, data, size );
+	}
+	else
+	{
+		offset= frame_offset_;
+		glBufferSubData( GL_ARRAY_BUFFER, offset, size, data );
+	}
+
+	frame_offset_+= ( size + ( c_data_alignment - 1u ) ) & ~( c_data_alignment - 1u );
+	return offset;
+}
+
+GLuint StreamingBuffer::GetBufferId() const
+{
+	return buffer_id_;
+}
+
+bool StreamingBuffer::IsPersistentMapped() const
+{
+	return persistent_mapping_;
+}
+
+void StreamingBuffer::Allocate( const unsigned int frame_size )
+{
+	PC_ASSERT( buffer_id_ == 0u );
+
+	frame_size_= ( frame_size + ( c_data_alignment - 1u ) ) & ~( c_data_alignment - 1u );
+	frame_offset_= 0u;
+	current_frame_= 0u;
+
+	glGenBuffers( 1, &buffer_id_ );
+	glBindBuffer( GL_ARRAY_BUFFER, buffer_id_ );
+
+	if( persistent_mapping_ )
+	{
+		const GLsizeiptr buffer_size= frame_size_ * c_frames;
+		glBufferStorage( GL_ARRAY_BUFFER, buffer_size, nullptr, g_persistent_mapping_flags );
+		mapped_data_= static_cast<unsigned char*>( glMapBufferRange( GL_ARRAY_BUFFER, 0, buffer_size, g_persistent_mapping_flags ) );
+		if( mapped_data_ != nullptr )
+			return;
+
+		Log::Warning( "Can not map streaming buffer persistently, use buffer orphaning" );
+		glDeleteBuffers( 1, &buffer_id_ );
+		glGenBuffers( 1, &buffer_id_ );
+		glBindBuffer( GL_ARRAY_BUFFER, buffer_id_ );
+		persistent_mapping_= false;
+	}
+
+	glBufferData( GL_ARRAY_BUFFER, frame_size_, nullptr, GL_STREAM_DRAW );
+}
+
+void StreamingBuffer::Free()
+{
+	for( GLsync& fence : frames_fences_ )
+	{
+		if( fence != nullptr )
+			glDeleteSync( fence );
+		fence= nullptr;
+	}
+
+	// Buffer is unmapped on deletion.
+	if( buffer_id_ != 0u )
+		glDeleteBuffers( 1, &buffer_id_ );
+
+	buffer_id_= 0u;
+	mapped_data_= nullptr;
+}
+
+void StreamingBuffer::WaitFence( const unsigned int frame )
+{
+	GLsync& fence= frames_fences_[ frame ];
+	if( fence == nullptr )
+		return;
+
+	while( true )
+	{
+		const GLenum result= glClientWaitSync( fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000u * 1000u * 1000u );
+		if( result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED )
+			break;
+	}
+
+	glDeleteSync( fence );
+	fence= nullptr;
+}
+
+} // namespace PanzerChasm
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <panzer_ogl_lib.hpp>
+
+namespace PanzerChasm
+{
+
+// Buffer for data, generated and uploaded to GPU each frame.
+// If persistent mapping is supported, buffer storage is mapped once and splitted into regions for several frames.
+// Regions are used as ring, reusing of region waits on fence of frame, which used it.
+// Otherwise, buffer storage is orphaned, when it is full.
+class StreamingBuffer final
+{
+public:
+	static bool PersistentMappingSupported();
+
+	StreamingBuffer();
+	StreamingBuffer( bool use_persistent_mapping, unsigned int initial_frame_size );
+	StreamingBuffer( StreamingBuffer&& other );
+	StreamingBuffer( const StreamingBuffer& other )= delete;
+
+	~StreamingBuffer();
+
+	StreamingBuffer& operator=( StreamingBuffer&& other );
+	StreamingBuffer& operator=( const StreamingBuffer& other )= delete;
+
+	// Call at frame start, before any upload.
+	void BeginFrame();
+
+	// Returns offset of data in buffer. Buffer may be recreated, so, setup vertex attributes after each upload.
+	// Result binding point is GL_ARRAY_BUFFER.
+	unsigned int Upload( const void* data, unsigned int size );
+
+	GLuint GetBufferId() const;
+	bool IsPersistentMapped() const;
+
+private:
+	static constexpr unsigned int c_frames= 3u;
+	static constexpr unsigned int c_data_alignment= 16u;
+
+	void Allocate( unsigned int frame_size );
+	void Free();
+	void WaitFence( unsigned int frame );
+
+private:
+	bool persistent_mapping_= false;
+	GLuint buffer_id_= 0u;
+
+	unsigned int frame_size_= 0u;
+	unsigned int frame_offset_= 0u;
+
+	// For persistent mapping only.
+	unsigned char* mapped_data_= nullptr;
+	unsigned int current_frame_= 0u;
+	GLsync frames_fences_[ c_frames ];
+};
+
+} // namespace PanzerChasm
@@ -1,5 +1,16 @@
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "../../common/files.hpp"
+using namespace ChasmReverse;
+
 #include "../../assert.hpp"
+#include "../../cache_files.hpp"
+#include "../../log.hpp"
 #include "../../map_loader.hpp"
+#include "../../math_utils.hpp"
+#include "../../save_load.hpp"
 
 #include "map_bsp_tree.hpp"
 #include <limits>
@@ -7,11 +18,17 @@
 namespace PanzerChasm
 {
 
-MapBSPTree::MapBSPTree( const MapDataConstPtr& map_data )
+const char MapBSPTree::CacheHeader::c_expected_id[8]= "PanChBs"; // PanzerChasmBSP
+
+MapBSPTree::MapBSPTree( const MapDataConstPtr& map_data, const BuildOptions& options )
 	: map_data_(map_data)
+	, options_(options)
 {
 	PC_ASSERT( map_data_ != nullptr );
 
+	if( options_.use_cache && LoadFromCache() )
+		return;
+
 	nodes_.emplace_back(); // Dummy node
 
 	BuildSegments segments;
@@ -26,7 +43,12 @@ MapBSPTree::MapBSPTree( const MapDataConstPtr& map_data )
 		segment.vert_pos[1]= wall.vert_pos[1];
 	}
 
+	random_generator_.seed( std::minstd_rand::default_seed );
 	root_node_= BuildTree_r( segments );
+	CalculateNodesBoundingBoxes_r( root_node_ );
+
+	if( options_.use_cache )
+		SaveToCache();
 }
 
 MapBSPTree::~MapBSPTree()
@@ -43,9 +65,18 @@ unsigned int MapBSPTree::BuildTree_r( const BuildSegments& build_segments )
 	const BuildSegment* best_splitter_segment= nullptr;
 
 	// Select best splitter.
-	// TODO - if we have too much walls - check not all walls, but some percent of random walls.
-	for( const BuildSegment& splitter_segment : build_segments )
+	// If we have too much walls - check not all walls, but some random walls.
+	const bool sample_splitters=
+		options_.max_splitter_candidates > 0u &&
+		build_segments.size() > options_.max_splitter_candidates;
+	const unsigned int candidate_count=
+		sample_splitters ? options_.max_splitter_candidates : static_cast<unsigned int>( build_segments.size() );
+
+	for( unsigned int candidate= 0u; candidate < candidate_count; candidate++ )
 	{
+		const BuildSegment& splitter_segment=
+			build_segments[ sample_splitters ? random_generator_() % build_segments.size() : candidate ];
+
 		m_Plane2 plane;
 		plane.normal.x= splitter_segment.vert_pos[1].y - splitter_segment.vert_pos[0].y;
 		plane.normal.y= splitter_segment.vert_pos[0].x - splitter_segment.vert_pos[1].x;
@@ -96,6 +127,17 @@ unsigned int MapBSPTree::BuildTree_r( const BuildSegments& build_segments )
 		}
 	} // fo splitter candidates.
 
+	if( best_splitter_segment == nullptr && sample_splitters )
+	{
+		// All random candidates are degenerated - take any valid splitter.
+		for( const BuildSegment& segment : build_segments )
+			if( ( segment.vert_pos[1] - segment.vert_pos[0] ).SquareLength() > 0.0f )
+			{
+				best_splitter_segment= &segment;
+				break;
+			}
+	}
+
 	if( best_splitter_segment == nullptr )
 	{
 		PC_ASSERT( false );
@@ -218,4 +260,142 @@ unsigned int MapBSPTree::BuildTree_r( const BuildSegments& build_segments )
 	return node_number;
 }
 
+void MapBSPTree::CalculateNodesBoundingBoxes_r( const unsigned int node_number )
+{
+	Node& node= nodes_[node_number];
+
+	node.bb_min= m_Vec2( +Constants::max_float, +Constants::max_float );
+	node.bb_max= m_Vec2( -Constants::max_float, -Constants::max_float );
+
+	for( unsigned int i= 0u; i < node.segment_count; i++ )
+	{
+		const WallSegment& segment= segments_[ node.first_segment + i ];
+		for( const m_Vec2& v : segment.vert_pos )
+		{
+			node.bb_min.x= std::min( node.bb_min.x, v.x );
+			node.bb_min.y= std::min( node.bb_min.y, v.y );
+			node.bb_max.x= std::max( node.bb_max.x, v.x );
+			node.bb_max.y= std::max( node.bb_max.y, v.y );
+		}
+	}
+
+	for( const unsigned int child : { node.node_front, node.node_back } )
+	{
+		if( child == c_null_node )
+			continue;
+
+		CalculateNodesBoundingBoxes_r( child );
+		const Node& child_node= nodes_[child];
+		node.bb_min.x= std::min( node.bb_min.x, child_node.bb_min.x );
+		node.bb_min.y= std::min( node.bb_min.y, child_node.bb_min.y );
+		node.bb_max.x= std::max( node.bb_max.x, child_node.bb_max.x );
+		node.bb_max.y= std::max( node.bb_max.y, child_node.bb_max.y );
+	}
+}
+
+unsigned int MapBSPTree::CalculateWallsHash() const
+{
+	// Tree depends only on walls positions.
+	std::vector<unsigned char> walls_data( map_data_->static_walls.size() * sizeof(m_Vec2) * 2u );
+	for( unsigned int i= 0u; i < map_data_->static_walls.size(); i++ )
+		std::memcpy( walls_data.data() + i * sizeof(m_Vec2) * 2u, map_data_->static_walls[i].vert_pos, sizeof(m_Vec2) * 2u );
+
+	return SaveHeader::CalculateHash( walls_data.data(), static_cast<unsigned int>( walls_data.size() ) );
+}
+
+bool MapBSPTree::LoadFromCache()
+{
+	char file_name[64];
+	GetMapCacheFileName( map_data_->number, "pcbsp", file_name, sizeof(file_name) );
+
+	std::FILE* const f= std::fopen( file_name, "rb" );
+	if( f == nullptr )
+		return false;
+
+	std::fseek( f, 0, SEEK_END );
+	const unsigned int file_size= std::ftell( f );
+	std::fseek( f, 0, SEEK_SET );
+
+	CacheHeader header;
+	if( file_size < sizeof(CacheHeader) )
+	{
+		std::fclose(f);
+		return false;
+	}
+	FileRead( f, &header, sizeof(CacheHeader) );
+
+	if( std::memcmp( header.id, CacheHeader::c_expected_id, sizeof(header.id) ) != 0 ||
+		header.version != CacheHeader::c_expected_version ||
+		header.map_number != map_data_->number ||
+		header.walls_hash != CalculateWallsHash() ||
+		header.max_splitter_candidates != options_.max_splitter_candidates ||
+		header.node_count == 0u ||
+		header.root_node >= header.node_count ||
+		file_size != sizeof(CacheHeader) + header.node_count * sizeof(Node) + header.segment_count * sizeof(WallSegment) )
+	{
+		Log::Info( "BSP tree cache \"", file_name, "\" is outdated" );
+		std::fclose(f);
+		return false;
+	}
+
+	nodes_.resize( header.node_count );
+	segments_.resize( header.segment_count );
+	FileRead( f, nodes_.data(), header.node_count * sizeof(Node) );
+	FileRead( f, segments_.data(), header.segment_count * sizeof(WallSegment) );
+	std::fclose(f);
+
+	root_node_= header.root_node;
+
+	// Check loaded data, do not trust file.
+	bool is_valid= true;
+	for( const Node& node : nodes_ )
+		is_valid&=
+			node.node_front < nodes_.size() && node.node_back < nodes_.size() &&
+			node.first_segment <= segments_.size() && node.segment_count <= segments_.size() - node.first_segment;
+	for( const WallSegment& segment : segments_ )
+		is_valid&= segment.wall_index < map_data_->static_walls.size();
+
+	if( !is_valid )
+	{
+		Log::Warning( "BSP tree cache \"", file_name, "\" is broken" );
+		nodes_.clear();
+		segments_.clear();
+		return false;
+	}
+
+	Log::Info( "BSP tree loaded from cache \"", file_name, "\"" );
+	return true;
+}
+
+void MapBSPTree::SaveToCache() const
+{
+	CreateCacheDir();
+
+	char file_name[64];
+	GetMapCacheFileName( map_data_->number, "pcbsp", file_name, sizeof(file_name) );
+
+	std::FILE* const f= std::fopen( file_name, "wb" );
+	if( f == nullptr )
+	{
+		Log::Warning( "Can not write BSP tree cache \"", file_name, "\"" );
+		return;
+	}
+
+	CacheHeader header;
+	std::memcpy( header.id, CacheHeader::c_expected_id, sizeof(header.id) );
+	header.version= CacheHeader::c_expected_version;
+	header.map_number= map_data_->number;
+	header.walls_hash= CalculateWallsHash();
+	header.max_splitter_candidates= options_.max_splitter_candidates;
+	header.root_node= root_node_;
+	header.node_count= static_cast<unsigned int>( nodes_.size() );
+	header.segment_count= static_cast<unsigned int>( segments_.size() );
+
+	FileWrite( f, &header, sizeof(CacheHeader) );
+	FileWrite( f, nodes_.data(), header.node_count * sizeof(Node) );
+	FileWrite( f, segments_.data(), header.segment_count * sizeof(WallSegment) );
+
+	std::fclose(f);
+}
+
 } // namespace PanzerChasm
@@ -1,4 +1,6 @@
 #pragma once
+#include <random>
+
 #include <plane.hpp>
 
 #include "../../fwd.hpp"
@@ -28,16 +30,34 @@ public:
 
 		// Zero - if has no child.
 		unsigned int node_front, node_back;
+
+		// Bounding box of all segments of node and it`s children.
+		// All static walls have same z range - [ 0; walls_height ], so, store only xy.
+		m_Vec2 bb_min, bb_max;
+	};
+
+	struct BuildOptions
+	{
+		// Load tree from disk cache, if it exists, and save new tree into cache.
+		bool use_cache= true;
+
+		// If greater, than zero - check only random subset of splitters for large segments sets.
+		// Zero means check all splitters.
+		unsigned int max_splitter_candidates= 0u;
 	};
 
 public:
-	explicit MapBSPTree( const MapDataConstPtr& map_data );
+	MapBSPTree( const MapDataConstPtr& map_data, const BuildOptions& options );
 	~MapBSPTree();
 
-	// FUNC - void( const Node& node )
+	// FUNC - void( const WallSegment& segment )
 	template<class Func>
 	void EnumerateSegmentsFrontToBack( const m_Vec2& camera_position, const Func& func ) const;
 
+	// NODE_FUNC - bool( const Node& node ). If returns false - node and all it`s children are skipped.
+	template<class NodeFunc, class Func>
+	void EnumerateSegmentsFrontToBack( const m_Vec2& camera_position, const NodeFunc& node_func, const Func& func ) const;
+
 private:
 	struct BuildSegment
 	{
@@ -46,15 +66,39 @@ private:
 	};
 	typedef std::vector<BuildSegment> BuildSegments;
 
+	struct CacheHeader
+	{
+		static const char c_expected_id[8];
+		static constexpr unsigned int c_expected_version= 2u; // Change each time, when format changed.
+
+		unsigned char id[8]; // must be equal to c_expected_id
+		unsigned int version;
+		unsigned int map_number;
+		unsigned int walls_hash;
+		unsigned int max_splitter_candidates;
+		unsigned int root_node;
+		unsigned int node_count;
+		unsigned int segment_count;
+	};
+
 private:
 	// Returns new node number.
 	unsigned int BuildTree_r( const BuildSegments& build_segments );
+	void CalculateNodesBoundingBoxes_r( unsigned int node_number );
 
-	template<class Func>
-	void EnumerateSegmentsFrontToBack_r( const Node& node, const m_Vec2& camera_position, const Func& func ) const;
+	unsigned int CalculateWallsHash() const;
+	bool LoadFromCache();
+	void SaveToCache() const;
+
+	template<class NodeFunc, class Func>
+	void EnumerateSegmentsFrontToBack_r( const Node& node, const m_Vec2& camera_position, const NodeFunc& node_func, const Func& func ) const;
 
 private:
 	const MapDataConstPtr map_data_;
+	const BuildOptions options_;
+
+	// Generator for splitter candidates selection. Reset before each build, for reproducible results.
+	std::minstd_rand random_generator_;
 
 	std::vector<WallSegment> segments_;
 
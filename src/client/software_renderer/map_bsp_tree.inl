@@ -8,12 +8,21 @@ namespace PanzerChasm
 template<class Func>
 void MapBSPTree::EnumerateSegmentsFrontToBack( const m_Vec2& camera_position, const Func& func ) const
 {
-	EnumerateSegmentsFrontToBack_r( nodes_[root_node_], camera_position, func );
+	EnumerateSegmentsFrontToBack( camera_position, []( const Node& ){ return true; }, func );
 }
 
-template<class Func>
-void MapBSPTree::EnumerateSegmentsFrontToBack_r( const Node& node, const m_Vec2& camera_position, const Func& func ) const
+template<class NodeFunc, class Func>
+void MapBSPTree::EnumerateSegmentsFrontToBack( const m_Vec2& camera_position, const NodeFunc& node_func, const Func& func ) const
 {
+	EnumerateSegmentsFrontToBack_r( nodes_[root_node_], camera_position, node_func, func );
+}
+
+template<class NodeFunc, class Func>
+void MapBSPTree::EnumerateSegmentsFrontToBack_r( const Node& node, const m_Vec2& camera_position, const NodeFunc& node_func, const Func& func ) const
+{
+	if( !node_func( node ) )
+		return;
+
 	const bool at_front= node.plane.IsPointAheadPlane( camera_position );
 
 	unsigned int node_front, node_back;
@@ -31,7 +40,7 @@ void MapBSPTree::EnumerateSegmentsFrontToBack_r( const Node& node, const m_Vec2&
 	if( node_front != c_null_node )
 	{
 		PC_ASSERT( node_front < nodes_.size() );
-		EnumerateSegmentsFrontToBack_r( nodes_[ node_front ], camera_position, func );
+		EnumerateSegmentsFrontToBack_r( nodes_[ node_front ], camera_position, node_func, func );
 	}
 
 	for( unsigned int segment= 0u; segment < node.segment_count; segment++ )
@@ -44,7 +53,7 @@ void MapBSPTree::EnumerateSegmentsFrontToBack_r( const Node& node, const m_Vec2&
 	if(  node_back != c_null_node )
 	{
 		PC_ASSERT(  node_back < nodes_.size() );
-		EnumerateSegmentsFrontToBack_r( nodes_[  node_back ], camera_position, func );
+		EnumerateSegmentsFrontToBack_r( nodes_[  node_back ], camera_position, node_func, func );
 	}
 }
 
@@ -6,21 +6,127 @@
 #include <mmintrin.h>
 #endif
 
+#ifdef PC_X86_SIMD_INSTRUCTIONS
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+#endif
+
+#include "../../math_utils.hpp"
+
 #include "rasterizer.hpp"
+#include "rasterizer_span_kernels.inl"
 
 namespace PanzerChasm
 {
 
+// Process destination pixels in range [ x_begin; x_end ).
+static void CopyScaledRowWithBlend(
+	const uint32_t* const src, const unsigned int x_step,
+	uint32_t* const dst, const unsigned int x_begin, const unsigned int x_end,
+	const unsigned char* const blend_color_components4, const unsigned char blend_alpha )
+{
+	unsigned int premultiplied_blend_color[4];
+	for( unsigned int j= 0u; j < 4u; j++ )
+		premultiplied_blend_color[j]= blend_color_components4[j] * blend_alpha;
+	const unsigned int one_minus_alpha= 256u - blend_alpha;
+
+	for( unsigned int x= x_begin; x < x_end; x++ )
+	{
+		const uint32_t pixel_value= src[ ( x * x_step ) >> 16u ];
+		unsigned char color[4];
+		for( unsigned int j= 0u; j < 4u; j++ )
+			color[j]= (
+				reinterpret_cast<const unsigned char*>(&pixel_value)[j] * one_minus_alpha +
+				premultiplied_blend_color[j] ) >> 8u;
+		std::memcpy( &dst[x], color, sizeof(uint32_t) );
+	}
+}
+
+#ifdef PC_X86_SIMD_INSTRUCTIONS
+PC_TARGET_SSE2 static void CopyScaledRowWithBlendSSE2(
+	const uint32_t* const src, const unsigned int x_step,
+	uint32_t* const dst, const unsigned int dst_size_x,
+	const unsigned char* const blend_color_components4, const unsigned char blend_alpha )
+{
+	const __m128i zero= _mm_setzero_si128();
+	const __m128i premultiplied_blend_color=
+		_mm_set_epi16(
+			short( blend_color_components4[3] * blend_alpha ), short( blend_color_components4[2] * blend_alpha ),
+			short( blend_color_components4[1] * blend_alpha ), short( blend_color_components4[0] * blend_alpha ),
+			short( blend_color_components4[3] * blend_alpha ), short( blend_color_components4[2] * blend_alpha ),
+			short( blend_color_components4[1] * blend_alpha ), short( blend_color_components4[0] * blend_alpha ) );
+	const __m128i one_minus_alpha= _mm_set1_epi16( short( 256u - blend_alpha ) );
+
+	unsigned int x= 0u;
+	for( ; x + 4u <= dst_size_x; x+= 4u )
+	{
+		const __m128i pixels=
+			_mm_set_epi32(
+				int( src[ ( ( x + 3u ) * x_step ) >> 16u ] ), int( src[ ( ( x + 2u ) * x_step ) >> 16u ] ),
+				int( src[ ( ( x + 1u ) * x_step ) >> 16u ] ), int( src[ (   x        * x_step ) >> 16u ] ) );
+
+		// Products are not greater, than 255 * 256, so, use unsigned shift.
+		const __m128i lo= _mm_srli_epi16( _mm_add_epi16( _mm_mullo_epi16( _mm_unpacklo_epi8( pixels, zero ), one_minus_alpha ), premultiplied_blend_color ), 8 );
+		const __m128i hi= _mm_srli_epi16( _mm_add_epi16( _mm_mullo_epi16( _mm_unpackhi_epi8( pixels, zero ), one_minus_alpha ), premultiplied_blend_color ), 8 );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( dst + x ), _mm_packus_epi16( lo, hi ) );
+	}
+
+	CopyScaledRowWithBlend( src, x_step, dst, x, dst_size_x, blend_color_components4, blend_alpha );
+}
+#endif
+
+// Returns azimuth in range [ -pi; pi ] and elevation.
+static void SkyDirectionToAngles( const float* const dir, float& out_azimuth, float& out_elevation )
+{
+	out_azimuth= std::atan2( dir[1], dir[0] );
+	out_elevation= std::atan2( dir[2], std::sqrt( dir[0] * dir[0] + dir[1] * dir[1] ) );
+}
+
+// Result is in range [ 0; size ).
+static fixed16_t WrapSkyTexCoord( const float tc, const float size )
+{
+	const float tc_wrapped= tc - std::floor( tc / size ) * size;
+	return std::max( 0, std::min( fixed16_t( tc_wrapped * 65536.0f ), fixed16_t( size * 65536.0f ) - 1 ) );
+}
+
 Rasterizer::Rasterizer(
 	const unsigned int viewport_size_x,
 	const unsigned int viewport_size_y,
 	const unsigned int row_size,
-	uint32_t* const color_buffer )
-	: viewport_size_x_( int(viewport_size_x) )
-	, viewport_size_y_( int(viewport_size_y) )
-	, row_size_( int(row_size) )
-	, color_buffer_( color_buffer )
+	uint32_t* const color_buffer,
+	const unsigned int band_y_begin,
+	const unsigned int band_y_end )
+	: simd_level_( GetSupportedSIMDLevel() )
+{
+	SetViewport( viewport_size_x, viewport_size_y, row_size, color_buffer, band_y_begin, band_y_end );
+}
+
+Rasterizer::~Rasterizer()
+{}
+
+void Rasterizer::SetViewport(
+	const unsigned int viewport_size_x,
+	const unsigned int viewport_size_y,
+	const unsigned int row_size,
+	uint32_t* const color_buffer,
+	const unsigned int band_y_begin,
+	const unsigned int band_y_end )
 {
+	viewport_size_x_= int(viewport_size_x);
+	viewport_size_y_= int(viewport_size_y);
+	row_size_= int(row_size);
+	color_buffer_= color_buffer;
+	band_y_begin_= int( std::min( band_y_begin, viewport_size_y ) );
+	band_y_end_= int( std::min( band_y_end, viewport_size_y ) );
+
+	PC_ASSERT( band_y_begin_ <= band_y_end_ );
+
+	// Shadow mask is cleared while applying. Clear rows of not applied mask, before changing of layout.
+	for( int y= shadow_mask_y_min_; y < shadow_mask_y_max_; y++ )
+		std::memset( shadow_mask_ + y * shadow_mask_width_, 0, shadow_mask_width_ );
+
 	{ // Setup depth buffer and depth buffer hierarchy.
 		unsigned int memory_for_depth_required= 0u;
 		depth_buffer_width_= ( viewport_size_x + 1u ) & (~1u);
@@ -36,7 +142,18 @@ Rasterizer::Rasterizer(
 			memory_for_depth_required+= depth_buffer_hierarchy_[i].width * depth_buffer_hierarchy_[i].height;
 		}
 
-		depth_buffer_storage_.resize( memory_for_depth_required );
+		// Fill with maximum depth. Depth buffer rows outside band are never cleared, so, they stay occluded.
+		// Rows inside band are cleared at frame start, so, fill only rows outside band and hierarchy.
+		if( depth_buffer_storage_.size() < memory_for_depth_required )
+			depth_buffer_storage_.resize( memory_for_depth_required );
+		std::fill(
+			depth_buffer_storage_.begin(),
+			depth_buffer_storage_.begin() + depth_buffer_width_ * static_cast<unsigned int>(band_y_begin_),
+			0xFFFFu );
+		std::fill(
+			depth_buffer_storage_.begin() + depth_buffer_width_ * static_cast<unsigned int>(band_y_end_),
+			depth_buffer_storage_.begin() + memory_for_depth_required,
+			0xFFFFu );
 
 		unsigned int offset= 0u;
 		depth_buffer_= depth_buffer_storage_.data();
@@ -58,7 +175,10 @@ Rasterizer::Rasterizer(
 		// Main buffer
 		occlusion_buffer_width_ = viewport_size_x_ceil / 8u;
 		occlusion_buffer_height_= viewport_size_y_ceil;
-		occlusion_buffer_storage_.resize( occlusion_buffer_width_ * occlusion_buffer_height_ );
+		// Occlusion buffer is fully cleared at frame start, so, do not clear it here.
+		const unsigned int occlusion_buffer_size= static_cast<unsigned int>( occlusion_buffer_width_ * occlusion_buffer_height_ );
+		if( occlusion_buffer_storage_.size() < occlusion_buffer_size )
+			occlusion_buffer_storage_.resize( occlusion_buffer_size );
 		occlusion_buffer_= occlusion_buffer_storage_.data();
 
 		// Hierarchy
@@ -72,7 +192,9 @@ Rasterizer::Rasterizer(
 			hexopixels_requested+= level.size[0] * level.size[1];
 		}
 
-		occlusion_heirarchy_storage_.resize( hexopixels_requested );
+		occlusion_hierarchy_size_= hexopixels_requested;
+		if( occlusion_heirarchy_storage_.size() < hexopixels_requested )
+			occlusion_heirarchy_storage_.resize( hexopixels_requested );
 		unsigned int offset= 0u;
 		for( unsigned int i= 0u; i < c_occlusion_hierarchy_levels; i++ )
 		{
@@ -81,31 +203,115 @@ Rasterizer::Rasterizer(
 			offset+= level.size[0] * level.size[1];
 		}
 	}
+	// Setup shadow mask. Row size is aligned to 64 bits, for skipping of empty blocks.
+	{
+		shadow_mask_width_= int( ( viewport_size_x + 63u ) / 64u * 8u );
+		// Mask is always zero outside rows, drawn since last applying. New elements are zero too.
+		const unsigned int shadow_mask_size= static_cast<unsigned int>(shadow_mask_width_) * viewport_size_y;
+		if( shadow_mask_storage_.size() < shadow_mask_size )
+			shadow_mask_storage_.resize( shadow_mask_size, 0u );
+		shadow_mask_= shadow_mask_storage_.data();
+		shadow_mask_y_min_= viewport_size_y_;
+		shadow_mask_y_max_= 0;
+	}
 }
 
-Rasterizer::~Rasterizer()
-{}
+static Rasterizer::SIMDLevel DetectSIMDLevel()
+{
+#ifdef PC_X86_SIMD_INSTRUCTIONS
+	bool sse2, avx2;
+
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid( info, 0 );
+	const int max_leaf= info[0];
+
+	__cpuid( info, 1 );
+	sse2= ( info[3] & (1 << 26) ) != 0;
+	// AVX registers must be supported by OS.
+	const bool os_avx=
+		( info[2] & (1 << 27) ) != 0 && ( info[2] & (1 << 28) ) != 0 &&
+		( _xgetbv(0) & 6u ) == 6u;
+
+	avx2= false;
+	if( max_leaf >= 7 && os_avx )
+	{
+		__cpuidex( info, 7, 0 );
+		avx2= ( info[1] & (1 << 5) ) != 0;
+	}
+#else
+	__builtin_cpu_init();
+	sse2= __builtin_cpu_supports( "sse2" );
+	avx2= __builtin_cpu_supports( "avx2" );
+#endif
+
+	if( avx2 )
+		return Rasterizer::SIMDLevel::AVX2;
+	if( sse2 )
+		return Rasterizer::SIMDLevel::SSE2;
+#endif
+	return Rasterizer::SIMDLevel::None;
+}
+
+Rasterizer::SIMDLevel Rasterizer::GetSupportedSIMDLevel()
+{
+	static const SIMDLevel level= DetectSIMDLevel();
+	return level;
+}
+
+const char* Rasterizer::GetSIMDLevelName( const SIMDLevel level )
+{
+	switch( level )
+	{
+	case SIMDLevel::None: return "none";
+	case SIMDLevel::SSE2: return "SSE2";
+	case SIMDLevel::AVX2: return "AVX2";
+	};
+
+	PC_ASSERT(false);
+	return "";
+}
+
+void Rasterizer::SetSIMDLevel( const SIMDLevel level )
+{
+	simd_level_=
+		static_cast<SIMDLevel>(
+			std::min(
+				static_cast<unsigned int>( level ),
+				static_cast<unsigned int>( GetSupportedSIMDLevel() ) ) );
+}
+
+Rasterizer::SIMDLevel Rasterizer::GetSIMDLevel() const
+{
+	return simd_level_;
+}
 
 void Rasterizer::ClearDepthBuffer()
 {
 	std::memset(
-		depth_buffer_,
+		depth_buffer_ + band_y_begin_ * depth_buffer_width_,
 		0,
-		static_cast<unsigned int>( depth_buffer_width_ * viewport_size_y_) * sizeof(unsigned short) );
+		static_cast<unsigned int>( depth_buffer_width_ * ( band_y_end_ - band_y_begin_ ) ) * sizeof(unsigned short) );
 }
 
 void Rasterizer::ClearOcclusionBuffer()
 {
-	// Set all occlusion buffer to zero.
+	// Set occlusion buffer of current viewport to zero.
 	std::memset(
 		occlusion_buffer_,
 		0,
-		occlusion_buffer_storage_.size() );
+		static_cast<unsigned int>( occlusion_buffer_width_ * occlusion_buffer_height_ ) );
 
 	// Mark cells of occlusion buffer outside screen as "white".
 	for( int y= 0; y < viewport_size_y_; y++ )
 	{
 		uint8_t* const dst= occlusion_buffer_ + y * occlusion_buffer_width_;
+		if( y < band_y_begin_ || y >= band_y_end_ )
+		{
+			std::memset( dst, 0xFF, occlusion_buffer_width_ );
+			continue;
+		}
+
 		const int x_ceil= ( viewport_size_x_ + 7 ) & (~7);
 
 		for( int x= viewport_size_x_; x < x_ceil; x++ )
@@ -119,8 +325,8 @@ void Rasterizer::ClearOcclusionBuffer()
 		std::memset( dst, 0xFF, occlusion_buffer_width_ );
 	}
 
-	// Set all occlusion hierarchy data to zero.
-	std::memset( occlusion_heirarchy_storage_.data(), 0, occlusion_heirarchy_storage_.size() * sizeof(unsigned short) );
+	// Set occlusion hierarchy data of current viewport to zero.
+	std::memset( occlusion_heirarchy_storage_.data(), 0, occlusion_hierarchy_size_ * sizeof(unsigned short) );
 
 	// Mark as "white" hierarchy cells bits for subcells, outside screen.
 	for( unsigned int i= 0u; i < c_occlusion_hierarchy_levels; i++ )
@@ -174,6 +380,26 @@ void Rasterizer::ClearOcclusionBuffer()
 		// Set full white Y cells.
 		for( unsigned int y= full_white_start_cell_y; y < level.size[1]; y++ )
 			std::memset( level.data + y * level.size[0], 0xFF, level.size[0] * sizeof(unsigned short) );
+
+		// Mark as "white" subcells outside band.
+		const unsigned int subcell_size= cell_size >> 2u;
+		for( unsigned int y= 0u; y < level.size[1]; y++ )
+		{
+			const int cell_y_begin= int( y << cell_size_log2 );
+			if( cell_y_begin >= band_y_begin_ && cell_y_begin + int(cell_size) <= band_y_end_ )
+				continue;
+
+			unsigned short row_mask= 0u;
+			for( unsigned int dy= 0u; dy < 4u; dy++ )
+			{
+				const int subcell_y_begin= cell_y_begin + int( dy * subcell_size );
+				if( subcell_y_begin + int(subcell_size) <= band_y_begin_ || subcell_y_begin >= band_y_end_ )
+					row_mask|= 15u << ( dy * 4u );
+			}
+
+			for( unsigned int x= 0u; x < level.size[0]; x++ )
+				level.data[ x + y * level.size[0] ]|= row_mask;
+		}
 	}
 }
 
@@ -184,7 +410,12 @@ void Rasterizer::BuildDepthBufferHierarchy()
 	const unsigned int first_level_x_left= static_cast<unsigned int>( viewport_size_x_ ) % c_first_depth_hierarchy_level_size;
 	const unsigned int first_level_y_left= static_cast<unsigned int>( viewport_size_y_ ) % c_first_depth_hierarchy_level_size;
 
-	for( unsigned int y= 0u; y < first_level_size_truncated_y; y++ )
+	// Build only cells, intersected with band. Other cells are always occluded.
+	const unsigned int first_level_y_begin= static_cast<unsigned int>( band_y_begin_ ) / c_first_depth_hierarchy_level_size;
+	const unsigned int first_level_y_end=
+		( static_cast<unsigned int>( band_y_end_ ) + ( c_first_depth_hierarchy_level_size - 1u ) ) / c_first_depth_hierarchy_level_size;
+
+	for( unsigned int y= first_level_y_begin; y < std::min( first_level_size_truncated_y, first_level_y_end ); y++ )
 	{
 		const unsigned short* src[ c_first_depth_hierarchy_level_size ];
 		for( unsigned int i= 0u; i < c_first_depth_hierarchy_level_size; i++ )
@@ -253,7 +484,7 @@ void Rasterizer::BuildDepthBufferHierarchy()
 	}
 
 	// Last partial row.
-	if( first_level_y_left > 0u )
+	if( first_level_y_left > 0u && first_level_y_end > first_level_size_truncated_y )
 	{
 		const unsigned int y= first_level_size_truncated_y;
 		PC_ASSERT( y == depth_buffer_hierarchy_[0].height - 1u );
@@ -800,7 +1031,7 @@ void Rasterizer::DebugDrawDepthHierarchy( unsigned int tick_count )
 		return;
 	else if( level == 1u )
 	{
-		for( int y= 0u; y < viewport_size_y_; y++ )
+		for( int y= band_y_begin_; y < band_y_end_; y++ )
 		for( int x= 0u; x < viewport_size_x_; x++ )
 			color_buffer_[ x + y * row_size_ ]=
 				depth_to_color( depth_buffer_[ x + y * depth_buffer_width_ ] );
@@ -812,7 +1043,7 @@ void Rasterizer::DebugDrawDepthHierarchy( unsigned int tick_count )
 		const auto& depth_hierarchy= depth_buffer_hierarchy_[ level ];
 		const int div= c_first_depth_hierarchy_level_size << int(level);
 
-		for( int y= 0u; y < viewport_size_y_; y++ )
+		for( int y= band_y_begin_; y < band_y_end_; y++ )
 		for( int x= 0u; x < viewport_size_x_; x++ )
 			color_buffer_[ x + y * row_size_ ]=
 				depth_to_color( depth_hierarchy.data[ x/div + y/div * int(depth_hierarchy.width) ] );
@@ -827,7 +1058,7 @@ void Rasterizer::DebugDrawOcclusionBuffer( unsigned int tick_count )
 		return;
 	else if( level == 1u )
 	{
-		for( int y= 0u; y < viewport_size_y_; y++ )
+		for( int y= band_y_begin_; y < band_y_end_; y++ )
 		for( int x= 0u; x < viewport_size_x_; x++ )
 			color_buffer_[ x + y * row_size_ ]=
 				( occlusion_buffer_[ (x>>3) + y * occlusion_buffer_width_ ] & (1<<(x&7)) ) == 0u
@@ -841,7 +1072,7 @@ void Rasterizer::DebugDrawOcclusionBuffer( unsigned int tick_count )
 		const unsigned int cell_size= 16u << (2u * level);
 		const unsigned int cell_bit_size= cell_size / 4u;
 
-		for( unsigned int y= 0u; y < static_cast<unsigned int>(viewport_size_y_); y++ )
+		for( unsigned int y= static_cast<unsigned int>(band_y_begin_); y < static_cast<unsigned int>(band_y_end_); y++ )
 		for( unsigned int x= 0u; x < static_cast<unsigned int>(viewport_size_x_); x++ )
 		{
 			const unsigned int cell_x= x / cell_size;
@@ -866,6 +1097,23 @@ void Rasterizer::SetTexture(
 	max_valid_tc_u_ = ( texture_size_x_ << 16 ) - 1;
 	max_valid_tc_v_ = ( texture_size_y_ << 16 ) - 1;
 	texture_data_= data;
+	texture_data_indexed_= nullptr;
+	texture_palette_= nullptr;
+}
+
+void Rasterizer::SetIndexedTexture(
+	const unsigned int size_x,
+	const unsigned int size_y,
+	const uint8_t* const data,
+	const uint32_t* const palette )
+{
+	texture_size_x_= size_x;
+	texture_size_y_= size_y;
+	max_valid_tc_u_ = ( texture_size_x_ << 16 ) - 1;
+	max_valid_tc_v_ = ( texture_size_y_ << 16 ) - 1;
+	texture_data_= nullptr;
+	texture_data_indexed_= data;
+	texture_palette_= palette;
 }
 
 void Rasterizer::SetLight( const fixed16_t light )
@@ -876,7 +1124,8 @@ void Rasterizer::SetLight( const fixed16_t light )
 void Rasterizer::DrawFullscreenBlend(
 	const unsigned char* color_components, const unsigned char alpha )
 {
-	const unsigned int pixel_count= static_cast<unsigned int>( viewport_size_y_ * row_size_ );
+	uint32_t* const pixels= color_buffer_ + band_y_begin_ * row_size_;
+	const unsigned int pixel_count= static_cast<unsigned int>( ( band_y_end_ - band_y_begin_ ) * row_size_ );
 
 	unsigned char color_components4[4]= { 0u };
 	std::memcpy( color_components4, color_components, 3u );
@@ -892,13 +1141,13 @@ void Rasterizer::DrawFullscreenBlend(
 	// TODO - maybe unroll?
 	for( unsigned int i= 0u; i < pixel_count; i++ )
 	{
-		__m64 dst_color= _mm_cvtsi32_si64( color_buffer_[i] );
+		__m64 dst_color= _mm_cvtsi32_si64( pixels[i] );
 		__m64 dst_color_depacked= _mm_unpacklo_pi8( dst_color, mm_zero );
 		__m64 dst_color_scaled= _mm_mullo_pi16( dst_color_depacked, mm_one_minus_alpha );
 		__m64 dst_color_scaled_plus_blend_color= _mm_add_pi16( dst_color_scaled, mm_premultiplied_blend_color );
 		__m64 result_color_shifted= _mm_srli_pi16( dst_color_scaled_plus_blend_color, 8 );
 		__m64 result_color_8bit= _mm_packs_pu16( result_color_shifted, mm_zero );
-		color_buffer_[i]= _m_to_int( result_color_8bit );
+		pixels[i]= _m_to_int( result_color_8bit );
 	}
 
 	_mm_empty();
@@ -911,17 +1160,324 @@ void Rasterizer::DrawFullscreenBlend(
 	// TODO - maybe unroll?
 	for( unsigned int i= 0u; i < pixel_count; i++ )
 	{
-		const uint32_t pixel_value= color_buffer_[i];
+		const uint32_t pixel_value= pixels[i];
 		unsigned char color[4];
-		for( unsigned int j= 0u; j < 3u; j++ )
+		// Process all 4 components, like MMX code does.
+		for( unsigned int j= 0u; j < 4u; j++ )
 			color[j]= (
 				reinterpret_cast<const unsigned char*>(&pixel_value)[j] * one_minus_alpha +
 				premultiplied_blend_color[j] ) >> 8u;
-		std::memcpy( &color_buffer_[i], color, sizeof(uint32_t) );
+		std::memcpy( &pixels[i], color, sizeof(uint32_t) );
 	}
 #endif
 }
 
+void Rasterizer::CopyScaledViewport(
+	uint32_t* const dst, const unsigned int dst_size_x, const unsigned int dst_size_y, const unsigned int dst_row_size,
+	const unsigned char* const blend_color_components, const unsigned char blend_alpha )
+{
+	PC_ASSERT( dst_size_x >= static_cast<unsigned int>(viewport_size_x_) );
+	PC_ASSERT( dst_size_y >= static_cast<unsigned int>(viewport_size_y_) );
+
+	const unsigned int x_step= ( static_cast<unsigned int>(viewport_size_x_) << 16u ) / dst_size_x;
+	const unsigned int y_step= ( static_cast<unsigned int>(viewport_size_y_) << 16u ) / dst_size_y;
+
+	unsigned char blend_color_components4[4]= { 0u };
+	std::memcpy( blend_color_components4, blend_color_components, 3u );
+
+	// Search first destination row for band.
+	unsigned int dst_y= ( static_cast<unsigned int>(band_y_begin_) << 16u ) / y_step;
+	while( dst_y > 0u && int( ( ( dst_y - 1u ) * y_step ) >> 16u ) >= band_y_begin_ )
+		dst_y--;
+	while( dst_y < dst_size_y && int( ( dst_y * y_step ) >> 16u ) < band_y_begin_ )
+		dst_y++;
+
+	int prev_src_y= -1;
+	for( ; dst_y < dst_size_y; dst_y++ )
+	{
+		const int src_y= int( ( dst_y * y_step ) >> 16u );
+		if( src_y >= band_y_end_ )
+			break;
+
+		uint32_t* const dst_row= dst + dst_y * dst_row_size;
+		if( src_y == prev_src_y )
+		{
+			// Same source row - just copy previous result.
+			std::memcpy( dst_row, dst_row - dst_row_size, dst_size_x * sizeof(uint32_t) );
+			continue;
+		}
+		prev_src_y= src_y;
+
+		const uint32_t* const src= color_buffer_ + src_y * row_size_;
+		if( blend_alpha == 0u )
+		{
+			for( unsigned int x= 0u; x < dst_size_x; x++ )
+				dst_row[x]= src[ ( x * x_step ) >> 16u ];
+		}
+#ifdef PC_X86_SIMD_INSTRUCTIONS
+		else if( simd_level_ != SIMDLevel::None )
+			CopyScaledRowWithBlendSSE2( src, x_step, dst_row, dst_size_x, blend_color_components4, blend_alpha );
+#endif
+		else
+			CopyScaledRowWithBlend( src, x_step, dst_row, 0u, dst_size_x, blend_color_components4, blend_alpha );
+	}
+}
+
+void Rasterizer::DrawGridPlanes( const GridPlanes& grid_planes )
+{
+	const float c_grid_size= float(grid_planes.grid_size);
+	// Max 1 / w, for which depth is valid.
+	const float c_max_inv_w= float( 1 << c_max_inv_z_min_log2 ) * 0.999f;
+
+	const int y_begin= std::max( 0, band_y_begin_ );
+	const int y_end= std::min( viewport_size_y_, band_y_end_ );
+	const float x_first= 0.5f, x_last= float(viewport_size_x_) - 0.5f;
+
+	for( int y= y_begin; y < y_end; y++ )
+	{
+		const float y_center= float(y) + 0.5f;
+
+		for( const GridPlanes::Plane& plane : grid_planes.planes )
+		{
+			const float* const m= plane.screen_to_plane;
+
+			// Row is visible on plane, if plane is in front of camera on both row ends.
+			const float inv_w_first= m[6] * x_first + m[7] * y_center + m[8];
+			const float inv_w_last = m[6] * x_last  + m[7] * y_center + m[8];
+			if( !( inv_w_first > 0.0f && inv_w_last > 0.0f && inv_w_first < c_max_inv_w && inv_w_last < c_max_inv_w ) )
+				continue;
+
+			// Grid position is linear along row, because camera has no roll.
+			float grid_pos[2], grid_pos_step[2];
+			for( unsigned int j= 0u; j < 2u; j++ )
+			{
+				const float first= ( m[j*3u] * x_first + m[j*3u+1u] * y_center + m[j*3u+2u] ) / inv_w_first;
+				const float last = ( m[j*3u] * x_last  + m[j*3u+1u] * y_center + m[j*3u+2u] ) / inv_w_last ;
+				grid_pos_step[j]= viewport_size_x_ > 1 ? ( last - first ) / ( x_last - x_first ) : 0.0f;
+				grid_pos[j]= first;
+			}
+			const float inv_w_step= viewport_size_x_ > 1 ? ( inv_w_last - inv_w_first ) / ( x_last - x_first ) : 0.0f;
+
+			// Cut row part outside grid.
+			float x_min= 0.0f, x_max= float(viewport_size_x_);
+			for( unsigned int j= 0u; j < 2u; j++ )
+			{
+				if( std::abs( grid_pos_step[j] ) < 1.0e-6f )
+				{
+					if( grid_pos[j] < 0.0f || grid_pos[j] >= c_grid_size )
+						x_max= 0.0f;
+					continue;
+				}
+				const float x0= ( 0.0f        - grid_pos[j] ) / grid_pos_step[j];
+				const float x1= ( c_grid_size - grid_pos[j] ) / grid_pos_step[j];
+				x_min= std::max( x_min, std::min( x0, x1 ) );
+				x_max= std::min( x_max, std::max( x0, x1 ) );
+			}
+			if( !( x_min < x_max ) )
+				continue;
+
+			// Take one pixel more at each side, pixels outside grid are rejected in span drawing.
+			const int x_start= std::max( 0, static_cast<int>( x_min ) - 1 );
+			const int x_end= std::min( viewport_size_x_, static_cast<int>( x_max ) + 2 );
+			if( x_end <= x_start )
+				continue;
+
+			if( grid_planes.palette != nullptr )
+				DrawGridPlaneSpan<IndexedTexture::Yes>( grid_planes, plane, y, x_start, x_end, grid_pos, grid_pos_step, inv_w_first, inv_w_step );
+			else
+				DrawGridPlaneSpan<IndexedTexture::No >( grid_planes, plane, y, x_start, x_end, grid_pos, grid_pos_step, inv_w_first, inv_w_step );
+		} // for planes
+	} // for rows
+}
+
+void Rasterizer::DrawSkyPanorama( const SkyPanorama& sky_panorama )
+{
+	constexpr int c_span_size= 16;
+	// Near zenith and nadir azimuth is too nonlinear, calculate texture coordinates for each pixel in such spans.
+	constexpr float c_max_span_azimuth_delta= 0.25f;
+	constexpr float c_max_span_elevation= 1.2f;
+
+	const float* const m= sky_panorama.screen_to_direction;
+	const unsigned int tex_size_x= sky_panorama.texture_size[0];
+	const float tex_size[2]= { float(sky_panorama.texture_size[0]), float(sky_panorama.texture_size[1]) };
+	const fixed16_t tex_size_fixed[2]= { fixed16_t( sky_panorama.texture_size[0] << 16u ), fixed16_t( sky_panorama.texture_size[1] << 16u ) };
+	const uint32_t* const texture_data= sky_panorama.texture_data;
+
+	const int y_begin= std::max( 0, band_y_begin_ );
+	const int y_end= std::min( viewport_size_y_, band_y_end_ );
+
+	for( int y= y_begin; y < y_end; y++ )
+	{
+		const float y_center= float(y) + 0.5f;
+		// Direction is linear along row.
+		const float dir_row[3]=
+		{
+			m[1] * y_center + m[2],
+			m[4] * y_center + m[5],
+			m[7] * y_center + m[8],
+		};
+
+		uint8_t* const occlusion_dst= occlusion_buffer_ + y * occlusion_buffer_width_;
+		uint32_t* const dst= color_buffer_ + y * row_size_;
+
+		// Angles at start of current span. Reused from end of previous span, if it was not skipped.
+		float angles_start[2];
+		bool angles_start_valid= false;
+
+		for( int x_start= 0; x_start < viewport_size_x_; x_start+= c_span_size )
+		{
+			// Occlusion buffer width is aligned, so, reading of two bytes is safe.
+			if( occlusion_dst[ x_start >> 3 ] == 0xFFu && occlusion_dst[ ( x_start >> 3 ) + 1 ] == 0xFFu )
+			{
+				angles_start_valid= false;
+				continue;
+			}
+
+			const int x_end= std::min( x_start + c_span_size, viewport_size_x_ );
+
+			if( !angles_start_valid )
+			{
+				const float x_center= float(x_start) + 0.5f;
+				const float dir[3]= { dir_row[0] + m[0] * x_center, dir_row[1] + m[3] * x_center, dir_row[2] + m[6] * x_center };
+				SkyDirectionToAngles( dir, angles_start[0], angles_start[1] );
+			}
+
+			float angles_end[2];
+			{
+				const float x_center= float(x_end) + 0.5f;
+				const float dir[3]= { dir_row[0] + m[0] * x_center, dir_row[1] + m[3] * x_center, dir_row[2] + m[6] * x_center };
+				SkyDirectionToAngles( dir, angles_end[0], angles_end[1] );
+			}
+
+			// Take shortest way around circle.
+			float azimuth_delta= angles_end[0] - angles_start[0];
+			if( azimuth_delta >  Constants::pi ) azimuth_delta-= Constants::two_pi;
+			if( azimuth_delta < -Constants::pi ) azimuth_delta+= Constants::two_pi;
+
+			const float span_length= float( x_end - x_start );
+			const float tc_start[2]= { angles_start[0] * sky_panorama.u_scale, -angles_start[1] * sky_panorama.v_scale };
+			const float tc_step[2]=
+			{
+				azimuth_delta * sky_panorama.u_scale / span_length,
+				( angles_start[1] - angles_end[1] ) * sky_panorama.v_scale / span_length,
+			};
+
+			if( std::abs( azimuth_delta ) <= c_max_span_azimuth_delta &&
+				std::abs( angles_start[1] ) <= c_max_span_elevation && std::abs( angles_end[1] ) <= c_max_span_elevation &&
+				std::abs( tc_step[0] ) < tex_size[0] && std::abs( tc_step[1] ) < tex_size[1] )
+			{
+				fixed16_t tc[2], step[2];
+				for( unsigned int j= 0u; j < 2u; j++ )
+				{
+					tc[j]= WrapSkyTexCoord( tc_start[j], tex_size[j] );
+					step[j]= fixed16_t( tc_step[j] * 65536.0f );
+				}
+
+				for( int x= x_start; x < x_end; x++ )
+				{
+					if( ( occlusion_dst[ x >> 3u ] & (1u<<(x&7u)) ) == 0u )
+						dst[x]= texture_data[ static_cast<unsigned int>( tc[0] >> 16 ) + static_cast<unsigned int>( tc[1] >> 16 ) * tex_size_x ];
+
+					// Step is less, than texture size, so, one addition or subtraction is enough for wrapping.
+					for( unsigned int j= 0u; j < 2u; j++ )
+					{
+						tc[j]+= step[j];
+						if( tc[j] >= tex_size_fixed[j] ) tc[j]-= tex_size_fixed[j];
+						else if( tc[j] < 0 ) tc[j]+= tex_size_fixed[j];
+					}
+				}
+			}
+			else
+			{
+				for( int x= x_start; x < x_end; x++ )
+				{
+					if( ( occlusion_dst[ x >> 3u ] & (1u<<(x&7u)) ) != 0u )
+						continue;
+
+					const float x_center= float(x) + 0.5f;
+					const float dir[3]= { dir_row[0] + m[0] * x_center, dir_row[1] + m[3] * x_center, dir_row[2] + m[6] * x_center };
+					float angles[2];
+					SkyDirectionToAngles( dir, angles[0], angles[1] );
+
+					const fixed16_t u= WrapSkyTexCoord(  angles[0] * sky_panorama.u_scale, tex_size[0] );
+					const fixed16_t v= WrapSkyTexCoord( -angles[1] * sky_panorama.v_scale, tex_size[1] );
+					dst[x]= texture_data[ static_cast<unsigned int>( u >> 16 ) + static_cast<unsigned int>( v >> 16 ) * tex_size_x ];
+				}
+			}
+
+			angles_start[0]= angles_end[0];
+			angles_start[1]= angles_end[1];
+			angles_start_valid= true;
+		} // for spans
+	} // for rows
+}
+
+template<Rasterizer::IndexedTexture indexed_texture>
+void Rasterizer::DrawGridPlaneSpan(
+	const GridPlanes& grid_planes, const GridPlanes::Plane& plane,
+	const int y, int x_start, int x_end,
+	const float* const grid_pos, const float* const grid_pos_step,
+	const float inv_w, const float inv_w_step )
+{
+	uint8_t* const occlusion_dst= occlusion_buffer_ + y * occlusion_buffer_width_;
+
+	// Skip occluded pixels at span ends.
+	if( occlusion_dst[ x_start >> 3 ] == 0xFFu ) x_start= (x_start + 7) & (~7);
+	while( x_start < x_end && occlusion_dst[ x_start >> 3 ] == 0xFFu ) x_start+= 8;
+	if( x_end <= x_start ) return;
+	if( occlusion_dst[ (x_end-1) >> 3 ] == 0xFFu ) x_end&= (~7);
+	while( x_start < x_end && occlusion_dst[ (x_end-1) >> 3 ] == 0xFFu ) x_end-= 8;
+	if( x_end <= x_start ) return;
+
+	// Limit step, because near horizon it may be too big for fixed16. Span is short in such case.
+	const float c_max_step= float(grid_planes.grid_size);
+	const float x_shift= float(x_start);
+	fixed16_t pos[2], step[2];
+	for( unsigned int j= 0u; j < 2u; j++ )
+	{
+		const float step_clamped= std::max( -c_max_step, std::min( grid_pos_step[j], c_max_step ) );
+		pos[j]= fixed16_t( std::max( -c_max_step, std::min( grid_pos[j] + grid_pos_step[j] * x_shift, 2.0f * c_max_step ) ) * 65536.0f );
+		step[j]= fixed16_t( step_clamped * 65536.0f );
+	}
+
+	// "depth" must be 65536 when inv_w == ( 1 << c_max_inv_z_min_log2 ). Use fixed8 here, fixed16 is too small for it.
+	const float c_depth_scale= float( 1 << ( 16 - c_max_inv_z_min_log2 ) ) * 256.0f;
+	fixed8_t depth= fixed8_t( ( inv_w + inv_w_step * x_shift ) * c_depth_scale );
+	const fixed8_t depth_step= fixed8_t( inv_w_step * c_depth_scale );
+
+	const unsigned int grid_size= grid_planes.grid_size;
+	uint32_t* const dst= color_buffer_ + y * row_size_;
+	unsigned short* const depth_dst= depth_buffer_ + y * depth_buffer_width_;
+
+	for( int x= x_start; x < x_end; x++, pos[0]+= step[0], pos[1]+= step[1], depth+= depth_step )
+	{
+		if( ( occlusion_dst[ x >> 3u ] & (1u<<(x&7u)) ) != 0u )
+			continue;
+
+		const unsigned int cell_x= static_cast<unsigned int>( pos[0] >> 16 );
+		const unsigned int cell_y= static_cast<unsigned int>( pos[1] >> 16 );
+		if( cell_x >= grid_size || cell_y >= grid_size )
+			continue;
+
+		const GridPlanes::Cell& cell= plane.cells[ cell_x + cell_y * grid_size ];
+		if( cell.texture_data == nullptr )
+			continue;
+
+		const unsigned int shift= 16u - cell.texture_size_log2;
+		const unsigned int u= static_cast<unsigned int>( pos[0] & 0xFFFF ) >> shift;
+		const unsigned int v= static_cast<unsigned int>( pos[1] & 0xFFFF ) >> shift;
+		const unsigned int texel_index= u + ( v << cell.texture_size_log2 );
+
+		if( indexed_texture == IndexedTexture::Yes )
+			dst[x]= grid_planes.palette[ static_cast<const uint8_t*>( cell.texture_data )[ texel_index ] ];
+		else
+			dst[x]= static_cast<const uint32_t*>( cell.texture_data )[ texel_index ];
+
+		depth_dst[x]= static_cast<unsigned short>( std::max( 0, std::min( depth >> 8, 65535 ) ) );
+		occlusion_dst[ x >> 3u ] |= 1u << (x&7u);
+	}
+}
+
 void Rasterizer::DrawAffineColoredTriangle( const RasterizerVertex* const vertices, const uint32_t color )
 {
 	PC_ASSERT( vertices[0].z > ( g_fixed16_one >> c_max_inv_z_min_log2 ) );
@@ -1257,19 +1813,61 @@ void Rasterizer::DrawShadowTriangle( const RasterizerVertex* const vertices )
 }
 
 
+void Rasterizer::ApplyShadowMask()
+{
+	for( int y= shadow_mask_y_min_; y < shadow_mask_y_max_; y++ )
+	{
+		uint8_t* const mask= shadow_mask_ + y * shadow_mask_width_;
+		uint32_t* const dst= color_buffer_ + y * row_size_;
+
+		for( int block_x= 0; block_x < shadow_mask_width_; block_x+= 8 )
+		{
+			// Skip 64 pixels at once, if they are not shadowed.
+			uint64_t block_mask;
+			std::memcpy( &block_mask, mask + block_x, sizeof(uint64_t) );
+			if( block_mask == 0u )
+				continue;
+
+			for( int byte_x= block_x; byte_x < block_x + 8; byte_x++ )
+			{
+				const unsigned int mask_byte= mask[ byte_x ];
+				if( mask_byte == 0u )
+					continue;
+
+				uint32_t* const pixels= dst + ( byte_x << 3 );
+				for( unsigned int bit= 0u; bit < 8u; bit++ )
+				{
+					if( ( mask_byte & ( 1u << bit ) ) != 0u )
+						pixels[bit]= ( pixels[bit] & 0xFEFEFEFEu ) >> 1u;
+				}
+			}
+			std::memset( mask + block_x, 0, sizeof(uint64_t) );
+		}
+	}
+
+	shadow_mask_y_min_= viewport_size_y_;
+	shadow_mask_y_max_= 0;
+}
+
 void Rasterizer::DrawAffineColoredTrianglePart( const uint32_t color )
 {
 	const fixed16_t y_start_f= std::max( triangle_part_vertices_[0].y, triangle_part_vertices_[2].y );
 	const fixed16_t y_end_f  = std::min( triangle_part_vertices_[1].y, triangle_part_vertices_[3].y );
 	const int y_start= std::max( 0, Fixed16RoundToInt( y_start_f ) );
-	const int y_end  = std::min( viewport_size_y_, Fixed16RoundToInt( y_end_f ) );
+	const int y_end  = std::min( band_y_end_, Fixed16RoundToInt( y_end_f ) );
 
 	const fixed16_t y_cut_left = ( y_start << 16 ) + g_fixed16_half - triangle_part_vertices_[0].y;
 	const fixed16_t y_cut_right= ( y_start << 16 ) + g_fixed16_half - triangle_part_vertices_[2].y;
 	fixed16_t x_left = triangle_part_vertices_[0].x + Fixed16Mul( y_cut_left , triangle_part_x_step_left_  );
 	fixed16_t x_right= triangle_part_vertices_[2].x + Fixed16Mul( y_cut_right, triangle_part_x_step_right_ );
+
+	// Skip rows before band start. Multiplication gives same result, as per-row addition.
+	const int y_band_skip= std::max( 0, band_y_begin_ - y_start );
+	x_left += y_band_skip * triangle_part_x_step_left_;
+	x_right+= y_band_skip * triangle_part_x_step_right_;
+
 	for(
-		int y= y_start;
+		int y= y_start + y_band_skip;
 		y< y_end;
 		y++,
 		x_left += triangle_part_x_step_left_ ,
@@ -1291,7 +1889,7 @@ void Rasterizer::DrawShadowTrianglePart()
 	const fixed16_t y_start_f= std::max( triangle_part_vertices_[0].y, triangle_part_vertices_[2].y );
 	const fixed16_t y_end_f  = std::min( triangle_part_vertices_[1].y, triangle_part_vertices_[3].y );
 	const int y_start= std::max( 0, Fixed16RoundToInt( y_start_f ) );
-	const int y_end  = std::min( viewport_size_y_, Fixed16RoundToInt( y_end_f ) );
+	const int y_end  = std::min( band_y_end_, Fixed16RoundToInt( y_end_f ) );
 
 	const fixed16_t y_cut_left = ( y_start << 16 ) + g_fixed16_half - triangle_part_vertices_[0].y;
 	const fixed16_t y_cut_right= ( y_start << 16 ) + g_fixed16_half - triangle_part_vertices_[2].y;
@@ -1299,8 +1897,20 @@ void Rasterizer::DrawShadowTrianglePart()
 	fixed16_t x_right= triangle_part_vertices_[2].x + Fixed16Mul( y_cut_right, triangle_part_x_step_right_ );
 	fixed_base_t inv_z_scaled_left= triangle_part_inv_z_scaled_left_ + Fixed16Mul( y_cut_left, triangle_part_inv_z_scaled_step_left_ );
 
+	// Skip rows before band start.
+	const int y_band_skip= std::max( 0, band_y_begin_ - y_start );
+	x_left           += y_band_skip * triangle_part_x_step_left_;
+	x_right          += y_band_skip * triangle_part_x_step_right_;
+	inv_z_scaled_left+= y_band_skip * triangle_part_inv_z_scaled_step_left_;
+
+	if( y_start + y_band_skip < y_end )
+	{
+		shadow_mask_y_min_= std::min( shadow_mask_y_min_, y_start + y_band_skip );
+		shadow_mask_y_max_= std::max( shadow_mask_y_max_, y_end );
+	}
+
 	for(
-		int y= y_start;
+		int y= y_start + y_band_skip;
 		y< y_end;
 		y++,
 		x_left += triangle_part_x_step_left_ ,
@@ -1313,14 +1923,14 @@ void Rasterizer::DrawShadowTrianglePart()
 
 		fixed_base_t line_inv_z_scaled= inv_z_scaled_left + Fixed16Mul( x_cut, line_inv_z_scaled_step_ );
 
-		uint32_t* const dst= color_buffer_ + y * row_size_;
+		uint8_t* const mask_dst= shadow_mask_ + y * shadow_mask_width_;
 		const unsigned short* const depth_dst= depth_buffer_ + y * depth_buffer_width_;
 
 		for( int x= x_start; x < x_end; x++,line_inv_z_scaled+= line_inv_z_scaled_step_ )
 		{
 			const unsigned short depth= line_inv_z_scaled >> ( c_inv_z_scaler_log2 + c_max_inv_z_min_log2 );
 			if( depth > depth_dst[x] )
-				dst[x]= ( dst[x] & 0xFEFEFEFEu ) >> 1u;
+				mask_dst[ x >> 3 ]|= 1u << ( x & 7 );
 		}
 	} // for y
 }
@@ -63,15 +63,78 @@ public:
 	{ Yes, No };
 	enum class DepthHack
 	{ Yes, No };
+	// Texture is 8-bit palette indices.
+	enum class IndexedTexture
+	{ Yes, No };
+
+	// Horizontal planes, splitted into grid of square cells with own textures. Used for floors and ceilings.
+	struct GridPlanes
+	{
+		struct Cell
+		{
+			// 32-bit colors or 8-bit palette indices. If null - cell is not drawn.
+			const void* texture_data;
+			unsigned int texture_size_log2; // Texture is square.
+		};
+
+		struct Plane
+		{
+			// Maps screen point ( x, y, 1 ) to ( grid_x / w, grid_y / w, 1 / w ). Grid coordinates are in cells.
+			float screen_to_plane[9];
+			const Cell* cells; // grid_size * grid_size
+		};
+
+		Plane planes[2];
+		unsigned int grid_size;
+		const uint32_t* palette; // Not null for 8-bit textures.
+	};
+
+	// Sky texture, wrapped around camera as cylinder. Texture coordinates depend only on view direction:
+	// u= azimuth * u_scale, v= -elevation * v_scale. Texture is repeated in both directions.
+	struct SkyPanorama
+	{
+		// Maps screen point ( x, y, 1 ) to unnormalized view direction ( dx, dy, dz ).
+		float screen_to_direction[9];
+		float u_scale, v_scale; // texels per radian
+		unsigned int texture_size[2];
+		const uint32_t* texture_data;
+	};
+
+	// Instructions set for span drawing kernels.
+	enum class SIMDLevel : unsigned int
+	{ None= 0u, SSE2= 1u, AVX2= 2u };
+
+	// Detects SIMD level, supported by current CPU. Detection is done once.
+	static SIMDLevel GetSupportedSIMDLevel();
+	static const char* GetSIMDLevelName( SIMDLevel level );
 
 	Rasterizer(
 		unsigned int viewport_size_x,
 		unsigned int viewport_size_y,
 		unsigned int row_size /* Greater or equal to viewport_size_x */,
-		uint32_t* color_buffer );
+		uint32_t* color_buffer,
+		// Rasterizer draws only rows in range [ band_y_begin; band_y_end ).
+		// Rows outside band are treated as occluded.
+		unsigned int band_y_begin= 0u,
+		unsigned int band_y_end= ~0u );
 
 	~Rasterizer();
 
+	// Change viewport size and color buffer. Depth and occlusion buffers are not reallocated, if they become smaller,
+	// so, preallocate it for maximum size in constructor.
+	// Band is specified for new viewport.
+	void SetViewport(
+		unsigned int viewport_size_x,
+		unsigned int viewport_size_y,
+		unsigned int row_size,
+		uint32_t* color_buffer,
+		unsigned int band_y_begin= 0u,
+		unsigned int band_y_end= ~0u );
+
+	// Set maximum allowed SIMD level. Actual level will be not greater, than supported.
+	void SetSIMDLevel( SIMDLevel level );
+	SIMDLevel GetSIMDLevel() const;
+
 	void ClearDepthBuffer();
 	void ClearOcclusionBuffer();
 	void BuildDepthBufferHierarchy();
@@ -91,16 +154,42 @@ public:
 		unsigned int size_y,
 		const uint32_t* data );
 
+	// Set texture with 8-bit palette indices. Colors are fetched from palette while drawing.
+	void SetIndexedTexture(
+		unsigned int size_x,
+		unsigned int size_y,
+		const uint8_t* data,
+		const uint32_t* palette );
+
 	// final_color= ( light * color ) >> 16
 	void SetLight( fixed16_t light );
 
 	void DrawFullscreenBlend( const unsigned char* color_components, unsigned char alpha );
 
+	// Nearest-neighbor copy of viewport into other buffer with greater or equal size.
+	// Blending is same, as in "DrawFullscreenBlend", zero alpha means no blending.
+	// Only destination rows, whose source rows are inside band, are written.
+	void CopyScaledViewport(
+		uint32_t* dst, unsigned int dst_size_x, unsigned int dst_size_y, unsigned int dst_row_size,
+		const unsigned char* blend_color_components, unsigned char blend_alpha );
+
+	// Draw planes row by row with affine texture coordinates, without per-pixel or per-span division.
+	// Each row must be line of constant depth on planes - camera must have no roll.
+	// Draws only pixels, not marked in occlusion buffer, writes depth and occlusion.
+	void DrawGridPlanes( const GridPlanes& grid_planes );
+
+	// Draw sky panorama into pixels, not marked in occlusion buffer. Does not write depth and occlusion.
+	// Texture coordinates are calculated at ends of short spans and interpolated linearly inside it.
+	void DrawSkyPanorama( const SkyPanorama& sky_panorama );
+
 	void DrawAffineColoredTriangle( const RasterizerVertex* trianlge_vertices, uint32_t color );
 	void DrawColoredConvexPolygon( const RasterizerVertex* polygon_vertices, unsigned int vertex_count, bool is_anticlockwise, uint32_t color );
 
-	// Draw triangle with depth test, without depth-write, with blending and black color.
+	// Mark triangle pixels in shadow mask, with depth test, without depth-write.
+	// Overlapping shadow triangles mark same pixels, so, each pixel is darkened only once.
 	void DrawShadowTriangle( const RasterizerVertex* trianlge_vertices );
+	// Darken pixels, marked in shadow mask, and clear shadow mask.
+	void ApplyShadowMask();
 
 	template<
 		DepthTest depth_test, DepthWrite depth_write,
@@ -127,19 +216,26 @@ public:
 		DepthTest depth_test, DepthWrite depth_write,
 		AlphaTest alpha_test,
 		OcclusionTest occlusion_test, OcclusionWrite occlusion_write,
-		Lighting lighting= Lighting::No, Blending= Blending::No>
+		Lighting lighting= Lighting::No, Blending= Blending::No, IndexedTexture indexed_texture= IndexedTexture::No>
 	void DrawTexturedConvexPolygonPerLineCorrected( const RasterizerVertex* trianlge_vertices, unsigned int vertex_count, bool is_anticlockwise );
 
 	template<
 		DepthTest depth_test, DepthWrite depth_write,
 		AlphaTest alpha_test,
 		OcclusionTest occlusion_test, OcclusionWrite occlusion_write,
-		Lighting lighting= Lighting::No, Blending= Blending::No>
+		Lighting lighting= Lighting::No, Blending= Blending::No, IndexedTexture indexed_texture= IndexedTexture::No>
 	void DrawTexturedConvexPolygonSpanCorrected( const RasterizerVertex* trianlge_vertices, unsigned int vertex_count, bool is_anticlockwise );
 
 private:
 	typedef void (Rasterizer::*TrianglePartDrawFunc)();
 
+	// Draw full span with size "c_z_correct_span_size". Pointers are pointers to span start.
+	typedef void (Rasterizer::*SpanDrawFunc)(
+		uint32_t* dst, unsigned short* depth_dst,
+		const fixed16_t* span_tc, const fixed16_t* tc_step,
+		fixed_base_t inv_z_scaled,
+		SpanOcclusionType& occlusion_value );
+
 private:
 	// Returns 1, if cell fully occluded, else - 0
 	template<unsigned int level>
@@ -148,6 +244,8 @@ private:
 	template<unsigned int level>
 	void SetToOneOcclusionHierarchyCell_r( unsigned int cell_x, unsigned int cell_y );
 
+	template<IndexedTexture indexed_texture>
+	uint32_t FetchTexel( int u, int v ) const;
 	template<Lighting lighting>
 	uint32_t ApplyLight( uint32_t texel ) const;
 	template<Blending blending>
@@ -158,6 +256,9 @@ private:
 	template< class TrianglePartDrawFunc, TrianglePartDrawFunc func>
 	void DrawConvexPolygonPerspectiveCorrectedImpl( const RasterizerVertex* trianlge_vertices, unsigned int vertex_count, bool is_anticlockwise );
 
+	template<IndexedTexture indexed_texture>
+	void DrawGridPlaneSpan( const GridPlanes& grid_planes, const GridPlanes::Plane& plane, int y, int x_start, int x_end, const float* grid_pos, const float* grid_pos_step, float inv_w, float inv_w_step );
+
 	void DrawAffineColoredTrianglePart( uint32_t color );
 	void DrawShadowTrianglePart();
 
@@ -172,24 +273,53 @@ private:
 		DepthTest depth_test, DepthWrite depth_write,
 		AlphaTest alpha_test,
 		OcclusionTest occlusion_test, OcclusionWrite occlusion_write,
-		Lighting lighting, Blending blending= Blending::No>
+		Lighting lighting, Blending blending= Blending::No, IndexedTexture indexed_texture= IndexedTexture::No>
 	void DrawTexturedTrianglePerLineCorrectedPart();
 
 	template<
 		DepthTest depth_test, DepthWrite depth_write,
 		AlphaTest alpha_test,
 		OcclusionTest occlusion_test, OcclusionWrite occlusion_write,
-		Lighting lighting, Blending blending= Blending::No, DepthHack depth_hack= DepthHack::No>
+		Lighting lighting, Blending blending= Blending::No, DepthHack depth_hack= DepthHack::No,
+		IndexedTexture indexed_texture= IndexedTexture::No>
 	void DrawTexturedTriangleSpanCorrectedPart();
 
+#ifdef PC_X86_SIMD_INSTRUCTIONS
+	template<
+		DepthTest depth_test, DepthWrite depth_write,
+		AlphaTest alpha_test,
+		OcclusionTest occlusion_test, OcclusionWrite occlusion_write,
+		Lighting lighting, Blending blending, DepthHack depth_hack, IndexedTexture indexed_texture>
+	void DrawTexturedSpanSSE2(
+		uint32_t* dst, unsigned short* depth_dst,
+		const fixed16_t* span_tc, const fixed16_t* tc_step,
+		fixed_base_t inv_z_scaled,
+		SpanOcclusionType& occlusion_value );
+
+	template<
+		DepthTest depth_test, DepthWrite depth_write,
+		AlphaTest alpha_test,
+		OcclusionTest occlusion_test, OcclusionWrite occlusion_write,
+		Lighting lighting, Blending blending, DepthHack depth_hack, IndexedTexture indexed_texture>
+	void DrawTexturedSpanAVX2(
+		uint32_t* dst, unsigned short* depth_dst,
+		const fixed16_t* span_tc, const fixed16_t* tc_step,
+		fixed_base_t inv_z_scaled,
+		SpanOcclusionType& occlusion_value );
+#endif
+
 private:
 	// Use only SIGNED types inside rasterizer.
 
 	// Buffer info
-	const int viewport_size_x_;
-	const int viewport_size_y_;
-	const int row_size_;
-	uint32_t* const color_buffer_;
+	int viewport_size_x_;
+	int viewport_size_y_;
+	int row_size_;
+	uint32_t* color_buffer_;
+	int band_y_begin_;
+	int band_y_end_;
+
+	SIMDLevel simd_level_;
 
 	// Depth buffer
 	std::vector<unsigned short> depth_buffer_storage_;
@@ -234,6 +364,16 @@ private:
 
 	} occlusion_hierarchy_levels_[ c_occlusion_hierarchy_levels ];
 	std::vector<unsigned short> occlusion_heirarchy_storage_;
+	unsigned int occlusion_hierarchy_size_= 0u; // Size of hierarchy data of current viewport.
+
+	// Shadow mask.
+	// Each bit in buffer is attribute of pixel. 1 - means pixel is shadowed.
+	std::vector<uint8_t> shadow_mask_storage_;
+	uint8_t* shadow_mask_= nullptr;
+	int shadow_mask_width_= 0; // in bytes, multiple of 8
+	// Range of rows with marked pixels - [ min; max ).
+	int shadow_mask_y_min_= 0;
+	int shadow_mask_y_max_= 0;
 
 	// Texture
 	int texture_size_x_= 0;
@@ -241,6 +381,8 @@ private:
 	fixed16_t max_valid_tc_u_= 0;
 	fixed16_t max_valid_tc_v_= 0;
 	const uint32_t* texture_data_= nullptr;
+	const uint8_t* texture_data_indexed_= nullptr;
+	const uint32_t* texture_palette_= nullptr;
 
 	// Light
 	fixed16_t light_= g_fixed16_one;
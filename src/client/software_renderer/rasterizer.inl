@@ -1,5 +1,6 @@
 #pragma once
 #include "rasterizer.hpp"
+#include "rasterizer_span_kernels.inl"
 
 #ifdef PC_MMX_INSTRUCTIONS
 #include <mmintrin.h>
@@ -178,6 +179,17 @@ void Rasterizer::DrawAffineTexturedTriangle( const RasterizerVertex* vertices )
 	}
 }
 
+template<Rasterizer::IndexedTexture indexed_texture>
+inline uint32_t Rasterizer::FetchTexel( const int u, const int v ) const
+{
+	PC_ASSERT( u >= 0 && u < texture_size_x_ );
+	PC_ASSERT( v >= 0 && v < texture_size_y_ );
+	if( indexed_texture == IndexedTexture::Yes )
+		return texture_palette_[ texture_data_indexed_[ u + v * texture_size_x_ ] ];
+	else
+		return texture_data_[ u + v * texture_size_x_ ];
+}
+
 template<Rasterizer::Lighting lighting>
 inline uint32_t Rasterizer::ApplyLight( const uint32_t texel ) const
 {
@@ -185,13 +197,15 @@ inline uint32_t Rasterizer::ApplyLight( const uint32_t texel ) const
 		return texel;
 	else
 	{
+		// Same formula, as in MMX and SSE code, so, result does not depend on instructions set.
+		// Light is in 10.6 format, multiplication result high part is taken and than shifted back, with 16-bit wrapping.
+		const int light_10_6= int16_t( light_ >> 2 );
 		unsigned char components[4];
-		for( unsigned int i= 0u; i < 3u; i++ )
+		for( unsigned int i= 0u; i < 4u; i++ )
 		{
-			const int c= ( reinterpret_cast<const unsigned char*>(&texel)[i] * light_ ) >> 16;
-			components[i]= std::min( c, 255 );
+			const int c= int16_t( ( ( reinterpret_cast<const unsigned char*>(&texel)[i] * light_10_6 ) >> 16 ) * 4 );
+			components[i]= std::max( 0, std::min( c, 255 ) );
 		}
-		components[3]= 0; // TODO - does this need?
 		uint32_t result;
 		std::memcpy( &result, components, sizeof(uint32_t) );
 		return result;
@@ -532,7 +546,7 @@ void Rasterizer::DrawAffineTexturedTrianglePart()
 	const fixed16_t y_start_f= std::max( triangle_part_vertices_[0].y, triangle_part_vertices_[2].y );
 	const fixed16_t y_end_f  = std::min( triangle_part_vertices_[1].y, triangle_part_vertices_[3].y );
 	const int y_start= std::max( 0, Fixed16RoundToInt( y_start_f ) );
-	const int y_end  = std::min( viewport_size_y_, Fixed16RoundToInt( y_end_f ) );
+	const int y_end  = std::min( band_y_end_, Fixed16RoundToInt( y_end_f ) );
 
 	const fixed16_t y_cut_left = ( y_start << 16 ) + g_fixed16_half - triangle_part_vertices_[0].y;
 	const fixed16_t y_cut_right= ( y_start << 16 ) + g_fixed16_half - triangle_part_vertices_[2].y;
@@ -544,8 +558,16 @@ void Rasterizer::DrawAffineTexturedTrianglePart()
 	tc_left[1]= trianlge_part_tc_left_.v + Fixed16Mul( y_cut_left, traingle_part_tc_step_left_[1] );
 	inv_z_scaled_left= triangle_part_inv_z_scaled_left_ + Fixed16Mul( y_cut_left, triangle_part_inv_z_scaled_step_left_ );
 
+	// Skip rows before band start. Multiplication gives same result, as per-row addition.
+	const int y_band_skip= std::max( 0, band_y_begin_ - y_start );
+	x_left           += y_band_skip * triangle_part_x_step_left_;
+	x_right          += y_band_skip * triangle_part_x_step_right_;
+	tc_left[0]       += y_band_skip * traingle_part_tc_step_left_[0];
+	tc_left[1]       += y_band_skip * traingle_part_tc_step_left_[1];
+	inv_z_scaled_left+= y_band_skip * triangle_part_inv_z_scaled_step_left_;
+
 	for(
-		int y= y_start;
+		int y= y_start + y_band_skip;
 		y< y_end;
 		y++,
 		x_left += triangle_part_x_step_left_ ,
@@ -637,13 +659,13 @@ template<
 	Rasterizer::DepthTest depth_test, Rasterizer::DepthWrite depth_write,
 	Rasterizer::AlphaTest alpha_test,
 	Rasterizer::OcclusionTest occlusion_test, Rasterizer::OcclusionWrite occlusion_write,
-	Rasterizer::Lighting lighting, Rasterizer::Blending blending>
+	Rasterizer::Lighting lighting, Rasterizer::Blending blending, Rasterizer::IndexedTexture indexed_texture>
 void Rasterizer::DrawTexturedTrianglePerLineCorrectedPart()
 {
 	const fixed16_t y_start_f= std::max( triangle_part_vertices_[0].y, triangle_part_vertices_[2].y );
 	const fixed16_t y_end_f  = std::min( triangle_part_vertices_[1].y, triangle_part_vertices_[3].y );
 	const int y_start= std::max( 0, Fixed16RoundToInt( y_start_f ) );
-	const int y_end  = std::min( viewport_size_y_, Fixed16RoundToInt( y_end_f ) );
+	const int y_end  = std::min( band_y_end_, Fixed16RoundToInt( y_end_f ) );
 
 	const fixed16_t y_cut_left = ( y_start << 16 ) + g_fixed16_half - triangle_part_vertices_[0].y;
 	const fixed16_t y_cut_right= ( y_start << 16 ) + g_fixed16_half - triangle_part_vertices_[2].y;
@@ -655,8 +677,16 @@ void Rasterizer::DrawTexturedTrianglePerLineCorrectedPart()
 	tc_div_z_left[1]= trianlge_part_tc_left_.v + Fixed16Mul( y_cut_left, traingle_part_tc_step_left_[1] );
 	inv_z_scaled_left= triangle_part_inv_z_scaled_left_ + Fixed16Mul( y_cut_left, triangle_part_inv_z_scaled_step_left_ );
 
+	// Skip rows before band start.
+	const int y_band_skip= std::max( 0, band_y_begin_ - y_start );
+	x_left           += y_band_skip * triangle_part_x_step_left_;
+	x_right          += y_band_skip * triangle_part_x_step_right_;
+	tc_div_z_left[0] += y_band_skip * traingle_part_tc_step_left_[0];
+	tc_div_z_left[1] += y_band_skip * traingle_part_tc_step_left_[1];
+	inv_z_scaled_left+= y_band_skip * triangle_part_inv_z_scaled_step_left_;
+
 	for(
-		int y= y_start;
+		int y= y_start + y_band_skip;
 		y< y_end;
 		y++,
 		x_left += triangle_part_x_step_left_ ,
@@ -761,11 +791,7 @@ void Rasterizer::DrawTexturedTrianglePerLineCorrectedPart()
 
 			if( depth_test == DepthTest::No || depth > depth_dst[x] )
 			{
-				const int u= line_tc[0] >> 16;
-				const int v= line_tc[1] >> 16;
-				PC_ASSERT( u >= 0 && u < texture_size_x_ );
-				PC_ASSERT( v >= 0 && v < texture_size_y_ );
-				const uint32_t tex_value= texture_data_[ u + v * texture_size_x_ ];
+				const uint32_t tex_value= FetchTexel<indexed_texture>( line_tc[0] >> 16, line_tc[1] >> 16 );
 
 				if( alpha_test == AlphaTest::Yes && (tex_value & c_alpha_mask) == 0u )
 					continue;
@@ -783,7 +809,8 @@ template<
 	Rasterizer::DepthTest depth_test, Rasterizer::DepthWrite depth_write,
 	Rasterizer::AlphaTest alpha_test,
 	Rasterizer::OcclusionTest occlusion_test, Rasterizer::OcclusionWrite occlusion_write,
-	Rasterizer::Lighting lighting, Rasterizer::Blending blending, Rasterizer::DepthHack depth_hack>
+	Rasterizer::Lighting lighting, Rasterizer::Blending blending, Rasterizer::DepthHack depth_hack,
+	Rasterizer::IndexedTexture indexed_texture>
 void Rasterizer::DrawTexturedTriangleSpanCorrectedPart()
 {
 	// TODO - maybe add mmx lighting support for other triangle-filling functions?
@@ -813,10 +840,21 @@ void Rasterizer::DrawTexturedTriangleSpanCorrectedPart()
 	#define DO_LIGHTING(tex_value, destination) ApplyBlending<blending>( destination, ApplyLight<lighting>(tex_value) );
 #endif
 
+#ifdef PC_X86_SIMD_INSTRUCTIONS
+	// Select SIMD kernel for full spans. Null means scalar code.
+	const SpanDrawFunc span_funcs[]=
+	{
+		nullptr,
+		&Rasterizer::DrawTexturedSpanSSE2<depth_test, depth_write, alpha_test, occlusion_test, occlusion_write, lighting, blending, depth_hack, indexed_texture>,
+		&Rasterizer::DrawTexturedSpanAVX2<depth_test, depth_write, alpha_test, occlusion_test, occlusion_write, lighting, blending, depth_hack, indexed_texture>,
+	};
+	const SpanDrawFunc span_func= span_funcs[ static_cast<unsigned int>(simd_level_) ];
+#endif
+
 	const fixed16_t y_start_f= std::max( triangle_part_vertices_[0].y, triangle_part_vertices_[2].y );
 	const fixed16_t y_end_f= std::min( triangle_part_vertices_[1].y, triangle_part_vertices_[3].y );
 	const int y_start= std::max( 0, Fixed16RoundToInt( y_start_f ) );
-	const int y_end  = std::min( viewport_size_y_, Fixed16RoundToInt( y_end_f ) );
+	const int y_end  = std::min( band_y_end_, Fixed16RoundToInt( y_end_f ) );
 
 	const fixed16_t y_cut_left = ( y_start << 16 ) + g_fixed16_half - triangle_part_vertices_[0].y;
 	const fixed16_t y_cut_right= ( y_start << 16 ) + g_fixed16_half - triangle_part_vertices_[2].y;
@@ -828,8 +866,16 @@ void Rasterizer::DrawTexturedTriangleSpanCorrectedPart()
 	tc_div_z_left[1]= trianlge_part_tc_left_.v + Fixed16Mul( y_cut_left, traingle_part_tc_step_left_[1] );
 	inv_z_scaled_left= triangle_part_inv_z_scaled_left_ + Fixed16Mul( y_cut_left, triangle_part_inv_z_scaled_step_left_ );
 
+	// Skip rows before band start.
+	const int y_band_skip= std::max( 0, band_y_begin_ - y_start );
+	x_left           += y_band_skip * triangle_part_x_step_left_;
+	x_right          += y_band_skip * triangle_part_x_step_right_;
+	tc_div_z_left[0] += y_band_skip * traingle_part_tc_step_left_[0];
+	tc_div_z_left[1] += y_band_skip * traingle_part_tc_step_left_[1];
+	inv_z_scaled_left+= y_band_skip * triangle_part_inv_z_scaled_step_left_;
+
 	for(
-		int y= y_start;
+		int y= y_start + y_band_skip;
 		y< y_end;
 		y++,
 		x_left += triangle_part_x_step_left_ ,
@@ -928,11 +974,7 @@ void Rasterizer::DrawTexturedTriangleSpanCorrectedPart()
 				if( depth_hack == DepthHack::Yes ) depth= ( int(depth) + 65536 * 3 ) >> 2;
 				if( depth_test == DepthTest::No || depth > depth_dst[ full_x ] )
 				{
-					const int u= span_tc[0] >> 16;
-					const int v= span_tc[1] >> 16;
-					PC_ASSERT( u >= 0 && u < texture_size_x_ );
-					PC_ASSERT( v >= 0 && v < texture_size_y_ );
-					const uint32_t tex_value= texture_data_[ u + v * texture_size_x_ ];
+					const uint32_t tex_value= FetchTexel<indexed_texture>( span_tc[0] >> 16, span_tc[1] >> 16 );
 
 					if( alpha_test == AlphaTest::Yes && (tex_value & c_alpha_mask) == 0u )
 						continue;
@@ -993,6 +1035,14 @@ void Rasterizer::DrawTexturedTriangleSpanCorrectedPart()
 			span_tc[0]= tc_current[0];
 			span_tc[1]= tc_current[1];
 
+#ifdef PC_X86_SIMD_INSTRUCTIONS
+			if( span_func != nullptr )
+			{
+				(this->*span_func)( dst + span_x, depth_dst + span_x, span_tc, tc_step, line_inv_z_scaled, occlusion_value );
+				line_inv_z_scaled+= line_inv_z_scaled_step_ << c_z_correct_span_size_log2;
+			}
+			else
+#endif
 			for( int x= 0; x < c_z_correct_span_size;
 				x++, line_inv_z_scaled+= line_inv_z_scaled_step_,
 				span_tc[0]+= tc_step[0], span_tc[1]+= tc_step[1] )
@@ -1005,11 +1055,7 @@ void Rasterizer::DrawTexturedTriangleSpanCorrectedPart()
 				if( depth_hack == DepthHack::Yes ) depth= ( int(depth) + 65536 * 3 ) >> 2;
 				if( depth_test == DepthTest::No || depth > depth_dst[ span_x + x ] )
 				{
-					const int u= span_tc[0] >> 16;
-					const int v= span_tc[1] >> 16;
-					PC_ASSERT( u >= 0 && u < texture_size_x_ );
-					PC_ASSERT( v >= 0 && v < texture_size_y_ );
-					const uint32_t tex_value= texture_data_[ u + v * texture_size_x_ ];
+					const uint32_t tex_value= FetchTexel<indexed_texture>( span_tc[0] >> 16, span_tc[1] >> 16 );
 
 					if( alpha_test == AlphaTest::Yes && (tex_value & c_alpha_mask) == 0u )
 						continue;
@@ -1072,11 +1118,7 @@ void Rasterizer::DrawTexturedTriangleSpanCorrectedPart()
 				if( depth_hack == DepthHack::Yes ) depth= ( int(depth) + 65536 * 3 ) >> 2;
 				if( depth_test == DepthTest::No || depth > depth_dst[x] )
 				{
-					const int u= span_tc[0] >> 16;
-					const int v= span_tc[1] >> 16;
-					PC_ASSERT( u >= 0 && u < texture_size_x_ );
-					PC_ASSERT( v >= 0 && v < texture_size_y_ );
-					const uint32_t tex_value= texture_data_[ u + v * texture_size_x_ ];
+					const uint32_t tex_value= FetchTexel<indexed_texture>( span_tc[0] >> 16, span_tc[1] >> 16 );
 
 					if( alpha_test == AlphaTest::Yes && (tex_value & c_alpha_mask) == 0u )
 						continue;
@@ -1128,12 +1170,12 @@ template<
 	Rasterizer::DepthTest depth_test, Rasterizer::DepthWrite depth_write,
 	Rasterizer::AlphaTest alpha_test,
 	Rasterizer::OcclusionTest occlusion_test, Rasterizer::OcclusionWrite occlusion_write,
-	Rasterizer::Lighting lighting, Rasterizer::Blending blending>
+	Rasterizer::Lighting lighting, Rasterizer::Blending blending, Rasterizer::IndexedTexture indexed_texture>
 void Rasterizer::DrawTexturedConvexPolygonPerLineCorrected(  const RasterizerVertex* vertices, unsigned int vertex_count, bool is_anticlockwise )
 {
 	DrawConvexPolygonPerspectiveCorrectedImpl<
 		TrianglePartDrawFunc,
-		&Rasterizer::DrawTexturedTrianglePerLineCorrectedPart<depth_test, depth_write, alpha_test, occlusion_test, occlusion_write, lighting, blending > >
+		&Rasterizer::DrawTexturedTrianglePerLineCorrectedPart<depth_test, depth_write, alpha_test, occlusion_test, occlusion_write, lighting, blending, indexed_texture > >
 			( vertices, vertex_count, is_anticlockwise );
 }
 
@@ -1141,12 +1183,12 @@ template<
 	Rasterizer::DepthTest depth_test, Rasterizer::DepthWrite depth_write,
 	Rasterizer::AlphaTest alpha_test,
 	Rasterizer::OcclusionTest occlusion_test, Rasterizer::OcclusionWrite occlusion_write,
-	Rasterizer::Lighting lighting, Rasterizer::Blending blending>
+	Rasterizer::Lighting lighting, Rasterizer::Blending blending, Rasterizer::IndexedTexture indexed_texture>
 void Rasterizer::DrawTexturedConvexPolygonSpanCorrected(  const RasterizerVertex* vertices, unsigned int vertex_count, bool is_anticlockwise )
 {
 	DrawConvexPolygonPerspectiveCorrectedImpl<
 		TrianglePartDrawFunc,
-		&Rasterizer::DrawTexturedTriangleSpanCorrectedPart<depth_test, depth_write, alpha_test, occlusion_test, occlusion_write, lighting, blending > >
+		&Rasterizer::DrawTexturedTriangleSpanCorrectedPart<depth_test, depth_write, alpha_test, occlusion_test, occlusion_write, lighting, blending, DepthHack::No, indexed_texture > >
 			( vertices, vertex_count, is_anticlockwise );
 }
 
@@ -0,0 +1,451 @@
+#include <algorithm>
+#include <cstring>
+
+#include "../../assert.hpp"
+#include "../../log.hpp"
+
+#include "rasterizer_bands.hpp"
+
+namespace PanzerChasm
+{
+
+// Refresh occlusion state for queries after this count of occlusion updates.
+// Less value - more accurate queries, but more synchronization.
+static constexpr unsigned int c_occlusion_updates_per_flush= 32u;
+
+RasterizerBands::RasterizerBands(
+	const unsigned int viewport_size_x,
+	const unsigned int viewport_size_y,
+	const unsigned int row_size,
+	uint32_t* const color_buffer,
+	TasksPool& tasks_pool,
+	const unsigned int band_count_requested )
+	: viewport_size_y_( int(viewport_size_y) )
+	, tasks_pool_( tasks_pool )
+{
+	const unsigned int band_count= std::max( 1u, std::min( band_count_requested, viewport_size_y / 16u ) );
+
+	bands_.resize( band_count );
+	for( Band& band : bands_ )
+		band.rasterizer.reset( new Rasterizer( viewport_size_x, viewport_size_y, row_size, color_buffer ) );
+
+	SetViewport( viewport_size_x, viewport_size_y, row_size, color_buffer );
+
+	if( band_count > 1u )
+		Log::Info( "Software rasterizer uses ", band_count, " bands." );
+}
+
+RasterizerBands::~RasterizerBands()
+{}
+
+void RasterizerBands::SetViewport(
+	const unsigned int viewport_size_x,
+	const unsigned int viewport_size_y,
+	const unsigned int row_size,
+	uint32_t* const color_buffer )
+{
+	// Recorded commands are for old viewport.
+	Flush();
+
+	viewport_size_y_= int(viewport_size_y);
+
+	const unsigned int band_count= static_cast<unsigned int>( bands_.size() );
+	const unsigned int band_height= ( viewport_size_y + band_count - 1u ) / band_count;
+	for( unsigned int i= 0u; i < band_count; i++ )
+	{
+		Band& band= bands_[i];
+		band.y_begin= int( std::min( i * band_height, viewport_size_y ) );
+		band.y_end= int( std::min( ( i + 1u ) * band_height, viewport_size_y ) );
+		band.rasterizer->SetViewport(
+			viewport_size_x, viewport_size_y,
+			row_size, color_buffer,
+			band.y_begin, band.y_end );
+	}
+}
+
+void RasterizerBands::Flush()
+{
+	if( commands_.empty() )
+		return;
+
+	tasks_pool_.Run(
+		static_cast<unsigned int>( bands_.size() ),
+		[this]( const unsigned int band_index )
+		{
+			ExecuteCommands( bands_[ band_index ] );
+		} );
+
+	commands_.clear();
+	commands_vertices_.clear();
+	occlusion_buffer_clear_pending_= false;
+	depth_hierarchy_build_pending_= false;
+	occlusion_updates_pending_= 0u;
+}
+
+void RasterizerBands::ClearDepthBuffer()
+{
+	if( IsMultithreaded() )
+		AddCommand( Command::Type::ClearDepthBuffer );
+	else
+		bands_.front().rasterizer->ClearDepthBuffer();
+}
+
+void RasterizerBands::ClearOcclusionBuffer()
+{
+	if( IsMultithreaded() )
+	{
+		AddCommand( Command::Type::ClearOcclusionBuffer );
+		occlusion_buffer_clear_pending_= true;
+	}
+	else
+		bands_.front().rasterizer->ClearOcclusionBuffer();
+}
+
+void RasterizerBands::BuildDepthBufferHierarchy()
+{
+	if( IsMultithreaded() )
+	{
+		AddCommand( Command::Type::BuildDepthBufferHierarchy );
+		depth_hierarchy_build_pending_= true;
+	}
+	else
+		bands_.front().rasterizer->BuildDepthBufferHierarchy();
+}
+
+bool RasterizerBands::IsDepthOccluded(
+	const fixed16_t x_min, const fixed16_t y_min, const fixed16_t x_max, const fixed16_t y_max,
+	const fixed16_t z_min, const fixed16_t z_max )
+{
+	if( depth_hierarchy_build_pending_ )
+		Flush();
+
+	for( const Band& band : bands_ )
+	{
+		if( !band.rasterizer->IsDepthOccluded( x_min, y_min, x_max, y_max, z_min, z_max ) )
+			return false;
+	}
+	return true;
+}
+
+void RasterizerBands::UpdateOcclusionHierarchy(
+	const RasterizerVertex* const polygon_vertices, const unsigned int polygon_vertex_count,
+	const bool has_alpha )
+{
+	if( IsMultithreaded() )
+	{
+		AddVerticesCommand( Command::Type::UpdateOcclusionHierarchy, polygon_vertices, polygon_vertex_count ).flag= has_alpha;
+		occlusion_updates_pending_++;
+	}
+	else
+		bands_.front().rasterizer->UpdateOcclusionHierarchy( polygon_vertices, polygon_vertex_count, has_alpha );
+}
+
+bool RasterizerBands::IsOccluded( const RasterizerVertex* const polygon_vertices, const unsigned int polygon_vertex_count )
+{
+	if( occlusion_buffer_clear_pending_ || occlusion_updates_pending_ >= c_occlusion_updates_per_flush )
+		Flush();
+
+	for( const Band& band : bands_ )
+	{
+		if( !band.rasterizer->IsOccluded( polygon_vertices, polygon_vertex_count ) )
+			return false;
+	}
+	return true;
+}
+
+void RasterizerBands::DebugDrawDepthHierarchy( const unsigned int tick_count )
+{
+	if( IsMultithreaded() )
+		AddCommand( Command::Type::DebugDrawDepthHierarchy ).tick_count= tick_count;
+	else
+		bands_.front().rasterizer->DebugDrawDepthHierarchy( tick_count );
+}
+
+void RasterizerBands::DebugDrawOcclusionBuffer( const unsigned int tick_count )
+{
+	if( IsMultithreaded() )
+		AddCommand( Command::Type::DebugDrawOcclusionBuffer ).tick_count= tick_count;
+	else
+		bands_.front().rasterizer->DebugDrawOcclusionBuffer( tick_count );
+}
+
+void RasterizerBands::SetTexture(
+	const unsigned int size_x,
+	const unsigned int size_y,
+	const uint32_t* const data )
+{
+	if( IsMultithreaded() )
+	{
+		Command& command= AddCommand( Command::Type::SetTexture );
+		command.texture.size[0]= size_x;
+		command.texture.size[1]= size_y;
+		command.texture.data= data;
+	}
+	else
+		bands_.front().rasterizer->SetTexture( size_x, size_y, data );
+}
+
+void RasterizerBands::SetIndexedTexture(
+	const unsigned int size_x,
+	const unsigned int size_y,
+	const uint8_t* const data,
+	const uint32_t* const palette )
+{
+	if( IsMultithreaded() )
+	{
+		Command& command= AddCommand( Command::Type::SetIndexedTexture );
+		command.texture.size[0]= size_x;
+		command.texture.size[1]= size_y;
+		command.texture.data_indexed= data;
+		command.texture.palette= palette;
+	}
+	else
+		bands_.front().rasterizer->SetIndexedTexture( size_x, size_y, data, palette );
+}
+
+void RasterizerBands::SetLight( const fixed16_t light )
+{
+	if( IsMultithreaded() )
+		AddCommand( Command::Type::SetLight ).light= light;
+	else
+		bands_.front().rasterizer->SetLight( light );
+}
+
+void RasterizerBands::DrawFullscreenBlend( const unsigned char* const color_components, const unsigned char alpha )
+{
+	if( IsMultithreaded() )
+	{
+		Command& command= AddCommand( Command::Type::DrawFullscreenBlend );
+		std::memcpy( command.blend, color_components, 3u );
+		command.blend[3]= alpha;
+	}
+	else
+		bands_.front().rasterizer->DrawFullscreenBlend( color_components, alpha );
+}
+
+void RasterizerBands::CopyScaledViewport(
+	uint32_t* const dst, const unsigned int dst_size_x, const unsigned int dst_size_y, const unsigned int dst_row_size,
+	const unsigned char* const blend_color_components, const unsigned char blend_alpha )
+{
+	if( IsMultithreaded() )
+	{
+		Command& command= AddCommand( Command::Type::CopyScaledViewport );
+		command.scaled_copy.dst= dst;
+		command.scaled_copy.size[0]= dst_size_x;
+		command.scaled_copy.size[1]= dst_size_y;
+		command.scaled_copy.row_size= dst_row_size;
+		std::memcpy( command.scaled_copy.blend, blend_color_components, 3u );
+		command.scaled_copy.blend[3]= blend_alpha;
+	}
+	else
+		bands_.front().rasterizer->CopyScaledViewport( dst, dst_size_x, dst_size_y, dst_row_size, blend_color_components, blend_alpha );
+}
+
+void RasterizerBands::DrawGridPlanes( const Rasterizer::GridPlanes& grid_planes )
+{
+	if( IsMultithreaded() )
+		AddCommand( Command::Type::DrawGridPlanes ).grid_planes= &grid_planes;
+	else
+		bands_.front().rasterizer->DrawGridPlanes( grid_planes );
+}
+
+void RasterizerBands::DrawSkyPanorama( const Rasterizer::SkyPanorama& sky_panorama )
+{
+	if( IsMultithreaded() )
+		AddCommand( Command::Type::DrawSkyPanorama ).sky_panorama= &sky_panorama;
+	else
+		bands_.front().rasterizer->DrawSkyPanorama( sky_panorama );
+}
+
+void RasterizerBands::DrawAffineColoredTriangle( const RasterizerVertex* const trianlge_vertices, const uint32_t color )
+{
+	if( IsMultithreaded() )
+		AddVerticesCommand( Command::Type::DrawAffineColoredTriangle, trianlge_vertices, 3u ).color= color;
+	else
+		bands_.front().rasterizer->DrawAffineColoredTriangle( trianlge_vertices, color );
+}
+
+void RasterizerBands::DrawColoredConvexPolygon(
+	const RasterizerVertex* const polygon_vertices, const unsigned int vertex_count,
+	const bool is_anticlockwise, const uint32_t color )
+{
+	if( IsMultithreaded() )
+	{
+		Command& command= AddVerticesCommand( Command::Type::DrawColoredConvexPolygon, polygon_vertices, vertex_count );
+		command.flag= is_anticlockwise;
+		command.color= color;
+	}
+	else
+		bands_.front().rasterizer->DrawColoredConvexPolygon( polygon_vertices, vertex_count, is_anticlockwise, color );
+}
+
+void RasterizerBands::DrawShadowTriangle( const RasterizerVertex* const trianlge_vertices )
+{
+	if( IsMultithreaded() )
+		AddVerticesCommand( Command::Type::DrawShadowTriangle, trianlge_vertices, 3u );
+	else
+		bands_.front().rasterizer->DrawShadowTriangle( trianlge_vertices );
+}
+
+void RasterizerBands::ApplyShadowMask()
+{
+	if( IsMultithreaded() )
+		AddCommand( Command::Type::ApplyShadowMask );
+	else
+		bands_.front().rasterizer->ApplyShadowMask();
+}
+
+void RasterizerBands::DrawTriangle( const Rasterizer::TriangleDrawFunc func, const RasterizerVertex* const trianlge_vertices )
+{
+	if( IsMultithreaded() )
+		AddVerticesCommand( Command::Type::DrawTriangle, trianlge_vertices, 3u ).triangle_func= func;
+	else
+		(bands_.front().rasterizer.get()->*func)( trianlge_vertices );
+}
+
+void RasterizerBands::DrawConvexPolygon(
+	const Rasterizer::ConvexPolygonDrawFunc func,
+	const RasterizerVertex* const polygon_vertices, const unsigned int vertex_count,
+	const bool is_anticlockwise )
+{
+	if( IsMultithreaded() )
+	{
+		Command& command= AddVerticesCommand( Command::Type::DrawConvexPolygon, polygon_vertices, vertex_count );
+		command.flag= is_anticlockwise;
+		command.polygon_func= func;
+	}
+	else
+		(bands_.front().rasterizer.get()->*func)( polygon_vertices, vertex_count, is_anticlockwise );
+}
+
+bool RasterizerBands::IsMultithreaded() const
+{
+	return bands_.size() > 1u;
+}
+
+void RasterizerBands::SetSIMDLevel( const Rasterizer::SIMDLevel level )
+{
+	PC_ASSERT( commands_.empty() );
+	for( Band& band : bands_ )
+		band.rasterizer->SetSIMDLevel( level );
+}
+
+Rasterizer::SIMDLevel RasterizerBands::GetSIMDLevel() const
+{
+	return bands_.front().rasterizer->GetSIMDLevel();
+}
+
+RasterizerBands::Command& RasterizerBands::AddCommand( const Command::Type type )
+{
+	commands_.emplace_back();
+	Command& command= commands_.back();
+	command.type= type;
+	command.flag= false;
+	command.y_min= 0;
+	command.y_max= viewport_size_y_;
+	command.first_vertex= 0u;
+	command.vertex_count= 0u;
+	return command;
+}
+
+RasterizerBands::Command& RasterizerBands::AddVerticesCommand(
+	const Command::Type type,
+	const RasterizerVertex* const vertices, const unsigned int vertex_count )
+{
+	Command& command= AddCommand( type );
+	command.first_vertex= static_cast<unsigned int>( commands_vertices_.size() );
+	command.vertex_count= vertex_count;
+	commands_vertices_.insert( commands_vertices_.end(), vertices, vertices + vertex_count );
+
+	// Rasterizer draws rows in range [ round(y_min), round(y_max) ). Use wider range.
+	fixed16_t y_min= vertices[0].y, y_max= vertices[0].y;
+	for( unsigned int i= 1u; i < vertex_count; i++ )
+	{
+		y_min= std::min( y_min, vertices[i].y );
+		y_max= std::max( y_max, vertices[i].y );
+	}
+	command.y_min= y_min >> 16;
+	command.y_max= ( y_max >> 16 ) + 1;
+
+	return command;
+}
+
+void RasterizerBands::ExecuteCommands( Band& band )
+{
+	Rasterizer& rasterizer= *band.rasterizer;
+
+	for( const Command& command : commands_ )
+	{
+		// Skip commands outside band.
+		if( command.y_max <= band.y_begin || command.y_min >= band.y_end )
+			continue;
+
+		const RasterizerVertex* const vertices= commands_vertices_.data() + command.first_vertex;
+
+		switch( command.type )
+		{
+		case Command::Type::ClearDepthBuffer:
+			rasterizer.ClearDepthBuffer();
+			break;
+		case Command::Type::ClearOcclusionBuffer:
+			rasterizer.ClearOcclusionBuffer();
+			break;
+		case Command::Type::BuildDepthBufferHierarchy:
+			rasterizer.BuildDepthBufferHierarchy();
+			break;
+		case Command::Type::UpdateOcclusionHierarchy:
+			rasterizer.UpdateOcclusionHierarchy( vertices, command.vertex_count, command.flag );
+			break;
+		case Command::Type::DebugDrawDepthHierarchy:
+			rasterizer.DebugDrawDepthHierarchy( command.tick_count );
+			break;
+		case Command::Type::DebugDrawOcclusionBuffer:
+			rasterizer.DebugDrawOcclusionBuffer( command.tick_count );
+			break;
+		case Command::Type::SetTexture:
+			rasterizer.SetTexture( command.texture.size[0], command.texture.size[1], command.texture.data );
+			break;
+		case Command::Type::SetIndexedTexture:
+			rasterizer.SetIndexedTexture( command.texture.size[0], command.texture.size[1], command.texture.data_indexed, command.texture.palette );
+			break;
+		case Command::Type::SetLight:
+			rasterizer.SetLight( command.light );
+			break;
+		case Command::Type::DrawFullscreenBlend:
+			rasterizer.DrawFullscreenBlend( command.blend, command.blend[3] );
+			break;
+		case Command::Type::CopyScaledViewport:
+			rasterizer.CopyScaledViewport(
+				command.scaled_copy.dst,
+				command.scaled_copy.size[0], command.scaled_copy.size[1], command.scaled_copy.row_size,
+				command.scaled_copy.blend, command.scaled_copy.blend[3] );
+			break;
+		case Command::Type::DrawGridPlanes:
+			rasterizer.DrawGridPlanes( *command.grid_planes );
+			break;
+		case Command::Type::DrawSkyPanorama:
+			rasterizer.DrawSkyPanorama( *command.sky_panorama );
+			break;
+		case Command::Type::DrawAffineColoredTriangle:
+			rasterizer.DrawAffineColoredTriangle( vertices, command.color );
+			break;
+		case Command::Type::DrawColoredConvexPolygon:
+			rasterizer.DrawColoredConvexPolygon( vertices, command.vertex_count, command.flag, command.color );
+			break;
+		case Command::Type::DrawShadowTriangle:
+			rasterizer.DrawShadowTriangle( vertices );
+			break;
+		case Command::Type::ApplyShadowMask:
+			rasterizer.ApplyShadowMask();
+			break;
+		case Command::Type::DrawTriangle:
+			(rasterizer.*command.triangle_func)( vertices );
+			break;
+		case Command::Type::DrawConvexPolygon:
+			(rasterizer.*command.polygon_func)( vertices, command.vertex_count, command.flag );
+			break;
+		};
+	}
+}
+
+} // namespace PanzerChasm
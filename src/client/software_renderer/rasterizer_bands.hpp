@@ -0,0 +1,215 @@
+#pragma once
+#include <memory>
+#include <vector>
+
+#include "rasterizer.hpp"
+#include "tasks_pool.hpp"
+
+namespace PanzerChasm
+{
+
+// Frontend for multithreaded rasterization.
+// Viewport is splitted into horizontal bands, each band has own rasterizer.
+// Commands are recorded and executed on "Flush" as tasks of given pool, each band executes only commands, intersected with it.
+// Pool is shared with other code, so, threads count of pool may be not equal to bands count.
+// Result is same, as for single rasterizer.
+// With one thread all commands are executed immediately.
+class RasterizerBands final
+{
+public:
+	RasterizerBands(
+		unsigned int viewport_size_x,
+		unsigned int viewport_size_y,
+		unsigned int row_size /* Greater or equal to viewport_size_x */,
+		uint32_t* color_buffer,
+		TasksPool& tasks_pool, /* Must live longer, than this class */
+		unsigned int band_count );
+
+	~RasterizerBands();
+
+	bool IsMultithreaded() const;
+
+	// Call it only before drawing.
+	void SetSIMDLevel( Rasterizer::SIMDLevel level );
+	Rasterizer::SIMDLevel GetSIMDLevel() const;
+
+	// Change viewport size and color buffer. Bands are resized proportionally.
+	// Viewport must be not greater, than initial viewport.
+	void SetViewport(
+		unsigned int viewport_size_x,
+		unsigned int viewport_size_y,
+		unsigned int row_size,
+		uint32_t* color_buffer );
+
+	// Execute all recorded commands and wait for finish.
+	// Call it before reading of color buffer.
+	void Flush();
+
+	void ClearDepthBuffer();
+	void ClearOcclusionBuffer();
+	void BuildDepthBufferHierarchy();
+
+	// Occlusion queries are done on state of last flush. Object is occluded, if it is occluded in all bands.
+	// Older state is less occluded, so, queries are conservative.
+	bool IsDepthOccluded(
+		fixed16_t x_min, fixed16_t y_min, fixed16_t x_max, fixed16_t y_max,
+		fixed16_t z_min, fixed16_t z_max );
+
+	void UpdateOcclusionHierarchy( const RasterizerVertex* polygon_vertices, unsigned int polygon_vertex_count, bool has_alpha );
+	bool IsOccluded( const RasterizerVertex* polygon_vertices, unsigned int polygon_vertex_count );
+
+	void DebugDrawDepthHierarchy( unsigned int tick_count );
+	void DebugDrawOcclusionBuffer( unsigned int tick_count );
+
+	// Texture data must live until next flush.
+	void SetTexture(
+		unsigned int size_x,
+		unsigned int size_y,
+		const uint32_t* data );
+
+	// Texture data and palette must live until next flush.
+	void SetIndexedTexture(
+		unsigned int size_x,
+		unsigned int size_y,
+		const uint8_t* data,
+		const uint32_t* palette );
+
+	void SetLight( fixed16_t light );
+
+	void DrawFullscreenBlend( const unsigned char* color_components, unsigned char alpha );
+
+	// Destination buffer must not intersect with viewport color buffer. Each band copies own rows.
+	void CopyScaledViewport(
+		uint32_t* dst, unsigned int dst_size_x, unsigned int dst_size_y, unsigned int dst_row_size,
+		const unsigned char* blend_color_components, unsigned char blend_alpha );
+
+	// Planes, cells and textures data must live until next flush.
+	void DrawGridPlanes( const Rasterizer::GridPlanes& grid_planes );
+	// Sky panorama and texture data must live until next flush.
+	void DrawSkyPanorama( const Rasterizer::SkyPanorama& sky_panorama );
+
+	void DrawAffineColoredTriangle( const RasterizerVertex* trianlge_vertices, uint32_t color );
+	void DrawColoredConvexPolygon( const RasterizerVertex* polygon_vertices, unsigned int vertex_count, bool is_anticlockwise, uint32_t color );
+	void DrawShadowTriangle( const RasterizerVertex* trianlge_vertices );
+	void ApplyShadowMask();
+
+	void DrawTriangle( Rasterizer::TriangleDrawFunc func, const RasterizerVertex* trianlge_vertices );
+	void DrawConvexPolygon( Rasterizer::ConvexPolygonDrawFunc func, const RasterizerVertex* polygon_vertices, unsigned int vertex_count, bool is_anticlockwise );
+
+	template<
+		Rasterizer::DepthTest depth_test, Rasterizer::DepthWrite depth_write,
+		Rasterizer::AlphaTest alpha_test,
+		Rasterizer::OcclusionTest occlusion_test, Rasterizer::OcclusionWrite occlusion_write,
+		Rasterizer::Lighting lighting= Rasterizer::Lighting::No, Rasterizer::Blending blending= Rasterizer::Blending::No,
+		Rasterizer::IndexedTexture indexed_texture= Rasterizer::IndexedTexture::No>
+	void DrawTexturedConvexPolygonPerLineCorrected( const RasterizerVertex* polygon_vertices, unsigned int vertex_count, bool is_anticlockwise )
+	{
+		DrawConvexPolygon(
+			&Rasterizer::DrawTexturedConvexPolygonPerLineCorrected<depth_test, depth_write, alpha_test, occlusion_test, occlusion_write, lighting, blending, indexed_texture>,
+			polygon_vertices, vertex_count, is_anticlockwise );
+	}
+
+	template<
+		Rasterizer::DepthTest depth_test, Rasterizer::DepthWrite depth_write,
+		Rasterizer::AlphaTest alpha_test,
+		Rasterizer::OcclusionTest occlusion_test, Rasterizer::OcclusionWrite occlusion_write,
+		Rasterizer::Lighting lighting= Rasterizer::Lighting::No, Rasterizer::Blending blending= Rasterizer::Blending::No,
+		Rasterizer::IndexedTexture indexed_texture= Rasterizer::IndexedTexture::No>
+	void DrawTexturedConvexPolygonSpanCorrected( const RasterizerVertex* polygon_vertices, unsigned int vertex_count, bool is_anticlockwise )
+	{
+		DrawConvexPolygon(
+			&Rasterizer::DrawTexturedConvexPolygonSpanCorrected<depth_test, depth_write, alpha_test, occlusion_test, occlusion_write, lighting, blending, indexed_texture>,
+			polygon_vertices, vertex_count, is_anticlockwise );
+	}
+
+private:
+	struct Command
+	{
+		enum class Type : unsigned char
+		{
+			ClearDepthBuffer,
+			ClearOcclusionBuffer,
+			BuildDepthBufferHierarchy,
+			UpdateOcclusionHierarchy,
+			DebugDrawDepthHierarchy,
+			DebugDrawOcclusionBuffer,
+			SetTexture,
+			SetIndexedTexture,
+			SetLight,
+			DrawFullscreenBlend,
+			CopyScaledViewport,
+			DrawGridPlanes,
+			DrawSkyPanorama,
+			DrawAffineColoredTriangle,
+			DrawColoredConvexPolygon,
+			DrawShadowTriangle,
+			ApplyShadowMask,
+			DrawTriangle,
+			DrawConvexPolygon,
+		};
+
+		Type type;
+		bool flag; // is_anticlockwise or has_alpha
+
+		// Rows range, affected by command.
+		int y_min, y_max;
+
+		unsigned int first_vertex;
+		unsigned int vertex_count;
+
+		union
+		{
+			Rasterizer::TriangleDrawFunc triangle_func;
+			Rasterizer::ConvexPolygonDrawFunc polygon_func;
+			struct
+			{
+				unsigned int size[2];
+				const uint32_t* data;
+				const uint8_t* data_indexed;
+				const uint32_t* palette;
+			} texture;
+			fixed16_t light;
+			uint32_t color;
+			unsigned int tick_count;
+			unsigned char blend[4]; // rgb + alpha
+			struct
+			{
+				uint32_t* dst;
+				unsigned int size[2];
+				unsigned int row_size;
+				unsigned char blend[4]; // rgb + alpha
+			} scaled_copy;
+			const Rasterizer::GridPlanes* grid_planes;
+			const Rasterizer::SkyPanorama* sky_panorama;
+		};
+	};
+
+	struct Band
+	{
+		std::unique_ptr<Rasterizer> rasterizer;
+		int y_begin, y_end;
+	};
+
+private:
+	Command& AddCommand( Command::Type type );
+	Command& AddVerticesCommand( Command::Type type, const RasterizerVertex* vertices, unsigned int vertex_count );
+
+	void ExecuteCommands( Band& band );
+
+private:
+	int viewport_size_y_;
+
+	std::vector<Band> bands_;
+
+	std::vector<Command> commands_;
+	std::vector<RasterizerVertex> commands_vertices_;
+
+	// Flags for queries.
+	bool occlusion_buffer_clear_pending_= false;
+	bool depth_hierarchy_build_pending_= false;
+	unsigned int occlusion_updates_pending_= 0u;
+
+	TasksPool& tasks_pool_;
+};
+
+} // namespace PanzerChasm
@@ -0,0 +1,244 @@
+#pragma once
+#include "rasterizer.hpp"
+
+#ifdef PC_X86_SIMD_INSTRUCTIONS
+
+#include <immintrin.h>
+
+// Kernels are compiled for specific instructions set and selected in runtime.
+#ifdef _MSC_VER
+#define PC_TARGET_SSE2
+#define PC_TARGET_AVX2
+#else
+#define PC_TARGET_SSE2 __attribute__((target("sse2")))
+#define PC_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace PanzerChasm
+{
+
+namespace RasterizerSpanKernels
+{
+
+// Lighting formula must be same, as in scalar code.
+PC_TARGET_SSE2 inline __m128i ApplyLightSSE2( const __m128i texels, const fixed16_t light )
+{
+	const __m128i zero= _mm_setzero_si128();
+	const __m128i light_vec= _mm_set1_epi16( static_cast<short>( light >> 2 ) );
+	const __m128i lo= _mm_slli_epi16( _mm_mulhi_epi16( _mm_unpacklo_epi8( texels, zero ), light_vec ), 2 );
+	const __m128i hi= _mm_slli_epi16( _mm_mulhi_epi16( _mm_unpackhi_epi8( texels, zero ), light_vec ), 2 );
+	return _mm_packus_epi16( lo, hi );
+}
+
+PC_TARGET_AVX2 inline __m256i ApplyLightAVX2( const __m256i texels, const fixed16_t light )
+{
+	const __m256i zero= _mm256_setzero_si256();
+	const __m256i light_vec= _mm256_set1_epi16( static_cast<short>( light >> 2 ) );
+	const __m256i lo= _mm256_slli_epi16( _mm256_mulhi_epi16( _mm256_unpacklo_epi8( texels, zero ), light_vec ), 2 );
+	const __m256i hi= _mm256_slli_epi16( _mm256_mulhi_epi16( _mm256_unpackhi_epi8( texels, zero ), light_vec ), 2 );
+	return _mm256_packus_epi16( lo, hi );
+}
+
+} // namespace RasterizerSpanKernels
+
+template<
+	Rasterizer::DepthTest depth_test, Rasterizer::DepthWrite depth_write,
+	Rasterizer::AlphaTest alpha_test,
+	Rasterizer::OcclusionTest occlusion_test, Rasterizer::OcclusionWrite occlusion_write,
+	Rasterizer::Lighting lighting, Rasterizer::Blending blending, Rasterizer::DepthHack depth_hack,
+	Rasterizer::IndexedTexture indexed_texture>
+PC_TARGET_SSE2 void Rasterizer::DrawTexturedSpanSSE2(
+	uint32_t* const dst, unsigned short* const depth_dst,
+	const fixed16_t* const span_tc, const fixed16_t* const tc_step,
+	const fixed_base_t inv_z_scaled,
+	SpanOcclusionType& occlusion_value )
+{
+	constexpr int c_pixels_per_iteration= 4;
+	static_assert( c_z_correct_span_size % c_pixels_per_iteration == 0, "Invalid span size" );
+
+	const __m128i zero= _mm_setzero_si128();
+	const __m128i pixel_bits= _mm_set_epi32( 8, 4, 2, 1 );
+	const __m128i depth_bias32= _mm_set1_epi32( 32768 );
+	const __m128i depth_bias16= _mm_set1_epi16( static_cast<short>( 0x8000 ) );
+	const __m128i inv_z_step= _mm_set1_epi32( line_inv_z_scaled_step_ * c_pixels_per_iteration );
+	__m128i inv_z=
+		_mm_set_epi32(
+			inv_z_scaled + line_inv_z_scaled_step_ * 3,
+			inv_z_scaled + line_inv_z_scaled_step_ * 2,
+			inv_z_scaled + line_inv_z_scaled_step_,
+			inv_z_scaled );
+
+	fixed16_t tc[2]= { span_tc[0], span_tc[1] };
+
+	for( int x= 0; x < c_z_correct_span_size; x+= c_pixels_per_iteration, inv_z= _mm_add_epi32( inv_z, inv_z_step ) )
+	{
+		__m128i mask= _mm_set1_epi32( -1 );
+
+		if( occlusion_test == OcclusionTest::Yes )
+		{
+			const __m128i bits= _mm_set1_epi32( ( occlusion_value >> x ) & 15 );
+			mask= _mm_cmpeq_epi32( _mm_and_si128( bits, pixel_bits ), zero );
+		}
+
+		// "depth" is 16-bit value, stored in 32-bit lanes.
+		__m128i depth= _mm_and_si128( _mm_srai_epi32( inv_z, c_inv_z_scaler_log2 + c_max_inv_z_min_log2 ), _mm_set1_epi32( 0xFFFF ) );
+		if( depth_hack == DepthHack::Yes )
+			depth= _mm_srli_epi32( _mm_add_epi32( depth, _mm_set1_epi32( 65536 * 3 ) ), 2 );
+
+		__m128i old_depth= zero;
+		if( depth_test == DepthTest::Yes || depth_write == DepthWrite::Yes )
+			old_depth= _mm_unpacklo_epi16( _mm_loadl_epi64( reinterpret_cast<const __m128i*>( depth_dst + x ) ), zero );
+		if( depth_test == DepthTest::Yes )
+			mask= _mm_and_si128( mask, _mm_cmpgt_epi32( depth, old_depth ) );
+
+		// SSE2 have no "gather" instruction, so, fetch texels per-pixel. Skip fetching for fully hidden pixels.
+		alignas(16) uint32_t texels[ c_pixels_per_iteration ];
+		if( ( occlusion_test == OcclusionTest::Yes || depth_test == DepthTest::Yes ) &&
+			_mm_movemask_epi8( mask ) == 0 )
+		{
+			tc[0]+= tc_step[0] * c_pixels_per_iteration;
+			tc[1]+= tc_step[1] * c_pixels_per_iteration;
+			continue;
+		}
+		for( int i= 0; i < c_pixels_per_iteration; i++, tc[0]+= tc_step[0], tc[1]+= tc_step[1] )
+		{
+			texels[i]= FetchTexel<indexed_texture>( tc[0] >> 16, tc[1] >> 16 );
+		}
+
+		const __m128i texel= _mm_load_si128( reinterpret_cast<const __m128i*>( texels ) );
+		if( alpha_test == AlphaTest::Yes )
+			mask= _mm_andnot_si128( _mm_cmpeq_epi32( _mm_and_si128( texel, _mm_set1_epi32( int(c_alpha_mask) ) ), zero ), mask );
+
+		if( depth_write == DepthWrite::Yes )
+		{
+			const __m128i new_depth= _mm_or_si128( _mm_and_si128( mask, depth ), _mm_andnot_si128( mask, old_depth ) );
+			// SSE2 have only signed 32->16 pack, so, shift values to signed range before packing.
+			const __m128i new_depth_packed= _mm_xor_si128( _mm_packs_epi32( _mm_sub_epi32( new_depth, depth_bias32 ), zero ), depth_bias16 );
+			_mm_storel_epi64( reinterpret_cast<__m128i*>( depth_dst + x ), new_depth_packed );
+		}
+
+		if( occlusion_write == OcclusionWrite::Yes && alpha_test == AlphaTest::Yes )
+			occlusion_value|= static_cast<SpanOcclusionType>( _mm_movemask_ps( _mm_castsi128_ps( mask ) ) << x );
+
+		__m128i color= texel;
+		if( lighting == Lighting::Yes )
+			color= RasterizerSpanKernels::ApplyLightSSE2( color, light_ );
+
+		__m128i* const dst_ptr= reinterpret_cast<__m128i*>( dst + x );
+		const __m128i old_color= _mm_loadu_si128( dst_ptr );
+		if( blending == Blending::Yes )
+			color=
+				_mm_add_epi32(
+					_mm_srli_epi32( _mm_and_si128( _mm_xor_si128( old_color, color ), _mm_set1_epi32( int(0xFEFEFEFEu) ) ), 1 ),
+					_mm_and_si128( old_color, color ) );
+
+		_mm_storeu_si128( dst_ptr, _mm_or_si128( _mm_and_si128( mask, color ), _mm_andnot_si128( mask, old_color ) ) );
+	}
+}
+
+template<
+	Rasterizer::DepthTest depth_test, Rasterizer::DepthWrite depth_write,
+	Rasterizer::AlphaTest alpha_test,
+	Rasterizer::OcclusionTest occlusion_test, Rasterizer::OcclusionWrite occlusion_write,
+	Rasterizer::Lighting lighting, Rasterizer::Blending blending, Rasterizer::DepthHack depth_hack,
+	Rasterizer::IndexedTexture indexed_texture>
+PC_TARGET_AVX2 void Rasterizer::DrawTexturedSpanAVX2(
+	uint32_t* const dst, unsigned short* const depth_dst,
+	const fixed16_t* const span_tc, const fixed16_t* const tc_step,
+	const fixed_base_t inv_z_scaled,
+	SpanOcclusionType& occlusion_value )
+{
+	constexpr int c_pixels_per_iteration= 8;
+	static_assert( c_z_correct_span_size % c_pixels_per_iteration == 0, "Invalid span size" );
+
+	const __m256i zero= _mm256_setzero_si256();
+	const __m256i pixel_index= _mm256_set_epi32( 7, 6, 5, 4, 3, 2, 1, 0 );
+	const __m256i pixel_bits= _mm256_set_epi32( 128, 64, 32, 16, 8, 4, 2, 1 );
+	const __m256i texture_size_x= _mm256_set1_epi32( texture_size_x_ );
+
+	// Multiplication gives same result, as per-pixel addition.
+	__m256i tc_u= _mm256_add_epi32( _mm256_set1_epi32( span_tc[0] ), _mm256_mullo_epi32( pixel_index, _mm256_set1_epi32( tc_step[0] ) ) );
+	__m256i tc_v= _mm256_add_epi32( _mm256_set1_epi32( span_tc[1] ), _mm256_mullo_epi32( pixel_index, _mm256_set1_epi32( tc_step[1] ) ) );
+	__m256i inv_z= _mm256_add_epi32( _mm256_set1_epi32( inv_z_scaled ), _mm256_mullo_epi32( pixel_index, _mm256_set1_epi32( line_inv_z_scaled_step_ ) ) );
+	const __m256i tc_u_step= _mm256_set1_epi32( tc_step[0] * c_pixels_per_iteration );
+	const __m256i tc_v_step= _mm256_set1_epi32( tc_step[1] * c_pixels_per_iteration );
+	const __m256i inv_z_step= _mm256_set1_epi32( line_inv_z_scaled_step_ * c_pixels_per_iteration );
+
+	for( int x= 0; x < c_z_correct_span_size; x+= c_pixels_per_iteration,
+		tc_u= _mm256_add_epi32( tc_u, tc_u_step ),
+		tc_v= _mm256_add_epi32( tc_v, tc_v_step ),
+		inv_z= _mm256_add_epi32( inv_z, inv_z_step ) )
+	{
+		__m256i mask= _mm256_set1_epi32( -1 );
+
+		if( occlusion_test == OcclusionTest::Yes )
+		{
+			const __m256i bits= _mm256_set1_epi32( ( occlusion_value >> x ) & 255 );
+			mask= _mm256_cmpeq_epi32( _mm256_and_si256( bits, pixel_bits ), zero );
+		}
+
+		__m256i depth= _mm256_and_si256( _mm256_srai_epi32( inv_z, c_inv_z_scaler_log2 + c_max_inv_z_min_log2 ), _mm256_set1_epi32( 0xFFFF ) );
+		if( depth_hack == DepthHack::Yes )
+			depth= _mm256_srli_epi32( _mm256_add_epi32( depth, _mm256_set1_epi32( 65536 * 3 ) ), 2 );
+
+		__m256i old_depth= zero;
+		if( depth_test == DepthTest::Yes || depth_write == DepthWrite::Yes )
+			old_depth= _mm256_cvtepu16_epi32( _mm_loadu_si128( reinterpret_cast<const __m128i*>( depth_dst + x ) ) );
+		if( depth_test == DepthTest::Yes )
+			mask= _mm256_and_si256( mask, _mm256_cmpgt_epi32( depth, old_depth ) );
+
+		// Skip fetching for fully hidden pixels.
+		if( ( occlusion_test == OcclusionTest::Yes || depth_test == DepthTest::Yes ) &&
+			_mm256_testz_si256( mask, mask ) )
+			continue;
+
+		const __m256i texel_offset=
+			_mm256_add_epi32(
+				_mm256_srai_epi32( tc_u, 16 ),
+				_mm256_mullo_epi32( _mm256_srai_epi32( tc_v, 16 ), texture_size_x ) );
+		__m256i texel;
+		if( indexed_texture == IndexedTexture::Yes )
+		{
+			// Gather 8-bit indices as 32-bit words and mask them. Texture data must have 3 bytes of padding at end.
+			const __m256i indices=
+				_mm256_and_si256(
+					_mm256_i32gather_epi32( reinterpret_cast<const int*>( texture_data_indexed_ ), texel_offset, 1 ),
+					_mm256_set1_epi32( 0xFF ) );
+			texel= _mm256_i32gather_epi32( reinterpret_cast<const int*>( texture_palette_ ), indices, 4 );
+		}
+		else
+			texel= _mm256_i32gather_epi32( reinterpret_cast<const int*>( texture_data_ ), texel_offset, 4 );
+
+		if( alpha_test == AlphaTest::Yes )
+			mask= _mm256_andnot_si256( _mm256_cmpeq_epi32( _mm256_and_si256( texel, _mm256_set1_epi32( int(c_alpha_mask) ) ), zero ), mask );
+
+		if( depth_write == DepthWrite::Yes )
+		{
+			const __m256i new_depth= _mm256_blendv_epi8( old_depth, depth, mask );
+			const __m128i new_depth_packed=
+				_mm_packus_epi32( _mm256_castsi256_si128( new_depth ), _mm256_extracti128_si256( new_depth, 1 ) );
+			_mm_storeu_si128( reinterpret_cast<__m128i*>( depth_dst + x ), new_depth_packed );
+		}
+
+		if( occlusion_write == OcclusionWrite::Yes && alpha_test == AlphaTest::Yes )
+			occlusion_value|= static_cast<SpanOcclusionType>( _mm256_movemask_ps( _mm256_castsi256_ps( mask ) ) << x );
+
+		__m256i color= texel;
+		if( lighting == Lighting::Yes )
+			color= RasterizerSpanKernels::ApplyLightAVX2( color, light_ );
+
+		__m256i* const dst_ptr= reinterpret_cast<__m256i*>( dst + x );
+		const __m256i old_color= _mm256_loadu_si256( dst_ptr );
+		if( blending == Blending::Yes )
+			color=
+				_mm256_add_epi32(
+					_mm256_srli_epi32( _mm256_and_si256( _mm256_xor_si256( old_color, color ), _mm256_set1_epi32( int(0xFEFEFEFEu) ) ), 1 ),
+					_mm256_and_si256( old_color, color ) );
+
+		_mm256_storeu_si256( dst_ptr, _mm256_blendv_epi8( old_color, color, mask ) );
+	}
+}
+
+} // namespace PanzerChasm
+
+#endif // PC_X86_SIMD_INSTRUCTIONS
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cmath>
 
 #include "../../assert.hpp"
@@ -8,16 +9,19 @@
 namespace PanzerChasm
 {
 
-// Returns result in bytes.
-inline unsigned int SurfaceDataSizeAligned(
-	const unsigned int size_x, const unsigned int size_y )
-{
-	const unsigned int pixels= size_x * size_y;
-	return ( (pixels + 3u) & (~3u) ) * sizeof(uint32_t);
-}
+// Texels fetching may read few bytes after last texel, so, add padding at storage end.
+static constexpr unsigned int c_storage_padding= sizeof(uint32_t);
+
+// Surfaces headers and data are placed together, so, each surface must be aligned for header.
+static constexpr unsigned int c_surface_alignment= alignof(SurfacesCache::Surface);
+static_assert( sizeof(SurfacesCache::Surface) % c_surface_alignment == 0u, "Surface data is not aligned" );
+static_assert( c_surface_alignment % alignof(uint32_t) == 0u, "Surface data is not aligned for 32-bit texels" );
 
-SurfacesCache::SurfacesCache( const Size2& viewport_size )
+SurfacesCache::SurfacesCache( const Size2& viewport_size, const unsigned int bytes_per_texel )
+	: bytes_per_texel_(bytes_per_texel)
 {
+	PC_ASSERT( bytes_per_texel_ == 1u || bytes_per_texel_ == 4u );
+
 	// For lower resolutions we need more surface cache, relative screen area.
 	// For bigger resolutions ( 1024x768 or more ) we need less relative cache size.
 	const unsigned int viewport_pixels= viewport_size.Width() * viewport_size.Height();
@@ -25,10 +29,8 @@ SurfacesCache::SurfacesCache( const Size2& viewport_size )
 	const unsigned int cache_size_pixels=
 		static_cast<unsigned int>( viewport_pixels_f * 2.5f / std::sqrt( viewport_pixels_f / ( 1024.0f * 768.0f ) ) );
 
-	storage_.resize( cache_size_pixels * sizeof(uint32_t) );
-
-	const unsigned int size_kb= (storage_.size() + 1023u) / 1024u;
-	Log::Info( "Surfaces cache size: ", size_kb, "kb ( ", size_kb / sizeof(uint32_t), " kilotexels )." );
+	default_storage_size_= cache_size_pixels * sizeof(uint32_t);
+	SetStorageSize( default_storage_size_ );
 }
 
 SurfacesCache::~SurfacesCache()
@@ -44,24 +46,24 @@ void SurfacesCache::AllocateSurface(
 
 	unsigned int surface_data_size= sizeof(Surface) + SurfaceDataSizeAligned( size_x, size_y );
 
-	PC_ASSERT( surface_data_size < storage_.size() );
+	PC_ASSERT( surface_data_size < GetStorageSize() );
 
-	const auto recylce_next_surface=
-	[this]
+	if( before_recycle_function_ != nullptr && AllocationRecyclesSurfaces( surface_data_size ) )
 	{
-		Surface* const recycled_surface= reinterpret_cast<Surface*>( storage_.data() + next_recycled_surface_offset_ );
-		if( recycled_surface->owner != nullptr )
-			*recycled_surface->owner= nullptr;
+		before_recycle_function_();
 
-		next_recycled_surface_offset_+=
-			sizeof(Surface) + SurfaceDataSizeAligned( recycled_surface->size[0], recycled_surface->size[1] );
-	};
+		// Recycle some surfaces ahead, but not at buffer start.
+		const unsigned int recycle_end_offset= next_allocated_surface_offset_ + surface_data_size + GetStorageSize() / 8u;
+		while( next_recycled_surface_offset_ < last_surface_in_buffer_end_offset_ &&
+			next_recycled_surface_offset_ < recycle_end_offset )
+			RecycleNextSurface();
+	}
 
-	if( next_allocated_surface_offset_ + surface_data_size > storage_.size() )
+	if( next_allocated_surface_offset_ + surface_data_size > GetStorageSize() )
 	{
 		// Recycle surfaces at end.
 		while( next_recycled_surface_offset_ < last_surface_in_buffer_end_offset_ )
-			recylce_next_surface();
+			RecycleNextSurface();
 
 		last_surface_in_buffer_end_offset_= next_allocated_surface_offset_;
 		next_allocated_surface_offset_= 0u;
@@ -71,16 +73,67 @@ void SurfacesCache::AllocateSurface(
 	// Recycle old surfaces, while we have no space for new surface.
 	while( next_recycled_surface_offset_ < last_surface_in_buffer_end_offset_ &&
 		next_recycled_surface_offset_ < next_allocated_surface_offset_ + surface_data_size )
-		recylce_next_surface();
+		RecycleNextSurface();
 
+	PC_ASSERT( next_allocated_surface_offset_ % c_surface_alignment == 0u );
 	Surface* const surface= reinterpret_cast<Surface*>( storage_.data() + next_allocated_surface_offset_ );
+	PC_ASSERT( reinterpret_cast<std::uintptr_t>(surface) % c_surface_alignment == 0u );
 	surface->size[0]= size_x;
 	surface->size[1]= size_y;
 	surface->owner= out_surface_ptr;
+	surface->last_used_frame= frame_number_;
 
 	*out_surface_ptr= surface;
 
 	next_allocated_surface_offset_+= surface_data_size;
+
+	frame_stats_.misses++;
+	frame_stats_.bytes_generated+= size_x * size_y * bytes_per_texel_;
+	frame_stats_.working_set_bytes+= surface_data_size;
+}
+
+void SurfacesCache::MarkSurfaceUsed( Surface& surface )
+{
+	frame_stats_.hits++;
+	if( surface.last_used_frame != frame_number_ )
+	{
+		surface.last_used_frame= frame_number_;
+		frame_stats_.working_set_bytes+= sizeof(Surface) + SurfaceDataSizeAligned( surface.size[0], surface.size[1] );
+	}
+}
+
+void SurfacesCache::BeginFrame()
+{
+	last_frame_stats_= frame_stats_;
+	peak_working_set_= std::max( peak_working_set_, frame_stats_.working_set_bytes );
+
+	frame_stats_= Stats();
+	frame_number_++;
+}
+
+const SurfacesCache::Stats& SurfacesCache::GetLastFrameStats() const
+{
+	return last_frame_stats_;
+}
+
+unsigned int SurfacesCache::GetPeakWorkingSet() const
+{
+	return peak_working_set_;
+}
+
+void SurfacesCache::SetBeforeRecycleFunction( std::function<void()> function )
+{
+	before_recycle_function_= std::move(function);
+}
+
+unsigned int SurfacesCache::GetStorageSize() const
+{
+	return static_cast<unsigned int>( storage_.size() ) - c_storage_padding;
+}
+
+unsigned int SurfacesCache::GetBytesPerTexel() const
+{
+	return bytes_per_texel_;
 }
 
 void SurfacesCache::Clear()
@@ -88,6 +141,83 @@ void SurfacesCache::Clear()
 	next_allocated_surface_offset_= 0u;
 	last_surface_in_buffer_end_offset_= 0u;
 	next_recycled_surface_offset_= ~0u;
+
+	peak_working_set_= 0u;
+}
+
+void SurfacesCache::AdaptStorageSize()
+{
+	if( peak_working_set_ == 0u )
+	{
+		Clear();
+		return; // Have no statistics - keep current size.
+	}
+
+	// We need some reserve over working set, because new surfaces appear, when camera moves.
+	// Do not allow too big difference with default size - working set of single frame may be strange.
+	const unsigned int c_size_granularity= 64u * 1024u;
+	unsigned int new_size= peak_working_set_ + peak_working_set_ / 2u;
+	new_size= std::max( default_storage_size_ / 2u, std::min( new_size, default_storage_size_ * 4u ) );
+	new_size= ( new_size + c_size_granularity - 1u ) / c_size_granularity * c_size_granularity;
+
+	// Do not reallocate storage for small changes.
+	const unsigned int current_size= GetStorageSize();
+	if( new_size > current_size / 4u * 5u || new_size < current_size / 4u * 3u )
+	{
+		Log::Info( "Surfaces cache peak working set: ", ( peak_working_set_ + 1023u ) / 1024u, "kb" );
+		SetStorageSize( new_size );
+	}
+
+	Clear();
+}
+
+// Returns result in bytes.
+unsigned int SurfacesCache::SurfaceDataSizeAligned(
+	const unsigned int size_x, const unsigned int size_y ) const
+{
+	// Align data size for placing of next surface header right after data.
+	const unsigned int data_size= size_x * size_y * bytes_per_texel_;
+	return ( data_size + ( c_surface_alignment - 1u ) ) & ~( c_surface_alignment - 1u );
+}
+
+bool SurfacesCache::AllocationRecyclesSurfaces( const unsigned int surface_data_size ) const
+{
+	// Wrapping to buffer start - assume, that there are some surfaces at start.
+	if( next_allocated_surface_offset_ + surface_data_size > GetStorageSize() )
+		return true;
+
+	return
+		next_recycled_surface_offset_ < last_surface_in_buffer_end_offset_ &&
+		next_recycled_surface_offset_ < next_allocated_surface_offset_ + surface_data_size;
+}
+
+void SurfacesCache::RecycleNextSurface()
+{
+	Surface* const recycled_surface= reinterpret_cast<Surface*>( storage_.data() + next_recycled_surface_offset_ );
+	if( recycled_surface->owner != nullptr )
+	{
+		*recycled_surface->owner= nullptr;
+
+		frame_stats_.evictions++;
+		if( recycled_surface->last_used_frame == frame_number_ )
+			frame_stats_.evictions_in_frame++;
+	}
+
+	next_recycled_surface_offset_+=
+		sizeof(Surface) + SurfaceDataSizeAligned( recycled_surface->size[0], recycled_surface->size[1] );
+}
+
+void SurfacesCache::SetStorageSize( const unsigned int size )
+{
+	// Free old storage before allocation of new.
+	storage_.clear();
+	storage_.shrink_to_fit();
+	storage_.resize( size + c_storage_padding );
+
+	Clear();
+
+	const unsigned int size_kb= ( GetStorageSize() + 1023u) / 1024u;
+	Log::Info( "Surfaces cache size: ", size_kb, "kb ( ", size_kb / bytes_per_texel_, " kilotexels )." );
 }
 
 } // namespace PanzerChasm
@@ -1,5 +1,6 @@
 #pragma once
 #include <cstdint>
+#include <functional>
 #include <vector>
 
 #include "../../size.hpp"
@@ -19,6 +20,9 @@ public:
 		// If zero - surface was freed.
 		Surface** owner;
 
+		// Number of last frame, where surface was used. Needed for statistics.
+		unsigned int last_used_frame;
+
 		uint32_t* GetData()
 		{
 			return reinterpret_cast<uint32_t*>(this + 1);
@@ -28,22 +32,84 @@ public:
 		{
 			return reinterpret_cast<const uint32_t*>(this + 1);
 		}
+
+		// For caches with 8-bit texels.
+		uint8_t* GetDataIndexed()
+		{
+			return reinterpret_cast<uint8_t*>(this + 1);
+		}
+
+		const uint8_t* GetDataIndexed() const
+		{
+			return reinterpret_cast<const uint8_t*>(this + 1);
+		}
+	};
+
+	// Per-frame statistics.
+	struct Stats
+	{
+		unsigned int hits= 0u; // Surface requested and found in cache.
+		unsigned int misses= 0u; // Surface allocated.
+		unsigned int evictions= 0u; // Recycled surfaces with alive owner.
+		unsigned int evictions_in_frame= 0u; // Recycled surfaces, used in same frame. If nonzero - cache is too small.
+		unsigned int bytes_generated= 0u;
+		unsigned int working_set_bytes= 0u; // Size of surfaces, used in frame.
 	};
 
 public:
-	explicit SurfacesCache( const Size2& viewport_size );
+	// "bytes_per_texel" - 4 for RGBA surfaces, 1 for palette indices surfaces.
+	// Cache with 8-bit texels contains more texels with same storage size.
+	SurfacesCache( const Size2& viewport_size, unsigned int bytes_per_texel= 4u );
 	~SurfacesCache();
 
 	void AllocateSurface( unsigned int size_x, unsigned int size_y, Surface** out_surface_ptr );
 
+	// Function, called before recycling of surfaces.
+	// Needed, if surfaces data may be still used asynchronously.
+	// After call of this function cache recycles some surfaces ahead, for reducing calls count.
+	void SetBeforeRecycleFunction( std::function<void()> function );
+
+	// Call it for surfaces, found in cache. Allocated surfaces are marked as used automatically.
+	void MarkSurfaceUsed( Surface& surface );
+
+	// Finishes statistics of previous frame and starts new frame.
+	void BeginFrame();
+	const Stats& GetLastFrameStats() const;
+	// Maximum working set since last clear.
+	unsigned int GetPeakWorkingSet() const;
+
+	// Returns cache storage size in bytes.
+	unsigned int GetStorageSize() const;
+	unsigned int GetBytesPerTexel() const;
+
 	// Clears surface cache, but not notify surfaces owners.
 	void Clear();
 
+	// Grows or shrinks storage, using peak working set, observed since last clear.
+	// Clears cache, so, call it only when all surfaces owners are destroyed or reset.
+	void AdaptStorageSize();
+
 private:
+	unsigned int SurfaceDataSizeAligned( unsigned int size_x, unsigned int size_y ) const;
+	bool AllocationRecyclesSurfaces( unsigned int surface_data_size ) const;
+	void RecycleNextSurface();
+	void SetStorageSize( unsigned int size );
+
+private:
+	const unsigned int bytes_per_texel_;
+	unsigned int default_storage_size_;
+
+	std::function<void()> before_recycle_function_;
+
 	std::vector<uint8_t> storage_;
 	unsigned int next_allocated_surface_offset_= 0u;
 	unsigned int last_surface_in_buffer_end_offset_= 0u;
 	unsigned int next_recycled_surface_offset_= ~0u;
+
+	unsigned int frame_number_= 1u;
+	Stats frame_stats_;
+	Stats last_frame_stats_;
+	unsigned int peak_working_set_= 0u;
 };
 
 } // namespace PanzerChasm
@@ -0,0 +1,104 @@
+#include "../../assert.hpp"
+
+#include "tasks_pool.hpp"
+
+namespace PanzerChasm
+{
+
+TasksPool::TasksPool( const unsigned int thread_count )
+	: next_task_(0u)
+{
+	// Caller thread is first worker.
+	for( unsigned int i= 1u; i < thread_count; i++ )
+		threads_.emplace_back( &TasksPool::WorkerThreadFunc, this );
+}
+
+TasksPool::~TasksPool()
+{
+	{
+		std::unique_lock<std::mutex> lock( mutex_ );
+		quit_= true;
+	}
+	work_condition_.notify_all();
+
+	for( std::thread& thread : threads_ )
+		thread.join();
+}
+
+unsigned int TasksPool::GetThreadCount() const
+{
+	return static_cast<unsigned int>( threads_.size() ) + 1u;
+}
+
+void TasksPool::Run( const unsigned int task_count, const TaskFunc& func )
+{
+	if( task_count == 0u )
+		return;
+
+	func_= &func;
+	task_count_= task_count;
+	next_task_.store( 0u );
+
+	// Do not wake up threads for single task.
+	if( threads_.empty() || task_count == 1u )
+	{
+		ExecuteTasks();
+		return;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock( mutex_ );
+		work_generation_++;
+		threads_in_progress_= static_cast<unsigned int>( threads_.size() );
+	}
+	work_condition_.notify_all();
+
+	ExecuteTasks();
+
+	{
+		std::unique_lock<std::mutex> lock( mutex_ );
+		work_done_condition_.wait( lock, [this]{ return threads_in_progress_ == 0u; } );
+	}
+
+	func_= nullptr;
+}
+
+void TasksPool::ExecuteTasks()
+{
+	while(true)
+	{
+		const unsigned int task_index= next_task_.fetch_add( 1u );
+		if( task_index >= task_count_ )
+			break;
+		(*func_)( task_index );
+	}
+}
+
+void TasksPool::WorkerThreadFunc()
+{
+	unsigned int last_work_generation= 0u;
+	while(true)
+	{
+		{
+			std::unique_lock<std::mutex> lock( mutex_ );
+			work_condition_.wait( lock, [&]{ return quit_ || work_generation_ != last_work_generation; } );
+			if( quit_ )
+				return;
+			last_work_generation= work_generation_;
+		}
+
+		ExecuteTasks();
+
+		bool all_done;
+		{
+			std::unique_lock<std::mutex> lock( mutex_ );
+			PC_ASSERT( threads_in_progress_ > 0u );
+			threads_in_progress_--;
+			all_done= threads_in_progress_ == 0u;
+		}
+		if( all_done )
+			work_done_condition_.notify_one();
+	}
+}
+
+} // namespace PanzerChasm
@@ -0,0 +1,45 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace PanzerChasm
+{
+
+// Simple pool of worker threads for "parallel for" tasks.
+// Caller thread also executes tasks.
+class TasksPool final
+{
+public:
+	typedef std::function<void(unsigned int task_index)> TaskFunc;
+
+	explicit TasksPool( unsigned int thread_count );
+	~TasksPool();
+
+	unsigned int GetThreadCount() const;
+
+	// Execute "func" for each index in range [ 0; task_count ) and wait for finish.
+	void Run( unsigned int task_count, const TaskFunc& func );
+
+private:
+	void ExecuteTasks();
+	void WorkerThreadFunc();
+
+private:
+	std::vector<std::thread> threads_;
+	std::mutex mutex_;
+	std::condition_variable work_condition_;
+	std::condition_variable work_done_condition_;
+	unsigned int work_generation_= 0u;
+	unsigned int threads_in_progress_= 0u;
+	bool quit_= false;
+
+	const TaskFunc* func_= nullptr;
+	unsigned int task_count_= 0u;
+	std::atomic<unsigned int> next_task_;
+};
+
+} // namespace PanzerChasm
@@ -0,0 +1,137 @@
+#include "../../assert.hpp"
+
+#include "vertices_transform.hpp"
+
+#ifdef PC_X86_SIMD_INSTRUCTIONS
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#define PC_TARGET_SSE2
+#define PC_TARGET_AVX2
+#else
+#define PC_TARGET_SSE2 __attribute__((target("sse2")))
+#define PC_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace PanzerChasm
+{
+
+static void TransformAndProjectVerticesScalar(
+	const float* const x, const float* const y, const float* const z,
+	const unsigned int count,
+	const float* const m,
+	const float screen_transform_x, const float screen_transform_y,
+	fixed16_t* const out_x, fixed16_t* const out_y, fixed16_t* const out_w )
+{
+	for( unsigned int i= 0u; i < count; i++ )
+	{
+		const float px= x[i] * m[0] + y[i] * m[4] + z[i] * m[ 8] + m[12];
+		const float py= x[i] * m[1] + y[i] * m[5] + z[i] * m[ 9] + m[13];
+		const float w = x[i] * m[3] + y[i] * m[7] + z[i] * m[11] + m[15];
+		const float inv_w= 1.0f / w;
+
+		out_x[i]= fixed16_t( ( px * inv_w + 1.0f ) * screen_transform_x * 65536.0f );
+		out_y[i]= fixed16_t( ( py * inv_w + 1.0f ) * screen_transform_y * 65536.0f );
+		out_w[i]= fixed16_t( w * 65536.0f );
+	}
+}
+
+#ifdef PC_X86_SIMD_INSTRUCTIONS
+
+PC_TARGET_SSE2 static void TransformAndProjectVerticesSSE2(
+	const float* const x, const float* const y, const float* const z,
+	const unsigned int count,
+	const float* const m,
+	const float screen_transform_x, const float screen_transform_y,
+	fixed16_t* const out_x, fixed16_t* const out_y, fixed16_t* const out_w )
+{
+	const __m128 one= _mm_set1_ps( 1.0f );
+	const __m128 scale_x= _mm_set1_ps( screen_transform_x * 65536.0f );
+	const __m128 scale_y= _mm_set1_ps( screen_transform_y * 65536.0f );
+	const __m128 scale_w= _mm_set1_ps( 65536.0f );
+
+	__m128 m_vec[16];
+	for( unsigned int i= 0u; i < 16u; i++ )
+		m_vec[i]= _mm_set1_ps( m[i] );
+
+	for( unsigned int i= 0u; i < count; i+= 4u )
+	{
+		const __m128 vx= _mm_loadu_ps( x + i );
+		const __m128 vy= _mm_loadu_ps( y + i );
+		const __m128 vz= _mm_loadu_ps( z + i );
+
+		const __m128 px= _mm_add_ps( _mm_add_ps( _mm_mul_ps( vx, m_vec[0] ), _mm_mul_ps( vy, m_vec[4] ) ), _mm_add_ps( _mm_mul_ps( vz, m_vec[ 8] ), m_vec[12] ) );
+		const __m128 py= _mm_add_ps( _mm_add_ps( _mm_mul_ps( vx, m_vec[1] ), _mm_mul_ps( vy, m_vec[5] ) ), _mm_add_ps( _mm_mul_ps( vz, m_vec[ 9] ), m_vec[13] ) );
+		const __m128 w = _mm_add_ps( _mm_add_ps( _mm_mul_ps( vx, m_vec[3] ), _mm_mul_ps( vy, m_vec[7] ) ), _mm_add_ps( _mm_mul_ps( vz, m_vec[11] ), m_vec[15] ) );
+		const __m128 inv_w= _mm_div_ps( one, w );
+
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( out_x + i ), _mm_cvttps_epi32( _mm_mul_ps( _mm_add_ps( _mm_mul_ps( px, inv_w ), one ), scale_x ) ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( out_y + i ), _mm_cvttps_epi32( _mm_mul_ps( _mm_add_ps( _mm_mul_ps( py, inv_w ), one ), scale_y ) ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( out_w + i ), _mm_cvttps_epi32( _mm_mul_ps( w, scale_w ) ) );
+	}
+}
+
+PC_TARGET_AVX2 static void TransformAndProjectVerticesAVX2(
+	const float* const x, const float* const y, const float* const z,
+	const unsigned int count,
+	const float* const m,
+	const float screen_transform_x, const float screen_transform_y,
+	fixed16_t* const out_x, fixed16_t* const out_y, fixed16_t* const out_w )
+{
+	const __m256 one= _mm256_set1_ps( 1.0f );
+	const __m256 scale_x= _mm256_set1_ps( screen_transform_x * 65536.0f );
+	const __m256 scale_y= _mm256_set1_ps( screen_transform_y * 65536.0f );
+	const __m256 scale_w= _mm256_set1_ps( 65536.0f );
+
+	__m256 m_vec[16];
+	for( unsigned int i= 0u; i < 16u; i++ )
+		m_vec[i]= _mm256_set1_ps( m[i] );
+
+	for( unsigned int i= 0u; i < count; i+= 8u )
+	{
+		const __m256 vx= _mm256_loadu_ps( x + i );
+		const __m256 vy= _mm256_loadu_ps( y + i );
+		const __m256 vz= _mm256_loadu_ps( z + i );
+
+		const __m256 px= _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( vx, m_vec[0] ), _mm256_mul_ps( vy, m_vec[4] ) ), _mm256_add_ps( _mm256_mul_ps( vz, m_vec[ 8] ), m_vec[12] ) );
+		const __m256 py= _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( vx, m_vec[1] ), _mm256_mul_ps( vy, m_vec[5] ) ), _mm256_add_ps( _mm256_mul_ps( vz, m_vec[ 9] ), m_vec[13] ) );
+		const __m256 w = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( vx, m_vec[3] ), _mm256_mul_ps( vy, m_vec[7] ) ), _mm256_add_ps( _mm256_mul_ps( vz, m_vec[11] ), m_vec[15] ) );
+		const __m256 inv_w= _mm256_div_ps( one, w );
+
+		_mm256_storeu_si256( reinterpret_cast<__m256i*>( out_x + i ), _mm256_cvttps_epi32( _mm256_mul_ps( _mm256_add_ps( _mm256_mul_ps( px, inv_w ), one ), scale_x ) ) );
+		_mm256_storeu_si256( reinterpret_cast<__m256i*>( out_y + i ), _mm256_cvttps_epi32( _mm256_mul_ps( _mm256_add_ps( _mm256_mul_ps( py, inv_w ), one ), scale_y ) ) );
+		_mm256_storeu_si256( reinterpret_cast<__m256i*>( out_w + i ), _mm256_cvttps_epi32( _mm256_mul_ps( w, scale_w ) ) );
+	}
+}
+
+#endif // PC_X86_SIMD_INSTRUCTIONS
+
+void TransformAndProjectVertices(
+	const Rasterizer::SIMDLevel simd_level,
+	const float* const x, const float* const y, const float* const z,
+	const unsigned int count,
+	const float* const matrix,
+	const float screen_transform_x, const float screen_transform_y,
+	fixed16_t* const out_x, fixed16_t* const out_y, fixed16_t* const out_w )
+{
+	PC_ASSERT( count % c_vertices_transform_padding == 0u );
+
+#ifdef PC_X86_SIMD_INSTRUCTIONS
+	if( simd_level == Rasterizer::SIMDLevel::AVX2 )
+	{
+		TransformAndProjectVerticesAVX2( x, y, z, count, matrix, screen_transform_x, screen_transform_y, out_x, out_y, out_w );
+		return;
+	}
+	if( simd_level == Rasterizer::SIMDLevel::SSE2 )
+	{
+		TransformAndProjectVerticesSSE2( x, y, z, count, matrix, screen_transform_x, screen_transform_y, out_x, out_y, out_w );
+		return;
+	}
+#endif
+
+	PC_UNUSED( simd_level );
+	TransformAndProjectVerticesScalar( x, y, z, count, matrix, screen_transform_x, screen_transform_y, out_x, out_y, out_w );
+}
+
+} // namespace PanzerChasm
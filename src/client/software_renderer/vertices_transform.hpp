@@ -0,0 +1,26 @@
+#pragma once
+#include "rasterizer.hpp"
+
+namespace PanzerChasm
+{
+
+// Vertices in SoA format. Count of vertices in arrays must be padded to c_vertices_transform_padding.
+static constexpr unsigned int c_vertices_transform_padding= 8u;
+
+inline unsigned int PadVerticesCount( const unsigned int count )
+{
+	return ( count + ( c_vertices_transform_padding - 1u ) ) & ~( c_vertices_transform_padding - 1u );
+}
+
+// Transform vertices with matrix ( row-vector convention, like m_Mat4 ), divide by "w" and convert to screen space.
+// Result - screen x, screen y and "w", all in fixed16 format.
+// All vertices must be in front of near plane.
+void TransformAndProjectVertices(
+	Rasterizer::SIMDLevel simd_level,
+	const float* x, const float* y, const float* z,
+	unsigned int count /* Padded */,
+	const float* matrix /* 4x4 */,
+	float screen_transform_x, float screen_transform_y,
+	fixed16_t* out_x, fixed16_t* out_y, fixed16_t* out_w );
+
+} // namespace PanzerChasm
@@ -34,6 +34,9 @@ typedef std::shared_ptr<const MapData> MapDataConstPtr;
 class MapLoader;
 typedef std::shared_ptr<MapLoader> MapLoaderPtr;
 
+class MapPVS;
+typedef std::shared_ptr<const MapPVS> MapPVSConstPtr;
+
 class MessagesSender;
 
 class LongRand;
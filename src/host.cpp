@@ -1,7 +1,6 @@
 #include <cstring>
 
 #include <framebuffer.hpp>
-#include <glsl_program.hpp>
 #include <ogl_state_manager.hpp>
 #include <shaders_loading.hpp>
 
@@ -259,6 +258,14 @@ bool Host::Loop()
 			shared_drawers_->text->Print(
 				offset, shared_drawers_->text->GetLineHeight(),
 				str, scale, ITextDrawer::FontColor::Golden, ITextDrawer::Alignment::Right );
+
+			if( client_ != nullptr )
+			{
+				if( const char* const map_drawer_status= client_->GetMapDrawerStatus() )
+					shared_drawers_->text->Print(
+						offset, 2u * shared_drawers_->text->GetLineHeight(),
+						map_drawer_status, scale, ITextDrawer::FontColor::Golden, ITextDrawer::Alignment::Right );
+			}
 		}
 
 		system_window_->EndFrame();
@@ -521,22 +528,19 @@ void Host::DoVidRestart()
 	system_window_.reset( new SystemWindow( settings_ ) );
 	system_window_->SetTitle( base_window_title_ );
 
+	// Measure drawers creation time. For OpenGL renderer most of this time is spent for shaders compilation.
+	const Time drawers_creation_start_time= Time::CurrentTime();
 
 	if( system_window_->IsOpenGLRenderer() )
 	{
 		r_OGLStateManager::ResetState();
 
 		rSetShadersDir( "shaders" );
-		{
-			const auto shaders_log_callback=
+		rSetShaderLoadingLogCallback(
 			[]( const char* const log_data )
 			{
 				Log::Warning( log_data );
-			};
-
-			rSetShaderLoadingLogCallback( shaders_log_callback );
-			r_GLSLProgram::SetProgramBuildLogOutCallback( shaders_log_callback );
-		}
+			} );
 		r_Framebuffer::SetScreenFramebufferSize( system_window_->GetViewportSize().Width(), system_window_->GetViewportSize().Height() );
 
 		drawers_factory_=
@@ -547,20 +551,9 @@ void Host::DoVidRestart()
 	}
 	else
 	{
-		// TODO - generate transformed palette in other place
 		RenderingContextSoft rendering_context= system_window_->GetRenderingContextSoft();
-		rendering_context.palette_transformed= std::make_shared<PaletteTransformed>();
-
-		const Palette& in_palette= game_resources_->palette;
-		for( unsigned int i= 0u; i < 256u; i++ )
-		{
-			unsigned char components[4];
-			components[ rendering_context.color_indeces_rgba[0] ]= in_palette[ i * 3u + 0u ];
-			components[ rendering_context.color_indeces_rgba[1] ]= in_palette[ i * 3u + 1u ];
-			components[ rendering_context.color_indeces_rgba[2] ]= in_palette[ i * 3u + 2u ];
-			components[ rendering_context.color_indeces_rgba[3] ]= i == 255u ? 0u : 255u;
-			std::memcpy( &(*rendering_context.palette_transformed)[i], &components, 4u );
-		}
+		rendering_context.palette_transformed=
+			CreatePaletteTransformed( game_resources_->palette, rendering_context.color_indeces_rgba );
 
 		drawers_factory_=
 			std::make_shared<DrawersFactorySoft>(
@@ -578,6 +571,8 @@ void Host::DoVidRestart()
 
 	if( client_ != nullptr )
 		client_->VidRestart( *drawers_factory_ );
+
+	Log::Info( "Drawers created in ", ( Time::CurrentTime() - drawers_creation_start_time ).ToSeconds() * 1000.0f, " ms" );
 }
 
 void Host::DoRunLevel( const unsigned int map_number, const DifficultyType difficulty )
@@ -6,6 +6,7 @@
 #include <SDL.h>
 
 #include "host.hpp"
+#include "render_benchmark.hpp"
 using namespace PanzerChasm;
 
 extern "C" int main( int argc, char *argv[] )
@@ -14,6 +15,12 @@ extern "C" int main( int argc, char *argv[] )
 	argc--;
 	argv++;
 
+	{
+		const ProgramArguments program_arguments( argc, argv );
+		if( program_arguments.HasParam( "bench-render" ) )
+			return RunRenderBenchmark( program_arguments );
+	}
+
 	// "Host" may be hard object. Create it on the heap.
 	std::unique_ptr<Host> host( new Host( argc, argv ) );
 
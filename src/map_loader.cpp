@@ -3,6 +3,7 @@
 
 #include "assert.hpp"
 #include "log.hpp"
+#include "map_pvs.hpp"
 #include "math_utils.hpp"
 
 #include "map_loader.hpp"
@@ -245,8 +246,12 @@ MapDataConstPtr MapLoader::LoadMap( const unsigned int map_number )
 
 	LoadModels( *result );
 
-	// Cache result and return it.
 	result->number= map_number;
+
+	// Needs walls, walls textures description and map number. Usually it is loaded from disk cache.
+	result->pvs= std::make_shared<MapPVS>( *result );
+
+	// Cache result and return it.
 	last_loaded_map_= result;
 	return result;
 }
@@ -289,6 +289,10 @@ public:
 	unsigned char lightmap[ c_lightmap_size * c_lightmap_size ];
 
 	unsigned char floor_textures_data[ c_floors_textures_count ][ c_floor_texture_size * c_floor_texture_size ];
+
+	// Potentially visible set of static walls and cells.
+	// Built at map loading, so, it is ready before any drawer or server thread uses map data.
+	MapPVSConstPtr pvs;
 };
 
 class MapLoader final
@@ -0,0 +1,691 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+#include "common/files.hpp"
+using namespace ChasmReverse;
+
+#include "assert.hpp"
+#include "cache_files.hpp"
+#include "log.hpp"
+#include "math_utils.hpp"
+#include "save_load.hpp"
+
+#include "map_pvs.hpp"
+
+namespace PanzerChasm
+{
+
+namespace
+{
+
+// PVS is calculated by drawing of walls into circular depth buffer from some points inside cell.
+// Buffer is indexed by pseudo-angle in range [ 0; 4 ), which is cheaper, than real angle.
+const unsigned int c_angle_bins= 1024u; // Must be power of two.
+const float c_bins_per_pseudo_angle= float(c_angle_bins) / 4.0f;
+
+const float c_min_line_dist= 1.0f / 256.0f;
+const float c_depth_eps= 1.0f / 64.0f;
+
+// Cell is splitted into square regions with sample point in center of each region.
+// Occluders are shrinked for each sample by parallax of its ends inside region.
+// Collinear occluders are merged before it, so, most of occluders are long and shrinking is cheap.
+const unsigned int c_samples_per_axis= 4u;
+const float c_sample_region_half_size= 0.5f / float(c_samples_per_axis);
+const float c_sample_region_radius= c_sample_region_half_size * std::sqrt( 2.0f );
+
+struct Segment
+{
+	m_Vec2 vert_pos[2];
+};
+
+struct BuildData
+{
+	std::vector<Segment> occluders;
+	std::vector<Segment> walls;
+
+	// Cell borders, covered by axis-aligned occluders. Visibility can not pass through it.
+	// Indexed as [ coord + line * size ]. For borders along x axis line is y, for borders along y axis line is x.
+	std::vector<bool> x_borders_covered;
+	std::vector<bool> y_borders_covered;
+
+	// Indeces of walls, touching cell. Walls of cell "c" are in range [ cell_walls_offsets[c]; cell_walls_offsets[c+1] ).
+	std::vector<unsigned int> cell_walls_offsets;
+	std::vector<unsigned int> cell_walls;
+
+	// Bins borders directions.
+	m_Vec2 bins_directions[ c_angle_bins ];
+};
+
+struct CalculationBuffers
+{
+	float depth_buffer[ c_angle_bins ];
+	std::vector<unsigned int> cells_queue;
+	std::vector<unsigned int> cells_visit_number;
+	unsigned int current_visit_number= 0u;
+};
+
+// Monotonic function of angle, in range [ 0; 4 ).
+float PseudoAngle( const m_Vec2& v )
+{
+	if( v.y >= 0.0f )
+		return v.x >= 0.0f ? ( v.y / ( v.x + v.y ) ) : ( 1.0f - v.x / ( v.y - v.x ) );
+	else
+		return v.x < 0.0f ? ( 2.0f - v.y / ( -v.x - v.y ) ) : ( 3.0f + v.x / ( v.x - v.y ) );
+}
+
+m_Vec2 PseudoAngleToDirection( const float pseudo_angle )
+{
+	const unsigned int quadrant= std::min( static_cast<unsigned int>( pseudo_angle ), 3u );
+	const float s= pseudo_angle - float(quadrant);
+
+	m_Vec2 result;
+	switch( quadrant )
+	{
+	case 0u: result= m_Vec2(  1.0f - s,         s ); break;
+	case 1u: result= m_Vec2(        -s,  1.0f - s ); break;
+	case 2u: result= m_Vec2(  s - 1.0f,        -s ); break;
+	default: result= m_Vec2(         s,  s - 1.0f ); break;
+	};
+	result.Normalize();
+	return result;
+}
+
+// Segment, viewed from point. Pseudo-angles are unwrapped, "end" is greater, than "start".
+struct AngularSpan
+{
+	float start, end;
+	float nearest_point_angle; // Pseudo-angle of nearest point of segment line. Unwrapped relative to "start".
+	float line_dist;
+
+	m_Vec2 start_vec, end_vec; // Vectors from view point to segment ends.
+	m_Vec2 normal; // Not normalized, directed from view point.
+	float line_normal_dist; // normal * ( line point - view point )
+};
+
+// Returns false for degenerated segments and segments, seen exactly from side.
+bool CalculateAngularSpan( const m_Vec2& point, const Segment& segment, AngularSpan& out_span )
+{
+	const m_Vec2 d0= segment.vert_pos[0] - point;
+	const m_Vec2 d1= segment.vert_pos[1] - point;
+	const m_Vec2 edge= segment.vert_pos[1] - segment.vert_pos[0];
+	const float edge_square_length= edge.SquareLength();
+	if( edge_square_length <= 0.0f )
+		return false;
+
+	const float cross= d0.x * d1.y - d0.y * d1.x;
+	out_span.line_dist= std::abs(cross) / std::sqrt( edge_square_length );
+	if( out_span.line_dist < c_min_line_dist )
+		return false;
+
+	// Start from vector, relative to which other vector is counterclockwise.
+	out_span.start_vec= cross > 0.0f ? d0 : d1;
+	out_span.end_vec  = cross > 0.0f ? d1 : d0;
+
+	out_span.start= PseudoAngle( out_span.start_vec );
+	out_span.end= PseudoAngle( out_span.end_vec );
+	if( out_span.end < out_span.start )
+		out_span.end+= 4.0f;
+
+	const m_Vec2 nearest_vec= d0 - edge * ( ( d0 * edge ) / edge_square_length );
+	out_span.nearest_point_angle= PseudoAngle( nearest_vec );
+	if( out_span.nearest_point_angle < out_span.start )
+		out_span.nearest_point_angle+= 4.0f;
+
+	out_span.normal= m_Vec2( edge.y, -edge.x );
+	out_span.line_normal_dist= out_span.normal * d0;
+	if( out_span.line_normal_dist < 0.0f )
+	{
+		out_span.normal= -out_span.normal;
+		out_span.line_normal_dist= -out_span.line_normal_dist;
+	}
+
+	return true;
+}
+
+// Distance to segment line along direction.
+float GetDistanceAlongDirection( const AngularSpan& span, const m_Vec2& direction )
+{
+	const float direction_dot= span.normal * direction;
+	if( direction_dot <= 0.0f )
+		return Constants::max_float;
+	return span.line_normal_dist / direction_dot;
+}
+
+// Shrink occluder span, because directions to occluder ends change inside sample region.
+// Returns false, if occluder hides nothing.
+bool ShrinkOccluderSpan( const m_Vec2& point, const Segment& occluder, AngularSpan& span )
+{
+	// All sample region must be on one side of occluder line.
+	// Otherwise something behind occluder is visible from some region points.
+	bool has_front= false, has_back= false;
+	for( unsigned int i= 0u; i < 4u; i++ )
+	{
+		const m_Vec2 corner(
+			point.x + ( ( i & 1u ) != 0u ? +c_sample_region_half_size : -c_sample_region_half_size ),
+			point.y + ( ( i & 2u ) != 0u ? +c_sample_region_half_size : -c_sample_region_half_size ) );
+		const float dist= span.normal * ( corner - occluder.vert_pos[0] );
+		has_front|= dist < 0.0f;
+		has_back |= dist > 0.0f;
+	}
+	if( has_front && has_back )
+		return false;
+
+	const float start_shrink_angle= std::asin( std::min( 1.0f, c_sample_region_radius / span.start_vec.Length() ) );
+	const float   end_shrink_angle= std::asin( std::min( 1.0f, c_sample_region_radius / span.  end_vec.Length() ) );
+
+	const float span_angle=
+		std::atan2(
+			span.start_vec.x * span.end_vec.y - span.start_vec.y * span.end_vec.x,
+			span.start_vec * span.end_vec );
+	if( start_shrink_angle + end_shrink_angle >= span_angle )
+		return false;
+
+	const float start_sin= std::sin( start_shrink_angle ), start_cos= std::cos( start_shrink_angle );
+	const float   end_sin= std::sin(   end_shrink_angle ),   end_cos= std::cos(   end_shrink_angle );
+	const m_Vec2 start_vec_rotated(
+		span.start_vec.x * start_cos - span.start_vec.y * start_sin,
+		span.start_vec.x * start_sin + span.start_vec.y * start_cos );
+	const m_Vec2 end_vec_rotated(
+		span.end_vec.x * end_cos + span.end_vec.y * end_sin,
+		span.end_vec.y * end_cos - span.end_vec.x * end_sin );
+
+	span.start= PseudoAngle( start_vec_rotated );
+	span.end= PseudoAngle( end_vec_rotated );
+	if( span.end < span.start )
+		span.end+= 4.0f;
+
+	return true;
+}
+
+void DrawOccluder( const BuildData& build_data, const AngularSpan& span, float* const depth_buffer )
+{
+	// Write only bins, fully covered by occluder, and use maximum distance inside bin.
+	// So, occluders are smaller, than real walls, and result is conservative.
+	const unsigned int first_bin= static_cast<unsigned int>( std::ceil( span.start * c_bins_per_pseudo_angle ) );
+	const unsigned int end_bin= static_cast<unsigned int>( std::floor( span.end * c_bins_per_pseudo_angle ) );
+	if( first_bin >= end_bin )
+		return;
+
+	float prev_border_dist= GetDistanceAlongDirection( span, build_data.bins_directions[ first_bin & ( c_angle_bins - 1u ) ] );
+	for( unsigned int bin= first_bin; bin < end_bin; bin++ )
+	{
+		const float border_dist= GetDistanceAlongDirection( span, build_data.bins_directions[ ( bin + 1u ) & ( c_angle_bins - 1u ) ] );
+
+		float& dst= depth_buffer[ bin & ( c_angle_bins - 1u ) ];
+		dst= std::min( dst, std::max( prev_border_dist, border_dist ) );
+
+		prev_border_dist= border_dist;
+	}
+}
+
+bool IsVisible( const BuildData& build_data, const AngularSpan& span, const float* const depth_buffer, const float depth_eps )
+{
+	// Use minimum distance inside each bin, touched by segment.
+	const unsigned int first_bin= static_cast<unsigned int>( std::floor( span.start * c_bins_per_pseudo_angle ) );
+	const unsigned int last_bin= static_cast<unsigned int>( std::floor( span.end * c_bins_per_pseudo_angle ) );
+	for( unsigned int bin= first_bin; bin <= last_bin; bin++ )
+	{
+		const float bin_start= float(bin     ) / c_bins_per_pseudo_angle;
+		const float bin_end  = float(bin + 1u) / c_bins_per_pseudo_angle;
+
+		float dist;
+		if( span.nearest_point_angle >= std::max( bin_start, span.start ) &&
+			span.nearest_point_angle <= std::min( bin_end, span.end ) )
+			dist= span.line_dist;
+		else
+		{
+			// Nearest point is outside bin part of segment. So, nearest point is on one of bin part borders.
+			const float start_dist=
+				bin_start <= span.start
+					? span.start_vec.Length()
+					: GetDistanceAlongDirection( span, build_data.bins_directions[ bin & ( c_angle_bins - 1u ) ] );
+			const float end_dist=
+				bin_end >= span.end
+					? span.end_vec.Length()
+					: GetDistanceAlongDirection( span, build_data.bins_directions[ ( bin + 1u ) & ( c_angle_bins - 1u ) ] );
+			dist= std::min( start_dist, end_dist );
+		}
+
+		if( dist < depth_buffer[ bin & ( c_angle_bins - 1u ) ] + depth_eps )
+			return true;
+	}
+
+	return false;
+}
+
+// Merge collinear occluders with common vertices into long occluders.
+// Long occluders lose less after shrinking.
+void MergeCollinearOccluders( std::vector<Segment>& occluders )
+{
+	const float c_vertex_eps= 1.0f / 256.0f;
+	const float c_collinear_eps= 1.0f / 1024.0f;
+
+	const auto try_merge=
+	[&]( Segment& a, const Segment& b ) -> bool
+	{
+		for( unsigned int a_v= 0u; a_v < 2u; a_v++ )
+		for( unsigned int b_v= 0u; b_v < 2u; b_v++ )
+		{
+			if( ( a.vert_pos[a_v] - b.vert_pos[b_v] ).SquareLength() > c_vertex_eps * c_vertex_eps )
+				continue;
+
+			// Common vertex must be between other vertices.
+			const m_Vec2 a_dir= a.vert_pos[a_v ^ 1u] - a.vert_pos[a_v];
+			const m_Vec2 b_dir= b.vert_pos[b_v ^ 1u] - b.vert_pos[b_v];
+			const float cross= a_dir.x * b_dir.y - a_dir.y * b_dir.x;
+			if( std::abs( cross ) > c_collinear_eps * a_dir.Length() * b_dir.Length() || a_dir * b_dir >= 0.0f )
+				continue;
+
+			a.vert_pos[a_v]= b.vert_pos[b_v ^ 1u];
+			return true;
+		}
+		return false;
+	};
+
+	bool merged= true;
+	while( merged )
+	{
+		merged= false;
+		for( unsigned int i= 0u; i < occluders.size(); i++ )
+		for( unsigned int j= i + 1u; j < occluders.size(); )
+		{
+			if( try_merge( occluders[i], occluders[j] ) )
+			{
+				occluders[j]= occluders.back();
+				occluders.pop_back();
+				merged= true;
+			}
+			else
+				j++;
+		}
+	}
+}
+
+void SetBit( uint32_t* const bits, const unsigned int index )
+{
+	bits[ index >> 5u ]|= 1u << ( index & 31u );
+}
+
+bool GetBit( const uint32_t* const bits, const unsigned int index )
+{
+	return ( bits[ index >> 5u ] & ( 1u << ( index & 31u ) ) ) != 0u;
+}
+
+void CalculateCellVisibility(
+	const BuildData& build_data,
+	const unsigned int cell_x, const unsigned int cell_y,
+	CalculationBuffers& buffers,
+	uint32_t* const out_cells_visibility,
+	uint32_t* const out_walls_visibility )
+{
+	const unsigned int c_map_size= MapData::c_map_size;
+	AngularSpan span;
+
+	for( unsigned int sample_y= 0u; sample_y < c_samples_per_axis; sample_y++ )
+	for( unsigned int sample_x= 0u; sample_x < c_samples_per_axis; sample_x++ )
+	{
+		const m_Vec2 point(
+			float(cell_x) + float( 2u * sample_x + 1u ) * c_sample_region_half_size,
+			float(cell_y) + float( 2u * sample_y + 1u ) * c_sample_region_half_size );
+
+		for( float& depth : buffers.depth_buffer )
+			depth= Constants::max_float;
+
+		for( const Segment& occluder : build_data.occluders )
+		{
+			if( CalculateAngularSpan( point, occluder, span ) &&
+				ShrinkOccluderSpan( point, occluder, span ) )
+				DrawOccluder( build_data, span, buffers.depth_buffer );
+		}
+
+		// Visit cells, starting from cell of view point, through visible cells borders.
+		buffers.current_visit_number++;
+		buffers.cells_queue.clear();
+
+		const unsigned int start_cell= cell_x + cell_y * c_map_size;
+		buffers.cells_queue.push_back( start_cell );
+		buffers.cells_visit_number[ start_cell ]= buffers.current_visit_number;
+
+		for( unsigned int i= 0u; i < buffers.cells_queue.size(); i++ )
+		{
+			const unsigned int cell= buffers.cells_queue[i];
+			SetBit( out_cells_visibility, cell );
+
+			// Walls, which are on depth buffer, are visible. Walls, seen exactly from side, are visible too.
+			for( unsigned int j= build_data.cell_walls_offsets[ cell ]; j < build_data.cell_walls_offsets[ cell + 1u ]; j++ )
+			{
+				const unsigned int w= build_data.cell_walls[j];
+				if( GetBit( out_walls_visibility, w ) )
+					continue;
+
+				if( !CalculateAngularSpan( point, build_data.walls[w], span ) ||
+					IsVisible( build_data, span, buffers.depth_buffer, +c_depth_eps ) )
+					SetBit( out_walls_visibility, w );
+			}
+
+			const unsigned int x= cell % c_map_size;
+			const unsigned int y= cell / c_map_size;
+			const auto try_visit_neighbor=
+			[&]( const unsigned int neighbor_x, const unsigned int neighbor_y, const bool border_covered, const Segment& border )
+			{
+				if( border_covered || neighbor_x >= c_map_size || neighbor_y >= c_map_size )
+					return;
+
+				const unsigned int neighbor_cell= neighbor_x + neighbor_y * c_map_size;
+				if( buffers.cells_visit_number[ neighbor_cell ] == buffers.current_visit_number )
+					return;
+
+				if( !CalculateAngularSpan( point, border, span ) ||
+					IsVisible( build_data, span, buffers.depth_buffer, -c_depth_eps ) )
+				{
+					buffers.cells_visit_number[ neighbor_cell ]= buffers.current_visit_number;
+					buffers.cells_queue.push_back( neighbor_cell );
+				}
+			};
+
+			const float x0= float(x), y0= float(y), x1= x0 + 1.0f, y1= y0 + 1.0f;
+			const m_Vec2 v00( x0, y0 ), v10( x1, y0 ), v01( x0, y1 ), v11( x1, y1 );
+			try_visit_neighbor( x, y - 1u, build_data.x_borders_covered[ x + y * c_map_size ], Segment{ { v00, v10 } } );
+			try_visit_neighbor( x, y + 1u, build_data.x_borders_covered[ x + ( y + 1u ) * c_map_size ], Segment{ { v01, v11 } } );
+			try_visit_neighbor( x - 1u, y, build_data.y_borders_covered[ y + x * c_map_size ], Segment{ { v00, v01 } } );
+			try_visit_neighbor( x + 1u, y, build_data.y_borders_covered[ y + ( x + 1u ) * c_map_size ], Segment{ { v10, v11 } } );
+		} // for cells
+	} // for sample points
+}
+
+} // namespace
+
+const char MapPVS::CacheHeader::c_expected_id[8]= "PanChPv"; // PanzerChasmPVS
+
+MapPVS::MapPVS( const MapData& map_data )
+{
+	walls_row_size_= ( static_cast<unsigned int>( map_data.static_walls.size() ) + 31u ) / 32u;
+
+	if( LoadFromCache( map_data ) )
+		return;
+
+	Build( map_data );
+	SaveToCache( map_data );
+}
+
+MapPVS::~MapPVS()
+{
+}
+
+unsigned int MapPVS::GetCellIndex( const m_Vec2& pos )
+{
+	if( !( pos.x >= 0.0f && pos.y >= 0.0f && pos.x < float(MapData::c_map_size) && pos.y < float(MapData::c_map_size) ) )
+		return c_invalid_cell;
+
+	return static_cast<unsigned int>(pos.x) + static_cast<unsigned int>(pos.y) * MapData::c_map_size;
+}
+
+bool MapPVS::IsCellVisible( const unsigned int from_cell, const unsigned int cell_x, const unsigned int cell_y ) const
+{
+	if( from_cell >= c_cell_count )
+		return true;
+
+	PC_ASSERT( cell_x < MapData::c_map_size && cell_y < MapData::c_map_size );
+	return GetBit( cells_visibility_.data() + from_cell * c_cells_row_size, cell_x + cell_y * MapData::c_map_size );
+}
+
+bool MapPVS::IsStaticWallVisible( const unsigned int from_cell, const unsigned int wall_index ) const
+{
+	if( from_cell >= c_cell_count )
+		return true;
+
+	PC_ASSERT( wall_index < walls_row_size_ * 32u );
+	return GetBit( walls_visibility_.data() + from_cell * walls_row_size_, wall_index );
+}
+
+void MapPVS::Build( const MapData& map_data )
+{
+	Log::Info( "Calculating PVS for map ", map_data.number );
+
+	const float c_border_eps= 1.0f / 64.0f;
+	const unsigned int c_map_size= MapData::c_map_size;
+
+	BuildData build_data;
+	build_data.x_borders_covered.resize( c_map_size * ( c_map_size + 1u ), false );
+	build_data.y_borders_covered.resize( c_map_size * ( c_map_size + 1u ), false );
+
+	std::vector< std::vector<unsigned int> > cells_walls( c_cell_count );
+
+	build_data.walls.resize( map_data.static_walls.size() );
+	for( unsigned int w= 0u; w < map_data.static_walls.size(); w++ )
+	{
+		const MapData::Wall& wall= map_data.static_walls[w];
+		Segment& segment= build_data.walls[w];
+		segment.vert_pos[0]= wall.vert_pos[0];
+		segment.vert_pos[1]= wall.vert_pos[1];
+
+		// Wall may be visible only if one of cells around it is visible.
+		const float eps= 2.0f * c_depth_eps;
+		const int x_min= std::max( 0, static_cast<int>( std::floor( std::min( wall.vert_pos[0].x, wall.vert_pos[1].x ) - eps ) ) );
+		const int y_min= std::max( 0, static_cast<int>( std::floor( std::min( wall.vert_pos[0].y, wall.vert_pos[1].y ) - eps ) ) );
+		const int x_max= std::min( int(c_map_size) - 1, static_cast<int>( std::floor( std::max( wall.vert_pos[0].x, wall.vert_pos[1].x ) + eps ) ) );
+		const int y_max= std::min( int(c_map_size) - 1, static_cast<int>( std::floor( std::max( wall.vert_pos[0].y, wall.vert_pos[1].y ) + eps ) ) );
+		for( int y= y_min; y <= y_max; y++ )
+		for( int x= x_min; x <= x_max; x++ )
+			cells_walls[ static_cast<unsigned int>( x + y * int(c_map_size) ) ].push_back( w );
+
+		if( wall.texture_id >= MapData::c_first_transparent_texture_id ||
+			map_data.walls_textures[ wall.texture_id ].file_path[0] == '\0' )
+			continue;
+
+		build_data.occluders.push_back( segment );
+
+		for( unsigned int axis= 0u; axis < 2u; axis++ )
+		{
+			const float line_coord= std::round( wall.vert_pos[0][axis ^ 1u] );
+			if( std::abs( wall.vert_pos[0][axis ^ 1u] - line_coord ) > c_border_eps ||
+				std::abs( wall.vert_pos[1][axis ^ 1u] - line_coord ) > c_border_eps ||
+				line_coord < 0.0f || line_coord > float(c_map_size) )
+				continue;
+
+			const float min_coord= std::min( wall.vert_pos[0][axis], wall.vert_pos[1][axis] );
+			const float max_coord= std::max( wall.vert_pos[0][axis], wall.vert_pos[1][axis] );
+			const unsigned int line= static_cast<unsigned int>( line_coord );
+			for( unsigned int i= 0u; i < c_map_size; i++ )
+			{
+				if( min_coord <= float(i) + c_border_eps && max_coord >= float(i + 1u) - c_border_eps )
+					( axis == 0u ? build_data.x_borders_covered : build_data.y_borders_covered )[ i + line * c_map_size ]= true;
+			}
+		}
+	}
+
+	MergeCollinearOccluders( build_data.occluders );
+
+	build_data.cell_walls_offsets.resize( c_cell_count + 1u );
+	for( unsigned int c= 0u; c < c_cell_count; c++ )
+	{
+		build_data.cell_walls_offsets[c]= static_cast<unsigned int>( build_data.cell_walls.size() );
+		build_data.cell_walls.insert( build_data.cell_walls.end(), cells_walls[c].begin(), cells_walls[c].end() );
+	}
+	build_data.cell_walls_offsets[ c_cell_count ]= static_cast<unsigned int>( build_data.cell_walls.size() );
+
+	for( unsigned int i= 0u; i < c_angle_bins; i++ )
+		build_data.bins_directions[i]= PseudoAngleToDirection( float(i) / c_bins_per_pseudo_angle );
+
+	// Camera can not be inside solid blocks. Find cells, reachable from player spawns and teleports destinations.
+	// For other cells everything is visible.
+	std::vector<bool> reachable_cells( c_cell_count, false );
+	std::vector<unsigned int> cells_queue;
+	const auto add_reachable_cell=
+	[&]( const unsigned int x, const unsigned int y )
+	{
+		if( x < c_map_size && y < c_map_size && !reachable_cells[ x + y * c_map_size ] )
+		{
+			reachable_cells[ x + y * c_map_size ]= true;
+			cells_queue.push_back( x + y * c_map_size );
+		}
+	};
+
+	for( const MapData::Monster& monster : map_data.monsters )
+	{
+		if( monster.monster_id == 0u && monster.pos.x >= 0.0f && monster.pos.y >= 0.0f )
+			add_reachable_cell( static_cast<unsigned int>( monster.pos.x ), static_cast<unsigned int>( monster.pos.y ) );
+	}
+	for( const MapData::Teleport& teleport : map_data.teleports )
+	{
+		// Coordinates may be in cells or in 1/256 of cell.
+		unsigned int xy[2];
+		for( unsigned int j= 0u; j < 2u; j++ )
+			xy[j]= teleport.to[j] >= c_map_size ? ( teleport.to[j] >> 8u ) : teleport.to[j];
+		add_reachable_cell( xy[0], xy[1] );
+	}
+
+	const bool have_reachable_cells= !cells_queue.empty();
+	for( unsigned int i= 0u; i < cells_queue.size(); i++ )
+	{
+		const unsigned int x= cells_queue[i] % c_map_size;
+		const unsigned int y= cells_queue[i] / c_map_size;
+		if( !build_data.x_borders_covered[ x + y * c_map_size ] ) add_reachable_cell( x, y - 1u );
+		if( !build_data.x_borders_covered[ x + ( y + 1u ) * c_map_size ] ) add_reachable_cell( x, y + 1u );
+		if( !build_data.y_borders_covered[ y + x * c_map_size ] ) add_reachable_cell( x - 1u, y );
+		if( !build_data.y_borders_covered[ y + ( x + 1u ) * c_map_size ] ) add_reachable_cell( x + 1u, y );
+	}
+
+	cells_visibility_.clear();
+	walls_visibility_.clear();
+	cells_visibility_.resize( c_cell_count * c_cells_row_size, 0u );
+	walls_visibility_.resize( c_cell_count * walls_row_size_, 0u );
+
+	// Cells are independent - calculate it in parallel.
+	std::atomic<unsigned int> next_cell( 0u );
+	const auto thread_func=
+	[&]()
+	{
+		std::unique_ptr<CalculationBuffers> buffers( new CalculationBuffers );
+		buffers->cells_visit_number.resize( c_cell_count, 0u );
+
+		while(true)
+		{
+			const unsigned int cell= next_cell.fetch_add( 1u );
+			if( cell >= c_cell_count )
+				break;
+
+			uint32_t* const cells_visibility= cells_visibility_.data() + cell * c_cells_row_size;
+			uint32_t* const walls_visibility= walls_visibility_.data() + cell * walls_row_size_;
+			if( have_reachable_cells && !reachable_cells[cell] )
+			{
+				std::fill( cells_visibility, cells_visibility + c_cells_row_size, ~0u );
+				std::fill( walls_visibility, walls_visibility + walls_row_size_, ~0u );
+				continue;
+			}
+
+			CalculateCellVisibility(
+				build_data,
+				cell % c_map_size, cell / c_map_size,
+				*buffers,
+				cells_visibility,
+				walls_visibility );
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for( unsigned int i= 1u; i < std::thread::hardware_concurrency(); i++ )
+		threads.emplace_back( thread_func );
+
+	thread_func();
+	for( std::thread& thread : threads )
+		thread.join();
+}
+
+unsigned int MapPVS::CalculateWallsHash( const MapData& map_data )
+{
+	// PVS depends on walls positions and on walls opacity.
+	const unsigned int c_wall_data_size= sizeof(m_Vec2) * 2u + 1u;
+	std::vector<unsigned char> walls_data( map_data.static_walls.size() * c_wall_data_size );
+	for( unsigned int i= 0u; i < map_data.static_walls.size(); i++ )
+	{
+		const MapData::Wall& wall= map_data.static_walls[i];
+		unsigned char* const dst= walls_data.data() + i * c_wall_data_size;
+		std::memcpy( dst, wall.vert_pos, sizeof(m_Vec2) * 2u );
+		dst[ sizeof(m_Vec2) * 2u ]=
+			wall.texture_id < MapData::c_first_transparent_texture_id &&
+			map_data.walls_textures[ wall.texture_id ].file_path[0] != '\0';
+	}
+
+	return SaveHeader::CalculateHash( walls_data.data(), static_cast<unsigned int>( walls_data.size() ) );
+}
+
+bool MapPVS::LoadFromCache( const MapData& map_data )
+{
+	char file_name[64];
+	GetMapCacheFileName( map_data.number, "pcpvs", file_name, sizeof(file_name) );
+
+	std::FILE* const f= std::fopen( file_name, "rb" );
+	if( f == nullptr )
+		return false;
+
+	std::fseek( f, 0, SEEK_END );
+	const unsigned int file_size= std::ftell( f );
+	std::fseek( f, 0, SEEK_SET );
+
+	const unsigned int expected_file_size=
+		sizeof(CacheHeader) + ( c_cells_row_size + walls_row_size_ ) * c_cell_count * sizeof(uint32_t);
+
+	CacheHeader header;
+	if( file_size != expected_file_size )
+	{
+		Log::Info( "PVS cache \"", file_name, "\" is outdated" );
+		std::fclose(f);
+		return false;
+	}
+	FileRead( f, &header, sizeof(CacheHeader) );
+
+	if( std::memcmp( header.id, CacheHeader::c_expected_id, sizeof(header.id) ) != 0 ||
+		header.version != CacheHeader::c_expected_version ||
+		header.map_number != map_data.number ||
+		header.walls_hash != CalculateWallsHash( map_data ) ||
+		header.walls_row_size != walls_row_size_ )
+	{
+		Log::Info( "PVS cache \"", file_name, "\" is outdated" );
+		std::fclose(f);
+		return false;
+	}
+
+	cells_visibility_.resize( c_cell_count * c_cells_row_size );
+	walls_visibility_.resize( c_cell_count * walls_row_size_ );
+	FileRead( f, cells_visibility_.data(), cells_visibility_.size() * sizeof(uint32_t) );
+	FileRead( f, walls_visibility_.data(), walls_visibility_.size() * sizeof(uint32_t) );
+	std::fclose(f);
+
+	Log::Info( "PVS loaded from cache \"", file_name, "\"" );
+	return true;
+}
+
+void MapPVS::SaveToCache( const MapData& map_data ) const
+{
+	CreateCacheDir();
+
+	char file_name[64];
+	GetMapCacheFileName( map_data.number, "pcpvs", file_name, sizeof(file_name) );
+
+	std::FILE* const f= std::fopen( file_name, "wb" );
+	if( f == nullptr )
+	{
+		Log::Warning( "Can not write PVS cache \"", file_name, "\"" );
+		return;
+	}
+
+	CacheHeader header;
+	std::memcpy( header.id, CacheHeader::c_expected_id, sizeof(header.id) );
+	header.version= CacheHeader::c_expected_version;
+	header.map_number= map_data.number;
+	header.walls_hash= CalculateWallsHash( map_data );
+	header.walls_row_size= walls_row_size_;
+
+	FileWrite( f, &header, sizeof(CacheHeader) );
+	FileWrite( f, cells_visibility_.data(), cells_visibility_.size() * sizeof(uint32_t) );
+	FileWrite( f, walls_visibility_.data(), walls_visibility_.size() * sizeof(uint32_t) );
+
+	std::fclose(f);
+}
+
+} // namespace PanzerChasm
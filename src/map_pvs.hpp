@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <vec.hpp>
+
+#include "map_loader.hpp"
+
+namespace PanzerChasm
+{
+
+// Potentially visible set for static map geometry.
+// For each map cell stores set of cells and static walls, which may be visible from any point inside this cell.
+// Only static walls with opaque textures are occluders. Dynamic walls are ignored, because they can move.
+class MapPVS final
+{
+public:
+	static constexpr unsigned int c_invalid_cell= ~0u;
+
+	// Build PVS or load it from disk cache.
+	explicit MapPVS( const MapData& map_data );
+	~MapPVS();
+
+	// Returns c_invalid_cell for positions outside map.
+	static unsigned int GetCellIndex( const m_Vec2& pos );
+
+	// For invalid "from_cell" everything is visible.
+	bool IsCellVisible( unsigned int from_cell, unsigned int cell_x, unsigned int cell_y ) const;
+	bool IsStaticWallVisible( unsigned int from_cell, unsigned int wall_index ) const;
+
+private:
+	struct CacheHeader
+	{
+		static const char c_expected_id[8];
+		static constexpr unsigned int c_expected_version= 1u; // Change each time, when format or algorithm changed.
+
+		unsigned char id[8]; // must be equal to c_expected_id
+		unsigned int version;
+		unsigned int map_number;
+		unsigned int walls_hash;
+		unsigned int walls_row_size;
+	};
+
+private:
+	void Build( const MapData& map_data );
+
+	static unsigned int CalculateWallsHash( const MapData& map_data );
+	bool LoadFromCache( const MapData& map_data );
+	void SaveToCache( const MapData& map_data ) const;
+
+private:
+	static constexpr unsigned int c_cell_count= MapData::c_map_size * MapData::c_map_size;
+	static constexpr unsigned int c_cells_row_size= c_cell_count / 32u;
+
+	// Bit sets. Row for each cell.
+	unsigned int walls_row_size_= 0u;
+	std::vector<uint32_t> cells_visibility_;
+	std::vector<uint32_t> walls_visibility_;
+};
+
+} // namespace PanzerChasm
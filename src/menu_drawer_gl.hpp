@@ -1,6 +1,5 @@
 #pragma once
 
-#include <glsl_program.hpp>
 #include <polygon_buffer.hpp>
 #include <texture.hpp>
 
@@ -8,6 +7,7 @@
 #include "game_constants.hpp"
 #include "i_menu_drawer.hpp"
 #include "rendering_context.hpp"
+#include "shader_program.hpp"
 
 namespace PanzerChasm
 {
@@ -56,13 +56,13 @@ private:
 	const unsigned int menu_scale_;
 	const unsigned int console_scale_;
 
-	r_GLSLProgram menu_background_shader_;
+	ShaderProgram menu_background_shader_;
 	r_Texture tiles_texture_;
 	r_Texture loading_texture_;
 	r_Texture game_background_texture_;
 	r_Texture pause_texture_;
 
-	r_GLSLProgram menu_picture_shader_;
+	ShaderProgram menu_picture_shader_;
 	r_Texture menu_pictures_[ size_t(MenuPicture::PicturesCount) ];
 
 	r_Texture framing_texture_;
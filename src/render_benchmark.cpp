@@ -0,0 +1,376 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "client/map_drawer_soft.hpp"
+#include "client/map_state.hpp"
+#include "client/movement_controller.hpp"
+#include "game_constants.hpp"
+#include "game_resources.hpp"
+#include "log.hpp"
+#include "map_loader.hpp"
+#include "math_utils.hpp"
+#include "settings.hpp"
+#include "shared_settings_keys.hpp"
+#include "vfs.hpp"
+
+#include "render_benchmark.hpp"
+
+namespace PanzerChasm
+{
+
+namespace
+{
+
+struct BenchmarkCommand
+{
+	enum class Type
+	{
+		Map,
+		Camera,
+		Spin,
+	};
+
+	Type type;
+	unsigned int number; // Map number or frame count.
+	m_Vec3 pos;
+	float angle_z, angle_x; // In degrees.
+};
+
+typedef std::vector<BenchmarkCommand> BenchmarkCommands;
+
+struct FixedSetting
+{
+	const char* key;
+	std::string value;
+};
+
+typedef std::vector<FixedSetting> FixedSettings;
+
+struct MapResult
+{
+	unsigned int map_number;
+	double load_time_ms;
+	std::vector<double> frame_times_ms;
+	double stages_times_ms[ MapDrawerSoft::StagesTimes::StageCount ];
+};
+
+bool LoadCameraPath( const char* const file_name, BenchmarkCommands& out_commands )
+{
+	std::FILE* const f= std::fopen( file_name, "rb" );
+	if( f == nullptr )
+	{
+		Log::Warning( "Can not open camera path file \"", file_name, "\"" );
+		return false;
+	}
+
+	char line[256];
+	unsigned int line_number= 0u;
+	while( std::fgets( line, sizeof(line), f ) != nullptr )
+	{
+		line_number++;
+
+		BenchmarkCommand command;
+		char command_name[16];
+		if( std::sscanf( line, "%15s", command_name ) != 1 || command_name[0] == '#' )
+			continue;
+
+		if( std::strcmp( command_name, "map" ) == 0 &&
+			std::sscanf( line, "%*s %u", &command.number ) == 1 )
+			command.type= BenchmarkCommand::Type::Map;
+		else if( std::strcmp( command_name, "cam" ) == 0 &&
+			std::sscanf( line, "%*s %f %f %f %f %f", &command.pos.x, &command.pos.y, &command.pos.z, &command.angle_z, &command.angle_x ) == 5 )
+			command.type= BenchmarkCommand::Type::Camera;
+		else if( std::strcmp( command_name, "spin" ) == 0 &&
+			std::sscanf( line, "%*s %u", &command.number ) == 1 )
+			command.type= BenchmarkCommand::Type::Spin;
+		else
+		{
+			Log::Warning( "Invalid camera path line ", line_number, ": ", line );
+			continue;
+		}
+
+		out_commands.push_back( command );
+	}
+
+	std::fclose(f);
+	return true;
+}
+
+// Renderer options for benchmark. Results must not depend on user config, so, all options, affecting software renderer, are fixed.
+FixedSettings GetBenchmarkSettings()
+{
+	return FixedSettings
+	{
+		{ SettingsKeys::fov, "90" },
+		{ SettingsKeys::old_style_perspective, "0" },
+		{ SettingsKeys::pvs, "1" },
+		{ SettingsKeys::shadows, "1" },
+		{ SettingsKeys::software_bsp_cache, "0" }, // Do not write cache files, measure BSP building in map loading time.
+		{ SettingsKeys::software_bsp_max_splitter_candidates, "0" },
+		{ SettingsKeys::software_floor_spans, "1" },
+		{ SettingsKeys::software_indexed_surfaces, "0" },
+		{ SettingsKeys::software_simd, "2" },
+		{ SettingsKeys::software_sky_panorama, "1" },
+		{ SettingsKeys::software_surfaces_cache_adaptive, "0" },
+		{ SettingsKeys::software_surfaces_cache_stats, "0" },
+		{ SettingsKeys::software_surfaces_prefetch, "1" },
+		// Same threads count, as in default config, but written explicitly.
+		{ SettingsKeys::software_surfaces_threads, std::to_string( std::max( 1u, std::thread::hardware_concurrency() ) ) },
+		{ SettingsKeys::software_target_frame_time, "0" },
+		{ SettingsKeys::software_threads, "1" },
+	};
+}
+
+void GenerateDefaultCameraPath( BenchmarkCommands& out_commands )
+{
+	// All maps of original game, camera spin on each.
+	for( unsigned int map_number= 1u; map_number <= 16u; map_number++ )
+	{
+		BenchmarkCommand command;
+		command.type= BenchmarkCommand::Type::Map;
+		command.number= map_number;
+		out_commands.push_back( command );
+
+		command.type= BenchmarkCommand::Type::Spin;
+		command.number= 128u;
+		out_commands.push_back( command );
+	}
+}
+
+double GetPercentile( std::vector<double> values, const double percentile )
+{
+	if( values.empty() )
+		return 0.0;
+
+	std::sort( values.begin(), values.end() );
+	const size_t index= std::min( values.size() - 1u, static_cast<size_t>( double( values.size() ) * percentile / 100.0 ) );
+	return values[index];
+}
+
+void WriteResultRow( std::FILE* const f, const char* const map_name, const std::vector<MapResult>& results )
+{
+	std::vector<double> frame_times_ms;
+	double load_time_ms= 0.0;
+	double stages_times_ms[ MapDrawerSoft::StagesTimes::StageCount ]= { 0.0 };
+	for( const MapResult& result : results )
+	{
+		frame_times_ms.insert( frame_times_ms.end(), result.frame_times_ms.begin(), result.frame_times_ms.end() );
+		load_time_ms+= result.load_time_ms;
+		for( unsigned int s= 0u; s < MapDrawerSoft::StagesTimes::StageCount; s++ )
+			stages_times_ms[s]+= result.stages_times_ms[s];
+	}
+
+	double frame_times_sum_ms= 0.0;
+	for( const double frame_time_ms : frame_times_ms )
+		frame_times_sum_ms+= frame_time_ms;
+
+	const double frame_count= double( std::max( size_t(1u), frame_times_ms.size() ) );
+
+	std::fprintf(
+		f, "%s,%u,%.3f,%.3f,%.3f,%.3f",
+		map_name,
+		static_cast<unsigned int>( frame_times_ms.size() ),
+		load_time_ms,
+		frame_times_ms.empty() ? 0.0 : *std::min_element( frame_times_ms.begin(), frame_times_ms.end() ),
+		frame_times_sum_ms / frame_count,
+		GetPercentile( frame_times_ms, 99.0 ) );
+	for( unsigned int s= 0u; s < MapDrawerSoft::StagesTimes::StageCount; s++ )
+		std::fprintf( f, ",%.3f", stages_times_ms[s] / frame_count );
+	std::fprintf( f, "\n" );
+}
+
+} // namespace
+
+int RunRenderBenchmark( const ProgramArguments& program_arguments )
+{
+	Log::Info( "Run software renderer benchmark" );
+
+	BenchmarkCommands commands;
+	const char* const camera_path_file= program_arguments.GetParamValue( "bench-render" );
+	if( camera_path_file != nullptr && !( camera_path_file[0] == '-' && camera_path_file[1] == '-' ) )
+	{
+		if( !LoadCameraPath( camera_path_file, commands ) )
+			return 1;
+	}
+	else
+		GenerateDefaultCameraPath( commands );
+
+	unsigned int viewport_width= 640u, viewport_height= 480u;
+	if( const char* const size_str= program_arguments.GetParamValue( "bench-size" ) )
+	{
+		if( std::sscanf( size_str, "%ux%u", &viewport_width, &viewport_height ) != 2 ||
+			viewport_width == 0u || viewport_height == 0u )
+		{
+			Log::Warning( "Invalid benchmark size: \"", size_str, "\"" );
+			return 1;
+		}
+	}
+
+	const char* output_file= "bench_render.csv";
+	if( const char* const overrided_output_file= program_arguments.GetParamValue( "bench-output" ) )
+		output_file= overrided_output_file;
+
+	// Do not touch user config, use in-memory settings.
+	const FixedSettings fixed_settings= GetBenchmarkSettings();
+	Settings settings;
+	for( const FixedSetting& fixed_setting : fixed_settings )
+		settings.SetSetting( fixed_setting.key, fixed_setting.value.c_str() );
+
+	const char* csm_file= "CSM.BIN";
+	if( const char* const overrided_csm_file = program_arguments.GetParamValue( "csm" ) )
+		csm_file= overrided_csm_file;
+	const VfsPtr vfs= std::make_shared<Vfs>( csm_file, program_arguments.GetParamValue( "addon" ) );
+
+	const GameResourcesConstPtr game_resources= LoadGameResources( vfs );
+	MapLoader map_loader( vfs );
+
+	// Offscreen buffer instead of window surface.
+	std::vector<uint32_t> color_buffer( viewport_width * viewport_height, 0u );
+
+	RenderingContextSoft rendering_context;
+	rendering_context.viewport_size= Size2( viewport_width, viewport_height );
+	rendering_context.row_pixels= viewport_width;
+	rendering_context.window_surface_data= color_buffer.data();
+	for( unsigned int i= 0u; i < 4u; i++ )
+		rendering_context.color_indeces_rgba[i]= static_cast<unsigned char>(i);
+	rendering_context.palette_transformed= CreatePaletteTransformed( game_resources->palette, rendering_context.color_indeces_rgba );
+
+	MapDrawerSoft map_drawer( settings, game_resources, rendering_context );
+	map_drawer.SetProfilingEnabled( true );
+
+	MovementController camera_controller( settings, m_Vec3( 0.0f, 0.0f, 0.0f ), float(viewport_width) / float(viewport_height) );
+	camera_controller.UpdateParams();
+
+	std::vector<MapResult> results;
+	MapDataConstPtr map_data;
+	std::unique_ptr<MapState> map_state;
+	m_Vec3 camera_pos( 0.0f, 0.0f, GameConstants::player_eyes_level );
+	float camera_angle_z= 0.0f, camera_angle_x= 0.0f; // In radians.
+
+	const auto draw_frame=
+	[&]()
+	{
+		MapResult& result= results.back();
+
+		// Use fixed time step for reproducible results.
+		map_state->Tick( Time::FromSeconds( double( result.frame_times_ms.size() ) / 60.0 ) );
+
+		camera_controller.SetAngles( camera_angle_z, camera_angle_x );
+
+		m_Mat4 view_rotation_and_projection_matrix;
+		camera_controller.GetViewRotationAndProjectionMatrix( view_rotation_and_projection_matrix );
+
+		ViewClipPlanes view_clip_planes;
+		camera_controller.GetViewClipPlanes( camera_pos, view_clip_planes );
+
+		const std::chrono::steady_clock::time_point start_time= std::chrono::steady_clock::now();
+		map_drawer.Draw( *map_state, view_rotation_and_projection_matrix, camera_pos, view_clip_planes, 0u );
+		map_drawer.DoFullscreenPostprocess( *map_state );
+		const std::chrono::steady_clock::time_point end_time= std::chrono::steady_clock::now();
+
+		result.frame_times_ms.push_back( std::chrono::duration<double, std::milli>( end_time - start_time ).count() );
+
+		const MapDrawerSoft::StagesTimes& stages_times= map_drawer.GetLastFrameStagesTimes();
+		for( unsigned int s= 0u; s < MapDrawerSoft::StagesTimes::StageCount; s++ )
+			result.stages_times_ms[s]+= stages_times.time_ms[s];
+	};
+
+	for( const BenchmarkCommand& command : commands )
+	{
+		if( command.type == BenchmarkCommand::Type::Map )
+		{
+			map_data= map_loader.LoadMap( command.number );
+			map_state.reset();
+			if( map_data == nullptr )
+				continue;
+
+			map_state.reset( new MapState( map_data, game_resources, Time::FromSeconds(0) ) );
+
+			results.emplace_back();
+			MapResult& result= results.back();
+			std::memset( result.stages_times_ms, 0, sizeof(result.stages_times_ms) );
+			result.map_number= command.number;
+
+			const std::chrono::steady_clock::time_point start_time= std::chrono::steady_clock::now();
+			map_drawer.SetMap( map_data );
+			result.load_time_ms= std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start_time ).count();
+
+			// Place camera on first player spawn.
+			camera_pos= m_Vec3( 0.0f, 0.0f, GameConstants::player_eyes_level );
+			camera_angle_z= camera_angle_x= 0.0f;
+			unsigned int min_spawn_number= ~0u;
+			for( const MapData::Monster& monster : map_data->monsters )
+			{
+				if( monster.monster_id == 0u && monster.difficulty_flags < min_spawn_number )
+				{
+					min_spawn_number= monster.difficulty_flags;
+					camera_pos= m_Vec3( monster.pos, GameConstants::player_eyes_level );
+					camera_angle_z= monster.angle - Constants::half_pi;
+				}
+			}
+			continue;
+		}
+
+		if( map_state == nullptr )
+		{
+			Log::Warning( "No map loaded for camera path" );
+			continue;
+		}
+
+		if( command.type == BenchmarkCommand::Type::Camera )
+		{
+			camera_pos= command.pos;
+			camera_angle_z= command.angle_z * Constants::to_rad;
+			camera_angle_x= command.angle_x * Constants::to_rad;
+			draw_frame();
+		}
+		else if( command.type == BenchmarkCommand::Type::Spin )
+		{
+			const float start_angle_z= camera_angle_z;
+			for( unsigned int i= 0u; i < command.number; i++ )
+			{
+				camera_angle_z= start_angle_z + Constants::two_pi * float(i) / float(command.number);
+				draw_frame();
+			}
+			camera_angle_z= start_angle_z;
+		}
+	}
+
+	std::FILE* const f= std::fopen( output_file, "wb" );
+	if( f == nullptr )
+	{
+		Log::Warning( "Can not write benchmark output \"", output_file, "\"" );
+		return 1;
+	}
+
+	// First line - renderer options, used for benchmark.
+	std::fprintf( f, "# %ux%u", viewport_width, viewport_height );
+	for( const FixedSetting& fixed_setting : fixed_settings )
+		std::fprintf( f, " %s=%s", fixed_setting.key, fixed_setting.value.c_str() );
+	std::fprintf( f, "\n" );
+
+	std::fprintf( f, "map,frames,load_ms,min_ms,avg_ms,p99_ms" );
+	for( unsigned int s= 0u; s < MapDrawerSoft::StagesTimes::StageCount; s++ )
+		std::fprintf( f, ",%s_ms", MapDrawerSoft::StagesTimes::c_stage_names[s] );
+	std::fprintf( f, "\n" );
+
+	for( const MapResult& result : results )
+	{
+		char map_name[16];
+		std::snprintf( map_name, sizeof(map_name), "%u", result.map_number );
+		WriteResultRow( f, map_name, std::vector<MapResult>{ result } );
+	}
+	WriteResultRow( f, "all", results );
+
+	std::fclose(f);
+
+	Log::Info( "Benchmark results written into \"", output_file, "\"" );
+	return results.empty() ? 1 : 0;
+}
+
+} // namespace PanzerChasm
@@ -0,0 +1,24 @@
+#pragma once
+#include "program_arguments.hpp"
+
+namespace PanzerChasm
+{
+
+// Headless benchmark of software renderer. Needs no window.
+// Draws maps into offscreen buffer with camera path and writes frame times into CSV file.
+//
+// Arguments:
+// --bench-render [camera path file] - run benchmark. Without camera path file each map is benchmarked with camera spin on player spawn.
+// --bench-output [file] - output CSV file, "bench_render.csv" by default.
+// --bench-size [WxH] - offscreen buffer size, "640x480" by default.
+//
+// Camera path file format (lines):
+// map [number] - load map, camera is placed on player spawn.
+// cam [x] [y] [z] [z angle] [x angle] - draw frame with given camera position and angles (in degrees).
+// spin [frames] - draw frames with full camera turn around on current position.
+// Such files may be recorded in game with "record_camera_path" command.
+//
+// Returns process exit code.
+int RunRenderBenchmark( const ProgramArguments& program_arguments );
+
+} // namespace PanzerChasm
@@ -0,0 +1,25 @@
+#include <cstring>
+
+#include "rendering_context.hpp"
+
+namespace PanzerChasm
+{
+
+PaletteTransformedPtr CreatePaletteTransformed( const Palette& palette, const unsigned char* const color_indeces_rgba )
+{
+	const PaletteTransformedPtr result= std::make_shared<PaletteTransformed>();
+
+	for( unsigned int i= 0u; i < 256u; i++ )
+	{
+		unsigned char components[4];
+		components[ color_indeces_rgba[0] ]= palette[ i * 3u + 0u ];
+		components[ color_indeces_rgba[1] ]= palette[ i * 3u + 1u ];
+		components[ color_indeces_rgba[2] ]= palette[ i * 3u + 2u ];
+		components[ color_indeces_rgba[3] ]= i == 255u ? 0u : 255u;
+		std::memcpy( &(*result)[i], &components, 4u );
+	}
+
+	return result;
+}
+
+} // namespace PanzerChasm
@@ -4,7 +4,9 @@
 
 #include <shaders_loading.hpp>
 
+#include "images.hpp"
 #include "size.hpp"
+#include "software_frame_postprocess.hpp"
 
 namespace PanzerChasm
 {
@@ -28,6 +30,12 @@ struct RenderingContextSoft
 	unsigned char color_indeces_rgba[4];
 
 	PaletteTransformedPtr palette_transformed;
+
+	// Parameters of final copy of frame into window. May be null - in this case drawers must apply blending themselves.
+	SoftwareFramePostprocess* frame_postprocess= nullptr;
 };
 
+// Convert palette to pixel format of software rendering context. Last palette color is transparent.
+PaletteTransformedPtr CreatePaletteTransformed( const Palette& palette, const unsigned char* color_indeces_rgba );
+
 } // namespace PanzerChasm
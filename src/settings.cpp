@@ -160,8 +160,14 @@ Settings::Settings( const char* file_name )
 	}
 }
 
+Settings::Settings()
+{}
+
 Settings::~Settings()
 {
+	if( file_name_.empty() )
+		return;
+
 	FILE* const file= std::fopen( file_name_.c_str(), "wb" );
 	if( file == nullptr )
 	{
@@ -10,6 +10,8 @@ class Settings final
 {
 public:
 	explicit Settings( const char* file_name );
+	// In-memory settings, without file. Nothing is loaded or saved.
+	Settings();
 	~Settings();
 
 	void SetSetting( const char* name, const char* value );
@@ -0,0 +1,390 @@
+#include <algorithm>
+#include <cstring>
+
+#include "common/files.hpp"
+using namespace ChasmReverse;
+
+#include "assert.hpp"
+#include "cache_files.hpp"
+#include "log.hpp"
+
+#include "shader_program.hpp"
+
+namespace PanzerChasm
+{
+
+const char ShaderProgram::CacheHeader::c_expected_id[8]= "PCPROG";
+constexpr unsigned int ShaderProgram::CacheHeader::c_expected_version;
+
+static uint64_t CombineHash( uint64_t hash, const void* const data, const unsigned int size )
+{
+	// FNV-1a
+	const unsigned char* const bytes= static_cast<const unsigned char*>(data);
+	for( unsigned int i= 0u; i < size; i++ )
+	{
+		hash^= bytes[i];
+		hash*= 1099511628211ull;
+	}
+	return hash;
+}
+
+static uint64_t CombineHash( const uint64_t hash, const std::string& str )
+{
+	// Combine also size, so, concatenation of different strings gives different hash.
+	const uint32_t size= static_cast<uint32_t>( str.size() );
+	return CombineHash( CombineHash( hash, &size, sizeof(size) ), str.data(), size );
+}
+
+static std::string GetGLString( const GLenum name )
+{
+	const char* const str= reinterpret_cast<const char*>( glGetString( name ) );
+	return str == nullptr ? std::string() : std::string( str );
+}
+
+static GLuint CompileShader( const GLenum type, const std::string& source )
+{
+	const GLuint shader= glCreateShader( type );
+	const GLchar* const source_ptr= source.data();
+	const GLint source_length= static_cast<GLint>( source.size() );
+	glShaderSource( shader, 1, &source_ptr, &source_length );
+	glCompileShader( shader );
+
+	GLint compile_status= 0;
+	glGetShaderiv( shader, GL_COMPILE_STATUS, &compile_status );
+	if( compile_status == 0 )
+	{
+		GLint log_length= 0;
+		glGetShaderiv( shader, GL_INFO_LOG_LENGTH, &log_length );
+		std::vector<char> log( static_cast<size_t>( log_length ) + 1u, '\0' );
+		glGetShaderInfoLog( shader, log_length, nullptr, log.data() );
+		Log::Warning( "Shader compilation failed: ", log.data() );
+	}
+
+	return shader;
+}
+
+ShaderProgram::ShaderProgram()
+{}
+
+ShaderProgram::ShaderProgram( ShaderProgram&& other )
+{
+	*this= std::move(other);
+}
+
+ShaderProgram::~ShaderProgram()
+{
+	if( program_id_ != 0u )
+		glDeleteProgram( program_id_ );
+}
+
+ShaderProgram& ShaderProgram::operator=( ShaderProgram&& other )
+{
+	if( program_id_ != 0u )
+		glDeleteProgram( program_id_ );
+
+	for( unsigned int i= 0u; i < NumKinds; i++ )
+		sources_[i]= std::move( other.sources_[i] );
+	attribs_locations_= std::move( other.attribs_locations_ );
+	uniforms_locations_= std::move( other.uniforms_locations_ );
+	program_id_= other.program_id_;
+
+	other.program_id_= 0u;
+	return *this;
+}
+
+void ShaderProgram::ShaderSource( std::vector<char> frag_src, std::vector<char> vert_src, std::vector<char> geom_src )
+{
+	std::vector<char>* const sources[ NumKinds ]= { &frag_src, &vert_src, &geom_src };
+	for( unsigned int i= 0u; i < NumKinds; i++ )
+	{
+		// Loaded sources may contain terminating zero.
+		const std::vector<char>& source= *sources[i];
+		sources_[i].assign( source.data(), ::strnlen( source.data(), source.size() ) );
+	}
+}
+
+void ShaderProgram::SetAttribLocation( const char* const attrib_name, const unsigned int location )
+{
+	attribs_locations_.emplace_back( attrib_name, location );
+}
+
+void ShaderProgram::Create()
+{
+	PC_ASSERT( program_id_ == 0u );
+
+	if( !ProgramBinariesSupported() )
+		CompileAndLink( false );
+	else
+	{
+		const uint64_t key= CalculateCacheKey();
+		if( !LoadFromCache( key ) )
+		{
+			CompileAndLink( true );
+			SaveToCache( key );
+		}
+	}
+
+	CollectUniformsLocations();
+}
+
+void ShaderProgram::Bind() const
+{
+	glUseProgram( program_id_ );
+}
+
+void ShaderProgram::Uniform( const char* const name, const int i )
+{
+	glUniform1i( GetUniformLocation( name ), i );
+}
+
+void ShaderProgram::Uniform( const char* const name, const float f )
+{
+	glUniform1f( GetUniformLocation( name ), f );
+}
+
+void ShaderProgram::Uniform( const char* const name, const m_Vec2& v )
+{
+	glUniform2f( GetUniformLocation( name ), v.x, v.y );
+}
+
+void ShaderProgram::Uniform( const char* const name, const m_Vec3& v )
+{
+	glUniform3f( GetUniformLocation( name ), v.x, v.y, v.z );
+}
+
+void ShaderProgram::Uniform( const char* const name, const float f0, const float f1, const float f2, const float f3 )
+{
+	glUniform4f( GetUniformLocation( name ), f0, f1, f2, f3 );
+}
+
+void ShaderProgram::Uniform( const char* const name, const m_Mat4& m )
+{
+	glUniformMatrix4fv( GetUniformLocation( name ), 1, GL_FALSE, m.value );
+}
+
+bool ShaderProgram::ProgramBinariesSupported()
+{
+	// Check version and number of formats. Some drivers support binaries, but have zero formats, when own cache is disabled.
+	GLint major_version= 0, minor_version= 0;
+	glGetIntegerv( GL_MAJOR_VERSION, &major_version );
+	glGetIntegerv( GL_MINOR_VERSION, &minor_version );
+	if( !( major_version > 4 || ( major_version == 4 && minor_version >= 1 ) ) )
+	{
+		bool has_extension= false;
+		GLint extension_count= 0;
+		glGetIntegerv( GL_NUM_EXTENSIONS, &extension_count );
+		for( GLint i= 0; i < extension_count; i++ )
+		{
+			const char* const extension= reinterpret_cast<const char*>( glGetStringi( GL_EXTENSIONS, i ) );
+			if( extension != nullptr && std::strcmp( extension, "GL_ARB_get_program_binary" ) == 0 )
+				has_extension= true;
+		}
+		if( !has_extension )
+			return false;
+	}
+
+	GLint formats_count= 0;
+	glGetIntegerv( GL_NUM_PROGRAM_BINARY_FORMATS, &formats_count );
+	return formats_count > 0;
+}
+
+uint64_t ShaderProgram::CalculateCacheKey() const
+{
+	uint64_t hash= 14695981039346656037ull;
+	for( const std::string& source : sources_ )
+		hash= CombineHash( hash, source );
+
+	for( const auto& attrib_location : attribs_locations_ )
+	{
+		hash= CombineHash( hash, attrib_location.first );
+		hash= CombineHash( hash, &attrib_location.second, sizeof(attrib_location.second) );
+	}
+
+	// Binary is valid only for same driver.
+	hash= CombineHash( hash, GetGLString( GL_VENDOR ) );
+	hash= CombineHash( hash, GetGLString( GL_RENDERER ) );
+	hash= CombineHash( hash, GetGLString( GL_VERSION ) );
+
+	return hash;
+}
+
+bool ShaderProgram::LoadFromCache( const uint64_t key )
+{
+	char file_name[64];
+	GetShaderProgramCacheFileName( key, file_name, sizeof(file_name) );
+
+	std::FILE* const f= std::fopen( file_name, "rb" );
+	if( f == nullptr )
+		return false;
+
+	std::fseek( f, 0, SEEK_END );
+	const unsigned int file_size= std::ftell( f );
+	std::fseek( f, 0, SEEK_SET );
+
+	CacheHeader header;
+	if( file_size < sizeof(CacheHeader) )
+	{
+		std::fclose(f);
+		return false;
+	}
+	FileRead( f, &header, sizeof(CacheHeader) );
+
+	if( std::memcmp( header.id, CacheHeader::c_expected_id, sizeof(header.id) ) != 0 ||
+		header.version != CacheHeader::c_expected_version ||
+		header.key != key ||
+		header.binary_size != file_size - sizeof(CacheHeader) )
+	{
+		std::fclose(f);
+		return false;
+	}
+
+	std::vector<unsigned char> binary( header.binary_size );
+	FileRead( f, binary.data(), header.binary_size );
+	std::fclose(f);
+
+	// Driver may reject binary, for example, after driver update with same version string.
+	program_id_= glCreateProgram();
+	glProgramBinary( program_id_, header.binary_format, binary.data(), static_cast<GLsizei>( binary.size() ) );
+
+	GLint link_status= 0;
+	glGetProgramiv( program_id_, GL_LINK_STATUS, &link_status );
+	if( link_status == 0 )
+	{
+		glDeleteProgram( program_id_ );
+		program_id_= 0u;
+		return false;
+	}
+
+	return true;
+}
+
+void ShaderProgram::SaveToCache( const uint64_t key ) const
+{
+	GLint link_status= 0;
+	glGetProgramiv( program_id_, GL_LINK_STATUS, &link_status );
+	if( link_status == 0 )
+		return;
+
+	GLint binary_size= 0;
+	glGetProgramiv( program_id_, GL_PROGRAM_BINARY_LENGTH, &binary_size );
+	if( binary_size <= 0 )
+		return;
+
+	std::vector<unsigned char> binary( static_cast<size_t>( binary_size ) );
+	GLenum binary_format= 0u;
+	GLsizei actual_binary_size= 0;
+	glGetProgramBinary( program_id_, binary_size, &actual_binary_size, &binary_format, binary.data() );
+	if( actual_binary_size <= 0 )
+		return;
+
+	CreateCacheDir();
+
+	char file_name[64];
+	GetShaderProgramCacheFileName( key, file_name, sizeof(file_name) );
+
+	std::FILE* const f= std::fopen( file_name, "wb" );
+	if( f == nullptr )
+		return;
+
+	CacheHeader header;
+	std::memcpy( header.id, CacheHeader::c_expected_id, sizeof(header.id) );
+	header.version= CacheHeader::c_expected_version;
+	header.key= key;
+	header.binary_format= binary_format;
+	header.binary_size= static_cast<unsigned int>( actual_binary_size );
+
+	FileWrite( f, &header, sizeof(CacheHeader) );
+	FileWrite( f, binary.data(), header.binary_size );
+
+	std::fclose(f);
+}
+
+void ShaderProgram::CompileAndLink( const bool retrievable_binary )
+{
+	static const GLenum c_shader_types[ NumKinds ]= { GL_FRAGMENT_SHADER, GL_VERTEX_SHADER, GL_GEOMETRY_SHADER };
+
+	program_id_= glCreateProgram();
+
+	GLuint shaders[ NumKinds ]= { 0u, 0u, 0u };
+	for( unsigned int i= 0u; i < NumKinds; i++ )
+	{
+		if( sources_[i].empty() )
+			continue;
+		shaders[i]= CompileShader( c_shader_types[i], sources_[i] );
+		glAttachShader( program_id_, shaders[i] );
+	}
+
+	for( const auto& attrib_location : attribs_locations_ )
+		glBindAttribLocation( program_id_, attrib_location.second, attrib_location.first.c_str() );
+
+	if( retrievable_binary )
+		glProgramParameteri( program_id_, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE );
+
+	glLinkProgram( program_id_ );
+
+	GLint link_status= 0;
+	glGetProgramiv( program_id_, GL_LINK_STATUS, &link_status );
+	if( link_status == 0 )
+	{
+		GLint log_length= 0;
+		glGetProgramiv( program_id_, GL_INFO_LOG_LENGTH, &log_length );
+		std::vector<char> log( static_cast<size_t>( log_length ) + 1u, '\0' );
+		glGetProgramInfoLog( program_id_, log_length, nullptr, log.data() );
+		Log::Warning( "Program linking failed: ", log.data() );
+	}
+
+	// Shaders are not needed after linking.
+	for( const GLuint shader : shaders )
+	{
+		if( shader == 0u )
+			continue;
+		glDetachShader( program_id_, shader );
+		glDeleteShader( shader );
+	}
+}
+
+void ShaderProgram::CollectUniformsLocations()
+{
+	uniforms_locations_.clear();
+
+	GLint uniform_count= 0, max_name_length= 0;
+	glGetProgramiv( program_id_, GL_ACTIVE_UNIFORMS, &uniform_count );
+	glGetProgramiv( program_id_, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_name_length );
+
+	std::vector<char> name( static_cast<size_t>( max_name_length ) + 1u, '\0' );
+	for( GLint i= 0; i < uniform_count; i++ )
+	{
+		GLsizei name_length= 0;
+		GLint size= 0;
+		GLenum type= 0u;
+		glGetActiveUniform( program_id_, static_cast<GLuint>(i), max_name_length, &name_length, &size, &type, name.data() );
+
+		// Arrays are reported as "name[0]", but accessed by "name".
+		std::string uniform_name( name.data(), static_cast<size_t>( name_length ) );
+		if( uniform_name.size() > 3u && uniform_name.compare( uniform_name.size() - 3u, 3u, "[0]" ) == 0 )
+			uniform_name.resize( uniform_name.size() - 3u );
+
+		const GLint location= glGetUniformLocation( program_id_, uniform_name.c_str() );
+		if( location != -1 ) // Uniforms from blocks have no location.
+			uniforms_locations_.emplace_back( std::move(uniform_name), location );
+	}
+
+	std::sort( uniforms_locations_.begin(), uniforms_locations_.end() );
+}
+
+GLint ShaderProgram::GetUniformLocation( const char* const name ) const
+{
+	const auto it=
+		std::lower_bound(
+			uniforms_locations_.begin(), uniforms_locations_.end(), name,
+			[]( const std::pair< std::string, GLint >& uniform, const char* const n )
+			{
+				return std::strcmp( uniform.first.c_str(), n ) < 0;
+			} );
+
+	if( it == uniforms_locations_.end() || std::strcmp( it->first.c_str(), name ) != 0 )
+		return -1; // glUniform* ignores location -1, same as for unknown or optimized-out uniforms.
+	return it->second;
+}
+
+} // namespace PanzerChasm
@@ -0,0 +1,82 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <panzer_ogl_lib.hpp>
+#include <matrix.hpp>
+#include <vec.hpp>
+
+namespace PanzerChasm
+{
+
+// GLSL program with same interface, as "r_GLSLProgram" from panzer_ogl_lib, but with on-disk cache of linked programs binaries.
+// Cache key is hash of final sources (with version and defines), attributes locations and GL vendor, renderer and version strings.
+// If driver does not support programs binaries, or if cached binary is missing or rejected by driver,
+// program is compiled and linked as usual.
+class ShaderProgram final
+{
+public:
+	ShaderProgram();
+	ShaderProgram( ShaderProgram&& other );
+	ShaderProgram( const ShaderProgram& other )= delete;
+	~ShaderProgram();
+
+	ShaderProgram& operator=( ShaderProgram&& other );
+	ShaderProgram& operator=( const ShaderProgram& other )= delete;
+
+	// Geometry shader is optional.
+	void ShaderSource( std::vector<char> frag_src, std::vector<char> vert_src, std::vector<char> geom_src= std::vector<char>() );
+	void SetAttribLocation( const char* attrib_name, unsigned int location );
+	void Create();
+
+	void Bind() const;
+
+	// Set uniforms of bound program.
+	void Uniform( const char* name, int i );
+	void Uniform( const char* name, float f );
+	void Uniform( const char* name, const m_Vec2& v );
+	void Uniform( const char* name, const m_Vec3& v );
+	void Uniform( const char* name, float f0, float f1, float f2, float f3 );
+	void Uniform( const char* name, const m_Mat4& m );
+
+private:
+	enum ShaderKind : unsigned int
+	{
+		Fragment, Vertex, Geometry, NumKinds
+	};
+
+	struct CacheHeader
+	{
+		static const char c_expected_id[8];
+		static constexpr unsigned int c_expected_version= 1u; // Change each time, when format changed.
+
+		unsigned char id[8]; // must be equal to c_expected_id
+		unsigned int version;
+		uint64_t key;
+		unsigned int binary_format;
+		unsigned int binary_size;
+	};
+
+private:
+	static bool ProgramBinariesSupported();
+
+	uint64_t CalculateCacheKey() const;
+	bool LoadFromCache( uint64_t key );
+	void SaveToCache( uint64_t key ) const;
+
+	void CompileAndLink( bool retrievable_binary );
+	void CollectUniformsLocations();
+	GLint GetUniformLocation( const char* name ) const;
+
+private:
+	std::string sources_[ NumKinds ];
+	std::vector< std::pair< std::string, unsigned int > > attribs_locations_;
+
+	GLuint program_id_= 0u;
+	// Sorted by name. Collected once after linking or loading, because uniforms are set each frame.
+	std::vector< std::pair< std::string, GLint > > uniforms_locations_;
+};
+
+} // namespace PanzerChasm
@@ -39,14 +39,32 @@ const char fullscreen_frequency[]= "r_fullscreen_frequency";
 
 const char software_rendering[]= "r_software_rendering";
 const char software_scale[]= "r_software_scale";
+const char software_threads[]= "r_soft_threads";
+const char software_simd[]= "r_soft_simd";
+const char software_surfaces_prefetch[]= "r_soft_surfaces_prefetch";
+const char software_surfaces_threads[]= "r_soft_surfaces_threads";
+const char software_indexed_surfaces[]= "r_soft_indexed_surfaces";
+const char software_bsp_cache[]= "r_soft_bsp_cache";
+const char software_bsp_max_splitter_candidates[]= "r_soft_bsp_max_splitter_candidates";
+const char software_target_frame_time[]= "r_soft_target_ms";
+const char software_floor_spans[]= "r_soft_floor_spans";
+const char software_sky_panorama[]= "r_soft_sky_panorama";
+const char software_surfaces_cache_adaptive[]= "r_soft_surfaces_cache_adaptive";
+const char software_surfaces_cache_stats[]= "r_soft_surfaces_cache_stats";
 
 const char opengl_dynamic_lighting[]= "r_dynamic_lighting";
+const char opengl_incremental_lightmaps[]= "r_dynamic_lighting_incremental";
 const char opengl_textures_filtering[]= "r_filter_textures";
 const char opengl_menu_textures_filtering[]= "r_filter_menu_textures";
 const char opengl_hud_textures_filtering[]= "r_filter_hud_textures";
 const char opengl_msaa_level[]= "r_msaa_level";
+const char opengl_models_instancing[]= "r_models_instancing";
+const char opengl_draw_stats[]= "r_gl_draw_stats";
+const char opengl_persistent_buffers[]= "r_gl_persistent_buffers";
+const char opengl_passes_stats_csv[]= "r_gl_passes_stats_csv";
 
 const char shadows[]= "r_shadows";
+const char pvs[]= "r_pvs";
 const char brightness[]= "r_brightness";
 
 } // namespace SettingsKeys
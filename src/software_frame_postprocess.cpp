@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "assert.hpp"
+#include "client/software_renderer/rasterizer.hpp"
+
+#include "software_frame_postprocess.hpp"
+
+#ifdef PC_X86_SIMD_INSTRUCTIONS
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#define PC_TARGET_SSE2
+#else
+#define PC_TARGET_SSE2 __attribute__((target("sse2")))
+#endif
+#endif
+
+namespace PanzerChasm
+{
+
+SoftwareFramePostprocess::SoftwareFramePostprocess()
+{
+	for( unsigned int i= 0u; i < 256u; i++ )
+		brightness_table[i]= static_cast<unsigned char>(i);
+}
+
+void SoftwareFramePostprocess::SetBrightness( float gamma )
+{
+	// Gamma near 1 is not visible, use identity, so, frame needs no postprocessing pass.
+	// Default brightness 0.5 gives gamma 0.95.
+	if( std::abs( gamma - 1.0f ) <= 0.06f )
+		gamma= 1.0f;
+
+	brightness_is_identity= true;
+	for( unsigned int i= 0u; i < 256u; i++ )
+	{
+		const float p= std::pow( ( float(i) + 0.5f ) / 255.5f, gamma ) * 255.0f;
+		brightness_table[i]= static_cast<unsigned char>( std::max( 0, std::min( int(std::round(p)), 255 ) ) );
+		brightness_is_identity= brightness_is_identity && brightness_table[i] == i;
+	}
+}
+
+bool SoftwareFramePostprocess::IsIdentity() const
+{
+	return blend_alpha == 0u && brightness_is_identity;
+}
+
+template<unsigned int c_scale>
+static void PostprocessAndScaleRowScalar(
+	const SoftwareFramePostprocess& postprocess,
+	const uint32_t* const src, const unsigned int src_pixel_count,
+	uint32_t* const dst, const unsigned int dynamic_scale )
+{
+	const unsigned int scale= c_scale == 0u ? dynamic_scale : c_scale;
+
+	int premultiplied_blend_color[4];
+	for( unsigned int j= 0u; j < 4u; j++ )
+		premultiplied_blend_color[j]= postprocess.blend_color[j] * postprocess.blend_alpha;
+	const int one_minus_alpha= 256 - postprocess.blend_alpha;
+
+	for( unsigned int x= 0u; x < src_pixel_count; x++ )
+	{
+		const uint32_t pixel_value= src[x];
+		unsigned char color[4];
+		for( unsigned int j= 0u; j < 4u; j++ )
+		{
+			const int c= ( reinterpret_cast<const unsigned char*>(&pixel_value)[j] * one_minus_alpha + premultiplied_blend_color[j] ) >> 8;
+			color[j]= postprocess.brightness_table[c];
+		}
+
+		uint32_t result;
+		std::memcpy( &result, color, sizeof(uint32_t) );
+		for( unsigned int dx= 0u; dx < scale; dx++ )
+			dst[ x * scale + dx ]= result;
+	}
+}
+
+#ifdef PC_X86_SIMD_INSTRUCTIONS
+
+// Process 16-bit components of two pixels. Only blending is done here, brightness table can not be applied with SSE2.
+PC_TARGET_SSE2 static inline __m128i BlendComponentsSSE2(
+	const __m128i components,
+	const __m128i one_minus_alpha, const __m128i premultiplied_blend_color )
+{
+	// Products of blending are not greater, than 255 * 256, so, use unsigned shift.
+	return _mm_srli_epi16( _mm_add_epi16( _mm_mullo_epi16( components, one_minus_alpha ), premultiplied_blend_color ), 8 );
+}
+
+template<unsigned int c_scale>
+PC_TARGET_SSE2 static void PostprocessAndScaleRowSSE2(
+	const SoftwareFramePostprocess& postprocess,
+	const uint32_t* const src, const unsigned int src_pixel_count,
+	uint32_t* const dst, const unsigned int dynamic_scale )
+{
+	const unsigned int scale= c_scale == 0u ? dynamic_scale : c_scale;
+
+	const __m128i zero= _mm_setzero_si128();
+	const __m128i one_minus_alpha= _mm_set1_epi16( short( 256u - postprocess.blend_alpha ) );
+	__m128i premultiplied_blend_color;
+	{
+		short c[4];
+		for( unsigned int j= 0u; j < 4u; j++ )
+			c[j]= short( postprocess.blend_color[j] * postprocess.blend_alpha );
+		premultiplied_blend_color= _mm_set_epi16( c[3], c[2], c[1], c[0], c[3], c[2], c[1], c[0] );
+	}
+
+	unsigned int x= 0u;
+	for( ; x + 4u <= src_pixel_count; x+= 4u )
+	{
+		const __m128i pixels= _mm_loadu_si128( reinterpret_cast<const __m128i*>( src + x ) );
+		const __m128i lo= BlendComponentsSSE2( _mm_unpacklo_epi8( pixels, zero ), one_minus_alpha, premultiplied_blend_color );
+		const __m128i hi= BlendComponentsSSE2( _mm_unpackhi_epi8( pixels, zero ), one_minus_alpha, premultiplied_blend_color );
+		const __m128i result= _mm_packus_epi16( lo, hi );
+
+		__m128i* const out= reinterpret_cast<__m128i*>( dst + x * scale );
+		if( scale == 1u )
+			_mm_storeu_si128( out, result );
+		else if( scale == 2u )
+		{
+			_mm_storeu_si128( out + 0, _mm_unpacklo_epi32( result, result ) );
+			_mm_storeu_si128( out + 1, _mm_unpackhi_epi32( result, result ) );
+		}
+		else if( scale == 4u )
+		{
+			_mm_storeu_si128( out + 0, _mm_shuffle_epi32( result, 0x00 ) );
+			_mm_storeu_si128( out + 1, _mm_shuffle_epi32( result, 0x55 ) );
+			_mm_storeu_si128( out + 2, _mm_shuffle_epi32( result, 0xAA ) );
+			_mm_storeu_si128( out + 3, _mm_shuffle_epi32( result, 0xFF ) );
+		}
+		else
+		{
+			uint32_t result_pixels[4];
+			_mm_storeu_si128( reinterpret_cast<__m128i*>( result_pixels ), result );
+			for( unsigned int i= 0u; i < 4u; i++ )
+			for( unsigned int dx= 0u; dx < scale; dx++ )
+				dst[ ( x + i ) * scale + dx ]= result_pixels[i];
+		}
+	}
+
+	PostprocessAndScaleRowScalar<c_scale>( postprocess, src + x, src_pixel_count - x, dst + x * scale, dynamic_scale );
+}
+
+#endif // PC_X86_SIMD_INSTRUCTIONS
+
+template<unsigned int c_scale>
+static void PostprocessAndScaleRowImpl(
+	const SoftwareFramePostprocess& postprocess,
+	const uint32_t* const src, const unsigned int src_pixel_count,
+	uint32_t* const dst, const unsigned int dynamic_scale )
+{
+#ifdef PC_X86_SIMD_INSTRUCTIONS
+	if( postprocess.brightness_is_identity && Rasterizer::GetSupportedSIMDLevel() != Rasterizer::SIMDLevel::None )
+	{
+		PostprocessAndScaleRowSSE2<c_scale>( postprocess, src, src_pixel_count, dst, dynamic_scale );
+		return;
+	}
+#endif
+
+	PostprocessAndScaleRowScalar<c_scale>( postprocess, src, src_pixel_count, dst, dynamic_scale );
+}
+
+void PostprocessAndScaleRow(
+	const SoftwareFramePostprocess& postprocess,
+	const uint32_t* const src, const unsigned int src_pixel_count,
+	uint32_t* const dst, const unsigned int scale )
+{
+	PC_ASSERT( scale >= 1u );
+
+	// Generate different functions for some useful scales, like in system window.
+	switch( scale )
+	{
+	case 1u: PostprocessAndScaleRowImpl<1u>( postprocess, src, src_pixel_count, dst, scale ); break;
+	case 2u: PostprocessAndScaleRowImpl<2u>( postprocess, src, src_pixel_count, dst, scale ); break;
+	case 3u: PostprocessAndScaleRowImpl<3u>( postprocess, src, src_pixel_count, dst, scale ); break;
+	case 4u: PostprocessAndScaleRowImpl<4u>( postprocess, src, src_pixel_count, dst, scale ); break;
+	default: PostprocessAndScaleRowImpl<0u>( postprocess, src, src_pixel_count, dst, scale ); break;
+	};
+}
+
+} // namespace PanzerChasm
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstdint>
+
+namespace PanzerChasm
+{
+
+// Final postprocessing of software renderer frame - fullscreen blend and brightness.
+// It is done by system window together with copy of frame into window surface, so, it costs no separate pass.
+struct SoftwareFramePostprocess
+{
+	// Blend color in screen components order. Zero alpha means no blending.
+	unsigned char blend_color[4]= { 0u, 0u, 0u, 0u };
+	unsigned char blend_alpha= 0u;
+
+	// Brightness table, same as gamma ramp for OpenGL renderer. Applied after blending.
+	unsigned char brightness_table[256];
+	bool brightness_is_identity= true;
+
+	SoftwareFramePostprocess();
+
+	void SetBrightness( float gamma );
+	bool IsIdentity() const;
+};
+
+// Apply postprocessing to "src_pixel_count" pixels and write each pixel "scale" times into "dst".
+// "src" and "dst" may be same for scale 1.
+void PostprocessAndScaleRow(
+	const SoftwareFramePostprocess& postprocess,
+	const uint32_t* src, unsigned int src_pixel_count,
+	uint32_t* dst, unsigned int scale );
+
+} // namespace PanzerChasm
@@ -8,6 +8,7 @@
 #include "log.hpp"
 #include "settings.hpp"
 #include "shared_settings_keys.hpp"
+#include "software_frame_postprocess.hpp"
 
 #include "system_window.hpp"
 
@@ -116,13 +117,12 @@ static void APIENTRY GLDebugMessageCallback(
 #endif
 
 
-template<class ScaleGetter>
-void SystemWindow::CopyAndScaleViewportToSystemViewport( const ScaleGetter& scale_getter )
+void SystemWindow::CopyAndScaleViewportToSystemViewport()
 {
 	PC_ASSERT( !IsOpenGLRenderer() );
 	PC_ASSERT( pixel_size_ > 1u );
 
-	const unsigned int scale= scale_getter();
+	const unsigned int scale= pixel_size_;
 	const unsigned int dst_width= surface_->pitch / sizeof(uint32_t);
 
 	for( unsigned int y= 0u; y < viewport_size_.Height(); y++ )
@@ -130,30 +130,27 @@ void SystemWindow::CopyAndScaleViewportToSystemViewport( const ScaleGetter& scal
 		const uint32_t* const src= scaled_viewport_color_buffer_.data() + y * scaled_viewport_buffer_width_;
 		uint32_t* const dst=  static_cast<uint32_t*>(surface_->pixels) + dst_width * y * scale ;
 
-		for( unsigned int x= 0u; x < viewport_size_.Width(); x++ )
-		{
-			const uint32_t color= src[x];
-			for( unsigned int dy= 0u; dy < scale; dy++ )
-			for( unsigned int dx= 0u; dx < scale; dx++ )
-				dst[ x * scale + dx + dy * dst_width ]= color;
-		}
+		// Fill first row of scaled pixels with postprocessing, than copy it. Memory is written sequentially.
+		PostprocessAndScaleRow( frame_postprocess_, src, viewport_size_.Width(), dst, scale );
 
 		unsigned int pixels_left= dst_width - viewport_size_.Width() * scale;
 		if( pixels_left > 0u )
 		{
 			unsigned int x= viewport_size_.Width();
-			const uint32_t color= src[x];
+			const uint32_t color= dst[ x * scale - 1u ];
 
-			for( unsigned int dy= 0u; dy < scale; dy++ )
 			for( unsigned int dx= 0u; dx < pixels_left; dx++ )
-				dst[ x * scale + dx + dy * dst_width ]= color;
+				dst[ x * scale + dx ]= color;
 		}
+
+		for( unsigned int dy= 1u; dy < scale; dy++ )
+			std::memcpy( dst + dy * dst_width, dst, sizeof(uint32_t) * dst_width );
 	}
 
 	unsigned int rows_left= surface_->h - viewport_size_.Height() * scale;
 	if( rows_left > 0u )
 	{
-		uint32_t* const dst= reinterpret_cast<uint32_t*>( static_cast<unsigned char*>(surface_->pixels) + dst_width * viewport_size_.Height() * scale );
+		uint32_t* const dst= static_cast<uint32_t*>(surface_->pixels) + dst_width * viewport_size_.Height() * scale;
 
 		for( unsigned int y= 0u; y < rows_left; y++ )
 			std::memcpy(
@@ -163,6 +160,18 @@ void SystemWindow::CopyAndScaleViewportToSystemViewport( const ScaleGetter& scal
 	}
 }
 
+void SystemWindow::PostprocessViewportInPlace( uint32_t* const pixels, const unsigned int row_pixels )
+{
+	if( frame_postprocess_.IsIdentity() )
+		return;
+
+	for( unsigned int y= 0u; y < viewport_size_.Height(); y++ )
+	{
+		uint32_t* const row= pixels + y * row_pixels;
+		PostprocessAndScaleRow( frame_postprocess_, row, viewport_size_.Width(), row, 1u );
+	}
+}
+
 SystemWindow::SystemWindow( Settings& settings )
 	: settings_(settings)
 {
@@ -513,12 +522,15 @@ RenderingContextSoft SystemWindow::GetRenderingContextSoft()
 	result.color_indeces_rgba[2]= pixel_colors_order_.components_indeces[ PixelColorsOrder::B ];
 	result.color_indeces_rgba[3]= pixel_colors_order_.components_indeces[ PixelColorsOrder::A ];
 
+	result.frame_postprocess= &frame_postprocess_;
+
 	return result;
 }
 
 void SystemWindow::BeginFrame()
 {
 	UpdateBrightness();
+	frame_postprocess_.blend_alpha= 0u;
 
 	const bool need_clear= settings_.GetOrSetBool( "r_clear", false );
 
@@ -565,6 +577,8 @@ void SystemWindow::EndFrame()
 	else if( use_gl_context_for_software_renderer_ )
 	{
 	#ifndef __APPLE__
+		PostprocessViewportInPlace( scaled_viewport_color_buffer_.data(), scaled_viewport_buffer_width_ );
+
 		glBindTexture( GL_TEXTURE_2D, software_renderer_gl_texture_ );
 		glTexSubImage2D(
 			GL_TEXTURE_2D, 0,
@@ -585,24 +599,20 @@ void SystemWindow::EndFrame()
 	}
 	else
 	{
-		if( pixel_size_ == 1u && SDL_MUSTLOCK( surface_ ) )
-			SDL_UnlockSurface( surface_ );
+		if( pixel_size_ == 1u )
+		{
+			// Frame is drawn directly into window surface, so, there is no copy. Postprocess it in place.
+			PostprocessViewportInPlace( static_cast<uint32_t*>(surface_->pixels), surface_->pitch / sizeof(uint32_t) );
 
-		if( pixel_size_ > 1u )
+			if( SDL_MUSTLOCK( surface_ ) )
+				SDL_UnlockSurface( surface_ );
+		}
+		else
 		{
 			if( SDL_MUSTLOCK( surface_ ) )
 				SDL_LockSurface( surface_ );
 
-			// Optimization.
-			// Generate different functions (via template parameter) for some useful scales.
-			// Compiler may optimize inner loops, if scale is constant.
-			switch( pixel_size_ )
-			{
-			case 2u: CopyAndScaleViewportToSystemViewport( []{ return 2u; } ); break;
-			case 3u: CopyAndScaleViewportToSystemViewport( []{ return 3u; } ); break;
-			case 4u: CopyAndScaleViewportToSystemViewport( []{ return 4u; } ); break;
-			default: CopyAndScaleViewportToSystemViewport( [this]{ return pixel_size_; } );  break;
-			};
+			CopyAndScaleViewportToSystemViewport();
 
 			if( SDL_MUSTLOCK( surface_ ) )
 				SDL_UnlockSurface( surface_ );
@@ -782,6 +792,14 @@ void SystemWindow::UpdateBrightness()
 		const float c_min_gamma= 0.4f;
 		const float c_max_gamma= 1.5f;
 		const float gamma= c_max_gamma - new_brightness * ( c_max_gamma - c_min_gamma );
+
+		// Software renderer applies brightness itself, while copying frame into window.
+		if( !IsOpenGLRenderer() )
+		{
+			frame_postprocess_.SetBrightness( gamma );
+			return;
+		}
+
 		for( unsigned int i= 0u; i < 256u; i++ )
 		{
 			float p= std::pow( ( float(i) + 0.5f ) / 255.5f, gamma ) * 65535.0f;
@@ -56,8 +56,9 @@ private:
 	void GetVideoModes();
 	void UpdateBrightness();
 
-	template<class ScaleGetter>
-	void CopyAndScaleViewportToSystemViewport( const ScaleGetter& scale_getter );
+	// Final copy of software frame. Fullscreen blend and brightness are applied here.
+	void CopyAndScaleViewportToSystemViewport();
+	void PostprocessViewportInPlace( uint32_t* pixels, unsigned int row_pixels );
 
 private:
 	Settings& settings_;
@@ -75,6 +76,7 @@ private:
 	unsigned int pixel_size_;
 	std::vector<uint32_t> scaled_viewport_color_buffer_;
 	unsigned int scaled_viewport_buffer_width_= 0u;
+	SoftwareFramePostprocess frame_postprocess_;
 
 	bool mouse_captured_= false;
 
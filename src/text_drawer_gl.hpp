@@ -1,12 +1,12 @@
 #pragma once
 
-#include <glsl_program.hpp>
 #include <polygon_buffer.hpp>
 #include <texture.hpp>
 
 #include "fwd.hpp"
 #include "i_text_drawer.hpp"
 #include "rendering_context.hpp"
+#include "shader_program.hpp"
 
 namespace PanzerChasm
 {
@@ -39,7 +39,7 @@ private:
 	const Size2 viewport_size_;
 	unsigned char letters_width_[256];
 
-	r_GLSLProgram shader_;
+	ShaderProgram shader_;
 	r_Texture texture_;
 
 	r_PolygonBuffer polygon_buffer_;
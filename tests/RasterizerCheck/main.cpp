@@ -0,0 +1,906 @@
+// Standalone check of software rasterizer. Needs no window, no game resources and no game code, except rasterizer itself.
+// Each rasterizer function (template instantiation), used by software renderer, draws set of canonical
+// polygons (large, thin, tiny, partially outside screen) into offscreen buffer.
+// Hash of result is compared with golden hash, with hash of scalar (non-SIMD) code result
+// and with hash of result of drawing in several bands.
+//
+// Arguments:
+// --golden [file] - golden hashes file, "golden.txt" by default.
+// --write-golden - write golden hashes file instead of comparison.
+// --benchmark - measure speed of each function for each supported SIMD level.
+// --output [file] - output CSV file for benchmark, "rasterizer_benchmark.csv" by default.
+//
+// Returns nonzero exit code, if golden file is missing or some hash does not match.
+//
+// Geometry and textures are generated with integer arithmetic only. Scalar, MMX and SSE code of rasterizer use same
+// lighting and blending formulas, so, golden hashes are same for builds with and without "PC_MMX_INSTRUCTIONS".
+// But sky uses "atan2", so, hashes may differ on platforms with different math library.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "client/software_renderer/rasterizer.hpp"
+#include "client/software_renderer/rasterizer.inl"
+#include "math_utils.hpp"
+#include "program_arguments.hpp"
+
+namespace PanzerChasm
+{
+
+namespace
+{
+
+const unsigned int c_viewport_size_x= 319u; // Odd size, so, SIMD kernels tails are checked too.
+const unsigned int c_viewport_size_y= 241u;
+const unsigned int c_bands= 3u;
+
+typedef std::vector<RasterizerVertex> Polygon;
+typedef std::vector<Polygon> Polygons;
+
+// Result of case, which is not in color buffer.
+typedef std::vector<uint32_t> ExtraOutput;
+
+struct CheckCase
+{
+	std::string name;
+	std::function<void( Rasterizer& rasterizer, ExtraOutput& extra_output )> draw;
+	// Case results depend on bands, if case reads state of rasterizer (occlusion queries).
+	bool bands_supported;
+};
+
+typedef std::vector<CheckCase> CheckCases;
+
+typedef std::map< std::string, uint64_t > Hashes;
+
+struct Texture
+{
+	static constexpr unsigned int c_size_log2= 6u;
+	static constexpr unsigned int c_size= 1u << c_size_log2;
+	static constexpr uint8_t c_transparent_index= 255u;
+
+	std::vector<uint32_t> data;
+	std::vector<uint8_t> data_indexed;
+	uint32_t palette[256];
+};
+
+// Simple generator with same sequence on all platforms. Standard library distributions are implementation-defined.
+class CheckRand final
+{
+public:
+	uint32_t Rand()
+	{
+		state_= state_ * 1664525u + 1013904223u;
+		return state_ >> 8u;
+	}
+
+	// Random value in range [ min_value; next_value_after_max ).
+	int32_t Rand( const int32_t min_value, const int32_t next_value_after_max )
+	{
+		return min_value + int32_t( Rand() % uint32_t( next_value_after_max - min_value ) );
+	}
+
+private:
+	uint32_t state_= 0u;
+};
+
+// Unit circle in 16 directions, multiplied by 1024.
+const int32_t c_directions_count= 16;
+const int32_t c_directions[ c_directions_count ][2]=
+{
+	{  1024,     0 }, {   946,   392 }, {   724,   724 }, {   392,   946 },
+	{     0,  1024 }, {  -392,   946 }, {  -724,   724 }, {  -946,   392 },
+	{ -1024,     0 }, {  -946,  -392 }, {  -724,  -724 }, {  -392,  -946 },
+	{     0, -1024 }, {   392,  -946 }, {   724,  -724 }, {   946,  -392 },
+};
+
+const unsigned char c_blend_color[3]= { 200u, 100u, 50u };
+
+template<
+	Rasterizer::DepthTest depth_test, Rasterizer::DepthWrite depth_write,
+	Rasterizer::AlphaTest alpha_test,
+	Rasterizer::OcclusionTest occlusion_test, Rasterizer::OcclusionWrite occlusion_write,
+	Rasterizer::Lighting lighting, Rasterizer::Blending blending,
+	Rasterizer::DepthHack depth_hack, Rasterizer::IndexedTexture indexed_texture>
+std::string MakeFuncName( const char* const func_kind )
+{
+	char name[128];
+	std::snprintf(
+		name, sizeof(name), "%s_dt%d_dw%d_at%d_ot%d_ow%d_l%d_b%d_dh%d_i%d",
+		func_kind,
+		depth_test == Rasterizer::DepthTest::Yes,
+		depth_write == Rasterizer::DepthWrite::Yes,
+		alpha_test == Rasterizer::AlphaTest::Yes,
+		occlusion_test == Rasterizer::OcclusionTest::Yes,
+		occlusion_write == Rasterizer::OcclusionWrite::Yes,
+		lighting == Rasterizer::Lighting::Yes,
+		blending == Rasterizer::Blending::Yes,
+		depth_hack == Rasterizer::DepthHack::Yes,
+		indexed_texture == Rasterizer::IndexedTexture::Yes );
+	return name;
+}
+
+void GenerateTexture( Texture& texture )
+{
+	const unsigned int c_size= Texture::c_size;
+
+	// Keep color components big enough, so, drawn pixels are never zero, even with lighting and blending.
+	for( unsigned int i= 0u; i < 256u; i++ )
+		texture.palette[i]=
+			( ( 64u + ( i * 37u ) % 192u ) << 0u ) |
+			( ( 64u + ( i * 91u ) % 192u ) << 8u ) |
+			( ( 64u + ( i * 53u ) % 192u ) << 16u ) |
+			Rasterizer::c_alpha_mask;
+	texture.palette[ Texture::c_transparent_index ]&= ~Rasterizer::c_alpha_mask;
+
+	texture.data.resize( c_size * c_size );
+	texture.data_indexed.resize( c_size * c_size );
+	for( unsigned int y= 0u; y < c_size; y++ )
+	for( unsigned int x= 0u; x < c_size; x++ )
+	{
+		// Checker with transparent holes in some cells.
+		const bool is_transparent= ( ( x >> 3u ) & 1u ) != 0u && ( ( y >> 3u ) & 1u ) != 0u && ( ( x ^ y ) & 4u ) != 0u;
+		const uint8_t index= is_transparent
+			? Texture::c_transparent_index
+			: static_cast<uint8_t>( ( x * 7u + y * 13u + ( ( x >> 2u ) ^ ( y >> 2u ) ) * 29u ) % 255u );
+
+		texture.data_indexed[ x + y * c_size ]= index;
+		texture.data[ x + y * c_size ]= texture.palette[ index ];
+	}
+}
+
+// All values are fixed16. Polygon is ellipse, inscribed into circle with given radius, stretched along x with given aspect and rotated.
+void AddPolygon(
+	CheckRand& rand,
+	const fixed16_t center_x, const fixed16_t center_y,
+	const fixed16_t radius, const fixed16_t aspect,
+	Polygons& out_polygons )
+{
+	const int64_t c_max_tc= int64_t( ( Texture::c_size << 16u ) - 1u );
+
+	const int32_t vertex_count= rand.Rand( 3, 7 );
+	const int32_t start_direction= rand.Rand( 0, c_directions_count );
+	const int32_t* const rotation= c_directions[ rand.Rand( 0, c_directions_count ) ];
+
+	// 1 / z must be linear in screen space, like for real projected polygon, else rasterizer may get negative 1 / z.
+	// Change it not so fast, that it becomes negative near polygon edges.
+	const int64_t inv_z_center= ( int64_t(1) << 32 ) / rand.Rand( g_fixed16_one / 2, g_fixed16_one * 8 );
+	const int32_t* const inv_z_gradient_direction= c_directions[ rand.Rand( 0, c_directions_count ) ];
+	const int64_t inv_z_gradient_scale= rand.Rand( 0, 128 ); // Divided by 256.
+	const int64_t max_extent= std::max( std::max( radius, fixed16_t( ( int64_t(radius) * aspect ) >> 16 ) ), 16 * g_fixed16_one );
+
+	Polygon polygon( static_cast<size_t>(vertex_count) );
+	for( int32_t i= 0; i < vertex_count; i++ )
+	{
+		// Vertices are placed in increasing angle order.
+		const int32_t* const direction= c_directions[ ( start_direction + i * c_directions_count / vertex_count ) % c_directions_count ];
+		const int64_t local_x= ( int64_t(direction[0]) * radius ) / 1024;
+		const int64_t local_y= ( ( int64_t(direction[1]) * radius ) / 1024 * aspect ) >> 16;
+		const int64_t offset_x= ( local_x * rotation[0] - local_y * rotation[1] ) / 1024;
+		const int64_t offset_y= ( local_x * rotation[1] + local_y * rotation[0] ) / 1024;
+
+		RasterizerVertex& v= polygon[ static_cast<size_t>(i) ];
+		v.x= fixed16_t( center_x + offset_x );
+		v.y= fixed16_t( center_y + offset_y );
+		v.u= fixed16_t( ( int64_t( direction[0] + 1024 ) * c_max_tc ) / 2048 );
+		v.v= fixed16_t( ( int64_t( direction[1] + 1024 ) * c_max_tc ) / 2048 );
+
+		const int64_t offset_along_gradient= ( offset_x * inv_z_gradient_direction[0] + offset_y * inv_z_gradient_direction[1] ) / 1024;
+		const int64_t inv_z= inv_z_center + inv_z_center * inv_z_gradient_scale / 256 * offset_along_gradient / max_extent;
+		v.z= fixed16_t( ( int64_t(1) << 32 ) / inv_z );
+	}
+
+	out_polygons.push_back( std::move(polygon) );
+}
+
+// Polygons overlap each other, so, depth test, occlusion test and blending affect result.
+void GeneratePolygons( Polygons& out_large_polygons, Polygons& out_polygons )
+{
+	CheckRand rand;
+	const fixed16_t size_x= fixed16_t( c_viewport_size_x << 16u );
+	const fixed16_t size_y= fixed16_t( c_viewport_size_y << 16u );
+	const fixed16_t min_size= std::min( size_x, size_y );
+
+	// Large.
+	for( unsigned int i= 0u; i < 4u; i++ )
+		AddPolygon(
+			rand,
+			rand.Rand( size_x / 10 * 3, size_x / 10 * 7 ), rand.Rand( size_y / 10 * 3, size_y / 10 * 7 ),
+			min_size / 10 * 4, rand.Rand( g_fixed16_one / 2, g_fixed16_one ),
+			out_large_polygons );
+
+	// Thin.
+	for( unsigned int i= 0u; i < 32u; i++ )
+	{
+		const fixed16_t length= rand.Rand( size_x / 5, size_x / 20 * 9 );
+		const fixed16_t width= rand.Rand( g_fixed16_one / 2, g_fixed16_one * 2 );
+		AddPolygon(
+			rand,
+			rand.Rand( 0, size_x ), rand.Rand( 0, size_y ),
+			length, fixed16_t( ( int64_t(width) << 16 ) / length ),
+			out_polygons );
+	}
+
+	// Tiny.
+	for( unsigned int i= 0u; i < 512u; i++ )
+		AddPolygon(
+			rand,
+			rand.Rand( 0, size_x ), rand.Rand( 0, size_y ),
+			rand.Rand( g_fixed16_one / 4, g_fixed16_one * 3 ), g_fixed16_one,
+			out_polygons );
+
+	// Partially outside screen.
+	for( unsigned int i= 0u; i < 8u; i++ )
+	{
+		const bool x_side= ( i & 1u ) != 0u;
+		const bool far_side= ( i & 2u ) != 0u;
+		const fixed16_t center_x= x_side ? ( far_side ? size_x : 0 ) : rand.Rand( 0, size_x );
+		const fixed16_t center_y= x_side ? rand.Rand( 0, size_y ) : ( far_side ? size_y : 0 );
+		AddPolygon( rand, center_x, center_y, min_size / 4, rand.Rand( g_fixed16_one / 2, g_fixed16_one ), out_polygons );
+	}
+}
+
+void DrawPolygons(
+	Rasterizer& rasterizer,
+	const Rasterizer::TriangleDrawFunc triangle_func, const Rasterizer::ConvexPolygonDrawFunc polygon_func,
+	const Polygons& polygons )
+{
+	for( const Polygon& polygon : polygons )
+	{
+		if( polygon_func != nullptr )
+			(rasterizer.*polygon_func)( polygon.data(), static_cast<unsigned int>( polygon.size() ), true );
+		else
+		{
+			for( unsigned int i= 2u; i < polygon.size(); i++ )
+			{
+				const RasterizerVertex triangle[3]= { polygon[0u], polygon[i-1u], polygon[i] };
+				(rasterizer.*triangle_func)( triangle );
+			}
+		}
+	}
+}
+
+class CasesBuilder final
+{
+public:
+	CasesBuilder()
+	{
+		GenerateTexture( texture_ );
+		GeneratePolygons( large_polygons_, polygons_ );
+		all_polygons_= large_polygons_;
+		all_polygons_.insert( all_polygons_.end(), polygons_.begin(), polygons_.end() );
+		GenerateGridCells();
+	}
+
+	CheckCases BuildCases()
+	{
+		AddDrawFuncsCases();
+		AddOtherCases();
+		return std::move(cases_);
+	}
+
+private:
+	void AddDrawFuncCase(
+		std::string name,
+		const Rasterizer::TriangleDrawFunc triangle_func, const Rasterizer::ConvexPolygonDrawFunc polygon_func,
+		const bool indexed_texture )
+	{
+		const uint32_t* const texture_data= texture_.data.data();
+		const uint8_t* const texture_data_indexed= texture_.data_indexed.data();
+		const Texture& texture= texture_;
+		const Polygons& polygons= all_polygons_;
+
+		cases_.push_back( CheckCase{
+			std::move(name),
+			[=, &texture, &polygons]( Rasterizer& rasterizer, ExtraOutput& )
+			{
+				rasterizer.SetLight( g_fixed16_one * 3 / 4 );
+				if( indexed_texture )
+					rasterizer.SetIndexedTexture( Texture::c_size, Texture::c_size, texture_data_indexed, texture.palette );
+				else
+					rasterizer.SetTexture( Texture::c_size, Texture::c_size, texture_data );
+				DrawPolygons( rasterizer, triangle_func, polygon_func, polygons );
+			},
+			true } );
+	}
+
+	template<
+		Rasterizer::DepthTest depth_test, Rasterizer::DepthWrite depth_write,
+		Rasterizer::AlphaTest alpha_test,
+		Rasterizer::OcclusionTest occlusion_test, Rasterizer::OcclusionWrite occlusion_write,
+		Rasterizer::Lighting lighting, Rasterizer::Blending blending>
+	void AffineTriangle()
+	{
+		AddDrawFuncCase(
+			MakeFuncName<depth_test, depth_write, alpha_test, occlusion_test, occlusion_write, lighting, blending, Rasterizer::DepthHack::No, Rasterizer::IndexedTexture::No>( "AffineTriangle" ),
+			&Rasterizer::DrawAffineTexturedTriangle<depth_test, depth_write, alpha_test, occlusion_test, occlusion_write, lighting, blending>,
+			nullptr,
+			false );
+	}
+
+	template<
+		Rasterizer::DepthTest depth_test, Rasterizer::DepthWrite depth_write,
+		Rasterizer::AlphaTest alpha_test,
+		Rasterizer::OcclusionTest occlusion_test, Rasterizer::OcclusionWrite occlusion_write,
+		Rasterizer::Lighting lighting, Rasterizer::Blending blending, Rasterizer::DepthHack depth_hack>
+	void TriangleSpanCorrected()
+	{
+		AddDrawFuncCase(
+			MakeFuncName<depth_test, depth_write, alpha_test, occlusion_test, occlusion_write, lighting, blending, depth_hack, Rasterizer::IndexedTexture::No>( "TriangleSpanCorrected" ),
+			&Rasterizer::DrawTexturedTriangleSpanCorrected<depth_test, depth_write, alpha_test, occlusion_test, occlusion_write, lighting, blending, depth_hack>,
+			nullptr,
+			false );
+	}
+
+	template<
+		Rasterizer::DepthTest depth_test, Rasterizer::DepthWrite depth_write,
+		Rasterizer::AlphaTest alpha_test,
+		Rasterizer::OcclusionTest occlusion_test, Rasterizer::OcclusionWrite occlusion_write,
+		Rasterizer::Lighting lighting, Rasterizer::Blending blending>
+	void TrianglePerLineCorrected()
+	{
+		AddDrawFuncCase(
+			MakeFuncName<depth_test, depth_write, alpha_test, occlusion_test, occlusion_write, lighting, blending, Rasterizer::DepthHack::No, Rasterizer::IndexedTexture::No>( "TrianglePerLineCorrected" ),
+			&Rasterizer::DrawTexturedTrianglePerLineCorrected<depth_test, depth_write, alpha_test, occlusion_test, occlusion_write, lighting, blending>,
+			nullptr,
+			false );
+	}
+
+	template<
+		Rasterizer::DepthTest depth_test, Rasterizer::DepthWrite depth_write,
+		Rasterizer::AlphaTest alpha_test,
+		Rasterizer::OcclusionTest occlusion_test, Rasterizer::OcclusionWrite occlusion_write,
+		Rasterizer::Lighting lighting, Rasterizer::Blending blending, Rasterizer::IndexedTexture indexed_texture>
+	void PolygonSpanCorrected()
+	{
+		AddDrawFuncCase(
+			MakeFuncName<depth_test, depth_write, alpha_test, occlusion_test, occlusion_write, lighting, blending, Rasterizer::DepthHack::No, indexed_texture>( "PolygonSpanCorrected" ),
+			nullptr,
+			&Rasterizer::DrawTexturedConvexPolygonSpanCorrected<depth_test, depth_write, alpha_test, occlusion_test, occlusion_write, lighting, blending, indexed_texture>,
+			indexed_texture == Rasterizer::IndexedTexture::Yes );
+	}
+
+	template<
+		Rasterizer::DepthTest depth_test, Rasterizer::DepthWrite depth_write,
+		Rasterizer::AlphaTest alpha_test,
+		Rasterizer::OcclusionTest occlusion_test, Rasterizer::OcclusionWrite occlusion_write,
+		Rasterizer::Lighting lighting, Rasterizer::Blending blending, Rasterizer::IndexedTexture indexed_texture>
+	void PolygonPerLineCorrected()
+	{
+		AddDrawFuncCase(
+			MakeFuncName<depth_test, depth_write, alpha_test, occlusion_test, occlusion_write, lighting, blending, Rasterizer::DepthHack::No, indexed_texture>( "PolygonPerLineCorrected" ),
+			nullptr,
+			&Rasterizer::DrawTexturedConvexPolygonPerLineCorrected<depth_test, depth_write, alpha_test, occlusion_test, occlusion_write, lighting, blending, indexed_texture>,
+			indexed_texture == Rasterizer::IndexedTexture::Yes );
+	}
+
+	// All instantiations, used in software map drawer. Update this list together with map drawer.
+	void AddDrawFuncsCases()
+	{
+		typedef Rasterizer::DepthTest DT;
+		typedef Rasterizer::DepthWrite DW;
+		typedef Rasterizer::AlphaTest AT;
+		typedef Rasterizer::OcclusionTest OT;
+		typedef Rasterizer::OcclusionWrite OW;
+		typedef Rasterizer::Lighting L;
+		typedef Rasterizer::Blending B;
+		typedef Rasterizer::DepthHack DH;
+		typedef Rasterizer::IndexedTexture IT;
+
+		// Walls.
+		PolygonSpanCorrected<DT::Yes, DW::Yes, AT::No , OT::No , OW::Yes, L::No, B::No, IT::No >();
+		PolygonSpanCorrected<DT::Yes, DW::Yes, AT::Yes, OT::No , OW::Yes, L::No, B::No, IT::No >();
+		PolygonSpanCorrected<DT::No , DW::Yes, AT::No , OT::Yes, OW::Yes, L::No, B::No, IT::No >();
+		PolygonSpanCorrected<DT::No , DW::Yes, AT::Yes, OT::Yes, OW::Yes, L::No, B::No, IT::No >();
+		PolygonSpanCorrected<DT::Yes, DW::Yes, AT::No , OT::No , OW::Yes, L::No, B::No, IT::Yes>();
+		PolygonSpanCorrected<DT::Yes, DW::Yes, AT::Yes, OT::No , OW::Yes, L::No, B::No, IT::Yes>();
+		PolygonSpanCorrected<DT::No , DW::Yes, AT::No , OT::Yes, OW::Yes, L::No, B::No, IT::Yes>();
+		PolygonSpanCorrected<DT::No , DW::Yes, AT::Yes, OT::Yes, OW::Yes, L::No, B::No, IT::Yes>();
+
+		// Floors and ceilings.
+		PolygonPerLineCorrected<DT::No, DW::Yes, AT::No, OT::Yes, OW::Yes, L::No, B::No, IT::No >();
+		PolygonPerLineCorrected<DT::No, DW::Yes, AT::No, OT::Yes, OW::Yes, L::No, B::No, IT::Yes>();
+
+		// Sky polygons.
+		PolygonSpanCorrected<DT::No, DW::No, AT::No, OT::Yes, OW::No, L::No, B::No, IT::No>();
+
+		// Models.
+		TriangleSpanCorrected<DT::Yes, DW::Yes, AT::No , OT::No, OW::No, L::Yes, B::No , DH::No>();
+		TriangleSpanCorrected<DT::Yes, DW::Yes, AT::Yes, OT::No, OW::No, L::Yes, B::No , DH::No>();
+		TriangleSpanCorrected<DT::Yes, DW::No , AT::No , OT::No, OW::No, L::Yes, B::Yes, DH::No>();
+		TriangleSpanCorrected<DT::Yes, DW::Yes, AT::Yes, OT::No, OW::No, L::Yes, B::Yes, DH::No>();
+		AffineTriangle<DT::Yes, DW::Yes, AT::No , OT::No, OW::No, L::Yes, B::No >();
+		AffineTriangle<DT::Yes, DW::Yes, AT::Yes, OT::No, OW::No, L::Yes, B::No >();
+		AffineTriangle<DT::Yes, DW::Yes, AT::No , OT::No, OW::No, L::Yes, B::Yes>();
+		AffineTriangle<DT::Yes, DW::Yes, AT::Yes, OT::No, OW::No, L::Yes, B::Yes>();
+
+		// Weapon.
+		TriangleSpanCorrected<DT::Yes, DW::Yes, AT::No , OT::No, OW::No, L::Yes, B::No , DH::Yes>();
+		TriangleSpanCorrected<DT::Yes, DW::Yes, AT::Yes, OT::No, OW::No, L::Yes, B::No , DH::Yes>();
+		TriangleSpanCorrected<DT::Yes, DW::Yes, AT::No , OT::No, OW::No, L::Yes, B::Yes, DH::Yes>();
+		TriangleSpanCorrected<DT::Yes, DW::Yes, AT::Yes, OT::No, OW::No, L::Yes, B::Yes, DH::Yes>();
+		TriangleSpanCorrected<DT::Yes, DW::Yes, AT::Yes, OT::No, OW::No, L::No , B::No , DH::Yes>();
+		TriangleSpanCorrected<DT::Yes, DW::Yes, AT::No , OT::No, OW::No, L::No , B::Yes, DH::Yes>();
+		TriangleSpanCorrected<DT::Yes, DW::Yes, AT::Yes, OT::No, OW::No, L::No , B::Yes, DH::Yes>();
+
+		// Sprites.
+		PolygonSpanCorrected<DT::Yes, DW::Yes, AT::Yes, OT::No, OW::No, L::Yes, B::Yes, IT::No>();
+		PolygonSpanCorrected<DT::Yes, DW::Yes, AT::Yes, OT::No, OW::No, L::No , B::Yes, IT::No>();
+
+		// Not used in map drawer now, but check it too, because it is public.
+		TrianglePerLineCorrected<DT::Yes, DW::Yes, AT::No , OT::No, OW::No, L::No , B::No >();
+		TrianglePerLineCorrected<DT::Yes, DW::Yes, AT::Yes, OT::No, OW::No, L::Yes, B::Yes>();
+	}
+
+	// Draw large polygons, like walls, with depth and occlusion write.
+	void DrawBackground( Rasterizer& rasterizer ) const
+	{
+		rasterizer.SetTexture( Texture::c_size, Texture::c_size, texture_.data.data() );
+		DrawPolygons(
+			rasterizer,
+			nullptr,
+			&Rasterizer::DrawTexturedConvexPolygonSpanCorrected<
+				Rasterizer::DepthTest::Yes, Rasterizer::DepthWrite::Yes,
+				Rasterizer::AlphaTest::Yes,
+				Rasterizer::OcclusionTest::No, Rasterizer::OcclusionWrite::Yes>,
+			large_polygons_ );
+	}
+
+	void AddGridPlanesCase( const Rasterizer::IndexedTexture indexed_texture )
+	{
+		const bool indexed= indexed_texture == Rasterizer::IndexedTexture::Yes;
+
+		char name[64];
+		std::snprintf( name, sizeof(name), "GridPlanes_i%d", indexed );
+
+		const void* const cell_texture_data=
+			indexed
+				? static_cast<const void*>( texture_.data_indexed.data() )
+				: static_cast<const void*>( texture_.data.data() );
+
+		cases_.push_back( CheckCase{
+			name,
+			[this, indexed, cell_texture_data]( Rasterizer& rasterizer, ExtraOutput& )
+			{
+				DrawBackground( rasterizer );
+
+				std::vector<Rasterizer::GridPlanes::Cell> cells= grid_cells_;
+				for( Rasterizer::GridPlanes::Cell& cell : cells )
+					if( cell.texture_data != nullptr )
+						cell.texture_data= cell_texture_data;
+
+				Rasterizer::GridPlanes grid_planes= grid_planes_;
+				grid_planes.planes[0].cells= cells.data();
+				grid_planes.planes[1].cells= cells.data() + c_grid_size * c_grid_size;
+				grid_planes.palette= indexed ? texture_.palette : nullptr;
+				rasterizer.DrawGridPlanes( grid_planes );
+			},
+			true } );
+	}
+
+	void AddOtherCases()
+	{
+		AddGridPlanesCase( Rasterizer::IndexedTexture::No  );
+		AddGridPlanesCase( Rasterizer::IndexedTexture::Yes );
+
+		cases_.push_back( CheckCase{
+			"SkyPanorama",
+			[this]( Rasterizer& rasterizer, ExtraOutput& )
+			{
+				DrawBackground( rasterizer );
+				rasterizer.DrawSkyPanorama( sky_panorama_ );
+			},
+			true } );
+
+		cases_.push_back( CheckCase{
+			"ColoredPolygons",
+			[this]( Rasterizer& rasterizer, ExtraOutput& )
+			{
+				uint32_t color_index= 0u;
+				for( const Polygon& polygon : all_polygons_ )
+				{
+					const uint32_t color= texture_.palette[ color_index % 255u ];
+					color_index++;
+					if( ( color_index & 1u ) != 0u )
+						rasterizer.DrawColoredConvexPolygon( polygon.data(), static_cast<unsigned int>( polygon.size() ), true, color );
+					else
+						for( unsigned int i= 2u; i < polygon.size(); i++ )
+						{
+							const RasterizerVertex triangle[3]= { polygon[0u], polygon[i-1u], polygon[i] };
+							rasterizer.DrawAffineColoredTriangle( triangle, color );
+						}
+				}
+			},
+			true } );
+
+		cases_.push_back( CheckCase{
+			"Shadows",
+			[this]( Rasterizer& rasterizer, ExtraOutput& )
+			{
+				DrawBackground( rasterizer );
+				for( const Polygon& polygon : polygons_ )
+					for( unsigned int i= 2u; i < polygon.size(); i++ )
+					{
+						const RasterizerVertex triangle[3]= { polygon[0u], polygon[i-1u], polygon[i] };
+						rasterizer.DrawShadowTriangle( triangle );
+					}
+				rasterizer.ApplyShadowMask();
+			},
+			true } );
+
+		cases_.push_back( CheckCase{
+			"FullscreenBlend",
+			[this]( Rasterizer& rasterizer, ExtraOutput& )
+			{
+				DrawBackground( rasterizer );
+				rasterizer.DrawFullscreenBlend( c_blend_color, 96u );
+			},
+			true } );
+
+		for( const unsigned char blend_alpha : { 0u, 128u } )
+		{
+			cases_.push_back( CheckCase{
+				"CopyScaledViewport_a" + std::to_string( blend_alpha ),
+				[this, blend_alpha]( Rasterizer& rasterizer, ExtraOutput& extra_output )
+				{
+					DrawBackground( rasterizer );
+
+					const unsigned int dst_size_x= c_viewport_size_x * 3u / 2u;
+					const unsigned int dst_size_y= c_viewport_size_y * 3u / 2u;
+					const unsigned int dst_row_size= dst_size_x + 5u;
+					// Do not clear it, each band writes only own rows.
+					extra_output.resize( dst_row_size * dst_size_y );
+					rasterizer.CopyScaledViewport( extra_output.data(), dst_size_x, dst_size_y, dst_row_size, c_blend_color, blend_alpha );
+				},
+				true } );
+		}
+
+		cases_.push_back( CheckCase{
+			"OcclusionQueries",
+			[this]( Rasterizer& rasterizer, ExtraOutput& extra_output )
+			{
+				// Occlusion buffer and hierarchy.
+				rasterizer.SetTexture( Texture::c_size, Texture::c_size, texture_.data.data() );
+				for( const Polygon& polygon : large_polygons_ )
+				{
+					rasterizer.DrawTexturedConvexPolygonSpanCorrected<
+						Rasterizer::DepthTest::No, Rasterizer::DepthWrite::Yes,
+						Rasterizer::AlphaTest::No,
+						Rasterizer::OcclusionTest::Yes, Rasterizer::OcclusionWrite::Yes>( polygon.data(), static_cast<unsigned int>( polygon.size() ), true );
+					rasterizer.UpdateOcclusionHierarchy( polygon.data(), static_cast<unsigned int>( polygon.size() ), false );
+				}
+				for( const Polygon& polygon : polygons_ )
+					extra_output.push_back( rasterizer.IsOccluded( polygon.data(), static_cast<unsigned int>( polygon.size() ) ) ? 1u : 0u );
+
+				// Depth buffer hierarchy.
+				rasterizer.BuildDepthBufferHierarchy();
+				for( const Polygon& polygon : polygons_ )
+				{
+					fixed16_t x_min= polygon[0].x, y_min= polygon[0].y, z_min= polygon[0].z;
+					fixed16_t x_max= x_min, y_max= y_min, z_max= z_min;
+					for( const RasterizerVertex& v : polygon )
+					{
+						x_min= std::min( x_min, v.x ); x_max= std::max( x_max, v.x );
+						y_min= std::min( y_min, v.y ); y_max= std::max( y_max, v.y );
+						z_min= std::min( z_min, v.z ); z_max= std::max( z_max, v.z );
+					}
+					extra_output.push_back( rasterizer.IsDepthOccluded( x_min, y_min, x_max, y_max, z_min, z_max ) ? 1u : 0u );
+				}
+			},
+			false } );
+	}
+
+	void GenerateGridCells()
+	{
+		// Floor and ceiling, some cells are empty.
+		grid_cells_.resize( c_grid_size * c_grid_size * 2u );
+		for( unsigned int i= 0u; i < grid_cells_.size(); i++ )
+		{
+			grid_cells_[i].texture_data= i % 5u == 3u ? nullptr : texture_.data.data();
+			grid_cells_[i].texture_size_log2= Texture::c_size_log2;
+		}
+
+		// Camera without roll, with yaw, looks horizontally. Cell size is 1.
+		// Rotation is exact - ( 0.8, 0.6 ).
+		const float c_cos= 0.8f, c_sin= 0.6f;
+		const float center_x= float(c_viewport_size_x) * 0.5f, center_y= float(c_viewport_size_y) * 0.5f;
+		const float cam_pos[2]= { 2.75f, 1.5f };
+		const float heights[2]= { 0.5f, -0.5f }; // Height of camera above plane.
+
+		for( unsigned int i= 0u; i < 2u; i++ )
+		{
+			const float focal_length= float(c_viewport_size_x) * 0.5f;
+			const float h= heights[i];
+
+			// Rows for screen ( x, y, 1 ).
+			const float inv_w[3]= { 0.0f, 1.0f / ( h * focal_length ), -center_y / ( h * focal_length ) };
+			const float local_x_div_w[3]= { 1.0f / focal_length, 0.0f, -center_x / focal_length };
+			const float local_y_div_w[3]= { 0.0f, 0.0f, 1.0f };
+
+			float* const m= grid_planes_.planes[i].screen_to_plane;
+			for( unsigned int j= 0u; j < 3u; j++ )
+			{
+				m[0u+j]= cam_pos[0] * inv_w[j] + c_cos * local_x_div_w[j] - c_sin * local_y_div_w[j];
+				m[3u+j]= cam_pos[1] * inv_w[j] + c_sin * local_x_div_w[j] + c_cos * local_y_div_w[j];
+				m[6u+j]= inv_w[j];
+			}
+		}
+		grid_planes_.grid_size= c_grid_size;
+
+		// Wide field of view, so, pixels near zenith and nadir are checked too.
+		{
+			const float focal_length= float(c_viewport_size_y) / 6.0f;
+			float* const m= sky_panorama_.screen_to_direction;
+			m[0]= c_cos / focal_length; m[1]= 0.0f; m[2]= -c_cos * center_x / focal_length - c_sin;
+			m[3]= c_sin / focal_length; m[4]= 0.0f; m[5]= -c_sin * center_x / focal_length + c_cos;
+			m[6]= 0.0f; m[7]= -1.0f / focal_length; m[8]= center_y / focal_length;
+		}
+		sky_panorama_.u_scale= float( Texture::c_size * 2u ) / Constants::two_pi;
+		sky_panorama_.v_scale= float( Texture::c_size ) / Constants::half_pi;
+		sky_panorama_.texture_size[0]= Texture::c_size;
+		sky_panorama_.texture_size[1]= Texture::c_size;
+		sky_panorama_.texture_data= texture_.data.data();
+	}
+
+private:
+	static constexpr unsigned int c_grid_size= 8u;
+
+	Texture texture_;
+	Polygons large_polygons_;
+	Polygons polygons_;
+	Polygons all_polygons_;
+
+	std::vector<Rasterizer::GridPlanes::Cell> grid_cells_;
+	Rasterizer::GridPlanes grid_planes_;
+	Rasterizer::SkyPanorama sky_panorama_;
+
+	CheckCases cases_;
+};
+
+// FNV-1a, bytes of pixels are taken in same order on all platforms.
+uint64_t CalculateHash( const std::vector<uint32_t>& data, uint64_t hash )
+{
+	for( const uint32_t value : data )
+	for( unsigned int i= 0u; i < 4u; i++ )
+	{
+		hash^= ( value >> ( i * 8u ) ) & 0xFFu;
+		hash*= 1099511628211u;
+	}
+	return hash;
+}
+
+uint64_t CalculateHash( const std::vector<uint32_t>& color_buffer, const ExtraOutput& extra_output )
+{
+	return CalculateHash( extra_output, CalculateHash( color_buffer, 14695981039346656037u ) );
+}
+
+uint64_t RunCase(
+	const CheckCase& check_case, const Rasterizer::SIMDLevel simd_level, const unsigned int bands,
+	std::vector<uint32_t>& color_buffer )
+{
+	std::fill( color_buffer.begin(), color_buffer.end(), 0u );
+	ExtraOutput extra_output;
+
+	for( unsigned int i= 0u; i < bands; i++ )
+	{
+		Rasterizer rasterizer(
+			c_viewport_size_x, c_viewport_size_y, c_viewport_size_x, color_buffer.data(),
+			c_viewport_size_y * i / bands, c_viewport_size_y * ( i + 1u ) / bands );
+		rasterizer.SetSIMDLevel( simd_level );
+		rasterizer.ClearDepthBuffer();
+		rasterizer.ClearOcclusionBuffer();
+		check_case.draw( rasterizer, extra_output );
+	}
+
+	return CalculateHash( color_buffer, extra_output );
+}
+
+double MeasureSpeed( const CheckCase& check_case, const Rasterizer::SIMDLevel simd_level, std::vector<uint32_t>& color_buffer )
+{
+	unsigned int pixel_count= 0u;
+	for( const uint32_t pixel : color_buffer )
+		if( pixel != 0u )
+			pixel_count++;
+
+	Rasterizer rasterizer( c_viewport_size_x, c_viewport_size_y, c_viewport_size_x, color_buffer.data() );
+	rasterizer.SetSIMDLevel( simd_level );
+
+	// Clear buffers between iterations, but do not include it into time.
+	constexpr double c_min_time_s= 0.2;
+	constexpr unsigned int c_min_iterations= 4u;
+	double total_time_s= 0.0;
+	unsigned int iterations= 0u;
+	ExtraOutput extra_output;
+	while( iterations < c_min_iterations || total_time_s < c_min_time_s )
+	{
+		rasterizer.ClearDepthBuffer();
+		rasterizer.ClearOcclusionBuffer();
+		extra_output.clear();
+
+		const std::chrono::steady_clock::time_point start_time= std::chrono::steady_clock::now();
+		check_case.draw( rasterizer, extra_output );
+		total_time_s+= std::chrono::duration<double>( std::chrono::steady_clock::now() - start_time ).count();
+		iterations++;
+	}
+
+	return double(pixel_count) * double(iterations) / ( total_time_s * 1.0e6 );
+}
+
+bool LoadGoldenHashes( const char* const file_name, Hashes& out_hashes )
+{
+	std::FILE* const f= std::fopen( file_name, "r" );
+	if( f == nullptr )
+	{
+		std::printf( "Can not open golden hashes file \"%s\"\n", file_name );
+		return false;
+	}
+
+	bool ok= true;
+	char line[256];
+	while( std::fgets( line, sizeof(line), f ) != nullptr )
+	{
+		if( line[0] == '#' || line[0] == '\n' )
+			continue;
+
+		char name[128];
+		unsigned long long hash;
+		if( std::sscanf( line, "%127s %llx", name, &hash ) != 2 )
+		{
+			std::printf( "Invalid line in golden hashes file: \"%s\"\n", line );
+			ok= false;
+			break;
+		}
+		out_hashes[ name ]= uint64_t(hash);
+	}
+	std::fclose(f);
+
+	return ok;
+}
+
+bool SaveGoldenHashes( const char* const file_name, const Hashes& hashes )
+{
+	std::FILE* const f= std::fopen( file_name, "w" );
+	if( f == nullptr )
+	{
+		std::printf( "Can not write golden hashes file \"%s\"\n", file_name );
+		return false;
+	}
+
+	std::fprintf( f, "# Golden hashes of software rasterizer results. Generated by \"RasterizerCheck --write-golden\".\n" );
+	for( const Hashes::value_type& hash : hashes )
+		std::fprintf( f, "%s %016llx\n", hash.first.c_str(), static_cast<unsigned long long>( hash.second ) );
+
+	std::fclose(f);
+	return true;
+}
+
+} // namespace
+
+} // namespace PanzerChasm
+
+using namespace PanzerChasm;
+
+int main( int argc, char* argv[] )
+{
+	// Skip first param - program path.
+	const ProgramArguments program_arguments( argc - 1, argv + 1 );
+
+	const char* golden_file= "golden.txt";
+	if( const char* const overrided_golden_file= program_arguments.GetParamValue( "golden" ) )
+		golden_file= overrided_golden_file;
+	const bool write_golden= program_arguments.HasParam( "write-golden" );
+
+	const bool benchmark= program_arguments.HasParam( "benchmark" );
+	const char* output_file= "rasterizer_benchmark.csv";
+	if( const char* const overrided_output_file= program_arguments.GetParamValue( "output" ) )
+		output_file= overrided_output_file;
+
+	Hashes golden_hashes;
+	if( !write_golden && !LoadGoldenHashes( golden_file, golden_hashes ) )
+		return 1;
+
+	std::FILE* benchmark_file= nullptr;
+	if( benchmark )
+	{
+		benchmark_file= std::fopen( output_file, "w" );
+		if( benchmark_file == nullptr )
+		{
+			std::printf( "Can not write benchmark output \"%s\"\n", output_file );
+			return 1;
+		}
+		std::fprintf( benchmark_file, "func,simd,mpixels_per_s\n" );
+	}
+
+	// Cases refer to data of builder, so, keep it alive.
+	CasesBuilder cases_builder;
+	const CheckCases cases= cases_builder.BuildCases();
+	const Rasterizer::SIMDLevel max_simd_level= Rasterizer::GetSupportedSIMDLevel();
+	std::printf( "Check %u cases, max SIMD level: %s\n", static_cast<unsigned int>( cases.size() ), Rasterizer::GetSIMDLevelName( max_simd_level ) );
+
+	std::vector<uint32_t> color_buffer( c_viewport_size_x * c_viewport_size_y, 0u );
+	Hashes result_hashes;
+	unsigned int mismatch_count= 0u;
+
+	for( const CheckCase& check_case : cases )
+	{
+		const uint64_t scalar_hash= RunCase( check_case, Rasterizer::SIMDLevel::None, 1u, color_buffer );
+		result_hashes[ check_case.name ]= scalar_hash;
+
+		if( !write_golden )
+		{
+			const auto it= golden_hashes.find( check_case.name );
+			if( it == golden_hashes.end() )
+			{
+				std::printf( "No golden hash for %s\n", check_case.name.c_str() );
+				mismatch_count++;
+			}
+			else if( it->second != scalar_hash )
+			{
+				std::printf( "Mismatch of %s with golden hash\n", check_case.name.c_str() );
+				mismatch_count++;
+			}
+		}
+
+		for( unsigned int level= 0u; level <= static_cast<unsigned int>(max_simd_level); level++ )
+		{
+			const Rasterizer::SIMDLevel simd_level= static_cast<Rasterizer::SIMDLevel>(level);
+			const char* const simd_level_name= Rasterizer::GetSIMDLevelName( simd_level );
+
+			if( simd_level != Rasterizer::SIMDLevel::None &&
+				RunCase( check_case, simd_level, 1u, color_buffer ) != scalar_hash )
+			{
+				std::printf( "Mismatch of %s with %s and scalar code\n", check_case.name.c_str(), simd_level_name );
+				mismatch_count++;
+			}
+			if( check_case.bands_supported &&
+				RunCase( check_case, simd_level, c_bands, color_buffer ) != scalar_hash )
+			{
+				std::printf( "Mismatch of %s with %s in %u bands and without bands\n", check_case.name.c_str(), simd_level_name, c_bands );
+				mismatch_count++;
+			}
+
+			if( benchmark_file != nullptr )
+			{
+				RunCase( check_case, simd_level, 1u, color_buffer );
+				const double mpixels_per_s= MeasureSpeed( check_case, simd_level, color_buffer );
+				std::fprintf( benchmark_file, "%s,%s,%.2f\n", check_case.name.c_str(), simd_level_name, mpixels_per_s );
+				std::printf( "%s %s: %.2f Mpixels/s\n", check_case.name.c_str(), simd_level_name, mpixels_per_s );
+			}
+		} // for SIMD levels
+	} // for cases
+
+	// Stale golden hashes are error too - list of cases must be same as in golden file.
+	for( const Hashes::value_type& golden_hash : golden_hashes )
+		if( result_hashes.count( golden_hash.first ) == 0u )
+		{
+			std::printf( "Golden hash for unknown case %s\n", golden_hash.first.c_str() );
+			mismatch_count++;
+		}
+
+	if( benchmark_file != nullptr )
+	{
+		std::fclose( benchmark_file );
+		std::printf( "Benchmark results written into \"%s\"\n", output_file );
+	}
+
+	if( write_golden )
+	{
+		if( !SaveGoldenHashes( golden_file, result_hashes ) )
+			return 1;
+		std::printf( "Golden hashes written into \"%s\"\n", golden_file );
+	}
+
+	if( mismatch_count > 0u )
+	{
+		std::printf( "%u mismatches\n", mismatch_count );
+		return 1;
+	}
+
+	std::printf( "All cases are ok\n" );
+	return 0;
+}